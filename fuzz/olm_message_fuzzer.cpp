@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "errors.hpp"
+#include "message.hpp"
+
+namespace
+{
+    /**
+     * \brief Crashes if a round-trip check fails. Unlike require(), this stays in release builds of the fuzzers.
+     */
+    void require(const bool condition)
+    {
+        if (!condition)
+        {
+            __builtin_trap();
+        }
+    }
+} // namespace
+
+// Just needed for compiling reasons
+extern "C" int LLVMFuzzerInitialize() { return 0; }
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+    const std::span<const std::uint8_t> input(Data, Size);
+
+    try
+    {
+        // Re-encoding a decoded message has to give a message of exactly the computed length, which decodes the same
+        const auto view = spank_olm::MessageView::decode(input);
+        std::vector<std::uint8_t> encoded(spank_olm::message_length(view.counter, view.ciphertext.size()));
+        auto pos = spank_olm::encode_message_header(
+            encoded.data(), view.ratchet_key.first<spank_olm::CURVE25519_KEY_LENGTH>(), view.counter,
+            view.ciphertext.size());
+        pos = std::copy(view.ciphertext.begin(), view.ciphertext.end(), pos);
+        pos = std::copy(view.mac.begin(), view.mac.end(), pos);
+        require(pos == encoded.data() + encoded.size());
+
+        const auto decoded = spank_olm::MessageView::decode(encoded);
+        require(decoded.counter == view.counter);
+        require(std::equal(decoded.ciphertext.begin(), decoded.ciphertext.end(), view.ciphertext.begin(),
+                           view.ciphertext.end()));
+    }
+    catch (const SpankOlmException &)
+    {
+    }
+
+    try
+    {
+        const auto view = spank_olm::PreKeyMessageView::decode(input);
+        std::vector<std::uint8_t> encoded(spank_olm::pre_key_message_length(view.message.size()));
+        auto pos = spank_olm::encode_pre_key_message_header(
+            encoded.data(), view.one_time_key.first<spank_olm::CURVE25519_KEY_LENGTH>(),
+            view.base_key.first<spank_olm::CURVE25519_KEY_LENGTH>(),
+            view.identity_key.first<spank_olm::CURVE25519_KEY_LENGTH>(), view.message.size());
+        pos = std::copy(view.message.begin(), view.message.end(), pos);
+        require(pos == encoded.data() + encoded.size());
+
+        const auto keys = spank_olm::PreKeyMessageView::decode_keys(encoded);
+        require(keys && std::equal(keys->base_key.begin(), keys->base_key.end(), view.base_key.begin()));
+        const auto decoded = spank_olm::PreKeyMessageView::decode(encoded);
+        require(decoded.message.size() == view.message.size());
+    }
+    catch (const SpankOlmException &)
+    {
+    }
+
+    // Must never read past the input, whatever it holds
+    spank_olm::PreKeyMessageView::decode_keys(input);
+
+    try
+    {
+        const auto view = spank_olm::GroupMessageView::decode(input);
+        std::vector<std::uint8_t> encoded(spank_olm::group_message_length(view.message_index, view.ciphertext.size()));
+        auto pos =
+            spank_olm::encode_group_message_header(encoded.data(), view.message_index, view.ciphertext.size());
+        pos = std::copy(view.ciphertext.begin(), view.ciphertext.end(), pos);
+        pos = std::copy(view.mac.begin(), view.mac.end(), pos);
+        pos = std::copy(view.signature.begin(), view.signature.end(), pos);
+        require(pos == encoded.data() + encoded.size());
+
+        const auto decoded = spank_olm::GroupMessageView::decode(encoded);
+        require(decoded.message_index == view.message_index);
+        require(decoded.signed_part.size() + spank_olm::GROUP_MESSAGE_SIGNATURE_LENGTH == encoded.size());
+    }
+    catch (const SpankOlmException &)
+    {
+    }
+
+    return 0;
+}
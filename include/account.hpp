@@ -1,11 +1,17 @@
 #pragma once
 
-#include <botan/base64.h>
 #include <botan/ed25519.h>
 #include <botan/x25519.h>
+#include <memory_resource>
 #include <numeric>
+#include <span>
 
+#include "base64.hpp"
+#include "canonical_json.hpp"
 #include "list.hpp"
+#include "pickle_encryption.hpp"
+#include "signature.hpp"
+#include "thread_pool.hpp"
 
 // Define a macro to detect Emscripten
 #ifdef __EMSCRIPTEN__
@@ -45,6 +51,26 @@ namespace spank_olm
 
     constexpr std::size_t MAX_ONE_TIME_KEYS(100); ///< The maximum number of one-time keys.
 
+    /**
+     * \brief The current version of the account pickle format.
+     *
+     * \details
+     * - Version 1 used only 32 bytes for the ed25519 private key. Any keys thus used should be considered
+     * compromised.
+     * - Version 2 does not have fallback keys.
+     * - Version 3 does not store whether the current fallback key is published.
+     */
+    constexpr std::uint32_t ACCOUNT_PICKLE_VERSION = 4;
+
+    /**
+     * \brief The signed keys of an account which haven't been published yet, as uploaded to /keys/upload.
+     */
+    struct SignedKeys
+    {
+        std::string one_time_keys; ///< The object mapping "signed_curve25519:<id>" to the signed one-time keys.
+        std::string fallback_keys; ///< The same for the current fallback key, {} if it was published.
+    };
+
     struct Account
     {
         Account() : next_one_time_key_id(0) {}
@@ -91,6 +117,73 @@ namespace spank_olm
          */
         [[nodiscard]] std::vector<uint8_t> sign(Botan::RandomNumberGenerator &rng, std::string_view message) const;
 
+        /**
+         * \brief Starts an incremental signature using the Ed25519 key.
+         *
+         * Use this to sign messages which are too large to be held in memory at once.
+         *
+         * \param rng The botan random number generator to use.
+         * \return A signer to feed the message into chunk by chunk.
+         */
+        [[nodiscard]] Ed25519phSigner start_signature(Botan::RandomNumberGenerator &rng) const;
+
+        /**
+         * \brief Signs the contents of a file using the Ed25519 key with constant memory.
+         *
+         * \param rng The botan random number generator to use.
+         * \param path The file to sign.
+         * \return The signature of the file contents.
+         * \throws SpankOlmErrorIO if the file can't be read.
+         */
+        [[nodiscard]] std::vector<uint8_t> sign_file(Botan::RandomNumberGenerator &rng,
+                                                     std::filesystem::path const &path) const;
+
+        /**
+         * \brief Output the signed device keys of this account, as uploaded to /keys/upload.
+         *
+         * The canonical JSON is written and signed in one pass, see CanonicalJsonWriter.
+         *
+         * \param rng The botan random number generator to use.
+         * \param user_id The user the device belongs to.
+         * \param device_id The ID of the device.
+         * \return The device keys object including its signature.
+         */
+        [[nodiscard]] std::string get_signed_device_keys_json(Botan::RandomNumberGenerator &rng,
+                                                              std::string_view user_id,
+                                                              std::string_view device_id) const;
+
+        /**
+         * \brief Writes a one-time or fallback key as a signed_curve25519 key object.
+         *
+         * A signer can be reused for any number of keys, as every signature resets it.
+         *
+         * \param writer The writer to write the key object to.
+         * \param signer The signer of the identity key of the account, see start_signature().
+         * \param rng The botan random number generator to use.
+         * \param key The key to write.
+         * \param fallback Whether the key is a fallback key.
+         * \param user_id The user the device belongs to.
+         * \param device_id The ID of the device.
+         */
+        static void write_signed_key(CanonicalJsonWriter &writer, Ed25519phSigner &signer,
+                                     Botan::RandomNumberGenerator &rng, OneTimeKey const &key, bool fallback,
+                                     std::string_view user_id, std::string_view device_id);
+
+        /**
+         * \brief Output all unpublished one-time keys and the unpublished fallback key as signed_curve25519 objects.
+         *
+         * The one-time keys are split into one range per worker thread. Each worker signs its range with a single
+         * signer into its own buffer, and the buffers are joined in canonical key order. Ed25519 signatures are
+         * deterministic, so no random number generator is needed.
+         *
+         * \param user_id The user the device belongs to.
+         * \param device_id The ID of the device.
+         * \param pool The pool to sign on.
+         * \return The one_time_keys and fallback_keys objects to upload.
+         */
+        [[nodiscard]] SignedKeys get_signed_keys_json(std::string_view user_id, std::string_view device_id,
+                                                      ThreadPool &pool) const;
+
 
         /**
          * \brief Output the identity keys for this account as JSON.
@@ -117,7 +210,7 @@ namespace spank_olm
             {
                 if (!key->published)
                 {
-                    auto key_base64 = Botan::base64_encode(key->key.public_key()->raw_public_key_bits());
+                    auto key_base64 = base64_encode(key->key.public_key()->raw_public_key_bits());
                     stringified_keys.push_back(R"(")" + std::to_string(key->id) + R"(": ")" + key_base64 + "\"");
                 }
             }
@@ -186,7 +279,7 @@ namespace spank_olm
                 return R"({"curve25519": {}})";
             }
 
-            const auto key_base64 = Botan::base64_encode(current_fallback_key->key.public_key()->raw_public_key_bits());
+            const auto key_base64 = base64_encode(current_fallback_key->key.public_key()->raw_public_key_bits());
             return R"({"curve25519": {")" + std::to_string(current_fallback_key->id) + R"(": ")" + key_base64 + "\"}}";
         }
 
@@ -205,8 +298,77 @@ namespace spank_olm
          */
         void remove_key(Botan::Public_Key const &key);
 
+        /**
+         * \brief Returns the number of bytes needed to pickle the account.
+         */
+        [[nodiscard]] std::size_t pickle_length() const;
+
+        /**
+         * \brief Serializes the account at the given position.
+         *
+         * The caller has to make sure that at least pickle_length() bytes are available.
+         *
+         * \param pos Pointer to the current position in the byte array.
+         * \return Pointer to the position in the byte array after the serialized data.
+         */
+        std::uint8_t *pickle(std::uint8_t *pos) const;
+
+        /**
+         * \brief Serializes the account into a caller provided buffer.
+         *
+         * \param buffer The buffer to write to. It has to hold at least pickle_length() bytes.
+         * \return The number of bytes written.
+         * \throws SpankOlmErrorOutputBufferTooSmall if the buffer is smaller than pickle_length().
+         */
+        std::size_t pickle(std::span<uint8_t> buffer) const;
+
         [[nodiscard]] std::vector<uint8_t> pickle() const;
 
+        /**
+         * \brief Serializes the account into a buffer allocated from the given memory resource.
+         *
+         * This allows pickling many accounts into a std::pmr::monotonic_buffer_resource or a per-thread pool without
+         * going through the global heap.
+         *
+         * \param resource The memory resource to allocate the buffer from.
+         * \return The serialized account.
+         */
+        [[nodiscard]] std::pmr::vector<uint8_t> pickle(std::pmr::memory_resource *resource) const;
+
+        /**
+         * \brief Serializes and encrypts the account in one pass.
+         *
+         * The output is compatible with the pickle encryption used by libolm.
+         *
+         * \param cipher The cipher holding the key schedule of the pickle key.
+         * \return The encrypted and base64 encoded account.
+         */
+        [[nodiscard]] std::string pickle(PickleCipher &cipher) const;
+
         static Account unpickle(std::vector<uint8_t> const &data);
+
+        /**
+         * \brief Decrypts and deserializes an account.
+         *
+         * \param cipher The cipher holding the key schedule of the pickle key.
+         * \param encrypted The encrypted and base64 encoded account.
+         * \return The deserialized account.
+         * \throws SpankOlmErrorBadAccountKey if the account was encrypted with a different key.
+         */
+        static Account unpickle(PickleCipher &cipher, std::string_view encrypted);
+
+        /**
+         * \brief Deserializes an account from any contiguous buffer, e.g. one allocated from a memory resource.
+         *
+         * \param data The serialized account.
+         * \return The deserialized account.
+         */
+        static Account unpickle(std::span<const uint8_t> data);
+
+    private:
+        /**
+         * \brief Returns the number of fallback keys which are stored in a pickle.
+         */
+        [[nodiscard]] std::uint8_t fallback_key_count() const;
     };
 } // namespace spank_olm
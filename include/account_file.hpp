@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "account.hpp"
+#include "open_addressing.hpp"
+
+namespace spank_olm
+{
+    /**
+     * \brief A stored account which is read and updated in place through a memory mapping.
+     *
+     * The file has a fixed layout, so a single key can be read or changed without parsing or rewriting the rest of
+     * the account. All integers are stored in little-endian byte order.
+     *
+     * | Offset | Size       | Content                                                                            |
+     * |--------|------------|------------------------------------------------------------------------------------|
+     * | 0      | 32         | Header: magic, version, record size, record count, next key id, one-time key count |
+     * | 32     | 12         | Offset table: offsets of the identity keys, the id index and the key records       |
+     * | 64     | 160        | Identity keys: Ed25519 public and private, Curve25519 public and private           |
+     * | 256    | 2 * 256    | Id index: for each id slot, the record slot plus one, or zero                      |
+     * | 768    | 64 * 258   | Key records: 256 one-time key slots, then the current and previous fallback key   |
+     *
+     * Each key record fills one 64-byte cache line and holds the key id, a flags byte, the first 24 bytes of the
+     * Curve25519 public key and the private key. The one-time key slots form a hash table keyed by the public key,
+     * and the id index is a second one keyed by the id; both use linear probing. Claiming a key therefore compares
+     * bytes in about one record instead of building Botan keys. Only a record whose prefix matches is built, and its
+     * full public key is checked. Removing a key wipes its record in place and leaves a marker so that later keys in
+     * the same probe run stay reachable.
+     *
+     * Changes are written straight into the mapping; call sync() to flush them to disk. An AccountFile must not be
+     * used from several threads at once, and the file must not be changed by anyone else while it is open.
+     */
+    class AccountFile
+    {
+    public:
+        static constexpr std::uint32_t VERSION = 2; ///< The current version of the file format.
+        /**
+         * \brief The number of hash table slots for one-time keys.
+         */
+        static constexpr std::size_t ONE_TIME_KEY_SLOTS = open_addressing_capacity(MAX_ONE_TIME_KEYS);
+        static constexpr std::size_t RECORD_COUNT = ONE_TIME_KEY_SLOTS + 2; ///< The number of key records.
+
+        /**
+         * \brief Writes an account to a new file, replacing any existing one.
+         *
+         * The file is written next to the target and then renamed over it, so a reader never sees half of it. The
+         * directory is synced afterwards so the rename survives a crash.
+         *
+         * \param path The file to write.
+         * \param account The account to store. It has to have identity keys.
+         * \throws SpankOlmErrorIO if the file can't be written.
+         */
+        static void write(std::filesystem::path const &path, Account const &account);
+
+        /**
+         * \brief Maps an account file.
+         *
+         * \param path The file to open.
+         * \param writable Whether the key records may be changed.
+         * \return The opened file.
+         * \throws SpankOlmErrorIO if the file can't be opened or mapped.
+         * \throws SpankOlmErrorUnknownPickleVersion if the file has a newer format version.
+         * \throws SpankOlmErrorCorruptedAccountFile if the file isn't a valid account file.
+         */
+        static AccountFile open(std::filesystem::path const &path, bool writable = false);
+
+        AccountFile(AccountFile &&other) noexcept;
+        AccountFile &operator=(AccountFile &&other) noexcept;
+        AccountFile(AccountFile const &) = delete;
+        AccountFile &operator=(AccountFile const &) = delete;
+        ~AccountFile();
+
+        /**
+         * \brief Returns the raw Ed25519 identity public key.
+         */
+        [[nodiscard]] std::span<const std::uint8_t> ed25519_public_key() const;
+
+        /**
+         * \brief Returns the raw Curve25519 identity public key.
+         */
+        [[nodiscard]] std::span<const std::uint8_t> curve25519_public_key() const;
+
+        /**
+         * \brief Output the identity keys for this account as JSON, see Account::get_identity_json().
+         */
+        [[nodiscard]] std::string get_identity_json() const;
+
+        /**
+         * \brief Signs a message using the Ed25519 key, see Account::sign().
+         */
+        [[nodiscard]] std::vector<std::uint8_t> sign(Botan::RandomNumberGenerator &rng, std::string_view message) const;
+
+        /**
+         * \brief Returns the identifier for the next one-time key.
+         */
+        [[nodiscard]] std::uint32_t next_one_time_key_id() const;
+
+        /**
+         * \brief Returns the number of stored one-time keys, not counting the fallback keys.
+         */
+        [[nodiscard]] std::size_t one_time_key_count() const;
+
+        /**
+         * \brief Lookup a one time key or fallback key with the given public key, see Account::lookup_key().
+         *
+         * The other records are compared as bytes; only a record whose public key prefix matches is built, and its full
+         * public key is checked.
+         */
+        [[nodiscard]] std::optional<OneTimeKey> lookup_key(Botan::Public_Key const &key) const;
+
+        /**
+         * \brief Marks the one-time key with the given id as published.
+         *
+         * \return Whether a key with the id was found.
+         * \throws SpankOlmErrorIO if the file was opened read-only.
+         */
+        bool mark_as_published(std::uint32_t id);
+
+        /**
+         * \brief Mark all one-time keys and the current fallback key as published, see
+         * Account::mark_keys_as_published().
+         *
+         * \return The count of one-time keys marked as published.
+         * \throws SpankOlmErrorIO if the file was opened read-only.
+         */
+        std::size_t mark_keys_as_published();
+
+        /**
+         * \brief Remove a one time key with the given public key, see Account::remove_key().
+         *
+         * \return Whether the key was found.
+         * \throws SpankOlmErrorIO if the file was opened read-only.
+         */
+        bool remove_key(Botan::Public_Key const &key);
+
+        /**
+         * \brief Flushes the changes made through the mapping to disk.
+         *
+         * \throws SpankOlmErrorIO if the changes can't be written.
+         */
+        void sync();
+
+        /**
+         * \brief Builds a full Account from the file.
+         */
+        [[nodiscard]] Account to_account() const;
+
+    private:
+        AccountFile(std::uint8_t *data, std::size_t size, bool writable);
+
+        /**
+         * \brief Returns the key record at the given index.
+         */
+        [[nodiscard]] std::uint8_t *record(std::size_t index) const;
+
+        /**
+         * \brief Returns the id index.
+         */
+        [[nodiscard]] std::uint8_t const *id_index() const;
+
+        /**
+         * \brief Returns the index of the record holding the given public key, together with the key built from it.
+         */
+        [[nodiscard]] std::optional<std::pair<std::size_t, OneTimeKey>> find_record(Botan::Public_Key const &key) const;
+
+        /**
+         * \brief Throws if the file was opened read-only.
+         */
+        void require_writable() const;
+
+        std::uint8_t *data = nullptr; ///< The start of the mapping.
+        std::size_t size = 0; ///< The length of the mapping.
+        bool writable = false;
+    };
+} // namespace spank_olm
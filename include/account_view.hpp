@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "account.hpp"
+#include "open_addressing.hpp"
+
+namespace spank_olm
+{
+    /**
+     * \brief A read-only view of a pickled account which defers all key construction.
+     *
+     * parse() only checks the structure of the pickle and remembers where each key is, so it neither copies key
+     * material nor builds any Botan key objects. The identity key is built on the first call to sign(), and one-time
+     * keys are built one by one as lookup_key() gets to them. This makes loading many accounts of which only a few are
+     * used nearly free.
+     *
+     * The view borrows the pickle, so the buffer has to outlive it. It caches the keys it builds and is therefore not
+     * safe to use from several threads at once.
+     */
+    class AccountView
+    {
+    public:
+        /**
+         * \brief A one-time key as stored in the pickle.
+         */
+        struct KeyRecord
+        {
+            std::uint32_t id; ///< The unique identifier for the one-time key.
+            bool published; ///< Indicates whether the key has been published.
+            std::span<const std::uint8_t> private_key; ///< The private key bits inside the pickle.
+        };
+
+        /**
+         * \brief Parses a pickled account without copying it.
+         *
+         * \param data The pickled account. It has to outlive the view.
+         * \return The view of the account.
+         * \throws SpankOlmErrorVersionNotFound if the pickle version is not found.
+         * \throws SpankOlmErrorBadLegacyAccountPickle if the pickle version is 1.
+         * \throws SpankOlmErrorUnknownPickleVersion if the pickle version is unknown.
+         * \throws SpankOlmErrorCorruptedAccountPickle if the pickle data is corrupted.
+         */
+        static AccountView parse(std::span<const std::uint8_t> data);
+
+        /**
+         * \brief Returns the version of the parsed pickle.
+         */
+        [[nodiscard]] std::uint32_t pickle_version() const { return version; }
+
+        /**
+         * \brief Returns the raw Ed25519 identity public key.
+         */
+        [[nodiscard]] std::span<const std::uint8_t> ed25519_public_key() const { return ed25519_public; }
+
+        /**
+         * \brief Returns the raw Curve25519 identity public key.
+         */
+        [[nodiscard]] std::span<const std::uint8_t> curve25519_public_key() const { return curve25519_public; }
+
+        /**
+         * \brief Output the identity keys for this account as JSON, see Account::get_identity_json().
+         *
+         * This only needs the public keys stored in the pickle and builds no key objects.
+         */
+        [[nodiscard]] std::string get_identity_json() const;
+
+        /**
+         * \brief Returns the one-time keys in the pickle, newest first.
+         */
+        [[nodiscard]] std::span<const KeyRecord> one_time_keys() const
+        {
+            return std::span(records.data(), one_time_key_count);
+        }
+
+        /**
+         * \brief Returns the current fallback key, if there is one.
+         */
+        [[nodiscard]] std::optional<KeyRecord> current_fallback_key() const;
+
+        /**
+         * \brief Returns the previous fallback key, if there is one.
+         */
+        [[nodiscard]] std::optional<KeyRecord> prev_fallback_key() const;
+
+        /**
+         * \brief Returns the identifier for the next one-time key.
+         */
+        [[nodiscard]] std::uint32_t next_one_time_key_id() const { return next_key_id; }
+
+        /**
+         * \brief Signs a message using the Ed25519 key, see Account::sign().
+         *
+         * The Ed25519 key is built on the first call.
+         */
+        [[nodiscard]] std::vector<std::uint8_t> sign(Botan::RandomNumberGenerator &rng, std::string_view message) const;
+
+        /**
+         * \brief Lookup a one time key or fallback key with the given public key, see Account::lookup_key().
+         *
+         * Keys are built as the search reaches them and indexed by their public key, so each key is built at most
+         * once and a later lookup only continues the search where the earlier ones stopped.
+         */
+        [[nodiscard]] std::optional<OneTimeKey const *> lookup_key(Botan::Public_Key const &key) const;
+
+        /**
+         * \brief Builds a full Account from the view.
+         */
+        [[nodiscard]] Account to_account() const;
+
+    private:
+        static constexpr std::size_t CURRENT_FALLBACK_KEY = MAX_ONE_TIME_KEYS; ///< The current fallback key record.
+        static constexpr std::size_t PREV_FALLBACK_KEY = MAX_ONE_TIME_KEYS + 1; ///< The previous fallback key record.
+
+        AccountView() = default;
+
+        /**
+         * \brief Returns the key for a record, building it on first use.
+         */
+        OneTimeKey const &materialize(std::size_t record) const;
+
+        std::uint32_t version = 0;
+        std::span<const std::uint8_t> ed25519_public;
+        std::span<const std::uint8_t> ed25519_private;
+        std::span<const std::uint8_t> curve25519_public;
+        std::span<const std::uint8_t> curve25519_private;
+        std::array<KeyRecord, MAX_ONE_TIME_KEYS + 2> records{}; ///< The one-time keys followed by the fallback keys.
+        std::size_t one_time_key_count = 0;
+        std::uint8_t fallback_key_count = 0;
+        std::uint32_t next_key_id = 0;
+
+        mutable std::optional<Botan::Ed25519_PrivateKey> ed25519_key; ///< The identity key, once built.
+        mutable std::unordered_map<std::size_t, OneTimeKey> keys; ///< The keys built so far, by record.
+        mutable ProbeTable index; ///< The records searched so far, hashed by public key.
+        mutable std::size_t indexed = 0; ///< The number of records in the index, in search order.
+    };
+} // namespace spank_olm
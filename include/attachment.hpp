@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <botan/hash.h>
+#include <botan/rng.h>
+#include <botan/stream_cipher.h>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t ATTACHMENT_KEY_LENGTH(32); ///< The length of the AES-256 key of an attachment.
+    constexpr std::size_t ATTACHMENT_IV_LENGTH(16); ///< The length of the initial counter block of an attachment.
+    constexpr std::size_t ATTACHMENT_HASH_LENGTH(32); ///< The length of the SHA-256 hash of an attachment.
+
+    /**
+     * \brief The number of bytes a worker thread encrypts or decrypts at once.
+     */
+    constexpr std::size_t ATTACHMENT_SEGMENT_LENGTH(1 << 20);
+
+    /**
+     * \brief What the receiver of an encrypted attachment needs to decrypt it, as in the file info of a room message.
+     *
+     * The fields are raw bytes. In the file info, the key is the unpadded base64url "k" of a JWK, while the IV and the
+     * hash are unpadded base64.
+     */
+    struct AttachmentInfo
+    {
+        std::array<std::uint8_t, ATTACHMENT_KEY_LENGTH> key; ///< The AES-256 key.
+        std::array<std::uint8_t, ATTACHMENT_IV_LENGTH> iv; ///< The initial counter block.
+        std::array<std::uint8_t, ATTACHMENT_HASH_LENGTH> sha256; ///< The SHA-256 hash of the ciphertext.
+    };
+
+    /**
+     * \brief Encrypts an attachment piece by piece with AES-256-CTR, hashing the ciphertext in the same pass.
+     *
+     * Like Element, the counter is the lower 64 bits of the counter block, and bit 63 of a new IV is cleared so it
+     * can't wrap around.
+     */
+    class AttachmentEncryption
+    {
+    public:
+        /**
+         * \brief Starts an attachment with a random key and IV.
+         *
+         * \param rng The botan random number generator to use for the key and IV.
+         */
+        explicit AttachmentEncryption(Botan::RandomNumberGenerator &rng);
+
+        /**
+         * \brief Encrypts the next piece of the attachment.
+         *
+         * \param plaintext The piece.
+         * \param ciphertext The buffer to write the encrypted piece to. It may be the same as plaintext.
+         * \throws SpankOlmErrorOutputBufferTooSmall if ciphertext is shorter than plaintext.
+         */
+        void update(std::span<const std::uint8_t> plaintext, std::span<std::uint8_t> ciphertext);
+
+        /**
+         * \brief Finishes the attachment.
+         *
+         * \return The key, IV and hash to send with the attachment.
+         */
+        [[nodiscard]] AttachmentInfo finish();
+
+    private:
+        AttachmentInfo info;
+        std::unique_ptr<Botan::StreamCipher> cipher;
+        std::unique_ptr<Botan::HashFunction> hash;
+    };
+
+    /**
+     * \brief Decrypts an attachment piece by piece, hashing the ciphertext in the same pass.
+     *
+     * The plaintext is handed out before the hash is checked in finish(), so it must not be trusted until then.
+     */
+    class AttachmentDecryption
+    {
+    public:
+        /**
+         * \brief Starts decrypting an attachment.
+         *
+         * \param info The key, IV and hash sent with the attachment.
+         */
+        explicit AttachmentDecryption(AttachmentInfo const &info);
+
+        /**
+         * \brief Decrypts the next piece of the attachment.
+         *
+         * \param ciphertext The piece.
+         * \param plaintext The buffer to write the decrypted piece to. It may be the same as ciphertext.
+         * \throws SpankOlmErrorOutputBufferTooSmall if plaintext is shorter than ciphertext.
+         */
+        void update(std::span<const std::uint8_t> ciphertext, std::span<std::uint8_t> plaintext);
+
+        /**
+         * \brief Checks the hash of the whole ciphertext.
+         *
+         * \throws SpankOlmErrorBadAttachmentHash if the ciphertext doesn't match the hash.
+         */
+        void finish();
+
+    private:
+        std::array<std::uint8_t, ATTACHMENT_HASH_LENGTH> expected_hash;
+        std::unique_ptr<Botan::StreamCipher> cipher;
+        std::unique_ptr<Botan::HashFunction> hash;
+    };
+
+    /**
+     * \brief Encrypts a whole attachment in memory, e.g. a memory mapped file, on a thread pool.
+     *
+     * The attachment is split into segments of ATTACHMENT_SEGMENT_LENGTH, which the workers encrypt independently by
+     * seeking the counter. The calling thread hashes the encrypted segments in order while the later ones are still
+     * being encrypted.
+     *
+     * \param rng The botan random number generator to use for the key and IV.
+     * \param plaintext The attachment.
+     * \param ciphertext The buffer to write the encrypted attachment to. It may be the same as plaintext.
+     * \param pool The pool to encrypt on.
+     * \return The key, IV and hash to send with the attachment.
+     * \throws SpankOlmErrorOutputBufferTooSmall if ciphertext is shorter than plaintext.
+     */
+    [[nodiscard]] AttachmentInfo encrypt_attachment(Botan::RandomNumberGenerator &rng,
+                                                    std::span<const std::uint8_t> plaintext,
+                                                    std::span<std::uint8_t> ciphertext, ThreadPool &pool);
+
+    /**
+     * \brief Decrypts a whole attachment in memory, e.g. a memory mapped file, on a thread pool.
+     *
+     * The calling thread hashes the segments in order and hands each one to a worker to decrypt once it is hashed, so
+     * hashing and decryption overlap. If the hash doesn't match, the plaintext is scrubbed before the exception is
+     * thrown.
+     *
+     * \param info The key, IV and hash sent with the attachment.
+     * \param ciphertext The encrypted attachment.
+     * \param plaintext The buffer to write the attachment to. It may be the same as ciphertext.
+     * \param pool The pool to decrypt on.
+     * \throws SpankOlmErrorOutputBufferTooSmall if plaintext is shorter than ciphertext.
+     * \throws SpankOlmErrorBadAttachmentHash if the ciphertext doesn't match the hash.
+     */
+    void decrypt_attachment(AttachmentInfo const &info, std::span<const std::uint8_t> ciphertext,
+                            std::span<std::uint8_t> plaintext, ThreadPool &pool);
+} // namespace spank_olm
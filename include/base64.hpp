@@ -0,0 +1,70 @@
+#pragma once
+
+#include <botan/secmem.h>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace spank_olm
+{
+    /**
+     * \brief Returns the length of the base64 encoding of the given number of bytes.
+     *
+     * \param length The number of bytes to encode.
+     * \param padded Whether the encoding is padded with '=' to a multiple of 4 characters. Matrix uses unpadded base64.
+     */
+    [[nodiscard]] constexpr std::size_t base64_encoded_length(const std::size_t length, const bool padded = true)
+    {
+        return padded ? (length + 2) / 3 * 4 : (length * 4 + 2) / 3;
+    }
+
+    /**
+     * \brief Returns the largest number of bytes the given number of base64 characters can decode to.
+     */
+    [[nodiscard]] constexpr std::size_t base64_decoded_length(const std::size_t length) { return length / 4 * 3 + 2; }
+
+    /**
+     * \brief Encodes bytes as base64 into a caller provided buffer.
+     *
+     * Large inputs are encoded with SSSE3 or AVX2 on x86, NEON on AArch64 or SIMD128 on WASM if available.
+     *
+     * \param input The bytes to encode.
+     * \param output The buffer to write to. It has to hold at least base64_encoded_length() characters.
+     * \param padded Whether to pad the output with '='.
+     * \return The number of characters written.
+     * \throws SpankOlmErrorOutputBufferTooSmall if the output buffer is too small.
+     */
+    std::size_t base64_encode(std::span<const std::uint8_t> input, std::span<char> output, bool padded = true);
+
+    /**
+     * \brief Encodes bytes as base64.
+     *
+     * \param input The bytes to encode.
+     * \param padded Whether to pad the output with '='.
+     * \return The encoded string.
+     */
+    [[nodiscard]] std::string base64_encode(std::span<const std::uint8_t> input, bool padded = true);
+
+    /**
+     * \brief Decodes standard base64, padded or unpadded, into a caller provided buffer.
+     *
+     * \param input The base64 to decode. Whitespace isn't allowed.
+     * \param output The buffer to write to. base64_decoded_length() bytes are always enough.
+     * \return The number of bytes written.
+     * \throws SpankOlmErrorInvalidBase64 if the input isn't valid base64, or isn't the canonical encoding because
+     * the unused bits of its last character are set.
+     * \throws SpankOlmErrorOutputBufferTooSmall if the output buffer is too small.
+     */
+    std::size_t base64_decode(std::string_view input, std::span<std::uint8_t> output);
+
+    /**
+     * \brief Decodes standard base64, padded or unpadded.
+     *
+     * \param input The base64 to decode. Whitespace isn't allowed.
+     * \return The decoded bytes.
+     * \throws SpankOlmErrorInvalidBase64 if the input isn't valid base64, or isn't the canonical encoding because
+     * the unused bits of its last character are set.
+     */
+    [[nodiscard]] Botan::secure_vector<std::uint8_t> base64_decode(std::string_view input);
+} // namespace spank_olm
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "account.hpp"
+#include "megolm.hpp"
+#include "pickle_encryption.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t BULK_UNPICKLE_BATCH_SIZE(256); ///< The default number of pickles a worker unpickles at once.
+
+    /**
+     * \brief The outcome of unpickling one pickle of a bulk load.
+     */
+    template <typename T>
+    struct Unpickled
+    {
+        std::optional<T> value; ///< The unpickled object, empty if unpickling failed.
+        std::exception_ptr error; ///< The exception unpickling threw, if any.
+
+        /**
+         * \brief Returns whether the pickle was unpickled successfully.
+         */
+        [[nodiscard]] bool ok() const { return value.has_value(); }
+    };
+
+    /**
+     * \brief Decrypts and unpickles encrypted pickles on a thread pool while they are still being read.
+     *
+     * Pickles are collected with add() and handed to the pool in batches, so the caller can keep reading from disk
+     * while earlier batches are being decrypted and unpickled. finish() waits for all batches and returns one result
+     * per added pickle, in the order they were added. A pickle which fails to unpickle is reported in its result and
+     * doesn't affect the others.
+     *
+     * Only Account and Megolm are supported. A BulkUnpickler must not be used from several threads at once.
+     */
+    template <typename T>
+    class BulkUnpickler
+    {
+    public:
+        /**
+         * \brief Sets up a bulk load.
+         *
+         * \param cipher The cipher of the pickle key. Every batch uses its own copy.
+         * \param pool The pool to unpickle on. It has to outlive the BulkUnpickler.
+         * \param batch_size The number of pickles per batch.
+         */
+        BulkUnpickler(PickleCipher const &cipher, ThreadPool &pool, std::size_t batch_size = BULK_UNPICKLE_BATCH_SIZE);
+
+        BulkUnpickler(BulkUnpickler const &) = delete;
+        BulkUnpickler &operator=(BulkUnpickler const &) = delete;
+
+        /**
+         * \brief Waits for the batches still being unpickled.
+         */
+        ~BulkUnpickler();
+
+        /**
+         * \brief Queues an encrypted pickle, starting a batch once enough pickles have been queued.
+         *
+         * \return The index of the pickle's result in the vector returned by finish().
+         */
+        std::size_t add(std::string encrypted);
+
+        /**
+         * \brief Unpickles the remaining pickles and waits for all batches.
+         *
+         * The BulkUnpickler is empty afterwards and can be used for another load.
+         *
+         * \return One result per added pickle.
+         */
+        [[nodiscard]] std::vector<Unpickled<T>> finish();
+
+    private:
+        /**
+         * \brief Hands the queued pickles to the pool.
+         */
+        void submit_batch();
+
+        PickleCipher cipher;
+        ThreadPool &pool;
+        std::size_t batch_size;
+        std::size_t added = 0;
+        std::vector<std::string> queued;
+        std::vector<std::future<std::vector<Unpickled<T>>>> batches;
+    };
+
+    extern template class BulkUnpickler<Account>;
+    extern template class BulkUnpickler<Megolm>;
+
+    /**
+     * \brief Decrypts and unpickles accounts in parallel.
+     *
+     * \param cipher The cipher of the pickle key. Every worker uses its own copy.
+     * \param encrypted The encrypted pickles, as written by Account::pickle(PickleCipher &).
+     * \param pool The pool to unpickle on.
+     * \return One result per pickle, in the same order.
+     */
+    [[nodiscard]] std::vector<Unpickled<Account>> unpickle_accounts(PickleCipher const &cipher,
+                                                                    std::span<const std::string_view> encrypted,
+                                                                    ThreadPool &pool);
+
+    /**
+     * \brief Decrypts and unpickles megolm ratchets in parallel.
+     *
+     * \param cipher The cipher of the pickle key. Every worker uses its own copy.
+     * \param encrypted The encrypted pickles, as written by Megolm::pickle(PickleCipher &).
+     * \param pool The pool to unpickle on.
+     * \return One result per pickle, in the same order.
+     */
+    [[nodiscard]] std::vector<Unpickled<Megolm>> unpickle_megolms(PickleCipher const &cipher,
+                                                                  std::span<const std::string_view> encrypted,
+                                                                  ThreadPool &pool);
+} // namespace spank_olm
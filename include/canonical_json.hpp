@@ -0,0 +1,105 @@
+#pragma once
+
+#include <botan/rng.h>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "signature.hpp"
+
+namespace spank_olm
+{
+    /**
+     * \brief Writes canonical JSON, the form Matrix signs, straight into a string.
+     *
+     * Canonical JSON has no whitespace and the keys of every object sorted by their UTF-8 bytes. The writer takes care
+     * of the separators and the escaping, the caller has to write the keys of each object in sorted order.
+     *
+     * A signed object is fed into a signer while it is written, so its signable form is hashed in the same
+     * pass that builds it. When the object is closed, the signature is inserted as its "signatures" field, at the
+     * position marked with signatures_position(), and nothing has to be parsed or canonicalized again.
+     */
+    class CanonicalJsonWriter
+    {
+    public:
+        /**
+         * \brief Starts writing JSON to the end of a string.
+         *
+         * \param output The string to append to.
+         */
+        explicit CanonicalJsonWriter(std::string &output);
+
+        void begin_object();
+        void end_object();
+        void begin_array();
+        void end_array();
+
+        /**
+         * \brief Writes the key of the next field of the current object.
+         */
+        void key(std::string_view name);
+
+        /**
+         * \brief Writes a key of the form "<algorithm>:<key id>", as in the keys and signatures of Matrix.
+         */
+        void key(std::string_view algorithm, std::string_view key_id);
+
+        void string_value(std::string_view text);
+        void bool_value(bool flag);
+
+        /**
+         * \brief Writes bytes as an unpadded base64 string, the encoding of keys and signatures in Matrix.
+         */
+        void base64_value(std::span<const std::uint8_t> bytes);
+
+        /**
+         * \brief Opens an object whose signable form is fed into a signer.
+         *
+         * Signed objects can't be nested.
+         *
+         * \param signer The signer, which must not have been fed anything else since its last signature.
+         */
+        void begin_signed_object(IncrementalSigner &signer);
+
+        /**
+         * \brief Marks where the "signatures" field goes in the signed object.
+         *
+         * Call it between the fields which sort before and after "signatures". Without it, the signatures are appended
+         * as the last field.
+         */
+        void signatures_position();
+
+        /**
+         * \brief Closes the signed object, signs it and inserts its "signatures" field.
+         *
+         * \param rng The botan random number generator to use.
+         * \param user_id The user the signing key belongs to.
+         * \param key_id The ID of the signing key, without the "ed25519:" prefix, e.g. a device ID.
+         */
+        void end_signed_object(Botan::RandomNumberGenerator &rng, std::string_view user_id, std::string_view key_id);
+
+    private:
+        /**
+         * \brief Writes the comma before a value or key, unless the value follows its key.
+         */
+        void separate();
+
+        /**
+         * \brief Feeds the text written since start into the signer of the current signed object, if any.
+         */
+        void feed(std::size_t start);
+
+        void write(char c);
+
+        std::string &output;
+        std::vector<bool> has_members; ///< Per open object or array, whether it has a member yet.
+        bool after_key = false;
+        IncrementalSigner *signer = nullptr;
+        std::size_t signed_depth = 0;
+        std::optional<std::size_t> signatures_offset;
+        bool signatures_after_member = false;
+    };
+} // namespace spank_olm
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <array>
+#include <botan/ed25519.h>
+#include <botan/rng.h>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t CROSS_SIGNING_KEY_LENGTH(32); ///< The length of a public cross-signing key in bytes.
+
+    /**
+     * \brief The private cross-signing keys of a user.
+     *
+     * The master key is the identity of the user. It signs the self-signing key, which signs the user's own devices,
+     * and the user-signing key, which signs the master keys of other users. Like every signed JSON object in Matrix,
+     * the key objects are signed with pure Ed25519, not the Ed25519ph used by Account::sign().
+     */
+    struct CrossSigningKeys
+    {
+        Botan::Ed25519_PrivateKey master_key; ///< The key the other two are signed with.
+        Botan::Ed25519_PrivateKey self_signing_key; ///< The key the devices of the user are signed with.
+        Botan::Ed25519_PrivateKey user_signing_key; ///< The key the master keys of other users are signed with.
+
+        /**
+         * \brief Generates new cross-signing keys.
+         *
+         * \param rng The botan random number generator to use.
+         * \throws SpankOlmErrorKeyGeneration if the key generation fails.
+         */
+        [[nodiscard]] static CrossSigningKeys generate(Botan::RandomNumberGenerator &rng);
+    };
+
+    /**
+     * \brief The key objects of the cross-signing keys of a user, as uploaded to /keys/device_signing/upload.
+     */
+    struct CrossSigningUpload
+    {
+        std::string master_key; ///< The master key object.
+        std::string self_signing_key; ///< The self-signing key object, signed by the master key.
+        std::string user_signing_key; ///< The user-signing key object, signed by the master key.
+    };
+
+    /**
+     * \brief Writes the key objects of cross-signing keys in canonical JSON, signing them while they are written.
+     *
+     * \param keys The cross-signing keys.
+     * \param rng The botan random number generator to use.
+     * \param user_id The user the keys belong to.
+     * \return The key objects.
+     */
+    [[nodiscard]] CrossSigningUpload get_cross_signing_upload_json(CrossSigningKeys const &keys,
+                                                                   Botan::RandomNumberGenerator &rng,
+                                                                   std::string_view user_id);
+
+    /**
+     * \brief A signed key object, reduced to what checking one link of a trust chain needs.
+     */
+    struct SignedKeyObject
+    {
+        std::string signable; ///< The canonical JSON of the object without its "signatures" and "unsigned" fields.
+        std::vector<std::uint8_t> signature; ///< The signature of the key one link up the chain.
+
+        bool operator==(SignedKeyObject const &) const = default;
+    };
+
+    /**
+     * \brief Decides whether users and devices are trusted through cross-signing, remembering every checked link.
+     *
+     * Our own master key is the root of trust. Another user is trusted if our user-signing key signed their master
+     * key, and a device is trusted if its user is trusted and the user's self-signing key, signed by their master key,
+     * signed the device keys.
+     *
+     * Every link is checked at most once. The result is kept until one of the keys or signatures of the link changes,
+     * so after the first query for a room, repeated queries only check what changed since. Updating a key drops only
+     * the links which depend on it.
+     *
+     * The verifier is not thread safe. Batch queries spread their signature checks over a pool themselves.
+     */
+    class TrustChainVerifier
+    {
+    public:
+        /**
+         * \brief Creates a verifier for the user whose trust decisions it makes.
+         *
+         * \param own_user_id The ID of our own user.
+         */
+        explicit TrustChainVerifier(std::string own_user_id);
+
+        /**
+         * \brief Sets our own cross-signing keys.
+         *
+         * The signatures of the self-signing and user-signing key objects are those of the master key. The master key
+         * object's signature is not checked. A changed user-signing key drops the trust in all other users.
+         *
+         * \throws SpankOlmErrorBadMessageFormat if a key object is malformed or belongs to another user.
+         * \throws SpankOlmErrorInvalidBase64 if a key isn't valid base64.
+         */
+        void set_own_keys(SignedKeyObject const &master_key, SignedKeyObject const &self_signing_key,
+                          SignedKeyObject const &user_signing_key);
+
+        /**
+         * \brief Sets or updates the cross-signing keys of another user.
+         *
+         * The signature of the master key object is the one of our user-signing key, the one of the self-signing key
+         * object the one of the user's master key. Unchanged objects keep their checked links.
+         *
+         * \throws SpankOlmErrorBadMessageFormat if a key object is malformed or belongs to another user.
+         * \throws SpankOlmErrorInvalidBase64 if a key isn't valid base64.
+         */
+        void set_user_keys(std::string_view user_id, SignedKeyObject const &master_key,
+                           SignedKeyObject const &self_signing_key);
+
+        /**
+         * \brief Forgets the keys of a user, e.g. after they left all shared rooms.
+         */
+        void forget_user(std::string_view user_id);
+
+        /**
+         * \brief Returns whether a user is trusted.
+         */
+        [[nodiscard]] bool is_user_trusted(std::string_view user_id);
+
+        /**
+         * \brief Returns whether the users are trusted, checking the links not known yet on a pool.
+         *
+         * \param user_ids The users, e.g. the members of a room.
+         * \param pool The pool to check the signatures on.
+         * \return Whether each user is trusted, in the same order.
+         */
+        [[nodiscard]] std::vector<bool> are_users_trusted(std::span<const std::string> user_ids, ThreadPool &pool);
+
+        /**
+         * \brief Returns whether a device is trusted.
+         *
+         * \param user_id The user the device belongs to.
+         * \param device_id The ID of the device.
+         * \param device_keys The device keys, signed by the self-signing key of the user.
+         * \throws SpankOlmErrorBadMessageFormat if the device keys are malformed or belong to another device.
+         */
+        [[nodiscard]] bool is_device_trusted(std::string_view user_id, std::string_view device_id,
+                                             SignedKeyObject const &device_keys);
+
+        /**
+         * \brief Returns how many signatures were checked so far, as opposed to answered from the remembered links.
+         */
+        [[nodiscard]] std::uint64_t verification_count() const { return verifications; }
+
+    private:
+        using PublicKey = std::array<std::uint8_t, CROSS_SIGNING_KEY_LENGTH>;
+
+        /**
+         * \brief Hashes user and device IDs, so the maps can be searched with a string_view.
+         */
+        struct IdHash
+        {
+            using is_transparent = void;
+
+            std::size_t operator()(const std::string_view id) const noexcept
+            {
+                return std::hash<std::string_view>{}(id);
+            }
+        };
+
+        template <typename Value>
+        using IdMap = std::unordered_map<std::string, Value, IdHash, std::equal_to<>>;
+
+        struct DeviceLink
+        {
+            SignedKeyObject device_keys;
+            bool trusted;
+        };
+
+        struct UserKeys
+        {
+            SignedKeyObject master_key;
+            SignedKeyObject self_signing_key;
+            PublicKey master_public_key;
+            PublicKey self_signing_public_key;
+            std::optional<bool> master_key_trusted; ///< Whether our user-signing key signed the master key.
+            std::optional<bool> self_signing_key_trusted; ///< Whether the master key signed the self-signing key.
+            IdMap<DeviceLink> devices; ///< The checked device keys by device ID.
+        };
+
+        /**
+         * \brief Returns the keys of a user, or nullptr if they aren't known.
+         */
+        UserKeys *find_user(std::string_view user_id);
+
+        /**
+         * \brief Checks a signature and counts the check.
+         */
+        bool verify(PublicKey const &key, SignedKeyObject const &object);
+
+        std::string own_user_id;
+        SignedKeyObject own_user_signing_object; ///< Our user-signing key object, as last set.
+        std::optional<PublicKey> own_user_signing_key; ///< Our user-signing key, if our master key signed it.
+        IdMap<UserKeys> users;
+        std::uint64_t verifications = 0;
+    };
+} // namespace spank_olm
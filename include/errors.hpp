@@ -65,3 +65,129 @@ public:
     {
     }
 };
+
+// Specific exception for failing to read or write a file
+class SpankOlmErrorIO final : public SpankOlmException
+{
+public:
+    SpankOlmErrorIO() : SpankOlmException("Error reading or writing a file.")
+    {
+    }
+};
+
+// Specific exception for an output buffer which is too small for the result
+class SpankOlmErrorOutputBufferTooSmall final : public SpankOlmException
+{
+public:
+    SpankOlmErrorOutputBufferTooSmall() : SpankOlmException("Output buffer too small.")
+    {
+    }
+};
+
+// Specific exception for input which isn't valid base64
+class SpankOlmErrorInvalidBase64 final : public SpankOlmException
+{
+public:
+    SpankOlmErrorInvalidBase64() : SpankOlmException("Invalid base64.")
+    {
+    }
+};
+
+// Specific exception for a pickle which was encrypted with a different key or was tampered with
+class SpankOlmErrorBadAccountKey final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadAccountKey() : SpankOlmException("Bad account key.")
+    {
+    }
+};
+
+// Specific exception for a corrupted pickle
+class SpankOlmErrorCorruptedPickle final : public SpankOlmException
+{
+public:
+    SpankOlmErrorCorruptedPickle() : SpankOlmException("Corrupted pickle.")
+    {
+    }
+};
+
+// Specific exception for a corrupted account file
+class SpankOlmErrorCorruptedAccountFile final : public SpankOlmException
+{
+public:
+    SpankOlmErrorCorruptedAccountFile() : SpankOlmException("Corrupted account file.")
+    {
+    }
+};
+
+// Specific exception for a message with an unsupported protocol version
+class SpankOlmErrorBadMessageVersion final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadMessageVersion() : SpankOlmException("Bad message version.")
+    {
+    }
+};
+
+// Specific exception for a message which can't be decoded
+class SpankOlmErrorBadMessageFormat final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadMessageFormat() : SpankOlmException("Bad message format.")
+    {
+    }
+};
+
+// Specific exception for a message which fails authentication
+class SpankOlmErrorBadMessageMac final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadMessageMac() : SpankOlmException("Bad message MAC.")
+    {
+    }
+};
+
+// Specific exception for a message whose key isn't available anymore, or not yet
+class SpankOlmErrorBadMessageKeyId final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadMessageKeyId() : SpankOlmException("Bad message key ID.")
+    {
+    }
+};
+
+// Specific exception for a public key which can't be used
+class SpankOlmErrorInvalidKey final : public SpankOlmException
+{
+public:
+    SpankOlmErrorInvalidKey() : SpankOlmException("Invalid key.")
+    {
+    }
+};
+
+// Specific exception for a message none of the sessions with its sender can decrypt
+class SpankOlmErrorNoMatchingSession final : public SpankOlmException
+{
+public:
+    SpankOlmErrorNoMatchingSession() : SpankOlmException("No matching session.")
+    {
+    }
+};
+
+// Specific exception for a file which isn't a Megolm key export
+class SpankOlmErrorBadKeyExport final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadKeyExport() : SpankOlmException("Bad key export.")
+    {
+    }
+};
+
+// Specific exception for an attachment whose ciphertext doesn't match its hash
+class SpankOlmErrorBadAttachmentHash final : public SpankOlmException
+{
+public:
+    SpankOlmErrorBadAttachmentHash() : SpankOlmException("Bad attachment hash.")
+    {
+    }
+};
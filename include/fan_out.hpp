@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <span>
+
+#include "session.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t FAN_OUT_CHUNK_SIZE(256); ///< The default number of sessions a worker encrypts at once.
+
+    /**
+     * \brief The encrypted payload for one session of a fan-out.
+     */
+    struct FanOutResult
+    {
+        std::size_t target; ///< The index of the session in the span passed to fan_out_encrypt().
+        OlmMessage message; ///< The encrypted payload.
+        std::exception_ptr error; ///< The exception encrypting threw, if any.
+
+        /**
+         * \brief Returns whether the payload was encrypted.
+         */
+        [[nodiscard]] bool ok() const { return !error; }
+    };
+
+    /**
+     * \brief Receives the results of a fan-out, one chunk at a time, in the order of the sessions.
+     *
+     * The span is only valid during the call, but the messages may be moved out of it.
+     */
+    using FanOutSink = std::function<void(std::span<FanOutResult> results)>;
+
+    /**
+     * \brief Encrypts one payload, e.g. a room key, for many sessions in parallel.
+     *
+     * The sessions are split into chunks which are encrypted on the pool. Every chunk shares the one plaintext and
+     * reuses one scratch buffer and random number generator for all of its sessions. The results are passed to the
+     * sink on the calling thread, in order, as soon as their chunk is done. At most two chunks per worker thread are
+     * held at once, so memory use doesn't grow with the number of sessions.
+     *
+     * A session which fails to encrypt is reported in its result and doesn't affect the others.
+     *
+     * \param sessions The sessions to encrypt for. Every session may only appear once.
+     * \param plaintext The payload.
+     * \param pool The pool to encrypt on.
+     * \param sink The function receiving the results.
+     * \param chunk_size The number of sessions per chunk.
+     * \throws Rethrows what the sink throws, after the chunks still being encrypted have finished.
+     */
+    void fan_out_encrypt(std::span<Session *const> sessions, std::span<const std::uint8_t> plaintext, ThreadPool &pool,
+                         FanOutSink const &sink, std::size_t chunk_size = FAN_OUT_CHUNK_SIZE);
+} // namespace spank_olm
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <botan/cipher_mode.h>
+#include <botan/secmem.h>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "account.hpp"
+#include "megolm.hpp"
+#include "pickle_encryption.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t JOURNAL_COMPACT_THRESHOLD(64 * 1024); ///< The default journal size which triggers compaction.
+
+    /**
+     * \brief An append-only file of small encrypted change records.
+     *
+     * Every record is a type byte and a payload, encrypted with AES-256-GCM under a key derived from the pickle key
+     * and a random salt in the journal header. The nonce is the position of the record in the journal, so records
+     * can't be reordered or dropped from the middle without failing authentication. A record costs 19 bytes on disk
+     * plus its payload.
+     *
+     * append() only buffers the record; commit() writes everything appended so far with a single write and fsync.
+     * Threads which commit while another thread is syncing wait for it and skip their own fsync if their records were
+     * part of it, so concurrent commits are grouped into one fsync.
+     */
+    class Journal
+    {
+    public:
+        /**
+         * \brief Called with the type and payload of each record when a journal is opened.
+         */
+        using Replay = std::function<void(std::uint8_t, std::span<const std::uint8_t>)>;
+
+        static constexpr std::size_t MAX_PAYLOAD_LENGTH = 1024; ///< The maximum length of a record payload.
+
+        /**
+         * \brief Opens a journal and replays its records.
+         *
+         * If the file doesn't exist or belongs to an older generation, a new empty journal is started instead. A last
+         * record which is cut off or fails authentication can only have been left by an interrupted write and ends the
+         * replay. The valid records are then written again under a new salt, so records appended afterwards never
+         * reuse a nonce of the dropped one under the same key.
+         *
+         * \param path The journal file.
+         * \param pickle_key The pickle key to derive the record key from.
+         * \param generation The generation of the snapshot the journal has to belong to.
+         * \param replay Called for each record.
+         * \throws SpankOlmErrorIO if the journal can't be read or written.
+         * \throws SpankOlmErrorCorruptedPickle if the journal belongs to a newer generation than the snapshot, or if a
+         * record other than the last one fails authentication. The file is left untouched then.
+         */
+        Journal(std::filesystem::path path, std::span<const std::uint8_t> pickle_key, std::uint64_t generation,
+                Replay const &replay);
+
+        Journal(Journal const &) = delete;
+        Journal &operator=(Journal const &) = delete;
+
+        /**
+         * \brief Commits the pending records and closes the journal. Errors are ignored.
+         */
+        ~Journal();
+
+        /**
+         * \brief Encrypts a record and queues it for the next commit().
+         *
+         * \throws SpankOlmErrorOutputBufferTooSmall if the payload is longer than MAX_PAYLOAD_LENGTH.
+         * \throws SpankOlmErrorIO if the journal failed and has to be reset().
+         */
+        void append(std::uint8_t type, std::span<const std::uint8_t> payload);
+
+        /**
+         * \brief Writes and fsyncs all records appended so far.
+         *
+         * If writing fails, the part of the records which reached the file is truncated away and they stay pending, so
+         * a later commit() can retry. If the file can't be truncated either, the journal fails: append() and commit()
+         * throw until reset().
+         *
+         * \throws SpankOlmErrorIO if writing fails.
+         */
+        void commit();
+
+        /**
+         * \brief Replaces the journal with an empty one for a new snapshot generation.
+         *
+         * The new journal is written next to the old one and renamed over it. Pending records are dropped, as the
+         * new snapshot is expected to contain them.
+         *
+         * \throws SpankOlmErrorIO if the journal can't be written.
+         */
+        void reset(std::uint64_t generation);
+
+        /**
+         * \brief Returns the number of bytes the records take up, including pending ones.
+         */
+        [[nodiscard]] std::size_t size() const;
+
+        /**
+         * \brief Returns the generation of the snapshot the journal belongs to.
+         */
+        [[nodiscard]] std::uint64_t generation() const { return current_generation; }
+
+    private:
+        /**
+         * \brief Derives the record key from the salt and sets up the ciphers.
+         */
+        void init(std::span<const std::uint8_t> salt);
+
+        /**
+         * \brief Replaces the journal with one under a new salt which holds the given decrypted records.
+         *
+         * \throws SpankOlmErrorIO if the journal can't be written. The journal fails then until reset().
+         */
+        void rewrite(std::uint64_t generation, std::span<const Botan::secure_vector<std::uint8_t>> records);
+
+        /**
+         * \brief Returns the nonce for the record with the given sequence number.
+         */
+        [[nodiscard]] static std::array<std::uint8_t, 12> nonce(std::uint64_t sequence);
+
+        std::filesystem::path path;
+        Botan::secure_vector<std::uint8_t> pickle_key;
+        std::uint64_t current_generation = 0;
+        int fd = -1;
+
+        mutable std::mutex mutex; ///< Guards everything below.
+        std::unique_ptr<Botan::Cipher_Mode> encryption;
+        std::unique_ptr<Botan::Cipher_Mode> decryption;
+        std::uint64_t next_sequence = 0; ///< The sequence number of the next appended record.
+        std::vector<std::uint8_t> pending; ///< Records appended but not written yet.
+        std::size_t written = 0; ///< The length of the records already in the file.
+        bool failed = false; ///< Whether a failed write left records in the file which can't be continued.
+
+        std::mutex sync_mutex; ///< Held by the thread which writes and fsyncs.
+    };
+
+    /**
+     * \brief State which is stored as a snapshot pickle plus a journal of the changes made since.
+     *
+     * The snapshot is an encrypted pickle at the given path, the journal lives next to it with a ".journal" suffix.
+     * Changes are recorded in the journal, so persisting a change costs a few dozen bytes instead of a full pickle.
+     * Once the journal grows beyond the compaction threshold, commit() writes a new snapshot and starts an empty
+     * journal.
+     *
+     * Both files carry a generation number, so a crash between writing the snapshot and resetting the journal leaves
+     * a stale journal which is then ignored instead of being applied twice.
+     */
+    class JournaledState
+    {
+    public:
+        JournaledState(JournaledState const &) = delete;
+        JournaledState &operator=(JournaledState const &) = delete;
+        virtual ~JournaledState() = default;
+
+        /**
+         * \brief Makes all changes so far durable, compacting the journal if it got too large.
+         *
+         * \throws SpankOlmErrorIO if writing fails.
+         */
+        void commit();
+
+        /**
+         * \brief Writes a new snapshot of the current state and starts an empty journal.
+         *
+         * \throws SpankOlmErrorIO if writing fails.
+         */
+        void compact();
+
+        /**
+         * \brief Returns the number of bytes in the journal.
+         */
+        [[nodiscard]] std::size_t journal_size() const { return journal->size(); }
+
+    protected:
+        /**
+         * \brief Prepares the store without loading it yet.
+         *
+         * \param path The snapshot file.
+         * \param pickle_key The key to encrypt the snapshot and the journal with.
+         * \param compact_threshold The journal size in bytes at which commit() compacts.
+         */
+        JournaledState(std::filesystem::path path, std::string_view pickle_key, std::size_t compact_threshold);
+
+        /**
+         * \brief Writes a snapshot as the first generation of a new store.
+         *
+         * \throws SpankOlmErrorIO if the snapshot can't be written.
+         */
+        static void create(std::filesystem::path const &path, std::string_view encrypted);
+
+        /**
+         * \brief Loads the snapshot and replays the journal. Called by the constructors of derived classes.
+         *
+         * \throws SpankOlmErrorIO if the snapshot can't be read.
+         * \throws SpankOlmErrorCorruptedPickle if the snapshot or the journal is corrupted.
+         */
+        void load();
+
+        /**
+         * \brief Appends a change record to the journal.
+         */
+        void record(std::uint8_t type, std::span<const std::uint8_t> payload) { journal->append(type, payload); }
+
+        /**
+         * \brief Returns the encrypted pickle of the current state.
+         */
+        [[nodiscard]] virtual std::string snapshot(PickleCipher &cipher) const = 0;
+
+        /**
+         * \brief Replaces the current state with an encrypted pickle.
+         */
+        virtual void restore(PickleCipher &cipher, std::string_view encrypted) = 0;
+
+        /**
+         * \brief Applies a change record to the current state.
+         *
+         * \throws SpankOlmErrorCorruptedPickle if the record is invalid.
+         */
+        virtual void apply(std::uint8_t type, std::span<const std::uint8_t> payload) = 0;
+
+    private:
+        std::filesystem::path path;
+        Botan::secure_vector<std::uint8_t> pickle_key;
+        PickleCipher cipher;
+        std::size_t compact_threshold;
+        std::unique_ptr<Journal> journal;
+    };
+
+    /**
+     * \brief An account whose changes are persisted through a journal.
+     *
+     * The methods mirror the ones of Account and record each change as it is made. None of them touch the disk; call
+     * commit() to make the changes durable, e.g. once per handled request. An AccountJournal must not be used from
+     * several threads at once.
+     */
+    class AccountJournal final : public JournaledState
+    {
+    public:
+        /**
+         * \brief Opens a stored account.
+         *
+         * \param path The snapshot file written by create().
+         * \param pickle_key The key the account is encrypted with.
+         * \param compact_threshold The journal size in bytes at which commit() compacts.
+         */
+        AccountJournal(std::filesystem::path path, std::string_view pickle_key,
+                       std::size_t compact_threshold = JOURNAL_COMPACT_THRESHOLD);
+
+        /**
+         * \brief Stores a new account.
+         */
+        static void create(std::filesystem::path const &path, std::string_view pickle_key, Account const &account);
+
+        /**
+         * \brief Returns the current state of the account.
+         */
+        [[nodiscard]] Account const &account() const { return state; }
+
+        /**
+         * \brief See Account::generate_one_time_keys().
+         */
+        void generate_one_time_keys(Botan::RandomNumberGenerator &rng, std::size_t number_of_keys);
+
+        /**
+         * \brief See Account::generate_fallback_key().
+         */
+        void generate_fallback_key(Botan::RandomNumberGenerator &rng);
+
+        /**
+         * \brief See Account::mark_keys_as_published().
+         */
+        std::size_t mark_keys_as_published();
+
+        /**
+         * \brief See Account::forget_old_fallback_key().
+         */
+        void forget_old_fallback_key();
+
+        /**
+         * \brief See Account::remove_key().
+         */
+        void remove_key(Botan::Public_Key const &key);
+
+    private:
+        [[nodiscard]] std::string snapshot(PickleCipher &cipher) const override;
+        void restore(PickleCipher &cipher, std::string_view encrypted) override;
+        void apply(std::uint8_t type, std::span<const std::uint8_t> payload) override;
+
+        Account state;
+    };
+
+    /**
+     * \brief A megolm ratchet whose advances are persisted through a journal.
+     *
+     * Every advance is recorded as the new counter. An MegolmJournal must not be used from several threads at once.
+     */
+    class MegolmJournal final : public JournaledState
+    {
+    public:
+        /**
+         * \brief Opens a stored ratchet.
+         *
+         * \param path The snapshot file written by create().
+         * \param pickle_key The key the ratchet is encrypted with.
+         * \param compact_threshold The journal size in bytes at which commit() compacts.
+         */
+        MegolmJournal(std::filesystem::path path, std::string_view pickle_key,
+                      std::size_t compact_threshold = JOURNAL_COMPACT_THRESHOLD);
+
+        /**
+         * \brief Stores a new ratchet.
+         */
+        static void create(std::filesystem::path const &path, std::string_view pickle_key, Megolm const &megolm);
+
+        /**
+         * \brief Returns the current state of the ratchet.
+         */
+        [[nodiscard]] Megolm const &megolm() const { return state; }
+
+        /**
+         * \brief See Megolm::advance().
+         */
+        void advance();
+
+        /**
+         * \brief See Megolm::advance(unsigned int).
+         */
+        void advance(unsigned int advance_to);
+
+    private:
+        [[nodiscard]] std::string snapshot(PickleCipher &cipher) const override;
+        void restore(PickleCipher &cipher, std::string_view encrypted) override;
+        void apply(std::uint8_t type, std::span<const std::uint8_t> payload) override;
+
+        Megolm state{};
+    };
+} // namespace spank_olm
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace spank_olm
+{
+    /**
+     * \brief Receives the raw name and value of a field, and returns true to stop at it.
+     */
+    using JsonFieldVisitor = std::function<bool(std::string_view name, std::string_view value)>;
+
+    /**
+     * \brief Visits the top level fields of a JSON object in order, without parsing their values.
+     *
+     * \param json The JSON object.
+     * \param visit The function to call for every field, until it returns true.
+     * \throws SpankOlmErrorBadMessageFormat if the JSON is malformed.
+     */
+    void for_each_json_field(std::string_view json, JsonFieldVisitor const &visit);
+
+    /**
+     * \brief Finds the value of a top level field of a JSON object without parsing the rest of it.
+     *
+     * Only the structure needed to skip the other fields is checked.
+     *
+     * \param json The JSON object.
+     * \param key The name of the field.
+     * \return The raw text of the value, e.g. an object including its braces or a string including its quotes.
+     * \throws SpankOlmErrorBadMessageFormat if the JSON is malformed or the field is missing.
+     */
+    [[nodiscard]] std::string_view find_json_value(std::string_view json, std::string_view key);
+
+    /**
+     * \brief Finds the string value of a top level field of a JSON object without parsing the rest of it.
+     *
+     * \param json The JSON object.
+     * \param key The name of the field.
+     * \return The raw value between the quotes, with its escapes left as they are.
+     * \throws SpankOlmErrorBadMessageFormat if the JSON is malformed, the field is missing or isn't a string.
+     */
+    [[nodiscard]] std::string_view find_json_string(std::string_view json, std::string_view key);
+
+    /**
+     * \brief Resolves the escapes of a raw JSON string value into a caller provided buffer.
+     *
+     * \param raw The value between the quotes.
+     * \param output The buffer to write the UTF-8 text to. raw.size() characters are always enough.
+     * \return The number of characters written.
+     * \throws SpankOlmErrorBadMessageFormat if an escape is invalid or the buffer is too small.
+     */
+    std::size_t unescape_json_string(std::string_view raw, std::span<char> output);
+
+    /**
+     * \brief Resolves the escapes of a raw JSON string value.
+     *
+     * \throws SpankOlmErrorBadMessageFormat if an escape is invalid.
+     */
+    [[nodiscard]] std::string unescape_json_string(std::string_view raw);
+
+    /**
+     * \brief Appends text as a quoted JSON string.
+     *
+     * Only quotes, backslashes and control characters are escaped, the short forms are used where JSON has them.
+     */
+    void append_json_string(std::string &json, std::string_view text);
+} // namespace spank_olm
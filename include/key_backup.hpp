@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "megolm.hpp"
+#include "pk_encryption.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::uint8_t SESSION_EXPORT_VERSION(1); ///< The version byte of an exported Megolm session.
+    constexpr std::size_t ED25519_PUBLIC_KEY_LENGTH(32); ///< The length of an Ed25519 public key in bytes.
+
+    /**
+     * \brief The length of an exported Megolm session: version, message index, ratchet and signing key.
+     */
+    constexpr std::size_t SESSION_EXPORT_LENGTH(1 + 4 + MEGOLM_RATCHET_LENGTH + ED25519_PUBLIC_KEY_LENGTH);
+
+    /**
+     * \brief The secret part of an inbound Megolm session, as it is shared in backups and forwarded room keys.
+     */
+    struct RoomKey
+    {
+        Megolm ratchet; ///< The ratchet at the first message index the key can decrypt.
+        std::array<std::uint8_t, ED25519_PUBLIC_KEY_LENGTH> signing_key; ///< The key the messages are signed with.
+
+        /**
+         * \brief Decodes a session key in libolm's export format.
+         *
+         * \param session_key The base64 encoded session key.
+         * \throws SpankOlmErrorInvalidBase64 if the key isn't valid base64.
+         * \throws SpankOlmErrorBadMessageVersion if the key has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the key has the wrong length.
+         */
+        [[nodiscard]] static RoomKey decode(std::string_view session_key);
+
+        /**
+         * \brief Encodes the key in libolm's export format.
+         *
+         * \return The unpadded base64 encoded session key.
+         */
+        [[nodiscard]] std::string encode() const;
+    };
+
+    /**
+     * \brief Decodes the session_key field of a JSON object, as in backups, forwarded room keys and key exports.
+     *
+     * The key is only copied into a fixed buffer on the stack, which is scrubbed afterwards.
+     *
+     * \param json The JSON object.
+     * \throws SpankOlmErrorBadMessageFormat if the JSON is malformed or the field is missing.
+     * \throws SpankOlmException for the errors of RoomKey::decode().
+     */
+    [[nodiscard]] RoomKey decode_session_key_field(std::string_view json);
+
+    /**
+     * \brief The outcome of restoring one room key of a backup.
+     */
+    struct RestoredRoomKey
+    {
+        RoomKey key; ///< The restored key.
+        std::exception_ptr error; ///< The exception decrypting or decoding threw, if any.
+
+        /**
+         * \brief Returns whether the key was restored.
+         */
+        [[nodiscard]] bool ok() const { return !error; }
+    };
+
+    /**
+     * \brief Restores the room keys of a server-side key backup in the m.megolm_backup.v1.curve25519-aes-sha2 format.
+     *
+     * The session data is decrypted on the pool with PkDecryption::decrypt_each(). Each worker takes the session key
+     * straight out of its decrypted buffer and decodes it into a Megolm ratchet, so no JSON document or string is
+     * built for a key.
+     *
+     * \param decryption The decryption with the private key of the backup.
+     * \param session_data The encrypted session data of the backed up sessions.
+     * \param pool The pool to decrypt on.
+     * \return One result per session, in the same order. A session which fails to restore is reported in its result
+     * and doesn't affect the others.
+     */
+    [[nodiscard]] std::vector<RestoredRoomKey> restore_key_backup(PkDecryption const &decryption,
+                                                                  std::span<const PkMessage> session_data,
+                                                                  ThreadPool &pool);
+} // namespace spank_olm
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <botan/rng.h>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "key_backup.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::uint32_t KEY_EXPORT_ROUNDS(500000); ///< The default number of PBKDF2 rounds of a key export.
+    /**
+     * \brief The most PBKDF2 rounds a key export may ask for.
+     *
+     * The round count is read from the file, so without a limit a crafted export could keep an import busy for hours.
+     */
+    constexpr std::uint32_t MAX_KEY_EXPORT_ROUNDS(10000000);
+    constexpr std::size_t KEY_EXPORT_CHUNK_SIZE(256); ///< The default number of sessions a worker handles at once.
+    constexpr std::size_t MAX_KEY_EXPORT_ENTRY_LENGTH(65536); ///< The longest JSON object of one session imported.
+
+    /**
+     * \brief A Megolm session as it is stored in a key export file.
+     */
+    struct ExportedSession
+    {
+        std::string room_id; ///< The room the session belongs to.
+        std::string session_id; ///< The ID of the session.
+        std::string sender_key; ///< The Curve25519 key of the device which created the session.
+        std::string sender_claimed_ed25519_key; ///< The Ed25519 key that device claims to have.
+        RoomKey key; ///< The ratchet and signing key.
+    };
+
+    /**
+     * \brief The outcome of importing one session of a key export.
+     */
+    struct ImportedSession
+    {
+        ExportedSession session; ///< The imported session.
+        std::exception_ptr error; ///< The exception decoding the session threw, if any.
+
+        /**
+         * \brief Returns whether the session was imported.
+         */
+        [[nodiscard]] bool ok() const { return !error; }
+    };
+
+    /**
+     * \brief Receives the sessions of an import, one chunk at a time, in the order of the file.
+     *
+     * The span is only valid during the call, but the sessions may be moved out of it.
+     */
+    using KeyImportSink = std::function<void(std::span<ImportedSession> sessions)>;
+
+    /**
+     * \brief Provides the sessions to export one at a time.
+     *
+     * \return Whether a session was written to the argument, false once there are no more.
+     */
+    using KeyExportSource = std::function<bool(ExportedSession &session)>;
+
+    /**
+     * \brief Imports a Megolm key export file, like the ones Element writes, in constant memory.
+     *
+     * The file is read twice. The first pass only checks the MAC, so nothing is handed out from a file which was
+     * tampered with or encrypted with another passphrase. It also records a hash of every 64 KiB of ciphertext. The
+     * second pass decrypts the file segment by segment, each only once its hash matches, so nothing is handed out
+     * which the MAC didn't cover, even if the file is changed between the passes. The decrypted JSON array is split
+     * into the objects of the sessions as the text arrives. The objects are decoded in chunks on the pool, and the
+     * decoded chunks are passed to the sink on the calling thread, in order. At most two chunks per worker thread are
+     * held at once, so apart from the 32 bytes of hash per 64 KiB of file, memory use doesn't grow with the size of
+     * the file.
+     *
+     * A session which fails to decode, e.g. because of an unknown algorithm, is reported in its result and doesn't
+     * affect the others.
+     *
+     * \param input The file. It has to be seekable, as it is read twice.
+     * \param passphrase The passphrase the file was exported with.
+     * \param pool The pool to decode the sessions on.
+     * \param sink The function receiving the sessions.
+     * \param chunk_size The number of sessions per chunk.
+     * \throws SpankOlmErrorBadKeyExport if the file isn't a key export, asks for more than
+     * MAX_KEY_EXPORT_ROUNDS, or its JSON is malformed.
+     * \throws SpankOlmErrorBadMessageVersion if the file has an unsupported version.
+     * \throws SpankOlmErrorInvalidBase64 if the file isn't valid base64.
+     * \throws SpankOlmErrorBadMessageMac if the passphrase is wrong or the file was changed.
+     * \throws SpankOlmErrorIO if the file can't be read twice.
+     * \throws Rethrows what the sink throws, after the chunks still being decoded have finished.
+     */
+    void import_keys(std::istream &input, std::string_view passphrase, ThreadPool &pool, KeyImportSink const &sink,
+                     std::size_t chunk_size = KEY_EXPORT_CHUNK_SIZE);
+
+    /**
+     * \brief Writes a Megolm key export file in constant memory.
+     *
+     * This is the import pipeline in reverse: the sessions are pulled from the source in chunks on the calling thread,
+     * encoded as JSON on the pool, and encrypted, authenticated and written to the file in order as their chunks are
+     * done. At most two chunks per worker thread are held at once.
+     *
+     * \param output The stream to write the file to.
+     * \param rng The botan random number generator to use for the salt and IV.
+     * \param passphrase The passphrase to encrypt the file with.
+     * \param source The function providing the sessions.
+     * \param pool The pool to encode the sessions on.
+     * \param rounds The number of PBKDF2 rounds to derive the keys from the passphrase with.
+     * \param chunk_size The number of sessions per chunk.
+     * \throws SpankOlmErrorBadKeyExport if rounds is zero or above MAX_KEY_EXPORT_ROUNDS.
+     * \throws SpankOlmErrorIO if writing fails.
+     * \throws Rethrows what the source throws, after the chunks still being encoded have finished.
+     */
+    void export_keys(std::ostream &output, Botan::RandomNumberGenerator &rng, std::string_view passphrase,
+                     KeyExportSource const &source, ThreadPool &pool, std::uint32_t rounds = KEY_EXPORT_ROUNDS,
+                     std::size_t chunk_size = KEY_EXPORT_CHUNK_SIZE);
+} // namespace spank_olm
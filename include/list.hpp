@@ -1,55 +1,97 @@
 #pragma once
 #include <cstddef>
+#include <functional>
 #include <iostream>
-#include <utility>
+#include <iterator>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 namespace spank_olm
 {
-    // Possibly should be replaced by implace_vector. For example https://godbolt.org/z/5P78aG5xE
-
     /**
      * \brief A fixed-size array implementation.
      *
+     * The elements live inline in a ring buffer, newest first. Inserting at the front and evicting the oldest element
+     * when full are O(1) and no element is ever heap allocated by the container itself.
+     *
+     * Elements are created with uses-allocator construction, so allocator-aware element types (for example
+     * std::pmr::string or std::pmr::vector) draw their memory from the allocator of the array. Like the std::pmr
+     * containers the allocator is not propagated on assignment.
+     *
      * \tparam T The type of elements stored in the array.
      * \tparam max_size The maximum number of elements the array can hold.
+     * \tparam Allocator The allocator passed on to the elements, e.g. std::pmr::polymorphic_allocator<T>.
      */
-    template <typename T, std::size_t max_size>
+    template <typename T, std::size_t max_size, typename Allocator = std::allocator<T>>
     class FixedSizeArray
     {
+        static_assert(max_size > 0, "FixedSizeArray needs room for at least one element");
+
+        using allocator_traits = std::allocator_traits<Allocator>;
+
     public:
+        using allocator_type = Allocator;
+
         /**
          * \brief Constructs an empty FixedSizeArray.
          */
-        FixedSizeArray() : current_size(0)
+        FixedSizeArray() : FixedSizeArray(allocator_type()) {}
+
+        /**
+         * \brief Constructs an empty FixedSizeArray using the given allocator for its elements.
+         *
+         * \param allocator The allocator to pass on to the elements.
+         */
+        explicit FixedSizeArray(const allocator_type &allocator) : allocator(allocator), head(0), current_size(0) {}
+
+        /**
+         * \brief Copy constructor.
+         *
+         * \param other The FixedSizeArray to copy from.
+         */
+        FixedSizeArray(const FixedSizeArray &other) :
+            FixedSizeArray(other, allocator_traits::select_on_container_copy_construction(other.allocator))
         {
-            data = std::make_unique<T*[]>(max_size + 1);
         }
 
         /**
-         * \brief Copy constructor.
+         * \brief Copy constructor using the given allocator for the new elements.
          *
          * \param other The FixedSizeArray to copy from.
+         * \param allocator The allocator to pass on to the elements.
          */
-        FixedSizeArray(const FixedSizeArray& other)
-            : current_size(other.current_size)
+        FixedSizeArray(const FixedSizeArray &other, const allocator_type &allocator) :
+            allocator(allocator), head(0), current_size(0)
         {
-            data = std::make_unique<T*[]>(max_size + 1);
             for (std::size_t i = 0; i < other.current_size; ++i)
             {
-                data[i] = new T(*other.data[i]);
+                construct(slot(i), other[i]);
+                ++current_size;
             }
         }
 
-
         /**
-         * \brief Destroys the FixedSizeArray and frees allocated memory.
+         * \brief Move constructor.
+         *
+         * \param other The FixedSizeArray to move from. It is left empty.
          */
-        ~FixedSizeArray()
+        FixedSizeArray(FixedSizeArray &&other) noexcept(std::is_nothrow_move_constructible_v<T>) :
+            allocator(other.allocator), head(0), current_size(0)
         {
-            clear();
+            for (std::size_t i = 0; i < other.current_size; ++i)
+            {
+                construct(slot(i), std::move(other[i]));
+                ++current_size;
+            }
+            other.clear();
         }
 
+        /**
+         * \brief Destroys the FixedSizeArray and its elements.
+         */
+        ~FixedSizeArray() { clear(); }
+
         // Error codes
         enum ErrorCode
         {
@@ -60,47 +102,58 @@ namespace spank_olm
         /**
          * \brief Inserts a value at the beginning of the array.
          *
+         * If the array is full the oldest element is dropped. Both steps are O(1).
+         *
          * \param value The value to insert.
          * \return ErrorCode indicating the result of the operation.
          */
-        constexpr ErrorCode insert(const T& value)
-        {
-            return insert_at(0, value);
-        }
+        constexpr ErrorCode insert(const T &value) { return insert_at(0, value); }
 
         /**
          * \brief Inserts a value at a specified index in the array.
          *
+         * If the array is full the last (oldest) element is dropped first.
+         *
          * \param index The index at which to insert the value.
          * \param value The value to insert.
          * \return ErrorCode indicating the result of the operation.
          */
-        constexpr ErrorCode insert_at(std::size_t index, const T& value)
+        constexpr ErrorCode insert_at(std::size_t index, const T &value)
         {
             if (index > current_size)
             {
                 return INDEX_OUT_OF_RANGE;
             }
-            if (current_size < max_size)
+            if (current_size == max_size)
             {
-                // Shift elements to the right
-                for (std::size_t i = current_size; i > index; --i)
+                if (index == max_size)
                 {
-                    data[i] = std::move(data[i - 1]);
+                    // The new element would be the oldest one, so it is dropped straight away.
+                    return SUCCESS;
+                }
+                std::destroy_at(element(current_size - 1));
+                --current_size;
+            }
+
+            if (index < current_size / 2)
+            {
+                // Move the front part one slot towards the front.
+                head = head == 0 ? max_size - 1 : head - 1;
+                for (std::size_t i = 0; i < index; ++i)
+                {
+                    relocate(element(i + 1), element(i));
                 }
-                data[index] = new T(value);
-                ++current_size;
             }
             else
             {
-                // Drop the last element and shift others to the right
-                delete data[max_size - 1];
-                for (std::size_t i = max_size - 1; i > index; --i)
+                // Move the back part one slot towards the back.
+                for (std::size_t i = current_size; i > index; --i)
                 {
-                    data[i] = std::move(data[i - 1]);
+                    relocate(element(i - 1), element(i));
                 }
-                data[index] = new T(value);
             }
+            construct(element(index), value);
+            ++current_size;
 
             return SUCCESS;
         }
@@ -120,12 +173,7 @@ namespace spank_olm
             {
                 return INDEX_OUT_OF_RANGE;
             }
-            delete data[index];
-            for (std::size_t i = index; i < current_size - 1; ++i)
-            {
-                data[i] = std::move(data[i + 1]);
-            }
-            --current_size;
+            remove(index);
             return SUCCESS;
         }
 
@@ -135,16 +183,22 @@ namespace spank_olm
          * \param ptr The pointer to the element to erase.
          * \return ErrorCode indicating the result of the operation.
          */
-        constexpr ErrorCode erase(T* const ptr)
+        constexpr ErrorCode erase(T *const ptr)
         {
-            for (std::size_t i = 0; i < current_size; ++i)
+            // Elements never move between slots on their own, so the slot tells us the position in O(1).
+            const std::less<const T *> less;
+            if (ptr == nullptr || less(ptr, slot(0)) || !less(ptr, slot(0) + max_size))
             {
-                if (data[i] == ptr)
-                {
-                    return erase_at(i);
-                }
+                return INDEX_OUT_OF_RANGE;
             }
-            return INDEX_OUT_OF_RANGE;
+            const auto physical = static_cast<std::size_t>(ptr - slot(0));
+            const std::size_t index = physical >= head ? physical - head : physical + max_size - head;
+            if (index >= current_size)
+            {
+                return INDEX_OUT_OF_RANGE;
+            }
+            remove(index);
+            return SUCCESS;
         }
 
         /**
@@ -153,10 +207,7 @@ namespace spank_olm
          * \param index The index of the element to access.
          * \return A reference to the element at the specified index.
          */
-        constexpr T& operator[](std::size_t index)
-        {
-            return *data[index];
-        }
+        constexpr T &operator[](std::size_t index) { return *element(index); }
 
         /**
          * \brief Accesses the element at a specified index (const version).
@@ -164,10 +215,7 @@ namespace spank_olm
          * \param index The index of the element to access.
          * \return A const reference to the element at the specified index.
          */
-        constexpr const T& operator[](std::size_t index) const
-        {
-            return *data[index];
-        }
+        constexpr const T &operator[](std::size_t index) const { return *element(index); }
 
         /**
          * \brief Assigns the contents of another FixedSizeArray to this one.
@@ -175,87 +223,218 @@ namespace spank_olm
          * \param other The FixedSizeArray to copy from.
          * \return A reference to this FixedSizeArray.
          */
-        constexpr FixedSizeArray& operator=(const FixedSizeArray& other)
+        constexpr FixedSizeArray &operator=(const FixedSizeArray &other)
         {
             if (this != &other)
             {
                 clear();
-                data = std::make_unique<T*[]>(max_size);
                 for (std::size_t i = 0; i < other.current_size; ++i)
                 {
-                    data[i] = new T(*other.data[i]);
+                    construct(slot(i), other[i]);
+                    ++current_size;
                 }
-                current_size = other.current_size;
             }
             return *this;
         }
 
         /**
-         * \brief Returns the number of elements in the array.
+         * \brief Moves the contents of another FixedSizeArray into this one.
          *
-         * \return The number of elements in the array.
+         * \param other The FixedSizeArray to move from. It is left empty.
+         * \return A reference to this FixedSizeArray.
          */
-        [[nodiscard]] constexpr std::size_t size() const
+        constexpr FixedSizeArray &operator=(FixedSizeArray &&other) noexcept(std::is_nothrow_move_constructible_v<T>)
         {
-            return current_size;
+            if (this != &other)
+            {
+                clear();
+                for (std::size_t i = 0; i < other.current_size; ++i)
+                {
+                    construct(slot(i), std::move(other[i]));
+                    ++current_size;
+                }
+                other.clear();
+            }
+            return *this;
         }
 
+        /**
+         * \brief Returns the number of elements in the array.
+         *
+         * \return The number of elements in the array.
+         */
+        [[nodiscard]] constexpr std::size_t size() const { return current_size; }
+
         /**
          * \brief Checks if the array is empty.
          *
          * \return True if the array is empty, false otherwise.
          */
-        [[nodiscard]] constexpr bool empty() const
+        [[nodiscard]] constexpr bool empty() const { return current_size == 0; }
+
+        /**
+         * \brief Returns the allocator passed on to the elements.
+         *
+         * \return A copy of the allocator.
+         */
+        [[nodiscard]] constexpr allocator_type get_allocator() const { return allocator; }
+
+        /**
+         * \brief Iterates the elements newest first.
+         *
+         * Dereferencing yields a pointer to the element, which can be passed to erase().
+         *
+         * \tparam Owner The (possibly const) FixedSizeArray type.
+         * \tparam Pointer The pointer type yielded on dereference.
+         */
+        template <typename Owner, typename Pointer>
+        class basic_iterator
         {
-            return current_size == 0;
-        }
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Pointer;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = Pointer;
+
+            constexpr basic_iterator() = default;
+            constexpr basic_iterator(Owner *owner, const std::size_t index) : owner(owner), index(index) {}
+
+            constexpr Pointer operator*() const { return owner->element(index); }
+
+            constexpr basic_iterator &operator++()
+            {
+                ++index;
+                return *this;
+            }
+
+            constexpr basic_iterator operator++(int)
+            {
+                auto previous = *this;
+                ++index;
+                return previous;
+            }
+
+            constexpr bool operator==(const basic_iterator &other) const = default;
+
+        private:
+            Owner *owner = nullptr;
+            std::size_t index = 0;
+        };
 
         // Iterator support
-        using iterator = T**;
-        using const_iterator = const T**;
+        using iterator = basic_iterator<FixedSizeArray, T *>;
+        using const_iterator = basic_iterator<const FixedSizeArray, const T *>;
 
         /**
          * \brief Returns an iterator to the beginning of the array.
          *
          * \return An iterator to the beginning of the array.
          */
-        constexpr iterator begin() { return data.get(); }
+        constexpr iterator begin() { return {this, 0}; }
 
         /**
          * \brief Returns a const iterator to the beginning of the array.
          *
          * \return A const iterator to the beginning of the array.
          */
-        constexpr const_iterator begin() const { return const_cast<const_iterator>(data.get()); }
+        constexpr const_iterator begin() const { return {this, 0}; }
 
         /**
          * \brief Returns an iterator to the end of the array.
          *
          * \return An iterator to the end of the array.
          */
-        constexpr iterator end() { return data.get() + current_size; }
+        constexpr iterator end() { return {this, current_size}; }
 
         /**
          * \brief Returns a const iterator to the end of the array.
          *
          * \return A const iterator to the end of the array.
          */
-        constexpr const_iterator end() const { return const_cast<const_iterator>(data.get() + current_size); }
+        constexpr const_iterator end() const { return {this, current_size}; }
 
     private:
         /**
-         * \brief Clears the array and frees allocated memory.
+         * \brief Clears the array and destroys its elements.
          */
         void clear()
         {
             for (std::size_t i = 0; i < current_size; ++i)
             {
-                delete data[i];
+                std::destroy_at(element(i));
             }
+            head = 0;
             current_size = 0;
         }
 
-        std::unique_ptr<T*[]> data; ///< Pointer to the array data.
+        /**
+         * \brief Removes the element at the given position, closing the gap from the shorter side.
+         */
+        constexpr void remove(const std::size_t index)
+        {
+            std::destroy_at(element(index));
+            if (index < current_size / 2)
+            {
+                for (std::size_t i = index; i > 0; --i)
+                {
+                    relocate(element(i - 1), element(i));
+                }
+                head = head + 1 == max_size ? 0 : head + 1;
+            }
+            else
+            {
+                for (std::size_t i = index + 1; i < current_size; ++i)
+                {
+                    relocate(element(i), element(i - 1));
+                }
+            }
+            --current_size;
+        }
+
+        /**
+         * \brief Creates an element in an empty slot using uses-allocator construction.
+         */
+        template <typename... Args>
+        void construct(T *to, Args &&...args)
+        {
+            std::uninitialized_construct_using_allocator(to, allocator, std::forward<Args>(args)...);
+        }
+
+        /**
+         * \brief Moves the element at from into the empty slot at to.
+         */
+        void relocate(T *from, T *to)
+        {
+            construct(to, std::move(*from));
+            std::destroy_at(from);
+        }
+
+        /**
+         * \brief Returns the storage slot with the given physical position.
+         */
+        T *slot(const std::size_t physical) { return reinterpret_cast<T *>(storage) + physical; }
+
+        const T *slot(const std::size_t physical) const { return reinterpret_cast<const T *>(storage) + physical; }
+
+        /**
+         * \brief Returns the storage slot of the element with the given position in the array.
+         */
+        T *element(const std::size_t index)
+        {
+            const std::size_t physical = head + index;
+            return slot(physical >= max_size ? physical - max_size : physical);
+        }
+
+        const T *element(const std::size_t index) const
+        {
+            const std::size_t physical = head + index;
+            return slot(physical >= max_size ? physical - max_size : physical);
+        }
+
+        [[no_unique_address]] allocator_type allocator; ///< The allocator passed on to the elements.
+        alignas(T) std::byte storage[sizeof(T) * max_size]; ///< Inline storage for the elements.
+        std::size_t head; ///< The slot of the first (newest) element.
         std::size_t current_size; ///< The current number of elements in the array.
     };
-}
+} // namespace spank_olm
@@ -1,6 +1,9 @@
 #pragma once
 #include <array>
 #include <botan/rng.h>
+#include <string>
+
+#include "pickle_encryption.hpp"
 
 /**
  * number of bytes in each part of the ratchet; this should be the same as
@@ -40,11 +43,29 @@ namespace spank_olm
          */
         std::uint8_t *pickle(std::uint8_t *pos) const;
 
+        /**
+         * \brief Pickle and encrypt the megolm in one pass.
+         *
+         * \param cipher The cipher holding the key schedule of the pickle key.
+         * \return The encrypted and base64 encoded megolm.
+         */
+        [[nodiscard]] std::string pickle(PickleCipher &cipher) const;
+
         /**
          * \brief Unpickle the megolm.
          */
         std::uint8_t const *unpickle(std::uint8_t const *pos, const std::uint8_t *end);
 
+        /**
+         * \brief Decrypt and unpickle the megolm.
+         *
+         * \param cipher The cipher holding the key schedule of the pickle key.
+         * \param encrypted The encrypted and base64 encoded megolm.
+         * \throws SpankOlmErrorBadAccountKey if the megolm was encrypted with a different key.
+         * \throws SpankOlmErrorCorruptedPickle if the pickle is invalid.
+         */
+        void unpickle(PickleCipher &cipher, std::string_view encrypted);
+
         /**
          * \brief Advance the megolm ratchet by one step.
          */
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace spank_olm
+{
+    constexpr std::size_t CURVE25519_KEY_LENGTH(32); ///< The length of a Curve25519 key in bytes.
+    constexpr std::uint8_t MESSAGE_PROTOCOL_VERSION(3); ///< The version byte of Olm and Megolm messages.
+    constexpr std::size_t MESSAGE_MAC_LENGTH(8); ///< The length of the truncated MAC at the end of a message.
+    constexpr std::size_t GROUP_MESSAGE_SIGNATURE_LENGTH(64); ///< The length of the signature of a group message.
+
+    /**
+     * \brief The length of the start of a pre-key message which holds its keys, if they are encoded first.
+     */
+    constexpr std::size_t PRE_KEY_MESSAGE_KEYS_LENGTH(1 + 3 * (2 + CURVE25519_KEY_LENGTH));
+
+    /**
+     * \brief A decoded Olm message.
+     *
+     * Olm and Megolm messages consist of a version byte followed by protobuf style fields: a varint tag holding the
+     * field number and wire type, then either a varint value or a varint length and that many bytes. Unknown fields
+     * are skipped. Decoding never copies: all spans point into the encoded message.
+     */
+    struct MessageView
+    {
+        std::span<const std::uint8_t> ratchet_key; ///< The Curve25519 ratchet key of the sender.
+        std::uint32_t counter = 0; ///< The index of the message in its chain.
+        std::span<const std::uint8_t> ciphertext; ///< The AES-256-CBC encrypted payload.
+        std::span<const std::uint8_t> authenticated; ///< The part of the message the MAC covers.
+        std::span<const std::uint8_t> mac; ///< The truncated MAC.
+
+        /**
+         * \brief Decodes a message.
+         *
+         * \param message The encoded message. It has to outlive the view.
+         * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+         */
+        static MessageView decode(std::span<const std::uint8_t> message);
+    };
+
+    /**
+     * \brief A decoded Olm pre-key message, which wraps a MessageView with the keys of a new session.
+     */
+    struct PreKeyMessageView
+    {
+        std::span<const std::uint8_t> one_time_key; ///< The one-time or fallback key of the receiver.
+        std::span<const std::uint8_t> base_key; ///< The ephemeral key of the sender.
+        std::span<const std::uint8_t> identity_key; ///< The Curve25519 identity key of the sender.
+        std::span<const std::uint8_t> message; ///< The encoded message inside.
+
+        /**
+         * \brief Decodes a pre-key message.
+         *
+         * \param message The encoded message. It has to outlive the view.
+         * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+         */
+        static PreKeyMessageView decode(std::span<const std::uint8_t> message);
+
+        /**
+         * \brief Decodes the keys from the first PRE_KEY_MESSAGE_KEYS_LENGTH bytes of a pre-key message.
+         *
+         * \return The keys, with an empty message, or nothing if the keys aren't encoded first.
+         */
+        static std::optional<PreKeyMessageView> decode_keys(std::span<const std::uint8_t> start);
+    };
+
+    /**
+     * \brief A decoded Megolm group message.
+     */
+    struct GroupMessageView
+    {
+        std::uint32_t message_index = 0; ///< The index of the ratchet the message was encrypted with.
+        std::span<const std::uint8_t> ciphertext; ///< The AES-256-CBC encrypted payload.
+        std::span<const std::uint8_t> authenticated; ///< The part of the message the MAC covers.
+        std::span<const std::uint8_t> mac; ///< The truncated MAC.
+        std::span<const std::uint8_t> signed_part; ///< The part of the message the signature covers.
+        std::span<const std::uint8_t> signature; ///< The Ed25519 signature of the sender.
+
+        /**
+         * \brief Decodes a group message.
+         *
+         * \param message The encoded message. It has to outlive the view.
+         * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+         */
+        static GroupMessageView decode(std::span<const std::uint8_t> message);
+    };
+
+    /**
+     * \brief Returns the length of an encoded Olm message, including its MAC.
+     */
+    [[nodiscard]] std::size_t message_length(std::uint32_t counter, std::size_t ciphertext_length);
+
+    /**
+     * \brief Returns the length of an encoded pre-key message wrapping a message of the given length.
+     */
+    [[nodiscard]] std::size_t pre_key_message_length(std::size_t message_length);
+
+    /**
+     * \brief Returns the length of an encoded group message, including its MAC and signature.
+     */
+    [[nodiscard]] std::size_t group_message_length(std::uint32_t message_index, std::size_t ciphertext_length);
+
+    /**
+     * \brief Encodes everything of an Olm message up to its ciphertext.
+     *
+     * The ciphertext_length bytes of ciphertext and then the MAC go right after the returned position.
+     *
+     * \param pos Pointer to the current position in the byte array.
+     * \return Pointer to the position of the ciphertext.
+     */
+    std::uint8_t *encode_message_header(std::uint8_t *pos,
+                                        std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> ratchet_key,
+                                        std::uint32_t counter, std::size_t ciphertext_length);
+
+    /**
+     * \brief Encodes everything of a pre-key message up to the message inside.
+     *
+     * The message_length bytes of the message go right after the returned position.
+     *
+     * \param pos Pointer to the current position in the byte array.
+     * \return Pointer to the position of the message inside.
+     */
+    std::uint8_t *encode_pre_key_message_header(std::uint8_t *pos,
+                                                std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> one_time_key,
+                                                std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> base_key,
+                                                std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> identity_key,
+                                                std::size_t message_length);
+
+    /**
+     * \brief Encodes everything of a group message up to its ciphertext.
+     *
+     * The ciphertext_length bytes of ciphertext, the MAC and then the signature go right after the returned position.
+     *
+     * \param pos Pointer to the current position in the byte array.
+     * \return Pointer to the position of the ciphertext.
+     */
+    std::uint8_t *encode_group_message_header(std::uint8_t *pos, std::uint32_t message_index,
+                                              std::size_t ciphertext_length);
+} // namespace spank_olm
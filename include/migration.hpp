@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "pickle_encryption.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t MIGRATION_BATCH_SIZE(4096); ///< The default number of pickles migrated per batch.
+
+    /**
+     * \brief Upgrades a single encrypted account pickle to ACCOUNT_PICKLE_VERSION and re-encrypts it.
+     *
+     * Pickles which already have the current version are only checked and re-encrypted, without building any keys.
+     *
+     * \param from The cipher of the key the pickle is encrypted with.
+     * \param to The cipher of the key to encrypt the result with. It may be the same key as from.
+     * \param encrypted The encrypted and base64 encoded account pickle.
+     * \param upgraded Set to whether the pickle had an older version.
+     * \return The encrypted and base64 encoded pickle in the current version.
+     * \throws Any exception thrown by PickleCipher::decrypt() or Account::unpickle().
+     */
+    [[nodiscard]] std::string migrate_pickle(PickleCipher &from, PickleCipher &to, std::string_view encrypted,
+                                             bool &upgraded);
+
+    /**
+     * \brief Counters for a running migration.
+     *
+     * The counters are atomic, so another thread may read them while the migration runs.
+     */
+    struct MigrationProgress
+    {
+        std::atomic<std::uint64_t> read{0}; ///< The number of pickles read.
+        std::atomic<std::uint64_t> migrated{0}; ///< The number of pickles written.
+        std::atomic<std::uint64_t> upgraded{0}; ///< The number of written pickles which had an older version.
+        std::atomic<std::uint64_t> failed{0}; ///< The number of pickles which couldn't be migrated.
+    };
+
+    /**
+     * \brief Migrates a stream of encrypted account pickles in parallel.
+     *
+     * The input has one encrypted pickle per line, as written by Account::pickle(PickleCipher &). Each output line
+     * holds the migrated pickle of the same input line, or is empty if that pickle couldn't be migrated, so the
+     * output stays aligned with the input.
+     *
+     * At most two batches are held in memory: the next batch is read while the workers migrate the current one.
+     */
+    class PickleMigrator
+    {
+    public:
+        /**
+         * \brief Called with the line number, starting at 1, and the error of a pickle which couldn't be migrated.
+         */
+        using ErrorHandler = std::function<void(std::uint64_t, std::exception const &)>;
+
+        /**
+         * \brief Called after each batch has been written.
+         */
+        using ProgressHandler = std::function<void(MigrationProgress const &)>;
+
+        /**
+         * \brief Sets up a migration.
+         *
+         * \param from The cipher of the current pickle key. Every worker uses its own copy.
+         * \param to The cipher of the new pickle key. Every worker uses its own copy.
+         * \param pool The pool to run the migration on.
+         * \param batch_size The number of pickles read and migrated at once.
+         */
+        PickleMigrator(PickleCipher const &from, PickleCipher const &to, ThreadPool &pool,
+                       std::size_t batch_size = MIGRATION_BATCH_SIZE);
+
+        /**
+         * \brief Sets the function which is called for every pickle that fails to migrate.
+         */
+        void on_error(ErrorHandler handler) { error_handler = std::move(handler); }
+
+        /**
+         * \brief Sets the function which is called after every batch.
+         */
+        void on_progress(ProgressHandler handler) { progress_handler = std::move(handler); }
+
+        /**
+         * \brief Migrates all pickles from the input to the output.
+         *
+         * \param input The encrypted pickles, one per line.
+         * \param output Receives the migrated pickles, one per line.
+         * \param progress The counters to update.
+         * \throws SpankOlmErrorIO if writing the output fails.
+         */
+        void run(std::istream &input, std::ostream &output, MigrationProgress &progress);
+
+    private:
+        PickleCipher from;
+        PickleCipher to;
+        ThreadPool &pool;
+        std::size_t batch_size;
+        ErrorHandler error_handler;
+        ProgressHandler progress_handler;
+    };
+} // namespace spank_olm
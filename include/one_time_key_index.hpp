@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "account.hpp"
+#include "open_addressing.hpp"
+
+namespace spank_olm
+{
+    /**
+     * \brief A hash index of the public one-time and fallback keys of an account.
+     *
+     * Account::lookup_key() compares the wanted key with every key of the account. The index copies the public keys
+     * into a small open addressing table once, so a lookup costs a single probe. This makes it cheap enough to reject
+     * pre-key messages for unknown keys, e.g. a flood of stale messages after a device restore, before doing any
+     * other work.
+     *
+     * The index points into the account. Rebuild it whenever keys are added to or removed from the account, and when
+     * the account is moved.
+     */
+    class OneTimeKeyIndex
+    {
+    public:
+        /**
+         * \brief Creates an empty index.
+         */
+        OneTimeKeyIndex() = default;
+
+        /**
+         * \brief Indexes the one-time and fallback keys of an account.
+         */
+        explicit OneTimeKeyIndex(Account const &account);
+
+        /**
+         * \brief Replaces the index with the current keys of an account.
+         */
+        void rebuild(Account const &account);
+
+        /**
+         * \brief Looks up a key by its raw Curve25519 public key.
+         *
+         * \return The key, or nullptr if the account has no such key.
+         */
+        [[nodiscard]] OneTimeKey const *find(std::span<const std::uint8_t> public_key) const;
+
+        /**
+         * \brief Returns the number of indexed keys.
+         */
+        [[nodiscard]] std::size_t size() const { return entries.size(); }
+
+    private:
+        struct Entry
+        {
+            std::array<std::uint8_t, 32> public_key;
+            OneTimeKey const *key;
+        };
+
+        void add(OneTimeKey const &key);
+
+        std::vector<Entry> entries;
+        ProbeTable table; ///< Indices into entries, hashed by public key.
+    };
+} // namespace spank_olm
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace spank_olm
+{
+    /**
+     * \brief Hashes a key by its leading bytes.
+     *
+     * The keys hashed in this library are public keys, ratchet keys and digests. They are uniformly random, so their
+     * first bytes are as good a hash as any mixing function would give, and much cheaper. Don't use it for keys an
+     * attacker can choose freely if they can also decide what gets stored.
+     */
+    inline std::size_t leading_bytes_hash(const std::span<const std::uint8_t> key)
+    {
+        std::size_t hash = 0;
+        std::memcpy(&hash, key.data(), std::min(sizeof(hash), key.size()));
+        return hash;
+    }
+
+    /**
+     * \brief leading_bytes_hash() as a hash function object, e.g. for std::unordered_map.
+     */
+    struct LeadingBytesHash
+    {
+        template <typename Key>
+        std::size_t operator()(Key const &key) const noexcept
+        {
+            return leading_bytes_hash(std::span<const std::uint8_t>(key));
+        }
+    };
+
+    /**
+     * \brief Returns the size of an open addressing table for the given number of entries.
+     *
+     * The size is a power of two, so a hash is reduced to a slot with a mask, and the table is kept at most half full,
+     * so probe sequences stay short.
+     */
+    constexpr std::size_t open_addressing_capacity(const std::size_t entries)
+    {
+        std::size_t capacity = 1;
+        while (capacity < 2 * entries)
+        {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    /**
+     * \brief The slots of an open addressing hash table with linear probing, holding indices into the owner's entries.
+     *
+     * The table doesn't store the entries themselves. Lookups and moves ask the owner to compare or hash an entry by
+     * its index, so the entries can live in whatever storage suits the owner, e.g. a preallocated array.
+     */
+    class ProbeTable
+    {
+    public:
+        static constexpr std::uint32_t NONE = 0xffffffff; ///< An empty slot, or no slot found.
+
+        /**
+         * \brief Creates an empty table which holds the given number of entries without growing.
+         */
+        explicit ProbeTable(const std::size_t entries = 0) : slots(open_addressing_capacity(entries), NONE) {}
+
+        /**
+         * \brief Returns the number of entries in the table.
+         */
+        [[nodiscard]] std::size_t size() const { return count; }
+
+        /**
+         * \brief Returns the entry in a slot returned by find().
+         */
+        [[nodiscard]] std::uint32_t operator[](const std::size_t slot) const { return slots[slot]; }
+
+        /**
+         * \brief Removes all entries, keeping the size of the table.
+         */
+        void clear()
+        {
+            std::fill(slots.begin(), slots.end(), NONE);
+            count = 0;
+        }
+
+        /**
+         * \brief Returns the slot of the entry with the given hash for which matches(entry) is true, or NONE.
+         */
+        template <typename Matches>
+        [[nodiscard]] std::size_t find(const std::size_t hash, Matches &&matches) const
+        {
+            if (count == 0)
+            {
+                return NONE;
+            }
+            const auto mask = slots.size() - 1;
+            for (auto slot = hash & mask; slots[slot] != NONE; slot = (slot + 1) & mask)
+            {
+                if (matches(slots[slot]))
+                {
+                    return slot;
+                }
+            }
+            return NONE;
+        }
+
+        /**
+         * \brief Adds an entry, doubling the table first if it would be more than half full.
+         *
+         * \param entry The index of the entry.
+         * \param hash_of Returns the hash of the entry with the given index.
+         */
+        template <typename HashOf>
+        void insert(const std::uint32_t entry, HashOf &&hash_of)
+        {
+            if (2 * (count + 1) > slots.size())
+            {
+                std::vector<std::uint32_t> old(open_addressing_capacity(count + 1), NONE);
+                old.swap(slots);
+                for (const auto moved : old)
+                {
+                    if (moved != NONE)
+                    {
+                        place(moved, hash_of(moved));
+                    }
+                }
+            }
+            place(entry, hash_of(entry));
+            ++count;
+        }
+
+        /**
+         * \brief Removes the entry in a slot returned by find().
+         *
+         * Later entries of the probe sequence move back into the gap (backward shift deletion), so lookups never need
+         * tombstones.
+         *
+         * \param slot The slot to empty.
+         * \param hash_of Returns the hash of the entry with the given index.
+         */
+        template <typename HashOf>
+        void erase(std::size_t slot, HashOf &&hash_of)
+        {
+            const auto mask = slots.size() - 1;
+            slots[slot] = NONE;
+            --count;
+            for (auto next = (slot + 1) & mask; slots[next] != NONE; next = (next + 1) & mask)
+            {
+                const auto home = hash_of(slots[next]) & mask;
+                // The entry may only move back if its home slot isn't cyclically within (slot, next].
+                const auto stays = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+                if (!stays)
+                {
+                    slots[slot] = slots[next];
+                    slots[next] = NONE;
+                    slot = next;
+                }
+            }
+        }
+
+    private:
+        void place(const std::uint32_t entry, const std::size_t hash)
+        {
+            const auto mask = slots.size() - 1;
+            auto slot = hash & mask;
+            while (slots[slot] != NONE)
+            {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = entry;
+        }
+
+        std::vector<std::uint32_t> slots;
+        std::size_t count = 0;
+    };
+} // namespace spank_olm
@@ -1,9 +1,75 @@
 #pragma once
 #include <account.hpp>
+#include <cross_signing.hpp>
 
 namespace spank_olm
 {
 
+    /**
+     * Returns the number of bytes needed to serialize a 32-bit unsigned integer.
+     */
+    constexpr std::size_t pickle_length(std::uint32_t) { return 4; }
+
+    /**
+     * Returns the number of bytes needed to serialize a boolean value.
+     */
+    constexpr std::size_t pickle_length(bool) { return 1; }
+
+    /**
+     * Returns the number of bytes needed to serialize a uint8_t value.
+     */
+    constexpr std::size_t pickle_length(std::uint8_t) { return 1; }
+
+    /**
+     * Returns the number of bytes needed to serialize a Botan::secure_vector<uint8_t>.
+     */
+    inline std::size_t pickle_length(const Botan::secure_vector<uint8_t> &value)
+    {
+        return pickle_length(std::uint32_t{}) + value.size();
+    }
+
+    /**
+     * Returns the number of bytes needed to serialize a std::vector<uint8_t>.
+     */
+    inline std::size_t pickle_length(const std::vector<uint8_t> &value)
+    {
+        return pickle_length(std::uint32_t{}) + value.size();
+    }
+
+    /**
+     * Returns the number of bytes needed to serialize a OneTimeKey.
+     */
+    std::size_t pickle_length(const OneTimeKey &value);
+
+    /**
+     * Returns the number of bytes needed to serialize an IdentityKeys object.
+     */
+    std::size_t pickle_length(const IdentityKeys &value);
+
+    /**
+     * The current version of the cross-signing keys pickle format.
+     */
+    constexpr std::uint32_t CROSS_SIGNING_PICKLE_VERSION = 1;
+
+    /**
+     * Returns the number of bytes needed to serialize a CrossSigningKeys object.
+     */
+    std::size_t pickle_length(const CrossSigningKeys &value);
+
+    /**
+     * Returns the number of bytes needed to serialize a FixedSizeArray of OneTimeKeys.
+     */
+    template <std::size_t max_size, typename Allocator>
+    std::size_t pickle_length(FixedSizeArray<OneTimeKey, max_size, Allocator> const &list)
+    {
+        std::size_t length = pickle_length(static_cast<std::uint32_t>(list.size()));
+        for (auto const &value : list)
+        {
+            length += pickle_length(*value);
+        }
+        return length;
+    }
+
     /**
      * Serializes a 32-bit unsigned integer into a byte array.
      *
@@ -82,6 +148,15 @@ namespace spank_olm
      */
     std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end, std::vector<uint8_t> &value);
 
+    /**
+     * Serializes a OneTimeKey object into a byte array.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param value A OneTimeKey object to serialize.
+     * @return Pointer to the position in the byte array after the serialized data.
+     */
+    std::uint8_t *pickle(std::uint8_t *pos, const OneTimeKey &value);
+
     /**
      *
      * @param pos Pointer to the current position in the byte array.
@@ -107,12 +182,13 @@ namespace spank_olm
      *
      * @tparam T The type of elements in the FixedSizeArray.
      * @tparam max_size The maximum size of the FixedSizeArray.
+     * @tparam Allocator The allocator of the FixedSizeArray.
      * @param pos Pointer to the current position in the byte array.
      * @param list The FixedSizeArray object to serialize.
      * @return Pointer to the position in the byte array after the serialized data.
      */
-    template <typename T, std::size_t max_size>
-    std::uint8_t *pickle(std::uint8_t *pos, FixedSizeArray<T, max_size> const &list)
+    template <typename T, std::size_t max_size, typename Allocator>
+    std::uint8_t *pickle(std::uint8_t *pos, FixedSizeArray<T, max_size, Allocator> const &list)
     {
         pos = pickle(pos, static_cast<std::uint32_t>(list.size()));
         for (auto const &value : list)
@@ -126,14 +202,15 @@ namespace spank_olm
      * Deserializes a FixedSizeArray object from a byte array.
      *
      * @tparam max_size The maximum size of the FixedSizeArray.
+     * @tparam Allocator The allocator of the FixedSizeArray.
      * @param pos Pointer to the current position in the byte array.
      * @param end Pointer to the end of the byte array.
      * @param list Reference to the FixedSizeArray object to store the deserialized values.
      * @return Pointer to the position in the byte array after the deserialized data, or nullptr on failure.
      */
-    template <std::size_t max_size>
+    template <std::size_t max_size, typename Allocator>
     std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end,
-                                 FixedSizeArray<OneTimeKey, max_size> &list)
+                                 FixedSizeArray<OneTimeKey, max_size, Allocator> &list)
     {
         std::uint32_t size;
         pos = unpickle(pos, end, size);
@@ -147,7 +224,8 @@ namespace spank_olm
             auto [temp_pos, value] = unpickle_otk(pos, end);
             if (!((pos = temp_pos)))
                 return nullptr;
-            list.insert(value.value());
+            // The keys were pickled newest first, so append them to keep that order.
+            list.insert_at(list.size(), value.value());
         }
 
         return pos;
@@ -191,6 +269,27 @@ namespace spank_olm
      */
     std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end, std::optional<IdentityKeys> &value);
 
+    /**
+     * Serializes a CrossSigningKeys object into a byte array.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param value The CrossSigningKeys object to serialize.
+     * @return Pointer to the position in the byte array after the serialized data.
+     */
+    std::uint8_t *pickle(std::uint8_t *pos, const CrossSigningKeys &value);
+
+    /**
+     * Deserializes a CrossSigningKeys object from a byte array.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param end Pointer to the end of the byte array.
+     * @param value Reference to the optional CrossSigningKeys object to store the deserialized value.
+     * @return Pointer to the position in the byte array after the deserialized data, or nullptr on failure or an
+     * unknown version.
+     */
+    std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end,
+                                 std::optional<CrossSigningKeys> &value);
+
     /**
      * Deserializes an optional OneTimeKey object from a byte array.
      *
@@ -201,6 +300,16 @@ namespace spank_olm
      */
     std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end, std::optional<OneTimeKey> &value);
 
+    /**
+     * Deserializes a length prefixed byte string without copying it.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param end Pointer to the end of the byte array.
+     * @param value Reference to the span which is set to the bytes inside the byte array.
+     * @return Pointer to the position in the byte array after the deserialized data, or nullptr on failure.
+     */
+    std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end, std::span<const uint8_t> &value);
+
     std::uint8_t *pickle_bytes(std::uint8_t *pos, const std::uint8_t *bytes, const std::size_t bytes_length);
 
     std::uint8_t const *unpickle_bytes(const std::uint8_t *pos, const std::uint8_t *end, std::uint8_t *bytes,
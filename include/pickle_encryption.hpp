@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <botan/cipher_mode.h>
+#include <botan/mac.h>
+#include <botan/secmem.h>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace spank_olm
+{
+    /**
+     * \brief Encrypts and decrypts pickles the same way libolm does.
+     *
+     * The pickle key is run through HKDF-SHA-256 with the info "Pickle" to get an AES-256 key, an HMAC-SHA-256 key and
+     * an IV. The pickle is encrypted with AES-256-CBC and PKCS#7 padding, the first 8 bytes of the HMAC of the
+     * ciphertext are appended and the result is encoded as unpadded base64.
+     *
+     * The derived keys and the Botan key schedules are computed once on construction and reused for every pickle, so
+     * a single PickleCipher should be kept around for as long as the pickle key is in use. An instance must not be used
+     * from several threads at once; copies share no state and are cheap, as they reuse the derived keys.
+     */
+    class PickleCipher
+    {
+    public:
+        static constexpr std::size_t MAC_LENGTH = 8; ///< The number of HMAC bytes appended to the ciphertext.
+
+        /**
+         * \brief Derives the encryption keys from a pickle key.
+         *
+         * \param pickle_key The pickle key. It may have any length.
+         */
+        explicit PickleCipher(std::span<const std::uint8_t> pickle_key);
+
+        /**
+         * \brief Derives the encryption keys from a pickle key.
+         *
+         * \param pickle_key The pickle key. It may have any length.
+         */
+        explicit PickleCipher(std::string_view pickle_key);
+
+        PickleCipher(const PickleCipher &other);
+        PickleCipher &operator=(const PickleCipher &other);
+        PickleCipher(PickleCipher &&other) noexcept = default;
+        PickleCipher &operator=(PickleCipher &&other) noexcept = default;
+        ~PickleCipher() = default;
+
+        /**
+         * \brief Returns the number of bytes the buffer passed to seal() should reserve for a raw pickle.
+         *
+         * Reserving this much up front lets seal() encrypt and authenticate the pickle without reallocating.
+         *
+         * \param raw_length The length of the unencrypted pickle.
+         */
+        [[nodiscard]] static std::size_t buffer_length(std::size_t raw_length);
+
+        /**
+         * \brief Returns the length of the encoded output for a raw pickle.
+         *
+         * \param raw_length The length of the unencrypted pickle.
+         */
+        [[nodiscard]] static std::size_t encrypted_length(std::size_t raw_length);
+
+        /**
+         * \brief Encrypts a pickle in place and encodes it.
+         *
+         * \param buffer The unencrypted pickle. It is overwritten with the ciphertext.
+         * \return The encrypted and base64 encoded pickle.
+         */
+        [[nodiscard]] std::string seal(Botan::secure_vector<std::uint8_t> &buffer);
+
+        /**
+         * \brief Encrypts and encodes a pickle.
+         *
+         * \param pickle The unencrypted pickle.
+         * \return The encrypted and base64 encoded pickle.
+         */
+        [[nodiscard]] std::string encrypt(std::span<const std::uint8_t> pickle);
+
+        /**
+         * \brief Decodes and decrypts a pickle.
+         *
+         * \param encrypted The encrypted and base64 encoded pickle.
+         * \return The unencrypted pickle.
+         * \throws SpankOlmErrorInvalidBase64 if the input isn't valid base64.
+         * \throws SpankOlmErrorBadAccountKey if the pickle wasn't encrypted with this key or was modified.
+         * \throws SpankOlmErrorCorruptedPickle if the pickle is too short or its padding is invalid.
+         */
+        [[nodiscard]] Botan::secure_vector<std::uint8_t> decrypt(std::string_view encrypted);
+
+    private:
+        /**
+         * \brief Sets up the Botan objects from the derived keys.
+         */
+        void init();
+
+        Botan::secure_vector<std::uint8_t> derived_keys; ///< The AES key, the HMAC key and the IV.
+        std::unique_ptr<Botan::Cipher_Mode> encryption;
+        std::unique_ptr<Botan::Cipher_Mode> decryption;
+        std::unique_ptr<Botan::MessageAuthenticationCode> hmac;
+    };
+} // namespace spank_olm
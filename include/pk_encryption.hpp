@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <botan/rng.h>
+#include <botan/secmem.h>
+#include <botan/x25519.h>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "message.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    /**
+     * \brief A message encrypted to a Curve25519 public key, e.g. the session data of a server-side key backup.
+     *
+     * The fields are the unpadded base64 strings libolm and the key backup format use.
+     */
+    struct PkMessage
+    {
+        std::string ciphertext; ///< The AES-256-CBC encrypted plaintext.
+        std::string mac; ///< The truncated MAC.
+        std::string ephemeral_key; ///< The Curve25519 key the sender generated for the message.
+    };
+
+    /**
+     * \brief The outcome of decrypting one message of a batch.
+     */
+    struct PkDecrypted
+    {
+        Botan::secure_vector<std::uint8_t> plaintext; ///< The decrypted message.
+        std::exception_ptr error; ///< The exception decrypting threw, if any.
+
+        /**
+         * \brief Returns whether the message was decrypted.
+         */
+        [[nodiscard]] bool ok() const { return !error; }
+    };
+
+    /**
+     * \brief Receives the plaintext of a message of PkDecryption::decrypt_each(), by its index.
+     */
+    using PkConsumer = std::function<void(std::size_t index, std::span<const std::uint8_t> plaintext)>;
+
+    /**
+     * \brief Encrypts messages to a Curve25519 public key, compatible with libolm's PkEncryption.
+     *
+     * Every message uses a fresh ephemeral key. The X25519 agreement of the ephemeral and the recipient key is
+     * expanded with HKDF-SHA-256 into an AES-256-CBC key, an HMAC-SHA-256 key and an IV. Like libolm, the MAC is taken
+     * over an empty string, so it only proves knowledge of the key, not the integrity of the ciphertext.
+     */
+    class PkEncryption
+    {
+    public:
+        /**
+         * \brief Creates an encryption to a recipient.
+         *
+         * \param recipient_key The raw Curve25519 public key of the recipient.
+         * \throws SpankOlmErrorInvalidKey if the key has the wrong length.
+         */
+        explicit PkEncryption(std::span<const std::uint8_t> recipient_key);
+
+        /**
+         * \brief Encrypts a message.
+         *
+         * \param rng The botan random number generator to use for the ephemeral key.
+         * \param plaintext The message.
+         * \return The encrypted message.
+         */
+        [[nodiscard]] PkMessage encrypt(Botan::RandomNumberGenerator &rng,
+                                        std::span<const std::uint8_t> plaintext) const;
+
+    private:
+        std::array<std::uint8_t, CURVE25519_KEY_LENGTH> recipient_key;
+    };
+
+    /**
+     * \brief Decrypts messages encrypted with PkEncryption, or libolm's PkEncryption, to a Curve25519 key pair.
+     *
+     * A PkDecryption isn't changed by decrypting, so it may be used from several threads at once.
+     */
+    class PkDecryption
+    {
+    public:
+        /**
+         * \brief Creates a new random key pair.
+         */
+        explicit PkDecryption(Botan::RandomNumberGenerator &rng);
+
+        /**
+         * \brief Restores a key pair from its private key, e.g. a backup recovery key.
+         *
+         * \throws SpankOlmErrorInvalidKey if the key has the wrong length.
+         */
+        explicit PkDecryption(std::span<const std::uint8_t> private_key);
+
+        /**
+         * \brief Returns the raw Curve25519 public key to encrypt to.
+         */
+        [[nodiscard]] std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> public_key() const { return our_public_key; }
+
+        /**
+         * \brief Returns the raw Curve25519 private key.
+         */
+        [[nodiscard]] Botan::secure_vector<std::uint8_t> private_key() const { return key.raw_private_key_bits(); }
+
+        /**
+         * \brief Decrypts a message.
+         *
+         * \param message The message.
+         * \return The plaintext.
+         * \throws SpankOlmErrorInvalidBase64 if a field isn't valid base64.
+         * \throws SpankOlmErrorInvalidKey if the ephemeral key is invalid.
+         * \throws SpankOlmErrorBadMessageMac if the MAC doesn't match, e.g. because the message is for another key.
+         * \throws SpankOlmErrorBadMessageFormat if the ciphertext can't be decrypted.
+         */
+        [[nodiscard]] Botan::secure_vector<std::uint8_t> decrypt(PkMessage const &message) const;
+
+        /**
+         * \brief Decrypts many messages, e.g. all session data of a key backup.
+         *
+         * The messages are split over the pool. Every worker sets up the key agreement and the symmetric primitives
+         * once and reuses them for all of its messages.
+         *
+         * \param messages The messages.
+         * \param pool The pool to decrypt on.
+         * \return One result per message, in the same order. A message which fails to decrypt is reported in its result
+         * and doesn't affect the others.
+         */
+        [[nodiscard]] std::vector<PkDecrypted> decrypt_batch(std::span<const PkMessage> messages,
+                                                             ThreadPool &pool) const;
+
+        /**
+         * \brief Decrypts many messages and hands each plaintext to a function on the worker which decrypted it.
+         *
+         * Unlike decrypt_batch(), no plaintext is kept: every worker decrypts into one reused buffer, so the consumer
+         * can parse it in place and only keep what it needs.
+         *
+         * \param messages The messages.
+         * \param pool The pool to decrypt on.
+         * \param consume Called with the index and plaintext of each message, concurrently from several workers. The
+         * plaintext is only valid during the call.
+         * \return One exception per message, null for the messages which were decrypted and consumed. An exception
+         * thrown by the function is reported like a decryption error.
+         */
+        std::vector<std::exception_ptr> decrypt_each(std::span<const PkMessage> messages, ThreadPool &pool,
+                                                     PkConsumer const &consume) const;
+
+    private:
+        Botan::X25519_PrivateKey key;
+        std::array<std::uint8_t, CURVE25519_KEY_LENGTH> our_public_key;
+    };
+} // namespace spank_olm
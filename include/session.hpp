@@ -0,0 +1,599 @@
+#pragma once
+
+#include <array>
+#include <botan/cipher_mode.h>
+#include <botan/kdf.h>
+#include <botan/mac.h>
+#include <botan/pubkey.h>
+#include <botan/rng.h>
+#include <botan/secmem.h>
+#include <botan/x25519.h>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "account.hpp"
+#include "list.hpp"
+#include "message.hpp"
+#include "one_time_key_index.hpp"
+#include "open_addressing.hpp"
+#include "pickle_encryption.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t MAX_RECEIVER_CHAINS(5); ///< The number of receiver chains a session remembers.
+    constexpr std::size_t MAX_SKIPPED_MESSAGE_KEYS(40); ///< The default number of skipped message keys kept.
+    constexpr std::uint32_t MAX_MESSAGE_GAP(2000); ///< The default number of messages a chain may skip at once.
+
+    /**
+     * \brief The current version of the session pickle format, which is the one libolm uses.
+     */
+    constexpr std::uint32_t SESSION_PICKLE_VERSION = 1;
+
+    using Curve25519PublicKey = std::array<std::uint8_t, CURVE25519_KEY_LENGTH>; ///< A raw Curve25519 public key.
+
+    /**
+     * \brief The type of an Olm message.
+     */
+    enum class MessageType : std::uint8_t
+    {
+        PreKey = 0, ///< A message which can create a new inbound session.
+        Normal = 1, ///< A message for an established session.
+    };
+
+    /**
+     * \brief An encrypted Olm message as sent over the wire.
+     */
+    struct OlmMessage
+    {
+        MessageType type; ///< The type of the message.
+        std::string body; ///< The unpadded base64 encoding of the message.
+    };
+
+    /**
+     * \brief The keys a pre-key message was created with.
+     */
+    struct PreKeyHeader
+    {
+        Curve25519PublicKey one_time_key; ///< The one-time or fallback key of the receiver.
+        Curve25519PublicKey base_key; ///< The ephemeral key of the sender.
+        Curve25519PublicKey identity_key; ///< The Curve25519 identity key of the sender.
+
+        /**
+         * \brief Decodes the keys of a pre-key message.
+         *
+         * Senders put the keys in front of the encrypted message, so usually only the first 140 characters of the
+         * body are decoded and the rest of the message isn't looked at.
+         *
+         * \param body The body of the pre-key message.
+         * \return The keys of the message.
+         * \throws SpankOlmErrorInvalidBase64 if the body isn't valid base64.
+         * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+         */
+        static PreKeyHeader decode(std::string_view body);
+    };
+
+    /**
+     * \brief Decodes the ratchet key of a message, which tells the chain of a session it belongs to.
+     *
+     * \param type The type of the message.
+     * \param body The body of the message.
+     * \return The ratchet key of the message, or of the message inside a pre-key message.
+     * \throws SpankOlmErrorInvalidBase64 if the body isn't valid base64.
+     * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+     * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+     */
+    [[nodiscard]] Curve25519PublicKey decode_ratchet_key(MessageType type, std::string_view body);
+
+    /**
+     * \brief Limits on the state a session keeps for out of order messages.
+     */
+    struct SessionLimits
+    {
+        std::size_t max_skipped_message_keys = MAX_SKIPPED_MESSAGE_KEYS; ///< The number of skipped keys kept.
+        std::uint32_t max_message_gap = MAX_MESSAGE_GAP; ///< The number of messages a chain may skip at once.
+    };
+
+    /**
+     * \brief The keys claimed from another device to create an outbound session with.
+     */
+    struct ClaimedOneTimeKey
+    {
+        std::span<const std::uint8_t> identity_key; ///< The Curve25519 identity key of the device.
+        std::span<const std::uint8_t> one_time_key; ///< A one-time or fallback key claimed from the device.
+    };
+
+    struct OutboundSession;
+
+    /**
+     * \brief A bounded cache of the message keys of messages which haven't arrived yet.
+     *
+     * The keys are stored in a preallocated array and indexed by an open addressing hash table on the ratchet key and
+     * message index, so lookups, inserts and removals are O(1) and never allocate. Once the cache is full, inserting
+     * evicts the oldest key. Removed and evicted keys are scrubbed from memory.
+     */
+    class SkippedMessageKeys
+    {
+    public:
+        /**
+         * \brief Creates an empty cache.
+         *
+         * \param capacity The maximum number of keys kept. 0 disables the cache.
+         */
+        explicit SkippedMessageKeys(std::size_t capacity = MAX_SKIPPED_MESSAGE_KEYS);
+
+        SkippedMessageKeys(SkippedMessageKeys const &) = default;
+        SkippedMessageKeys &operator=(SkippedMessageKeys const &) = default;
+        SkippedMessageKeys(SkippedMessageKeys &&) noexcept = default;
+        SkippedMessageKeys &operator=(SkippedMessageKeys &&) noexcept = default;
+
+        /**
+         * \brief Scrubs the keys.
+         */
+        ~SkippedMessageKeys();
+
+        /**
+         * \brief Returns the number of keys in the cache.
+         */
+        [[nodiscard]] std::size_t size() const { return count; }
+
+        /**
+         * \brief Returns the maximum number of keys in the cache.
+         */
+        [[nodiscard]] std::size_t capacity() const { return entries.size(); }
+
+        /**
+         * \brief Adds a key, evicting the oldest one if the cache is full.
+         *
+         * \param ratchet_key The ratchet key of the chain the message belongs to.
+         * \param index The index of the message in its chain.
+         * \param message_key The key of the message.
+         */
+        void insert(Curve25519PublicKey const &ratchet_key, std::uint32_t index,
+                    std::span<const std::uint8_t, 32> message_key);
+
+        /**
+         * \brief Looks up the key of a message.
+         *
+         * \return The 32 byte message key, or nullptr if it isn't cached. It stays valid until the cache is modified.
+         */
+        [[nodiscard]] std::uint8_t const *find(std::span<const std::uint8_t> ratchet_key, std::uint32_t index) const;
+
+        /**
+         * \brief Removes the key of a message.
+         *
+         * \return Whether the key was cached.
+         */
+        bool erase(std::span<const std::uint8_t> ratchet_key, std::uint32_t index);
+
+        /**
+         * \brief Removes all keys.
+         */
+        void clear();
+
+        /**
+         * \brief Calls a function with the ratchet key, index and message key of every cached key, oldest first.
+         */
+        template <typename F>
+        void for_each(F &&function) const
+        {
+            for (auto entry = oldest; entry != NONE; entry = entries[entry].newer)
+            {
+                function(entries[entry].ratchet_key, entries[entry].index,
+                         std::span<const std::uint8_t, 32>(entries[entry].message_key));
+            }
+        }
+
+        /**
+         * \brief Calls a function with the ratchet key, index and message key of every cached key, newest first.
+         */
+        template <typename F>
+        void for_each_newest_first(F &&function) const
+        {
+            for (auto entry = newest; entry != NONE; entry = entries[entry].older)
+            {
+                function(entries[entry].ratchet_key, entries[entry].index,
+                         std::span<const std::uint8_t, 32>(entries[entry].message_key));
+            }
+        }
+
+    private:
+        static constexpr std::uint32_t NONE = 0xffffffff;
+
+        struct Entry
+        {
+            Curve25519PublicKey ratchet_key;
+            std::uint32_t index;
+            std::array<std::uint8_t, 32> message_key;
+            std::uint32_t older; ///< The next older entry, or the next free entry.
+            std::uint32_t newer; ///< The next newer entry.
+        };
+
+        /**
+         * \brief Returns the hash of the entry with the given index.
+         */
+        [[nodiscard]] std::size_t hash_of(std::uint32_t entry) const;
+
+        /**
+         * \brief Returns the slot of the hash table which refers to the given key, or ProbeTable::NONE.
+         */
+        [[nodiscard]] std::size_t find_slot(std::span<const std::uint8_t> ratchet_key, std::uint32_t index) const;
+
+        /**
+         * \brief Removes the entry referred to by the given slot of the hash table.
+         */
+        void remove(std::size_t slot);
+
+        std::vector<Entry> entries; ///< Preallocated storage for the keys.
+        ProbeTable table; ///< Indices into entries, hashed by ratchet key and index.
+        std::uint32_t oldest = NONE; ///< The oldest entry in use.
+        std::uint32_t newest = NONE; ///< The newest entry in use.
+        std::uint32_t free = 0; ///< The first unused entry.
+        std::size_t count = 0;
+    };
+
+    /**
+     * \brief An Olm session: a double ratchet between two devices.
+     *
+     * The session is compatible with libolm: it uses the same 3DH handshake, the same root and chain key derivation,
+     * AES-256-CBC with a truncated HMAC-SHA-256 for the messages, the same wire format and the same pickle format.
+     *
+     * All chain state is stored inline: the sender chain, up to MAX_RECEIVER_CHAINS receiver chains and a preallocated
+     * SkippedMessageKeys cache. Encrypting and decrypting a message therefore only allocate the output and one
+     * scratch buffer, apart from the rare steps of the ratchet which need a new Curve25519 key.
+     *
+     * A session must not be used from several threads at once.
+     */
+    class Session
+    {
+    public:
+        /**
+         * \brief Creates an empty session, e.g. to unpickle into.
+         */
+        explicit Session(SessionLimits limits = {});
+
+        Session(Session const &other);
+        Session &operator=(Session const &other);
+        Session(Session &&other) noexcept;
+        Session &operator=(Session &&other) noexcept;
+
+        /**
+         * \brief Scrubs the ratchet state.
+         */
+        ~Session();
+
+        /**
+         * \brief Creates a session to send messages to another device.
+         *
+         * \param rng The botan random number generator to use.
+         * \param account The account to send from.
+         * \param their_identity_key The Curve25519 identity key of the other device.
+         * \param their_one_time_key A one-time or fallback key claimed from the other device.
+         * \param limits The limits for out of order messages.
+         * \throws SpankOlmErrorInvalidKey if one of the keys is invalid.
+         */
+        static Session create_outbound(Botan::RandomNumberGenerator &rng, Account const &account,
+                                       std::span<const std::uint8_t> their_identity_key,
+                                       std::span<const std::uint8_t> their_one_time_key, SessionLimits limits = {});
+
+        /**
+         * \brief Creates sessions to send messages to many devices at once, e.g. after claiming their one-time keys.
+         *
+         * The private keys of all sessions are drawn from the random number generator in one go on the calling
+         * thread. The key agreements, which are most of the work, are then split over the pool, with one agreement
+         * setup for the account's identity key per worker.
+         *
+         * \param rng The botan random number generator to use.
+         * \param account The account to send from.
+         * \param claimed The keys of the other devices.
+         * \param pool The pool to do the key agreements on.
+         * \param limits The limits for out of order messages.
+         * \return One result per device, in the same order. A device with invalid keys is reported in its result and
+         * doesn't affect the others.
+         */
+        [[nodiscard]] static std::vector<OutboundSession>
+        create_outbound_batch(Botan::RandomNumberGenerator &rng, Account const &account,
+                              std::span<const ClaimedOneTimeKey> claimed, ThreadPool &pool, SessionLimits limits = {});
+
+        /**
+         * \brief Creates a session from a pre-key message another device sent to us.
+         *
+         * The message itself isn't decrypted; pass it to decrypt() afterwards. The one-time key it used isn't removed
+         * from the account, call Account::remove_key() with one_time_key() once the message has been decrypted.
+         *
+         * \param account The account the message was sent to.
+         * \param body The body of the pre-key message.
+         * \param their_identity_key If not empty, the Curve25519 identity key the message has to come from.
+         * \param limits The limits for out of order messages.
+         * \throws SpankOlmErrorInvalidBase64 if the body isn't valid base64.
+         * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+         * \throws SpankOlmErrorBadMessageKeyId if the message uses a one-time key the account doesn't have, or comes
+         * from a different identity key.
+         */
+        static Session create_inbound(Account const &account, std::string_view body,
+                                      std::span<const std::uint8_t> their_identity_key = {},
+                                      SessionLimits limits = {});
+
+        /**
+         * \brief Creates a session from a pre-key message, looking up its one-time key in an index.
+         *
+         * The keys of the message are checked before the rest of it is decoded, so a message for an unknown key is
+         * rejected after decoding its first 140 characters and a single probe of the index.
+         *
+         * \param account The account the message was sent to.
+         * \param index The index of the account's keys.
+         * \see create_inbound(Account const &, std::string_view, std::span<const std::uint8_t>, SessionLimits)
+         */
+        static Session create_inbound(Account const &account, OneTimeKeyIndex const &index, std::string_view body,
+                                      std::span<const std::uint8_t> their_identity_key = {},
+                                      SessionLimits limits = {});
+
+        /**
+         * \brief Returns the unpadded base64 encoded SHA-256 hash identifying the session on both sides.
+         */
+        [[nodiscard]] std::string session_id() const;
+
+        /**
+         * \brief Returns the one-time key the session was created with.
+         *
+         * For an inbound session, this is the key of ours whose private part the handshake used, as decoded from the
+         * whole pre-key message.
+         */
+        [[nodiscard]] Curve25519PublicKey const &one_time_key() const { return bob_one_time_key; }
+
+        /**
+         * \brief Returns whether a pre-key message belongs to this session.
+         *
+         * Only the keys are compared, so the message can be routed to its session without any key agreement.
+         */
+        [[nodiscard]] bool matches_inbound(PreKeyHeader const &header) const;
+
+        /**
+         * \brief Returns whether the session has a receiver chain for a ratchet key of the other side.
+         *
+         * Messages with such a ratchet key can be decrypted without a new key agreement.
+         */
+        [[nodiscard]] bool has_receiver_chain(std::span<const std::uint8_t> ratchet_key) const;
+
+        /**
+         * \brief Returns whether a message from the other side has been decrypted.
+         *
+         * Until then, encrypt() produces pre-key messages.
+         */
+        [[nodiscard]] bool has_received_message() const { return received_message; }
+
+        /**
+         * \brief Returns the limits for out of order messages.
+         */
+        [[nodiscard]] SessionLimits const &limits() const { return session_limits; }
+
+        /**
+         * \brief Returns the number of message keys kept for messages which haven't arrived yet.
+         */
+        [[nodiscard]] std::size_t skipped_message_key_count() const { return skipped_message_keys.size(); }
+
+        /**
+         * \brief Encrypts a message.
+         *
+         * \param rng The botan random number generator to use, if the ratchet needs a new key.
+         * \param plaintext The message to encrypt.
+         * \return The encrypted message.
+         */
+        [[nodiscard]] OlmMessage encrypt(Botan::RandomNumberGenerator &rng, std::span<const std::uint8_t> plaintext);
+
+        /**
+         * \brief Encrypts a message.
+         *
+         * \param rng The botan random number generator to use, if the ratchet needs a new key.
+         * \param plaintext The message to encrypt.
+         * \return The encrypted message.
+         */
+        [[nodiscard]] OlmMessage encrypt(Botan::RandomNumberGenerator &rng, std::string_view plaintext);
+
+        /**
+         * \brief Encrypts a message, building it in a caller provided scratch buffer.
+         *
+         * Encrypting many messages with the same buffer only allocates the base64 encoded results.
+         *
+         * \param rng The botan random number generator to use, if the ratchet needs a new key.
+         * \param plaintext The message to encrypt.
+         * \param buffer The scratch buffer. Its contents are replaced.
+         * \return The encrypted message.
+         */
+        [[nodiscard]] OlmMessage encrypt(Botan::RandomNumberGenerator &rng, std::span<const std::uint8_t> plaintext,
+                                         Botan::secure_vector<std::uint8_t> &buffer);
+
+        /**
+         * \brief Decrypts a message.
+         *
+         * The session is only changed if the message is authentic.
+         *
+         * \param type The type of the message.
+         * \param body The body of the message.
+         * \return The plaintext.
+         * \throws SpankOlmErrorInvalidBase64 if the body isn't valid base64.
+         * \throws SpankOlmErrorBadMessageVersion if the message has an unsupported version.
+         * \throws SpankOlmErrorBadMessageFormat if the message can't be decoded.
+         * \throws SpankOlmErrorBadMessageKeyId if the key of the message is no longer or not yet available.
+         * \throws SpankOlmErrorBadMessageMac if the message fails authentication.
+         */
+        [[nodiscard]] Botan::secure_vector<std::uint8_t> decrypt(MessageType type, std::string_view body);
+
+        /**
+         * \brief Decrypts a message.
+         *
+         * \see decrypt(MessageType, std::string_view)
+         */
+        [[nodiscard]] Botan::secure_vector<std::uint8_t> decrypt(OlmMessage const &message)
+        {
+            return decrypt(message.type, message.body);
+        }
+
+        /**
+         * \brief Returns the number of bytes needed to pickle the session.
+         */
+        [[nodiscard]] std::size_t pickle_length() const;
+
+        /**
+         * \brief Serializes the session at the given position.
+         *
+         * The caller has to make sure that at least pickle_length() bytes are available.
+         *
+         * \param pos Pointer to the current position in the byte array.
+         * \return Pointer to the position in the byte array after the serialized data.
+         */
+        std::uint8_t *pickle(std::uint8_t *pos) const;
+
+        /**
+         * \brief Serializes and encrypts the session in one pass.
+         *
+         * \param cipher The cipher holding the key schedule of the pickle key.
+         * \return The encrypted and base64 encoded session.
+         */
+        [[nodiscard]] std::string pickle(PickleCipher &cipher) const;
+
+        /**
+         * \brief Deserializes a session.
+         *
+         * \param data The serialized session.
+         * \param limits The limits for out of order messages. If the pickle holds more skipped message keys than
+         * allowed, the oldest ones are dropped.
+         * \return The deserialized session.
+         * \throws SpankOlmErrorVersionNotFound if the pickle version is not found.
+         * \throws SpankOlmErrorUnknownPickleVersion if the pickle version is unknown.
+         * \throws SpankOlmErrorCorruptedPickle if the pickle data is corrupted.
+         */
+        static Session unpickle(std::span<const std::uint8_t> data, SessionLimits limits = {});
+
+        /**
+         * \brief Decrypts and deserializes a session.
+         *
+         * \param cipher The cipher holding the key schedule of the pickle key.
+         * \param encrypted The encrypted and base64 encoded session.
+         * \param limits The limits for out of order messages.
+         * \return The deserialized session.
+         * \throws SpankOlmErrorBadAccountKey if the session was encrypted with a different key.
+         * \throws SpankOlmErrorCorruptedPickle if the pickle data is corrupted.
+         */
+        static Session unpickle(PickleCipher &cipher, std::string_view encrypted, SessionLimits limits = {});
+
+    private:
+        struct ChainKey
+        {
+            std::array<std::uint8_t, 32> key;
+            std::uint32_t index;
+        };
+
+        struct SenderChain
+        {
+            Botan::X25519_PrivateKey ratchet_key;
+            Curve25519PublicKey ratchet_public_key;
+            ChainKey chain_key;
+        };
+
+        struct ReceiverChain
+        {
+            Curve25519PublicKey ratchet_key;
+            ChainKey chain_key;
+        };
+
+        /**
+         * \brief The Botan objects a session works with, created once per session.
+         *
+         * Copies get their own objects, as they keep state between calls.
+         */
+        struct Primitives
+        {
+            Primitives();
+            Primitives(Primitives const &) : Primitives() {}
+            Primitives &operator=(Primitives const &) { return *this; }
+            Primitives(Primitives &&) noexcept = default;
+            Primitives &operator=(Primitives &&) noexcept = default;
+            ~Primitives() = default;
+
+            std::unique_ptr<Botan::KDF> hkdf;
+            std::unique_ptr<Botan::MessageAuthenticationCode> hmac;
+            std::unique_ptr<Botan::Cipher_Mode> encryption;
+            std::unique_ptr<Botan::Cipher_Mode> decryption;
+        };
+
+        /**
+         * \brief Creates an outbound session from the private keys drawn for it.
+         *
+         * \param identity_agreement The key agreement with the account's identity key.
+         * \param identity_key The public Curve25519 identity key of the account.
+         * \param private_keys The base key and then the first ratchet key of the session.
+         */
+        static Session create_outbound_session(Botan::PK_Key_Agreement const &identity_agreement,
+                                               Curve25519PublicKey const &identity_key,
+                                               std::span<const std::uint8_t> private_keys,
+                                               std::span<const std::uint8_t> their_identity_key,
+                                               std::span<const std::uint8_t> their_one_time_key, SessionLimits limits);
+
+        /**
+         * \brief Creates an inbound session, looking up the one-time key in the index if there is one.
+         */
+        static Session create_inbound_session(Account const &account, OneTimeKeyIndex const *index,
+                                              std::string_view body, std::span<const std::uint8_t> their_identity_key,
+                                              SessionLimits limits);
+
+        /**
+         * \brief Derives the root key and the first chain key from the 3DH secret.
+         */
+        void initialise(std::span<const std::uint8_t> shared_secret, std::span<std::uint8_t, 32> chain_key);
+
+        /**
+         * \brief Starts a new sender chain with a fresh ratchet key.
+         */
+        void start_sender_chain(Botan::RandomNumberGenerator &rng);
+
+        /**
+         * \brief Derives the next root key and a new chain key from a Curve25519 agreement.
+         */
+        void ratchet_root_key(Botan::X25519_PrivateKey const &our_key, std::span<const std::uint8_t> their_key,
+                              std::span<std::uint8_t, 32> root_key_out, std::span<std::uint8_t, 32> chain_key_out);
+
+        void advance_chain_key(ChainKey &chain_key);
+        void create_message_key(ChainKey const &chain_key, std::span<std::uint8_t, 32> message_key);
+
+        /**
+         * \brief Checks the MAC of a message and decrypts its ciphertext.
+         */
+        [[nodiscard]] Botan::secure_vector<std::uint8_t>
+        verify_and_decrypt(std::span<const std::uint8_t, 32> message_key, std::span<const std::uint8_t> authenticated,
+                           std::span<const std::uint8_t> mac, std::span<const std::uint8_t> ciphertext);
+
+        SessionLimits session_limits;
+        bool received_message = false;
+        Curve25519PublicKey alice_identity_key{};
+        Curve25519PublicKey alice_base_key{};
+        Curve25519PublicKey bob_one_time_key{};
+        std::array<std::uint8_t, 32> root_key{};
+        std::optional<SenderChain> sender_chain;
+        FixedSizeArray<ReceiverChain, MAX_RECEIVER_CHAINS> receiver_chains; ///< Newest first.
+        SkippedMessageKeys skipped_message_keys;
+        Primitives primitives;
+    };
+
+    /**
+     * \brief The outcome of creating one session of Session::create_outbound_batch().
+     */
+    struct OutboundSession
+    {
+        std::optional<Session> session; ///< The session, if it was created.
+        std::exception_ptr error; ///< The exception creating the session threw, if any.
+
+        /**
+         * \brief Returns whether the session was created.
+         */
+        [[nodiscard]] bool ok() const { return !error; }
+    };
+} // namespace spank_olm
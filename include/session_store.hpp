@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <list>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "account.hpp"
+#include "one_time_key_index.hpp"
+#include "open_addressing.hpp"
+#include "session.hpp"
+#include "thread_pool.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t MAX_SESSIONS_PER_PEER(50); ///< The default number of sessions kept per device.
+
+    /**
+     * \brief An encrypted message for SessionStore::decrypt_batch().
+     */
+    struct IncomingMessage
+    {
+        std::span<const std::uint8_t> sender_key; ///< The Curve25519 identity key of the sender.
+        MessageType type; ///< The type of the message.
+        std::string_view body; ///< The body of the message.
+    };
+
+    /**
+     * \brief The outcome of decrypting one message of a batch.
+     */
+    struct BatchDecrypted
+    {
+        Botan::secure_vector<std::uint8_t> plaintext; ///< The decrypted message.
+        std::string session_id; ///< The ID of the session which decrypted the message.
+        bool new_session = false; ///< Whether the session was created from the message.
+        std::exception_ptr error; ///< The exception decrypting threw, if any.
+
+        /**
+         * \brief Returns whether the message was decrypted.
+         */
+        [[nodiscard]] bool ok() const { return !error; }
+    };
+
+    /**
+     * \brief The Olm sessions with other devices, grouped by their Curve25519 identity key.
+     *
+     * The sessions of each device are kept in most recently used order, so the session a message most likely belongs
+     * to is tried first, and are also indexed by session ID. Pre-key messages are matched to their session by their
+     * keys alone. Normal messages are tried first on the sessions which already have a chain for their ratchet key,
+     * and only then on the others, which needs a key agreement per session.
+     *
+     * Once a device has more than the maximum number of sessions, the least recently used one is dropped.
+     *
+     * A SessionStore must not be used from several threads at once.
+     */
+    class SessionStore
+    {
+    public:
+        /**
+         * \brief The outcome of decrypting a message with a SessionStore.
+         */
+        struct Decrypted
+        {
+            Botan::secure_vector<std::uint8_t> plaintext; ///< The decrypted message.
+            Session *session; ///< The session which decrypted the message.
+            bool new_session; ///< Whether the session was created from the message.
+            std::optional<Curve25519PublicKey> one_time_key; ///< The one-time key of ours a new session used.
+        };
+
+        /**
+         * \brief Creates an empty store.
+         *
+         * \param max_sessions_per_peer The maximum number of sessions kept per device, at least 1.
+         * \param limits The limits for out of order messages of the sessions decrypt() creates.
+         */
+        explicit SessionStore(std::size_t max_sessions_per_peer = MAX_SESSIONS_PER_PEER, SessionLimits limits = {});
+
+        SessionStore(SessionStore const &) = delete;
+        SessionStore &operator=(SessionStore const &) = delete;
+
+        /**
+         * \brief Adds a session as the most recently used one with a device.
+         *
+         * A session with the same ID is replaced.
+         *
+         * \param their_identity_key The Curve25519 identity key of the other device.
+         * \param session The session.
+         * \return The stored session. It stays valid until it is removed or dropped.
+         */
+        Session &add(std::span<const std::uint8_t> their_identity_key, Session session);
+
+        /**
+         * \brief Looks up a session by its ID.
+         *
+         * \return The session, or nullptr if there is none.
+         */
+        [[nodiscard]] Session *find(std::string_view session_id);
+
+        /**
+         * \brief Returns the most recently used session with a device, e.g. to encrypt to it.
+         *
+         * \return The session, or nullptr if there is none.
+         */
+        [[nodiscard]] Session *most_recent(std::span<const std::uint8_t> their_identity_key);
+
+        /**
+         * \brief Returns the sessions with a device, most recently used first.
+         */
+        [[nodiscard]] std::vector<Session *> sessions(std::span<const std::uint8_t> their_identity_key);
+
+        /**
+         * \brief Removes a session.
+         *
+         * \return Whether there was such a session.
+         */
+        bool remove(std::string_view session_id);
+
+        /**
+         * \brief Returns the number of sessions in the store.
+         */
+        [[nodiscard]] std::size_t size() const { return by_id.size(); }
+
+        /**
+         * \brief Decrypts a message from a device with the session it belongs to.
+         *
+         * A pre-key message which doesn't belong to any session creates a new inbound session. Its one-time key isn't
+         * removed from the account, call Account::remove_key() with Decrypted::one_time_key afterwards. The session
+         * which decrypted the message becomes the most recently used one.
+         *
+         * \param account The account the message was sent to.
+         * \param their_identity_key The Curve25519 identity key of the sender.
+         * \param message The message.
+         * \param index If not null, the index of the account's keys to look up one-time keys in.
+         * \return The plaintext and the session which decrypted it.
+         * \throws SpankOlmErrorNoMatchingSession if no session can decrypt a normal message.
+         * \throws SpankOlmErrorBadMessageKeyId if a pre-key message uses a one-time key the account doesn't have.
+         * \throws SpankOlmException for the other errors of Session::create_inbound() and Session::decrypt().
+         */
+        Decrypted decrypt(Account const &account, std::span<const std::uint8_t> their_identity_key,
+                          OlmMessage const &message, OneTimeKeyIndex const *index = nullptr);
+
+        /**
+         * \brief Decrypts a burst of messages, e.g. the to-device messages of a sync after a long time offline.
+         *
+         * The messages are grouped by sender. The groups are decrypted concurrently on the pool, and the messages of
+         * each group in their original order, so every message sees the sessions exactly like decrypt() would. New
+         * inbound sessions are created from a OneTimeKeyIndex of the account, and the one-time keys they used are
+         * removed from the account in one go once all groups are done. If several new sessions used the same
+         * one-time key, all of them are kept.
+         *
+         * The account must not be changed by anyone else until decrypt_batch() returns.
+         *
+         * \param account The account the messages were sent to.
+         * \param messages The messages.
+         * \param pool The pool to decrypt on.
+         * \return One result per message, in the same order. A message which fails to decrypt is reported in its result
+         * and doesn't affect the others.
+         */
+        [[nodiscard]] std::vector<BatchDecrypted> decrypt_batch(Account &account,
+                                                                std::span<const IncomingMessage> messages,
+                                                                ThreadPool &pool);
+
+    private:
+        struct Entry
+        {
+            std::string session_id;
+            Session session;
+        };
+
+        using Peer = std::list<Entry>; ///< The sessions with a device, most recently used first.
+
+        struct Location
+        {
+            Curve25519PublicKey peer_key;
+            Peer::iterator entry;
+        };
+
+        /**
+         * \brief Makes a session the most recently used one of its device.
+         */
+        static Session *touch(Peer &peer, Peer::iterator entry);
+
+        /**
+         * \brief Decrypts a message with the sessions of one device.
+         *
+         * Only the device's sessions are touched, so different devices can be handled concurrently. New sessions are
+         * put at the front of the device's sessions, but aren't indexed by ID until index_sessions() is called.
+         */
+        Decrypted decrypt_from(Peer &peer, Account const &account, std::span<const std::uint8_t> their_identity_key,
+                               MessageType type, std::string_view body, OneTimeKeyIndex const *index) const;
+
+        /**
+         * \brief Indexes the new sessions of a device and drops the least recently used ones over the limit.
+         */
+        void index_sessions(Curve25519PublicKey const &peer_key, Peer &peer);
+
+        std::size_t max_sessions_per_peer;
+        std::unordered_map<Curve25519PublicKey, Peer, LeadingBytesHash> peers;
+        std::unordered_map<std::string, Location> by_id;
+        SessionLimits session_limits;
+    };
+} // namespace spank_olm
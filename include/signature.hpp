@@ -0,0 +1,300 @@
+#pragma once
+
+#include <array>
+#include <botan/ed25519.h>
+#include <botan/pk_keys.h>
+#include <botan/pubkey.h>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "open_addressing.hpp"
+
+namespace spank_olm
+{
+    constexpr std::size_t ED25519_SIGNATURE_LENGTH(64); ///< The length of an Ed25519 signature in bytes.
+    constexpr std::size_t SIGNATURE_CHUNK_SIZE(1 << 20); ///< The default chunk size for streaming signatures.
+
+    /**
+     * \brief A signature the message is fed into chunk by chunk, see CanonicalJsonWriter.
+     */
+    class IncrementalSigner
+    {
+    public:
+        virtual ~IncrementalSigner() = default;
+
+        /**
+         * \brief Feeds the next chunk of the message into the signature.
+         *
+         * \param chunk The next part of the message.
+         */
+        virtual void update(std::string_view chunk) = 0;
+
+        /**
+         * \brief Finishes the signature.
+         *
+         * \param rng The botan random number generator to use.
+         * \return The signature of all chunks passed to update().
+         */
+        [[nodiscard]] virtual std::vector<std::uint8_t> finish(Botan::RandomNumberGenerator &rng) = 0;
+    };
+
+    /**
+     * \brief Incrementally creates an Ed25519ph signature.
+     *
+     * Ed25519ph only needs a SHA-512 hash of the message, so the message can be fed in chunks of any size and never
+     * has to be held in memory as a whole. The result is identical to Account::sign() over the concatenated chunks.
+     */
+    class Ed25519phSigner : public IncrementalSigner
+    {
+    public:
+        /**
+         * \brief Starts a new signature.
+         *
+         * \param key The Ed25519 key to sign with.
+         * \param rng The botan random number generator to use.
+         */
+        Ed25519phSigner(Botan::Ed25519_PrivateKey const &key, Botan::RandomNumberGenerator &rng);
+
+        /**
+         * \brief Feeds the next chunk of the message into the signature.
+         *
+         * \param chunk The next part of the message.
+         */
+        void update(std::span<const std::uint8_t> chunk);
+
+        /**
+         * \brief Feeds the next chunk of the message into the signature.
+         *
+         * \param chunk The next part of the message.
+         */
+        void update(std::string_view chunk) override;
+
+        /**
+         * \brief Finishes the signature.
+         *
+         * The signer can be reused for a new message afterwards.
+         *
+         * \param rng The botan random number generator to use.
+         * \return The signature of all chunks passed to update().
+         */
+        [[nodiscard]] std::vector<std::uint8_t> finish(Botan::RandomNumberGenerator &rng) override;
+
+    private:
+        Botan::PK_Signer signer;
+    };
+
+    /**
+     * \brief Creates a pure Ed25519 signature, which Matrix uses for signed JSON objects such as cross-signing keys.
+     *
+     * Pure Ed25519 hashes the message twice, so the chunks are buffered until finish(). It suits small messages only.
+     */
+    class Ed25519Signer : public IncrementalSigner
+    {
+    public:
+        /**
+         * \brief Starts a new signature.
+         *
+         * \param key The Ed25519 key to sign with.
+         * \param rng The botan random number generator to use.
+         */
+        Ed25519Signer(Botan::Ed25519_PrivateKey const &key, Botan::RandomNumberGenerator &rng);
+
+        void update(std::string_view chunk) override;
+
+        /**
+         * \brief Finishes the signature. The signer can be reused for a new message afterwards.
+         */
+        [[nodiscard]] std::vector<std::uint8_t> finish(Botan::RandomNumberGenerator &rng) override;
+
+    private:
+        Botan::PK_Signer signer;
+    };
+
+    /**
+     * \brief Incrementally verifies an Ed25519ph signature.
+     */
+    class Ed25519phVerifier
+    {
+    public:
+        /**
+         * \brief Starts a new verification.
+         *
+         * \param key The Ed25519 public key of the signer.
+         */
+        explicit Ed25519phVerifier(Botan::Public_Key const &key);
+
+        /**
+         * \brief Feeds the next chunk of the message into the verification.
+         *
+         * \param chunk The next part of the message.
+         */
+        void update(std::span<const std::uint8_t> chunk);
+
+        /**
+         * \brief Feeds the next chunk of the message into the verification.
+         *
+         * \param chunk The next part of the message.
+         */
+        void update(std::string_view chunk);
+
+        /**
+         * \brief Checks the signature against all chunks passed to update().
+         *
+         * The verifier can be reused for a new message afterwards.
+         *
+         * \param signature The signature to check.
+         * \return True if the signature is valid, false otherwise.
+         */
+        [[nodiscard]] bool finish(std::span<const std::uint8_t> signature);
+
+    private:
+        Botan::PK_Verifier verifier;
+    };
+
+    /**
+     * \brief Signs a region of memory, for example a memory mapped file, chunk by chunk.
+     *
+     * \param key The Ed25519 key to sign with.
+     * \param rng The botan random number generator to use.
+     * \param data The data to sign.
+     * \param chunk_size The number of bytes to hash at a time.
+     * \return The signature of the data.
+     */
+    [[nodiscard]] std::vector<std::uint8_t> sign_chunked(Botan::Ed25519_PrivateKey const &key,
+                                                         Botan::RandomNumberGenerator &rng,
+                                                         std::span<const std::uint8_t> data,
+                                                         std::size_t chunk_size = SIGNATURE_CHUNK_SIZE);
+
+    /**
+     * \brief Signs the contents of a file using constant memory.
+     *
+     * The next chunk is read while the current one is hashed.
+     *
+     * \param key The Ed25519 key to sign with.
+     * \param rng The botan random number generator to use.
+     * \param path The file to sign.
+     * \param chunk_size The number of bytes to read at a time.
+     * \return The signature of the file contents.
+     * \throws SpankOlmErrorIO if the file can't be read.
+     */
+    [[nodiscard]] std::vector<std::uint8_t> sign_file(Botan::Ed25519_PrivateKey const &key,
+                                                      Botan::RandomNumberGenerator &rng,
+                                                      std::filesystem::path const &path,
+                                                      std::size_t chunk_size = SIGNATURE_CHUNK_SIZE);
+
+    /**
+     * \brief Verifies the signature of a file using constant memory.
+     *
+     * \param key The Ed25519 public key of the signer.
+     * \param path The file to verify.
+     * \param signature The signature to check.
+     * \param chunk_size The number of bytes to read at a time.
+     * \return True if the signature is valid, false otherwise.
+     * \throws SpankOlmErrorIO if the file can't be read.
+     */
+    [[nodiscard]] bool verify_file(Botan::Public_Key const &key, std::filesystem::path const &path,
+                                   std::span<const std::uint8_t> signature,
+                                   std::size_t chunk_size = SIGNATURE_CHUNK_SIZE);
+
+    /**
+     * \brief Verifies an Ed25519ph signature as produced by Account::sign().
+     *
+     * \param key The Ed25519 public key of the signer.
+     * \param message The message that was signed.
+     * \param signature The signature to check.
+     * \return True if the signature is valid for the message and key, false otherwise.
+     */
+    [[nodiscard]] bool verify_signature(Botan::Public_Key const &key, std::string_view message,
+                                        std::span<const std::uint8_t> signature);
+
+    /**
+     * \brief Verifies a pure Ed25519 signature as produced by Ed25519Signer, e.g. one of a cross-signing key object.
+     *
+     * \param key The Ed25519 public key of the signer.
+     * \param message The message that was signed.
+     * \param signature The signature to check.
+     * \return True if the signature is valid for the message and key, false otherwise.
+     */
+    [[nodiscard]] bool verify_pure_signature(Botan::Public_Key const &key, std::string_view message,
+                                             std::span<const std::uint8_t> signature);
+
+    /**
+     * \brief A bounded cache of signature verification results.
+     *
+     * Entries are keyed by the SHA-256 hash of the public key, the signature and the message, so a repeated check of
+     * an unchanged device or cross-signing signature costs one hash and one table lookup instead of an Ed25519
+     * verification. When the cache is full the least recently used entry is evicted.
+     *
+     * The cache is safe to share between threads.
+     */
+    class SignatureVerificationCache
+    {
+    public:
+        static constexpr std::size_t DEFAULT_CAPACITY = 4096; ///< The default number of cached results.
+
+        /**
+         * \brief Constructs an empty cache.
+         *
+         * \param capacity The maximum number of verification results to keep.
+         */
+        explicit SignatureVerificationCache(std::size_t capacity = DEFAULT_CAPACITY);
+
+        /**
+         * \brief Verifies a signature, consulting the cache first.
+         *
+         * \param key The Ed25519 public key of the signer.
+         * \param message The message that was signed.
+         * \param signature The signature to check.
+         * \return True if the signature is valid for the message and key, false otherwise.
+         */
+        [[nodiscard]] bool verify(Botan::Public_Key const &key, std::string_view message,
+                                  std::span<const std::uint8_t> signature);
+
+        /**
+         * \brief Drops all cached results.
+         */
+        void clear();
+
+        /**
+         * \brief Returns the number of cached results.
+         */
+        [[nodiscard]] std::size_t size() const;
+
+        /**
+         * \brief Returns the maximum number of cached results.
+         */
+        [[nodiscard]] std::size_t capacity() const { return max_entries; }
+
+        /**
+         * \brief Returns how many calls to verify() were answered from the cache.
+         */
+        [[nodiscard]] std::uint64_t hits() const;
+
+        /**
+         * \brief Returns how many calls to verify() needed a full verification.
+         */
+        [[nodiscard]] std::uint64_t misses() const;
+
+    private:
+        using Digest = std::array<std::uint8_t, 32>;
+
+        struct Entry
+        {
+            Digest digest;
+            bool valid;
+        };
+
+        std::size_t max_entries; ///< The maximum number of cached results.
+        std::list<Entry> entries; ///< The cached results, most recently used first.
+        std::unordered_map<Digest, std::list<Entry>::iterator, LeadingBytesHash> index; ///< Lookup table into entries.
+        std::uint64_t hit_count = 0;
+        std::uint64_t miss_count = 0;
+        mutable std::mutex mutex;
+    };
+} // namespace spank_olm
@@ -1,3 +1,4 @@
 #pragma once
 
-#include "account.hpp"
\ No newline at end of file
+#include "account.hpp"
+#include "signature.hpp"
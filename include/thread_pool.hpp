@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace spank_olm
+{
+    /**
+     * \brief A fixed set of worker threads which run submitted tasks in order of submission.
+     *
+     * The bulk operations of the library share this pool so that they don't each spawn and tear down their own
+     * threads. A pool without threads runs every task inline in submit(), which is what happens when building for
+     * WASM, where threads aren't available.
+     */
+    class ThreadPool
+    {
+    public:
+        /**
+         * \brief Starts the worker threads.
+         *
+         * \param threads The number of worker threads. 0 runs all tasks on the calling thread.
+         */
+        explicit ThreadPool(std::size_t threads = default_thread_count());
+
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool &operator=(ThreadPool const &) = delete;
+
+        /**
+         * \brief Waits for all queued tasks and stops the worker threads.
+         */
+        ~ThreadPool();
+
+        /**
+         * \brief Returns the number of hardware threads, or 0 if threads aren't available.
+         */
+        [[nodiscard]] static std::size_t default_thread_count();
+
+        /**
+         * \brief Returns the number of worker threads.
+         */
+        [[nodiscard]] std::size_t size() const { return workers.size(); }
+
+        /**
+         * \brief Queues a task.
+         *
+         * \param task The task to run. Exceptions it throws are passed on through the returned future.
+         * \return A future for the result of the task.
+         */
+        template <typename F>
+        std::future<std::invoke_result_t<F>> submit(F &&task)
+        {
+            using Result = std::invoke_result_t<F>;
+            auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+            auto future = packaged->get_future();
+            if (workers.empty())
+            {
+                (*packaged)();
+                return future;
+            }
+
+            {
+                std::lock_guard lock(mutex);
+                tasks.emplace_back([packaged] { (*packaged)(); });
+            }
+            condition.notify_one();
+            return future;
+        }
+
+        /**
+         * \brief Calls a function for every index in [0, count) and waits until all calls are done.
+         *
+         * The indices are split into one contiguous range per worker thread.
+         *
+         * \param count The number of indices.
+         * \param function The function to call with each index.
+         * \throws Rethrows the first exception thrown by one of the calls, after all of them have finished.
+         */
+        void parallel_for(std::size_t count, std::function<void(std::size_t)> const &function);
+
+        /**
+         * \brief Splits [0, count) into one contiguous range per worker thread, calls a function with the bounds of
+         * each range and waits until all calls are done.
+         *
+         * Use this instead of parallel_for() when each range needs its own state, e.g. a cipher or signer which must
+         * not be shared between threads. Without workers, or for a single index, the function is called once on the
+         * calling thread. No range is empty.
+         *
+         * \param count The number of indices.
+         * \param function The function to call with the first and one past the last index of each range.
+         * \throws Rethrows the first exception thrown by one of the calls, after all of them have finished.
+         */
+        void parallel_for_chunks(std::size_t count, std::function<void(std::size_t, std::size_t)> const &function);
+
+    private:
+        /**
+         * \brief Runs tasks from the queue until the pool is stopped.
+         */
+        void work();
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping = false;
+    };
+
+    /**
+     * \brief Runs tasks on a pool and hands their results on in the order they were submitted.
+     *
+     * This is the pipeline of the streaming bulk operations: a producer submits chunks of work, and their results
+     * reach a sink in order while the pool works on the next ones. Once the maximum number of tasks is in flight,
+     * submitting first hands on the result of the oldest, which bounds the memory held by finished results. The
+     * destructor waits for the tasks still running, as they reference the caller's state.
+     */
+    template <typename Result>
+    class InOrder
+    {
+    public:
+        /**
+         * \brief The number of tasks per worker thread which may be running or waiting to be handed on at once.
+         */
+        static constexpr std::size_t TASKS_IN_FLIGHT_PER_THREAD = 2;
+
+        explicit InOrder(ThreadPool &pool) :
+            pool(pool), max_in_flight(std::max<std::size_t>(1, pool.size()) * TASKS_IN_FLIGHT_PER_THREAD)
+        {
+        }
+
+        InOrder(InOrder const &) = delete;
+        InOrder &operator=(InOrder const &) = delete;
+
+        ~InOrder()
+        {
+            for (auto &task : in_flight)
+            {
+                task.wait();
+            }
+        }
+
+        /**
+         * \brief Queues a task, first handing the oldest result to deliver if too many tasks are in flight.
+         *
+         * \throws Rethrows an exception of the task whose result is handed on, or of deliver.
+         */
+        template <typename Task, typename Deliver>
+        void submit(Task &&task, Deliver const &deliver)
+        {
+            if (in_flight.size() >= max_in_flight)
+            {
+                deliver_next(deliver);
+            }
+            in_flight.push_back(pool.submit(std::forward<Task>(task)));
+        }
+
+        /**
+         * \brief Hands the results of all remaining tasks to deliver, in order.
+         */
+        template <typename Deliver>
+        void drain(Deliver const &deliver)
+        {
+            while (!in_flight.empty())
+            {
+                deliver_next(deliver);
+            }
+        }
+
+    private:
+        template <typename Deliver>
+        void deliver_next(Deliver const &deliver)
+        {
+            auto task = std::move(in_flight.front());
+            in_flight.pop_front();
+            deliver(task.get());
+        }
+
+        ThreadPool &pool;
+        std::size_t max_in_flight;
+        std::deque<std::future<Result>> in_flight;
+    };
+} // namespace spank_olm
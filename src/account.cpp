@@ -1,12 +1,20 @@
 #include "account.hpp"
 #include "errors.hpp"
 #include "pickle.hpp"
+#include "signature.hpp"
 
+#include <algorithm>
 #include <botan/pubkey.h>
 #include <botan/rng.h>
 
 namespace spank_olm
 {
+    namespace
+    {
+        constexpr std::string_view OLM_ALGORITHM = "m.olm.v1.curve25519-aes-sha2";
+        constexpr std::string_view MEGOLM_ALGORITHM = "m.megolm.v1.aes-sha2";
+    } // namespace
+
     void Account::new_account(Botan::RandomNumberGenerator &rng)
     {
         identity_keys = IdentityKeys{Botan::Ed25519_PrivateKey(rng), Botan::X25519_PrivateKey(rng)};
@@ -26,25 +34,143 @@ namespace spank_olm
         auto curve25519_key = identity_keys->curve25519_key.public_key()->raw_public_key_bits();
         auto ed25519_key = identity_keys->ed25519_key.public_key()->raw_public_key_bits();
 
-        const auto curve25519_base64 = Botan::base64_encode(curve25519_key);
-        const auto ed25519_base64 = Botan::base64_encode(ed25519_key);
+        const auto curve25519_base64 = base64_encode(curve25519_key);
+        const auto ed25519_base64 = base64_encode(ed25519_key);
 
         return R"({"curve25519": ")" + curve25519_base64 + R"(", "ed25519": ")" + ed25519_base64 + "\"}";
     }
 
     std::vector<uint8_t> Account::sign(Botan::RandomNumberGenerator &rng, const std::string_view message) const
     {
-        // According to https://botan.randombit.net/handbook/api_ref/pubkey.html#ed25519-ed448-variants
-        const std::string padding_scheme = "Ed25519ph";
-
         // Use the Ed25519 key to sign the message using the Botan library.
+        Ed25519phSigner signer(identity_keys->ed25519_key, rng);
+        signer.update(message);
+        return signer.finish(rng);
+    }
 
+    Ed25519phSigner Account::start_signature(Botan::RandomNumberGenerator &rng) const
+    {
+        return {identity_keys->ed25519_key, rng};
+    }
 
-        Botan::PK_Signer signer(identity_keys->ed25519_key, rng, padding_scheme);
-        signer.update(message);
-        auto signature = signer.signature(rng);
+    std::vector<uint8_t> Account::sign_file(Botan::RandomNumberGenerator &rng, std::filesystem::path const &path) const
+    {
+        return spank_olm::sign_file(identity_keys->ed25519_key, rng, path);
+    }
 
-        return signature;
+    std::string Account::get_signed_device_keys_json(Botan::RandomNumberGenerator &rng,
+                                                     const std::string_view user_id,
+                                                     const std::string_view device_id) const
+    {
+        std::string json;
+        CanonicalJsonWriter writer(json);
+        auto signer = start_signature(rng);
+
+        writer.begin_signed_object(signer);
+        writer.key("algorithms");
+        writer.begin_array();
+        writer.string_value(OLM_ALGORITHM);
+        writer.string_value(MEGOLM_ALGORITHM);
+        writer.end_array();
+        writer.key("device_id");
+        writer.string_value(device_id);
+        writer.key("keys");
+        writer.begin_object();
+        writer.key("curve25519", device_id);
+        writer.base64_value(identity_keys->curve25519_key.public_key()->raw_public_key_bits());
+        writer.key("ed25519", device_id);
+        writer.base64_value(identity_keys->ed25519_key.public_key()->raw_public_key_bits());
+        writer.end_object();
+        writer.signatures_position();
+        writer.key("user_id");
+        writer.string_value(user_id);
+        writer.end_signed_object(rng, user_id, device_id);
+        return json;
+    }
+
+    void Account::write_signed_key(CanonicalJsonWriter &writer, Ed25519phSigner &signer,
+                                   Botan::RandomNumberGenerator &rng, OneTimeKey const &key, const bool fallback,
+                                   const std::string_view user_id, const std::string_view device_id)
+    {
+        writer.begin_signed_object(signer);
+        if (fallback)
+        {
+            writer.key("fallback");
+            writer.bool_value(true);
+        }
+        writer.key("key");
+        writer.base64_value(key.key.public_key()->raw_public_key_bits());
+        writer.end_signed_object(rng, user_id, device_id);
+    }
+
+    SignedKeys Account::get_signed_keys_json(const std::string_view user_id, const std::string_view device_id,
+                                             ThreadPool &pool) const
+    {
+        struct UnpublishedKey
+        {
+            std::string id;
+            OneTimeKey const *key;
+        };
+
+        // Canonical JSON sorts the keys as strings, so "signed_curve25519:10" comes before "signed_curve25519:9".
+        std::vector<UnpublishedKey> unpublished;
+        for (const auto &key : one_time_keys)
+        {
+            if (!key->published)
+            {
+                unpublished.push_back({std::to_string(key->id), &*key});
+            }
+        }
+        std::ranges::sort(unpublished, {}, &UnpublishedKey::id);
+
+        const auto write_key = [&](CanonicalJsonWriter &writer, Ed25519phSigner &signer, UnpublishedKey const &key,
+                                   const bool fallback) {
+            Botan::Null_RNG null_rng;
+            writer.key("signed_curve25519", key.id);
+            write_signed_key(writer, signer, null_rng, *key.key, fallback, user_id, device_id);
+        };
+
+        // Each range writes its part at the index of its first key; the other entries stay empty.
+        std::vector<std::string> parts(unpublished.size());
+        pool.parallel_for_chunks(unpublished.size(), [&](const std::size_t begin, const std::size_t end) {
+            Botan::Null_RNG null_rng;
+            Ed25519phSigner signer(identity_keys->ed25519_key, null_rng);
+            CanonicalJsonWriter writer(parts[begin]);
+            writer.begin_object();
+            for (auto i = begin; i < end; ++i)
+            {
+                write_key(writer, signer, unpublished[i], false);
+            }
+            writer.end_object();
+        });
+
+        SignedKeys keys;
+        keys.one_time_keys = "{";
+        for (auto const &part : parts)
+        {
+            if (part.empty())
+            {
+                continue;
+            }
+            if (keys.one_time_keys.size() > 1)
+            {
+                keys.one_time_keys += ',';
+            }
+            // Drop the braces of the part's object.
+            keys.one_time_keys.append(part, 1, part.size() - 2);
+        }
+        keys.one_time_keys += '}';
+
+        CanonicalJsonWriter writer(keys.fallback_keys);
+        writer.begin_object();
+        if (current_fallback_key && !current_fallback_key->published)
+        {
+            Botan::Null_RNG null_rng;
+            Ed25519phSigner signer(identity_keys->ed25519_key, null_rng);
+            write_key(writer, signer, {std::to_string(current_fallback_key->id), &*current_fallback_key}, true);
+        }
+        writer.end_object();
+        return keys;
     }
 
     std::size_t Account::mark_keys_as_published()
@@ -59,7 +185,10 @@ namespace spank_olm
             }
         }
 
-        current_fallback_key->published = true;
+        if (current_fallback_key)
+        {
+            current_fallback_key->published = true;
+        }
         return count;
     }
 
@@ -88,32 +217,35 @@ namespace spank_olm
 
     std::optional<OneTimeKey const *> Account::lookup_key(Botan::Public_Key const &key) const
     {
+        // Compare the stored public values, instead of creating a public key object for every key.
+        const auto wanted = key.raw_public_key_bits();
+
         for (const auto &one_time_key : one_time_keys)
         {
-            if (one_time_key->key.public_key()->raw_public_key_bits() == key.raw_public_key_bits())
+            if (one_time_key->key.raw_public_key_bits() == wanted)
             {
                 return one_time_key;
             }
         }
-        if (current_fallback_key &&
-            current_fallback_key->key.public_key()->raw_public_key_bits() == key.raw_public_key_bits())
+        if (current_fallback_key && current_fallback_key->key.raw_public_key_bits() == wanted)
         {
             return &current_fallback_key.value();
         }
-        if (prev_fallback_key &&
-            prev_fallback_key->key.public_key()->raw_public_key_bits() == key.raw_public_key_bits())
+        if (prev_fallback_key && prev_fallback_key->key.raw_public_key_bits() == wanted)
         {
-            return &current_fallback_key.value();
+            return &prev_fallback_key.value();
         }
         return std::nullopt;
     }
 
     void Account::remove_key(Botan::Public_Key const &key)
     {
+        const auto wanted = key.raw_public_key_bits();
+
         // Use iterator to find and remove the key.
         for (const auto &one_time_key : one_time_keys)
         {
-            if (one_time_key->key.public_key()->raw_public_key_bits() == key.raw_public_key_bits())
+            if (one_time_key->key.raw_public_key_bits() == wanted)
             {
                 one_time_keys.erase(one_time_key);
                 return;
@@ -122,46 +254,42 @@ namespace spank_olm
     }
 
 
-    namespace
+    std::uint8_t Account::fallback_key_count() const
     {
-        /**
-         * \brief The current version of the account pickle format.
-         *
-         * \details
-         * - Version 1 used only 32 bytes for the ed25519 private key. Any keys thus used should be considered
-         * compromised.
-         * - Version 2 does not have fallback keys.
-         * - Version 3 does not store whether the current fallback key is published.
-         */
-        constexpr std::uint32_t ACCOUNT_PICKLE_VERSION = 4;
-    } // namespace
-
+        // The previous fallback key is only stored alongside a current one.
+        if (!current_fallback_key)
+            return 0;
+        return prev_fallback_key ? 2 : 1;
+    }
 
-    /**
-     * Serializes the Account object into a byte array.
-     *
-     * @return A vector of uint8_t containing the serialized data.
-     */
-    std::vector<uint8_t> Account::pickle() const
+    std::size_t Account::pickle_length() const
     {
-        std::vector<uint8_t> buffer(1024); // Initial buffer size, can be adjusted
-        auto pos = buffer.data();
+        std::size_t length = spank_olm::pickle_length(ACCOUNT_PICKLE_VERSION);
+        length += spank_olm::pickle_length(*identity_keys);
+        length += spank_olm::pickle_length(one_time_keys);
+        length += spank_olm::pickle_length(fallback_key_count());
+        if (current_fallback_key)
+        {
+            length += spank_olm::pickle_length(*current_fallback_key);
+            if (prev_fallback_key)
+            {
+                length += spank_olm::pickle_length(*prev_fallback_key);
+            }
+        }
+        length += spank_olm::pickle_length(next_one_time_key_id);
+        return length;
+    }
 
+    std::uint8_t *Account::pickle(std::uint8_t *pos) const
+    {
         pos = spank_olm::pickle(pos, ACCOUNT_PICKLE_VERSION);
 
         pos = spank_olm::pickle(pos, identity_keys);
 
         pos = spank_olm::pickle(pos, one_time_keys);
 
-        // Calculate the number of fallback keys
-        std::uint8_t fallback_key_count = 0;
-        if (current_fallback_key && current_fallback_key->published)
-            fallback_key_count++;
-        if (prev_fallback_key && prev_fallback_key->published)
-            fallback_key_count++;
-
         // Serialize the fallback key count
-        pos = spank_olm::pickle(pos, fallback_key_count);
+        pos = spank_olm::pickle(pos, fallback_key_count());
 
         if (current_fallback_key)
         {
@@ -174,21 +302,68 @@ namespace spank_olm
 
         pos = spank_olm::pickle(pos, next_one_time_key_id);
 
-        buffer.resize(pos - buffer.data()); // Adjust buffer size to actual data size
+        return pos;
+    }
+
+    std::size_t Account::pickle(const std::span<uint8_t> buffer) const
+    {
+        const auto length = pickle_length();
+        if (buffer.size() < length)
+        {
+            throw SpankOlmErrorOutputBufferTooSmall();
+        }
+        pickle(buffer.data());
+        return length;
+    }
+
+    /**
+     * Serializes the Account object into a byte array.
+     *
+     * @return A vector of uint8_t containing the serialized data.
+     */
+    std::vector<uint8_t> Account::pickle() const
+    {
+        std::vector<uint8_t> buffer(pickle_length());
+        pickle(buffer.data());
         return buffer;
     }
 
+    std::pmr::vector<uint8_t> Account::pickle(std::pmr::memory_resource *resource) const
+    {
+        std::pmr::vector<uint8_t> buffer(pickle_length(), resource);
+        pickle(buffer.data());
+        return buffer;
+    }
+
+    std::string Account::pickle(PickleCipher &cipher) const
+    {
+        // Pickle straight into the buffer which is then encrypted in place.
+        Botan::secure_vector<uint8_t> buffer;
+        buffer.reserve(PickleCipher::buffer_length(pickle_length()));
+        buffer.resize(pickle_length());
+        pickle(buffer.data());
+        return cipher.seal(buffer);
+    }
+
+    Account Account::unpickle(std::vector<uint8_t> const &data) { return unpickle(std::span<const uint8_t>(data)); }
+
+    Account Account::unpickle(PickleCipher &cipher, const std::string_view encrypted)
+    {
+        const auto data = cipher.decrypt(encrypted);
+        return unpickle(std::span<const uint8_t>(data));
+    }
+
     /**
      * Deserializes an Account object from a byte array.
      *
-     * @param data A vector of uint8_t containing the serialized data.
+     * @param data A span of uint8_t containing the serialized data.
      * @return The deserialized Account object.
      * @throws SpankOlmErrorVersionNotFound if the pickle version is not found.
      * @throws SpankOlmErrorBadLegacyAccountPickle if the pickle version is 1.
      * @throws SpankOlmErrorUnknownPickleVersion if the pickle version is unknown.
      * @throws SpankOlmErrorCorruptedAccountPickle if the pickle data is corrupted.
      */
-    Account Account::unpickle(std::vector<uint8_t> const &data)
+    Account Account::unpickle(const std::span<const uint8_t> data)
     {
         Account value;
         auto pos = data.data();
@@ -224,7 +399,11 @@ namespace spank_olm
             throw SpankOlmErrorCorruptedAccountPickle();
         }
 
-        if (pickle_version == 3)
+        if (pickle_version == 2)
+        {
+            // Version 2 did not have fallback keys.
+        }
+        else if (pickle_version == 3)
         {
             pos = spank_olm::unpickle(pos, end, value.current_fallback_key);
             if (!pos)
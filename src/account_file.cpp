@@ -0,0 +1,573 @@
+#include "account_file.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <array>
+#include <botan/mem_ops.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::array<std::uint8_t, 4> MAGIC = {'S', 'O', 'A', 'F'};
+
+        // Header fields.
+        constexpr std::size_t VERSION_OFFSET = 4;
+        constexpr std::size_t RECORD_SIZE_OFFSET = 8;
+        constexpr std::size_t RECORD_COUNT_OFFSET = 12;
+        constexpr std::size_t NEXT_KEY_ID_OFFSET = 16;
+        constexpr std::size_t ONE_TIME_KEY_COUNT_OFFSET = 20;
+        constexpr std::size_t HEADER_SIZE = 32;
+
+        // Offset table.
+        constexpr std::size_t IDENTITY_OFFSET_OFFSET = HEADER_SIZE;
+        constexpr std::size_t ID_INDEX_OFFSET_OFFSET = HEADER_SIZE + 4;
+        constexpr std::size_t RECORDS_OFFSET_OFFSET = HEADER_SIZE + 8;
+        constexpr std::size_t OFFSET_TABLE_SIZE = 12;
+
+        constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+        constexpr std::size_t align_to_cache_line(const std::size_t offset)
+        {
+            return (offset + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+        }
+
+        // Identity keys.
+        constexpr std::size_t ED25519_PUBLIC_KEY_LENGTH = 32;
+        constexpr std::size_t ED25519_PRIVATE_KEY_LENGTH = 64;
+        constexpr std::size_t CURVE25519_KEY_LENGTH = 32;
+        constexpr std::size_t ED25519_PRIVATE_OFFSET = ED25519_PUBLIC_KEY_LENGTH;
+        constexpr std::size_t CURVE25519_PUBLIC_OFFSET = ED25519_PRIVATE_OFFSET + ED25519_PRIVATE_KEY_LENGTH;
+        constexpr std::size_t CURVE25519_PRIVATE_OFFSET = CURVE25519_PUBLIC_OFFSET + CURVE25519_KEY_LENGTH;
+        constexpr std::size_t IDENTITY_SIZE = CURVE25519_PRIVATE_OFFSET + CURVE25519_KEY_LENGTH;
+
+        // Id index: one entry per one-time key slot, holding the record slot plus one or zero if unused.
+        constexpr std::size_t ID_INDEX_ENTRY_SIZE = 2;
+
+        // Key records.
+        constexpr std::size_t RECORD_ID_OFFSET = 0;
+        constexpr std::size_t RECORD_FLAGS_OFFSET = 4;
+        constexpr std::size_t RECORD_PUBLIC_OFFSET = 8;
+        constexpr std::size_t RECORD_PUBLIC_LENGTH = 24;
+        constexpr std::size_t RECORD_PRIVATE_OFFSET = RECORD_PUBLIC_OFFSET + RECORD_PUBLIC_LENGTH;
+        constexpr std::size_t RECORD_SIZE = RECORD_PRIVATE_OFFSET + CURVE25519_KEY_LENGTH;
+        static_assert(RECORD_SIZE == CACHE_LINE_SIZE);
+
+        constexpr std::uint8_t FLAG_IN_USE = 1;
+        constexpr std::uint8_t FLAG_PUBLISHED = 2;
+        constexpr std::uint8_t FLAG_REMOVED = 4;
+
+        constexpr std::size_t SLOT_MASK = AccountFile::ONE_TIME_KEY_SLOTS - 1;
+
+        constexpr std::size_t CURRENT_FALLBACK_KEY = AccountFile::ONE_TIME_KEY_SLOTS;
+        constexpr std::size_t PREV_FALLBACK_KEY = AccountFile::ONE_TIME_KEY_SLOTS + 1;
+
+        constexpr std::size_t IDENTITY_START = align_to_cache_line(HEADER_SIZE + OFFSET_TABLE_SIZE);
+        constexpr std::size_t ID_INDEX_START = align_to_cache_line(IDENTITY_START + IDENTITY_SIZE);
+        constexpr std::size_t ID_INDEX_SIZE = AccountFile::ONE_TIME_KEY_SLOTS * ID_INDEX_ENTRY_SIZE;
+        constexpr std::size_t RECORDS_START = align_to_cache_line(ID_INDEX_START + ID_INDEX_SIZE);
+        constexpr std::size_t FILE_SIZE = RECORDS_START + AccountFile::RECORD_COUNT * RECORD_SIZE;
+
+        std::uint32_t load_u32(std::uint8_t const *pos)
+        {
+            return static_cast<std::uint32_t>(pos[0]) | static_cast<std::uint32_t>(pos[1]) << 8 |
+                static_cast<std::uint32_t>(pos[2]) << 16 | static_cast<std::uint32_t>(pos[3]) << 24;
+        }
+
+        void store_u32(std::uint8_t *pos, const std::uint32_t value)
+        {
+            pos[0] = static_cast<std::uint8_t>(value);
+            pos[1] = static_cast<std::uint8_t>(value >> 8);
+            pos[2] = static_cast<std::uint8_t>(value >> 16);
+            pos[3] = static_cast<std::uint8_t>(value >> 24);
+        }
+
+        std::uint16_t load_u16(std::uint8_t const *pos)
+        {
+            return static_cast<std::uint16_t>(pos[0] | pos[1] << 8);
+        }
+
+        void store_u16(std::uint8_t *pos, const std::uint16_t value)
+        {
+            pos[0] = static_cast<std::uint8_t>(value);
+            pos[1] = static_cast<std::uint8_t>(value >> 8);
+        }
+
+        /**
+         * \brief Returns the one-time key slot where probing for a public key starts.
+         *
+         * This is leading_bytes_hash() read in little-endian order, so the file means the same on every machine.
+         */
+        std::size_t home_slot(std::uint8_t const *public_key) { return load_u32(public_key) & SLOT_MASK; }
+
+        template <typename Bits>
+        void store_bits(std::uint8_t *pos, Bits const &bits, const std::size_t length)
+        {
+            std::memcpy(pos, bits.data(), std::min(bits.size(), length));
+        }
+
+        void store_record(std::uint8_t *pos, OneTimeKey const &key, std::span<const std::uint8_t> public_key)
+        {
+            store_u32(pos + RECORD_ID_OFFSET, key.id);
+            pos[RECORD_FLAGS_OFFSET] = FLAG_IN_USE | (key.published ? FLAG_PUBLISHED : 0);
+            store_bits(pos + RECORD_PUBLIC_OFFSET, public_key, RECORD_PUBLIC_LENGTH);
+            store_bits(pos + RECORD_PRIVATE_OFFSET, key.key.raw_private_key_bits(), CURVE25519_KEY_LENGTH);
+        }
+
+        OneTimeKey load_record(std::uint8_t const *pos)
+        {
+            return OneTimeKey{load_u32(pos + RECORD_ID_OFFSET), (pos[RECORD_FLAGS_OFFSET] & FLAG_PUBLISHED) != 0,
+                              Botan::X25519_PrivateKey(
+                                  std::span(pos + RECORD_PRIVATE_OFFSET, CURVE25519_KEY_LENGTH))};
+        }
+
+        /**
+         * \brief Closes a file descriptor when it goes out of scope.
+         */
+        struct FileDescriptor
+        {
+            int fd;
+
+            ~FileDescriptor()
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+        };
+    } // namespace
+
+    void AccountFile::write(std::filesystem::path const &path, Account const &account)
+    {
+        if (!account.identity_keys)
+        {
+            throw SpankOlmErrorIO();
+        }
+
+        Botan::secure_vector<std::uint8_t> buffer(FILE_SIZE);
+        const auto data = buffer.data();
+
+        std::copy(MAGIC.begin(), MAGIC.end(), data);
+        store_u32(data + VERSION_OFFSET, VERSION);
+        store_u32(data + RECORD_SIZE_OFFSET, RECORD_SIZE);
+        store_u32(data + RECORD_COUNT_OFFSET, RECORD_COUNT);
+        store_u32(data + NEXT_KEY_ID_OFFSET, account.next_one_time_key_id);
+        store_u32(data + ONE_TIME_KEY_COUNT_OFFSET, static_cast<std::uint32_t>(account.one_time_keys.size()));
+
+        store_u32(data + IDENTITY_OFFSET_OFFSET, IDENTITY_START);
+        store_u32(data + ID_INDEX_OFFSET_OFFSET, ID_INDEX_START);
+        store_u32(data + RECORDS_OFFSET_OFFSET, RECORDS_START);
+
+        const auto identity = data + IDENTITY_START;
+        const auto &identity_keys = *account.identity_keys;
+        store_bits(identity, identity_keys.ed25519_key.raw_public_key_bits(), ED25519_PUBLIC_KEY_LENGTH);
+        store_bits(identity + ED25519_PRIVATE_OFFSET, identity_keys.ed25519_key.raw_private_key_bits(),
+                   ED25519_PRIVATE_KEY_LENGTH);
+        store_bits(identity + CURVE25519_PUBLIC_OFFSET, identity_keys.curve25519_key.raw_public_key_bits(),
+                   CURVE25519_KEY_LENGTH);
+        store_bits(identity + CURVE25519_PRIVATE_OFFSET, identity_keys.curve25519_key.raw_private_key_bits(),
+                   CURVE25519_KEY_LENGTH);
+
+        // One-time keys go into an open-addressing table keyed by their public key, with linear probing. The id
+        // index is a second such table keyed by the id, pointing at the record slots. Unlike ProbeTable, removal
+        // leaves a marker instead of shifting records back: a shift writes several records of the mapping, and a
+        // crash between them could leave keys unreachable.
+        const auto id_index = data + ID_INDEX_START;
+        const auto records = data + RECORDS_START;
+        for (const auto &key : account.one_time_keys)
+        {
+            const auto public_key = key->key.raw_public_key_bits();
+            auto slot = home_slot(public_key.data());
+            while (records[slot * RECORD_SIZE + RECORD_FLAGS_OFFSET] != 0)
+            {
+                slot = (slot + 1) & SLOT_MASK;
+            }
+            store_record(records + slot * RECORD_SIZE, *key, public_key);
+
+            auto entry = key->id & SLOT_MASK;
+            while (load_u16(id_index + entry * ID_INDEX_ENTRY_SIZE) != 0)
+            {
+                entry = (entry + 1) & SLOT_MASK;
+            }
+            store_u16(id_index + entry * ID_INDEX_ENTRY_SIZE, static_cast<std::uint16_t>(slot + 1));
+        }
+        if (account.current_fallback_key)
+        {
+            store_record(records + CURRENT_FALLBACK_KEY * RECORD_SIZE, *account.current_fallback_key,
+                         account.current_fallback_key->key.raw_public_key_bits());
+        }
+        if (account.prev_fallback_key)
+        {
+            store_record(records + PREV_FALLBACK_KEY * RECORD_SIZE, *account.prev_fallback_key,
+                         account.prev_fallback_key->key.raw_public_key_bits());
+        }
+
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            const FileDescriptor file{::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)};
+            if (file.fd < 0)
+            {
+                throw SpankOlmErrorIO();
+            }
+            std::size_t written = 0;
+            while (written < buffer.size())
+            {
+                const auto result = ::write(file.fd, data + written, buffer.size() - written);
+                if (result < 0)
+                {
+                    std::filesystem::remove(temporary);
+                    throw SpankOlmErrorIO();
+                }
+                written += static_cast<std::size_t>(result);
+            }
+            if (::fsync(file.fd) != 0)
+            {
+                std::filesystem::remove(temporary);
+                throw SpankOlmErrorIO();
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temporary);
+            throw SpankOlmErrorIO();
+        }
+
+        // Make the rename itself durable.
+        const FileDescriptor directory{::open(path.parent_path().empty() ? "." : path.parent_path().c_str(),
+                                              O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+        if (directory.fd >= 0)
+        {
+            ::fsync(directory.fd);
+        }
+    }
+
+    AccountFile AccountFile::open(std::filesystem::path const &path, const bool writable)
+    {
+        const FileDescriptor file{::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC)};
+        if (file.fd < 0)
+        {
+            throw SpankOlmErrorIO();
+        }
+
+        struct stat status{};
+        if (::fstat(file.fd, &status) != 0)
+        {
+            throw SpankOlmErrorIO();
+        }
+        const auto size = static_cast<std::size_t>(status.st_size);
+        if (size < HEADER_SIZE + OFFSET_TABLE_SIZE)
+        {
+            throw SpankOlmErrorCorruptedAccountFile();
+        }
+
+        const auto protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        const auto mapping = ::mmap(nullptr, size, protection, MAP_SHARED, file.fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            throw SpankOlmErrorIO();
+        }
+
+        // The mapping stays valid after the descriptor is closed.
+        AccountFile account_file(static_cast<std::uint8_t *>(mapping), size, writable);
+        const auto data = account_file.data;
+
+        if (!std::equal(MAGIC.begin(), MAGIC.end(), data))
+        {
+            throw SpankOlmErrorCorruptedAccountFile();
+        }
+        if (load_u32(data + VERSION_OFFSET) > VERSION)
+        {
+            throw SpankOlmErrorUnknownPickleVersion();
+        }
+        if (load_u32(data + VERSION_OFFSET) != VERSION || load_u32(data + RECORD_SIZE_OFFSET) != RECORD_SIZE ||
+            load_u32(data + RECORD_COUNT_OFFSET) != RECORD_COUNT)
+        {
+            throw SpankOlmErrorCorruptedAccountFile();
+        }
+
+        const auto fits = [size](const std::size_t offset, const std::size_t length)
+        { return offset >= HEADER_SIZE + OFFSET_TABLE_SIZE && offset <= size && size - offset >= length; };
+        const std::size_t identity_offset = load_u32(data + IDENTITY_OFFSET_OFFSET);
+        const std::size_t id_index_offset = load_u32(data + ID_INDEX_OFFSET_OFFSET);
+        const std::size_t records_offset = load_u32(data + RECORDS_OFFSET_OFFSET);
+        if (!fits(identity_offset, IDENTITY_SIZE) || !fits(id_index_offset, ID_INDEX_SIZE) ||
+            !fits(records_offset, RECORD_COUNT * RECORD_SIZE) || records_offset % CACHE_LINE_SIZE != 0 ||
+            load_u32(data + ONE_TIME_KEY_COUNT_OFFSET) > MAX_ONE_TIME_KEYS)
+        {
+            throw SpankOlmErrorCorruptedAccountFile();
+        }
+        for (std::size_t entry = 0; entry < ONE_TIME_KEY_SLOTS; ++entry)
+        {
+            if (load_u16(data + id_index_offset + entry * ID_INDEX_ENTRY_SIZE) > ONE_TIME_KEY_SLOTS)
+            {
+                throw SpankOlmErrorCorruptedAccountFile();
+            }
+        }
+
+        return account_file;
+    }
+
+    AccountFile::AccountFile(std::uint8_t *data, const std::size_t size, const bool writable) :
+        data(data), size(size), writable(writable)
+    {
+    }
+
+    AccountFile::AccountFile(AccountFile &&other) noexcept :
+        data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)), writable(other.writable)
+    {
+    }
+
+    AccountFile &AccountFile::operator=(AccountFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (data)
+            {
+                ::munmap(data, size);
+            }
+            data = std::exchange(other.data, nullptr);
+            size = std::exchange(other.size, 0);
+            writable = other.writable;
+        }
+        return *this;
+    }
+
+    AccountFile::~AccountFile()
+    {
+        if (data)
+        {
+            ::munmap(data, size);
+        }
+    }
+
+    std::span<const std::uint8_t> AccountFile::ed25519_public_key() const
+    {
+        return {data + load_u32(data + IDENTITY_OFFSET_OFFSET), ED25519_PUBLIC_KEY_LENGTH};
+    }
+
+    std::span<const std::uint8_t> AccountFile::curve25519_public_key() const
+    {
+        return {data + load_u32(data + IDENTITY_OFFSET_OFFSET) + CURVE25519_PUBLIC_OFFSET, CURVE25519_KEY_LENGTH};
+    }
+
+    std::string AccountFile::get_identity_json() const
+    {
+        const auto curve25519_base64 = base64_encode(curve25519_public_key());
+        const auto ed25519_base64 = base64_encode(ed25519_public_key());
+
+        return R"({"curve25519": ")" + curve25519_base64 + R"(", "ed25519": ")" + ed25519_base64 + "\"}";
+    }
+
+    std::vector<std::uint8_t> AccountFile::sign(Botan::RandomNumberGenerator &rng, const std::string_view message) const
+    {
+        const auto identity = data + load_u32(data + IDENTITY_OFFSET_OFFSET);
+        const auto key = Botan::Ed25519_PrivateKey::from_bytes(
+            std::span(identity + ED25519_PRIVATE_OFFSET, ED25519_PRIVATE_KEY_LENGTH));
+
+        Ed25519phSigner signer(key, rng);
+        signer.update(message);
+        return signer.finish(rng);
+    }
+
+    std::uint32_t AccountFile::next_one_time_key_id() const { return load_u32(data + NEXT_KEY_ID_OFFSET); }
+
+    std::size_t AccountFile::one_time_key_count() const { return load_u32(data + ONE_TIME_KEY_COUNT_OFFSET); }
+
+    std::uint8_t *AccountFile::record(const std::size_t index) const
+    {
+        return data + load_u32(data + RECORDS_OFFSET_OFFSET) + index * RECORD_SIZE;
+    }
+
+    std::uint8_t const *AccountFile::id_index() const { return data + load_u32(data + ID_INDEX_OFFSET_OFFSET); }
+
+    std::optional<std::pair<std::size_t, OneTimeKey>> AccountFile::find_record(Botan::Public_Key const &key) const
+    {
+        const auto wanted = key.raw_public_key_bits();
+        if (wanted.size() != CURVE25519_KEY_LENGTH)
+        {
+            return std::nullopt;
+        }
+        // The record only holds a prefix of the public key. Anyone can make a key with the prefix of one we published,
+        // so a prefix match is confirmed against the public key derived from the private one.
+        const auto match = [&](const std::size_t index) -> std::optional<std::pair<std::size_t, OneTimeKey>>
+        {
+            const auto pos = record(index);
+            if (!(pos[RECORD_FLAGS_OFFSET] & FLAG_IN_USE) ||
+                std::memcmp(pos + RECORD_PUBLIC_OFFSET, wanted.data(), RECORD_PUBLIC_LENGTH) != 0)
+            {
+                return std::nullopt;
+            }
+            auto found = load_record(pos);
+            if (found.key.public_value() != wanted)
+            {
+                return std::nullopt;
+            }
+            return std::pair{index, std::move(found)};
+        };
+
+        // A probe run ends at a slot that was never used; removed keys leave a marker that keeps it going.
+        auto slot = home_slot(wanted.data());
+        for (std::size_t probe = 0; probe < ONE_TIME_KEY_SLOTS && record(slot)[RECORD_FLAGS_OFFSET] != 0; ++probe)
+        {
+            if (auto found = match(slot))
+            {
+                return found;
+            }
+            slot = (slot + 1) & SLOT_MASK;
+        }
+
+        for (const auto index : {CURRENT_FALLBACK_KEY, PREV_FALLBACK_KEY})
+        {
+            if (auto found = match(index))
+            {
+                return found;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<OneTimeKey> AccountFile::lookup_key(Botan::Public_Key const &key) const
+    {
+        if (auto found = find_record(key))
+        {
+            return std::move(found->second);
+        }
+        return std::nullopt;
+    }
+
+    void AccountFile::require_writable() const
+    {
+        if (!writable)
+        {
+            throw SpankOlmErrorIO();
+        }
+    }
+
+    bool AccountFile::mark_as_published(const std::uint32_t id)
+    {
+        require_writable();
+        const auto publish = [&](std::uint8_t *pos)
+        {
+            if (!(pos[RECORD_FLAGS_OFFSET] & FLAG_IN_USE) || load_u32(pos + RECORD_ID_OFFSET) != id)
+            {
+                return false;
+            }
+            pos[RECORD_FLAGS_OFFSET] |= FLAG_PUBLISHED;
+            return true;
+        };
+
+        const auto index = id_index();
+        auto entry = id & SLOT_MASK;
+        for (std::size_t probe = 0; probe < ONE_TIME_KEY_SLOTS; ++probe)
+        {
+            const auto slot = load_u16(index + entry * ID_INDEX_ENTRY_SIZE);
+            if (slot == 0)
+            {
+                break;
+            }
+            if (publish(record(slot - 1)))
+            {
+                return true;
+            }
+            entry = (entry + 1) & SLOT_MASK;
+        }
+        return publish(record(CURRENT_FALLBACK_KEY)) || publish(record(PREV_FALLBACK_KEY));
+    }
+
+    std::size_t AccountFile::mark_keys_as_published()
+    {
+        require_writable();
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < ONE_TIME_KEY_SLOTS; ++i)
+        {
+            const auto pos = record(i);
+            if ((pos[RECORD_FLAGS_OFFSET] & FLAG_IN_USE) && !(pos[RECORD_FLAGS_OFFSET] & FLAG_PUBLISHED))
+            {
+                pos[RECORD_FLAGS_OFFSET] |= FLAG_PUBLISHED;
+                ++count;
+            }
+        }
+
+        const auto fallback = record(CURRENT_FALLBACK_KEY);
+        if (fallback[RECORD_FLAGS_OFFSET] & FLAG_IN_USE)
+        {
+            fallback[RECORD_FLAGS_OFFSET] |= FLAG_PUBLISHED;
+        }
+        return count;
+    }
+
+    bool AccountFile::remove_key(Botan::Public_Key const &key)
+    {
+        require_writable();
+        const auto found = find_record(key);
+        // Like Account::remove_key(), only one-time keys can be removed.
+        if (!found || found->first >= ONE_TIME_KEY_SLOTS)
+        {
+            return false;
+        }
+
+        // The file never gains keys in place, so the removal markers can't pile up.
+        const auto pos = record(found->first);
+        Botan::secure_scrub_memory(pos, RECORD_SIZE);
+        pos[RECORD_FLAGS_OFFSET] = FLAG_REMOVED;
+        store_u32(data + ONE_TIME_KEY_COUNT_OFFSET, load_u32(data + ONE_TIME_KEY_COUNT_OFFSET) - 1);
+        return true;
+    }
+
+    void AccountFile::sync()
+    {
+        if (::msync(data, size, MS_SYNC) != 0)
+        {
+            throw SpankOlmErrorIO();
+        }
+    }
+
+    Account AccountFile::to_account() const
+    {
+        Account account;
+        const auto identity = data + load_u32(data + IDENTITY_OFFSET_OFFSET);
+        account.identity_keys = IdentityKeys{
+            Botan::Ed25519_PrivateKey::from_bytes(
+                std::span(identity + ED25519_PRIVATE_OFFSET, ED25519_PRIVATE_KEY_LENGTH)),
+            Botan::X25519_PrivateKey(std::span(identity + CURVE25519_PRIVATE_OFFSET, CURVE25519_KEY_LENGTH))};
+
+        // The slots follow the public key hash, so restore the newest first order from the ids.
+        std::vector<std::pair<std::uint32_t, std::size_t>> used;
+        for (std::size_t i = 0; i < ONE_TIME_KEY_SLOTS; ++i)
+        {
+            const auto pos = record(i);
+            if (pos[RECORD_FLAGS_OFFSET] & FLAG_IN_USE)
+            {
+                used.emplace_back(load_u32(pos + RECORD_ID_OFFSET), i);
+            }
+        }
+        std::sort(used.begin(), used.end(), std::greater<>());
+        for (const auto &[id, index] : used)
+        {
+            account.one_time_keys.insert_at(account.one_time_keys.size(), load_record(record(index)));
+        }
+
+        if (record(CURRENT_FALLBACK_KEY)[RECORD_FLAGS_OFFSET] & FLAG_IN_USE)
+        {
+            account.current_fallback_key = load_record(record(CURRENT_FALLBACK_KEY));
+        }
+        if (record(PREV_FALLBACK_KEY)[RECORD_FLAGS_OFFSET] & FLAG_IN_USE)
+        {
+            account.prev_fallback_key = load_record(record(PREV_FALLBACK_KEY));
+        }
+        account.next_one_time_key_id = next_one_time_key_id();
+        return account;
+    }
+} // namespace spank_olm
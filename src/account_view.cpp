@@ -0,0 +1,230 @@
+#include "account_view.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+#include "pickle.hpp"
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::size_t ED25519_PUBLIC_KEY_LENGTH = 32;
+        constexpr std::size_t ED25519_PRIVATE_KEY_LENGTH = 64;
+        constexpr std::size_t CURVE25519_KEY_LENGTH = 32;
+
+        /**
+         * \brief Reads a length prefixed key and checks its length.
+         */
+        std::uint8_t const *unpickle_key(std::uint8_t const *pos, std::uint8_t const *end,
+                                         std::span<const std::uint8_t> &value, const std::size_t expected_length)
+        {
+            pos = unpickle(pos, end, value);
+            if (!pos || value.size() != expected_length)
+            {
+                throw SpankOlmErrorCorruptedAccountPickle();
+            }
+            return pos;
+        }
+
+        /**
+         * \brief Reads a one-time key record without copying the key.
+         */
+        std::uint8_t const *unpickle_record(std::uint8_t const *pos, std::uint8_t const *end,
+                                            AccountView::KeyRecord &record)
+        {
+            pos = unpickle(pos, end, record.id);
+            if (!pos)
+            {
+                throw SpankOlmErrorCorruptedAccountPickle();
+            }
+            pos = unpickle(pos, end, record.published);
+            if (!pos)
+            {
+                throw SpankOlmErrorCorruptedAccountPickle();
+            }
+            return unpickle_key(pos, end, record.private_key, CURVE25519_KEY_LENGTH);
+        }
+    } // namespace
+
+    AccountView AccountView::parse(const std::span<const std::uint8_t> data)
+    {
+        AccountView view;
+        auto pos = data.data();
+        const auto end = data.data() + data.size();
+
+        pos = unpickle(pos, end, view.version);
+        if (!pos)
+        {
+            throw SpankOlmErrorVersionNotFound();
+        }
+
+        switch (view.version)
+        {
+        case ACCOUNT_PICKLE_VERSION:
+        case 3:
+        case 2:
+            break;
+        case 1:
+            throw SpankOlmErrorBadLegacyAccountPickle();
+        default:
+            throw SpankOlmErrorUnknownPickleVersion();
+        }
+
+        pos = unpickle_key(pos, end, view.ed25519_public, ED25519_PUBLIC_KEY_LENGTH);
+        pos = unpickle_key(pos, end, view.ed25519_private, ED25519_PRIVATE_KEY_LENGTH);
+        pos = unpickle_key(pos, end, view.curve25519_public, CURVE25519_KEY_LENGTH);
+        pos = unpickle_key(pos, end, view.curve25519_private, CURVE25519_KEY_LENGTH);
+
+        std::uint32_t size;
+        pos = unpickle(pos, end, size);
+        if (!pos)
+        {
+            throw SpankOlmErrorCorruptedAccountPickle();
+        }
+        while (size-- && pos != end)
+        {
+            KeyRecord record{};
+            pos = unpickle_record(pos, end, record);
+            // Like Account::unpickle, keys beyond the maximum are dropped.
+            if (view.one_time_key_count < MAX_ONE_TIME_KEYS)
+            {
+                view.records[view.one_time_key_count++] = record;
+            }
+        }
+
+        if (view.version == 2)
+        {
+            // Version 2 did not have fallback keys.
+        }
+        else if (view.version == 3)
+        {
+            pos = unpickle_record(pos, end, view.records[CURRENT_FALLBACK_KEY]);
+            pos = unpickle_record(pos, end, view.records[PREV_FALLBACK_KEY]);
+            view.fallback_key_count = 2;
+        }
+        else
+        {
+            pos = unpickle(pos, end, view.fallback_key_count);
+            if (!pos || view.fallback_key_count >= 3)
+            {
+                throw SpankOlmErrorCorruptedAccountPickle();
+            }
+            if (view.fallback_key_count >= 1)
+            {
+                pos = unpickle_record(pos, end, view.records[CURRENT_FALLBACK_KEY]);
+            }
+            if (view.fallback_key_count >= 2)
+            {
+                pos = unpickle_record(pos, end, view.records[PREV_FALLBACK_KEY]);
+            }
+        }
+
+        pos = unpickle(pos, end, view.next_key_id);
+        if (!pos)
+        {
+            throw SpankOlmErrorCorruptedAccountPickle();
+        }
+
+        return view;
+    }
+
+    std::string AccountView::get_identity_json() const
+    {
+        const auto curve25519_base64 = base64_encode(curve25519_public);
+        const auto ed25519_base64 = base64_encode(ed25519_public);
+
+        return R"({"curve25519": ")" + curve25519_base64 + R"(", "ed25519": ")" + ed25519_base64 + "\"}";
+    }
+
+    std::optional<AccountView::KeyRecord> AccountView::current_fallback_key() const
+    {
+        if (fallback_key_count < 1)
+        {
+            return std::nullopt;
+        }
+        return records[CURRENT_FALLBACK_KEY];
+    }
+
+    std::optional<AccountView::KeyRecord> AccountView::prev_fallback_key() const
+    {
+        if (fallback_key_count < 2)
+        {
+            return std::nullopt;
+        }
+        return records[PREV_FALLBACK_KEY];
+    }
+
+    std::vector<std::uint8_t> AccountView::sign(Botan::RandomNumberGenerator &rng, const std::string_view message) const
+    {
+        if (!ed25519_key)
+        {
+            ed25519_key = Botan::Ed25519_PrivateKey::from_bytes(ed25519_private);
+        }
+
+        Ed25519phSigner signer(*ed25519_key, rng);
+        signer.update(message);
+        return signer.finish(rng);
+    }
+
+    OneTimeKey const &AccountView::materialize(const std::size_t record) const
+    {
+        if (const auto it = keys.find(record); it != keys.end())
+        {
+            return it->second;
+        }
+
+        const auto &stored = records[record];
+        const auto [it, inserted] = keys.emplace(
+            record, OneTimeKey{stored.id, stored.published, Botan::X25519_PrivateKey(stored.private_key)});
+        return it->second;
+    }
+
+    std::optional<OneTimeKey const *> AccountView::lookup_key(Botan::Public_Key const &key) const
+    {
+        const auto wanted = key.raw_public_key_bits();
+        const auto hash_of = [this](const std::uint32_t record)
+        { return leading_bytes_hash(materialize(record).key.raw_public_key_bits()); };
+
+        const auto slot = index.find(leading_bytes_hash(wanted), [&](const std::uint32_t record)
+                                     { return materialize(record).key.raw_public_key_bits() == wanted; });
+        if (slot != ProbeTable::NONE)
+        {
+            return &materialize(index[slot]);
+        }
+
+        // Build and index the keys the earlier lookups didn't get to, in order, until one matches.
+        while (indexed < one_time_key_count + fallback_key_count)
+        {
+            const auto record =
+                indexed < one_time_key_count ? indexed : CURRENT_FALLBACK_KEY + (indexed - one_time_key_count);
+            const auto &built = materialize(record);
+            index.insert(static_cast<std::uint32_t>(record), hash_of);
+            ++indexed;
+            if (built.key.raw_public_key_bits() == wanted)
+            {
+                return &built;
+            }
+        }
+        return std::nullopt;
+    }
+
+    Account AccountView::to_account() const
+    {
+        Account account;
+        account.identity_keys = IdentityKeys{Botan::Ed25519_PrivateKey::from_bytes(ed25519_private),
+                                             Botan::X25519_PrivateKey(curve25519_private)};
+        for (std::size_t i = 0; i < one_time_key_count; ++i)
+        {
+            account.one_time_keys.insert_at(account.one_time_keys.size(), materialize(i));
+        }
+        if (fallback_key_count >= 1)
+        {
+            account.current_fallback_key = materialize(CURRENT_FALLBACK_KEY);
+        }
+        if (fallback_key_count >= 2)
+        {
+            account.prev_fallback_key = materialize(PREV_FALLBACK_KEY);
+        }
+        account.next_one_time_key_id = next_key_id;
+        return account;
+    }
+} // namespace spank_olm
@@ -0,0 +1,194 @@
+#include "attachment.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <botan/mem_ops.h>
+#include <future>
+#include <vector>
+
+namespace spank_olm
+{
+    namespace
+    {
+        /**
+         * \brief AES-256-CTR with the 64 bit counter of WebCrypto, which wraps around without carrying into the nonce.
+         */
+        constexpr std::string_view ATTACHMENT_CIPHER = "CTR-BE(AES-256,8)";
+
+        std::unique_ptr<Botan::StreamCipher> create_cipher(AttachmentInfo const &info, const std::uint64_t offset)
+        {
+            auto cipher = Botan::StreamCipher::create_or_throw(ATTACHMENT_CIPHER);
+            cipher->set_key(info.key);
+            cipher->set_iv(info.iv);
+            if (offset != 0)
+            {
+                cipher->seek(offset);
+            }
+            return cipher;
+        }
+
+        std::unique_ptr<Botan::HashFunction> create_hash() { return Botan::HashFunction::create_or_throw("SHA-256"); }
+
+        void check_output_length(const std::span<const std::uint8_t> input, const std::span<std::uint8_t> output)
+        {
+            if (output.size() < input.size())
+            {
+                throw SpankOlmErrorOutputBufferTooSmall();
+            }
+        }
+
+        AttachmentInfo random_info(Botan::RandomNumberGenerator &rng)
+        {
+            AttachmentInfo info{};
+            rng.randomize(info.key);
+            rng.randomize(info.iv);
+            info.iv[8] &= 0x7f;
+            return info;
+        }
+
+        /**
+         * \brief The segments of an attachment being processed on the pool.
+         *
+         * The destructor waits for the segments still running, as they reference the caller's buffers.
+         */
+        struct Segments
+        {
+            explicit Segments(const std::size_t length) :
+                count((length + ATTACHMENT_SEGMENT_LENGTH - 1) / ATTACHMENT_SEGMENT_LENGTH)
+            {
+                tasks.reserve(count);
+            }
+
+            Segments(Segments const &) = delete;
+            Segments &operator=(Segments const &) = delete;
+
+            ~Segments()
+            {
+                for (auto &task : tasks)
+                {
+                    if (task.valid())
+                    {
+                        task.wait();
+                    }
+                }
+            }
+
+            /**
+             * \brief Submits processing segment i to the pool.
+             */
+            void submit(ThreadPool &pool, AttachmentInfo const &info, std::span<const std::uint8_t> input,
+                        std::span<std::uint8_t> output, const std::size_t i)
+            {
+                const auto offset = i * ATTACHMENT_SEGMENT_LENGTH;
+                const auto length = std::min(ATTACHMENT_SEGMENT_LENGTH, input.size() - offset);
+                input = input.subspan(offset, length);
+                output = output.subspan(offset, length);
+                tasks.push_back(pool.submit([&info, input, output, offset] {
+                    create_cipher(info, offset)->cipher(input, output);
+                }));
+            }
+
+            std::size_t count;
+            std::vector<std::future<void>> tasks;
+        };
+    } // namespace
+
+    AttachmentEncryption::AttachmentEncryption(Botan::RandomNumberGenerator &rng) :
+        info(random_info(rng)), cipher(create_cipher(info, 0)), hash(create_hash())
+    {
+    }
+
+    void AttachmentEncryption::update(const std::span<const std::uint8_t> plaintext,
+                                      const std::span<std::uint8_t> ciphertext)
+    {
+        check_output_length(plaintext, ciphertext);
+        const auto output = ciphertext.first(plaintext.size());
+        cipher->cipher(plaintext, output);
+        hash->update(output);
+    }
+
+    AttachmentInfo AttachmentEncryption::finish()
+    {
+        hash->final(info.sha256);
+        return info;
+    }
+
+    AttachmentDecryption::AttachmentDecryption(AttachmentInfo const &info) :
+        expected_hash(info.sha256), cipher(create_cipher(info, 0)), hash(create_hash())
+    {
+    }
+
+    void AttachmentDecryption::update(const std::span<const std::uint8_t> ciphertext,
+                                      const std::span<std::uint8_t> plaintext)
+    {
+        check_output_length(ciphertext, plaintext);
+        hash->update(ciphertext);
+        cipher->cipher(ciphertext, plaintext.first(ciphertext.size()));
+    }
+
+    void AttachmentDecryption::finish()
+    {
+        std::array<std::uint8_t, ATTACHMENT_HASH_LENGTH> actual_hash;
+        hash->final(actual_hash);
+        if (!Botan::constant_time_compare(std::span<const std::uint8_t>(actual_hash), expected_hash))
+        {
+            throw SpankOlmErrorBadAttachmentHash();
+        }
+    }
+
+    AttachmentInfo encrypt_attachment(Botan::RandomNumberGenerator &rng, const std::span<const std::uint8_t> plaintext,
+                                      const std::span<std::uint8_t> ciphertext, ThreadPool &pool)
+    {
+        check_output_length(plaintext, ciphertext);
+        auto info = random_info(rng);
+        const auto hash = create_hash();
+
+        Segments segments(plaintext.size());
+        for (std::size_t i = 0; i < segments.count; ++i)
+        {
+            segments.submit(pool, info, plaintext, ciphertext, i);
+        }
+        // Hash the segments as they are done, while the workers go on with the later ones.
+        for (std::size_t i = 0; i < segments.count; ++i)
+        {
+            segments.tasks[i].get();
+            const auto offset = i * ATTACHMENT_SEGMENT_LENGTH;
+            const auto length = std::min(ATTACHMENT_SEGMENT_LENGTH, plaintext.size() - offset);
+            hash->update(ciphertext.subspan(offset, length));
+        }
+
+        hash->final(info.sha256);
+        return info;
+    }
+
+    void decrypt_attachment(AttachmentInfo const &info, const std::span<const std::uint8_t> ciphertext,
+                            const std::span<std::uint8_t> plaintext, ThreadPool &pool)
+    {
+        check_output_length(ciphertext, plaintext);
+        const auto hash = create_hash();
+
+        {
+            // A segment is only handed to a worker once it is hashed, so the ciphertext may be decrypted in place.
+            Segments segments(ciphertext.size());
+            for (std::size_t i = 0; i < segments.count; ++i)
+            {
+                const auto offset = i * ATTACHMENT_SEGMENT_LENGTH;
+                const auto length = std::min(ATTACHMENT_SEGMENT_LENGTH, ciphertext.size() - offset);
+                hash->update(ciphertext.subspan(offset, length));
+                segments.submit(pool, info, ciphertext, plaintext, i);
+            }
+            for (auto &task : segments.tasks)
+            {
+                task.get();
+            }
+        }
+
+        std::array<std::uint8_t, ATTACHMENT_HASH_LENGTH> actual_hash;
+        hash->final(actual_hash);
+        if (!Botan::constant_time_compare(std::span<const std::uint8_t>(actual_hash), info.sha256))
+        {
+            Botan::secure_scrub_memory(plaintext.data(), ciphertext.size());
+            throw SpankOlmErrorBadAttachmentHash();
+        }
+    }
+} // namespace spank_olm
@@ -0,0 +1,529 @@
+#include "base64.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <array>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SPANK_OLM_BASE64_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define SPANK_OLM_BASE64_NEON
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#define SPANK_OLM_BASE64_WASM
+#include <wasm_simd128.h>
+#endif
+
+/*
+ * All SIMD kernels use the same scheme, so they can be checked against each other:
+ *
+ * Encoding shuffles every 3 input bytes b0 b1 b2 into a 32-bit lane holding b1 b0 b2 b1 (little endian), from which
+ * the four 6-bit indices are cut out with shifts and masks. The indices are turned into ASCII by adding an offset
+ * which is looked up from the range the index falls into.
+ *
+ * Decoding maps every character to its 6-bit value with range compares, stopping at the first block which holds
+ * anything else, and packs each 32-bit lane of four values into three bytes with shifts and a shuffle.
+ *
+ * The kernels only handle whole blocks and never read or write outside of the buffers; the scalar code does the rest,
+ * including padding and error reporting.
+ */
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::array<char, 64> ALPHABET = {
+            'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+            'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+            'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+            'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
+
+        constexpr std::uint8_t INVALID = 0xff;
+
+        constexpr std::array<std::uint8_t, 256> make_decoding_table()
+        {
+            std::array<std::uint8_t, 256> table{};
+            table.fill(INVALID);
+            for (std::size_t i = 0; i < ALPHABET.size(); ++i)
+            {
+                table[static_cast<std::uint8_t>(ALPHABET[i])] = static_cast<std::uint8_t>(i);
+            }
+            return table;
+        }
+
+        constexpr std::array<std::uint8_t, 256> DECODING_TABLE = make_decoding_table();
+
+        /**
+         * \brief Encodes as many whole blocks as possible and returns the number of input bytes consumed.
+         */
+        using EncodeKernel = std::size_t (*)(std::uint8_t const *input, std::size_t length, char *output);
+
+        /**
+         * \brief Decodes as many whole valid blocks as possible and returns the number of characters consumed.
+         */
+        using DecodeKernel = std::size_t (*)(char const *input, std::size_t length, std::uint8_t *output,
+                                             std::size_t output_length);
+
+#if !defined(SPANK_OLM_BASE64_NEON) && !defined(SPANK_OLM_BASE64_WASM)
+        std::size_t encode_none(std::uint8_t const *, std::size_t, char *) { return 0; }
+
+        std::size_t decode_none(char const *, std::size_t, std::uint8_t *, std::size_t) { return 0; }
+#endif
+
+#ifdef SPANK_OLM_BASE64_X86
+        __attribute__((target("ssse3"))) __m128i to_ascii_ssse3(const __m128i indices)
+        {
+            const auto offsets = _mm_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0);
+            auto reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+            const auto less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+            reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+            return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, reduced));
+        }
+
+        __attribute__((target("ssse3"))) __m128i split_ssse3(const __m128i v)
+        {
+            return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 10), _mm_set1_epi32(0x0000003f)),
+                                             _mm_and_si128(_mm_slli_epi32(v, 4), _mm_set1_epi32(0x00003f00))),
+                                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 6), _mm_set1_epi32(0x003f0000)),
+                                             _mm_and_si128(_mm_slli_epi32(v, 8), _mm_set1_epi32(0x3f000000))));
+        }
+
+        __attribute__((target("ssse3"))) std::size_t encode_ssse3(std::uint8_t const *input, const std::size_t length,
+                                                                  char *output)
+        {
+            const auto shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+            std::size_t pos = 0;
+            for (; length - pos >= 16; pos += 12, output += 16)
+            {
+                const auto in = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + pos));
+                const auto indices = split_ssse3(_mm_shuffle_epi8(in, shuffle));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output), to_ascii_ssse3(indices));
+            }
+            return pos;
+        }
+
+        __attribute__((target("ssse3"))) __m128i in_range_ssse3(const __m128i c, const char low, const char high)
+        {
+            return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(c, _mm_set1_epi8(low)), c),
+                                 _mm_cmpeq_epi8(_mm_min_epu8(c, _mm_set1_epi8(high)), c));
+        }
+
+        __attribute__((target("ssse3"))) bool to_values_ssse3(const __m128i c, __m128i &values)
+        {
+            const auto upper = in_range_ssse3(c, 'A', 'Z');
+            const auto lower = in_range_ssse3(c, 'a', 'z');
+            const auto digit = in_range_ssse3(c, '0', '9');
+            const auto plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+            const auto slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+            const auto valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash);
+            if (_mm_movemask_epi8(valid) != 0xffff)
+            {
+                return false;
+            }
+
+            values = _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(_mm_sub_epi8(c, _mm_set1_epi8(65)), upper),
+                             _mm_and_si128(_mm_sub_epi8(c, _mm_set1_epi8(71)), lower)),
+                _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_add_epi8(c, _mm_set1_epi8(4)), digit),
+                                          _mm_and_si128(_mm_set1_epi8(62), plus)),
+                             _mm_and_si128(_mm_set1_epi8(63), slash)));
+            return true;
+        }
+
+        __attribute__((target("ssse3"))) __m128i pack_ssse3(const __m128i v)
+        {
+            const auto shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+            const auto packed =
+                _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 18), _mm_set1_epi32(0x00fc0000)),
+                                          _mm_and_si128(_mm_slli_epi32(v, 4), _mm_set1_epi32(0x0003f000))),
+                             _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 10), _mm_set1_epi32(0x00000fc0)),
+                                          _mm_and_si128(_mm_srli_epi32(v, 24), _mm_set1_epi32(0x0000003f))));
+            return _mm_shuffle_epi8(packed, shuffle);
+        }
+
+        __attribute__((target("ssse3"))) std::size_t decode_ssse3(char const *input, const std::size_t length,
+                                                                  std::uint8_t *output, const std::size_t output_length)
+        {
+            std::size_t pos = 0;
+            std::size_t written = 0;
+            for (; length - pos >= 16 && output_length - written >= 16; pos += 16, written += 12)
+            {
+                __m128i values;
+                if (!to_values_ssse3(_mm_loadu_si128(reinterpret_cast<__m128i const *>(input + pos)), values))
+                {
+                    break;
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + written), pack_ssse3(values));
+            }
+            return pos;
+        }
+
+        __attribute__((target("avx2"))) __m256i to_ascii_avx2(const __m256i indices)
+        {
+            const auto offsets = _mm256_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0, 71,
+                                                  -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0);
+            auto reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            const auto less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+            return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, reduced));
+        }
+
+        __attribute__((target("avx2"))) std::size_t encode_avx2(std::uint8_t const *input, const std::size_t length,
+                                                                char *output)
+        {
+            const auto shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3,
+                                                  5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+            std::size_t pos = 0;
+            // Each 128-bit lane takes 12 bytes, so the second load starts 12 bytes in.
+            for (; length - pos >= 28; pos += 24, output += 32)
+            {
+                const auto low = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + pos));
+                const auto high = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input + pos + 12));
+                const auto v = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1),
+                                                   shuffle);
+                const auto indices = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 10), _mm256_set1_epi32(0x0000003f)),
+                                    _mm256_and_si256(_mm256_slli_epi32(v, 4), _mm256_set1_epi32(0x00003f00))),
+                    _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 6), _mm256_set1_epi32(0x003f0000)),
+                                    _mm256_and_si256(_mm256_slli_epi32(v, 8), _mm256_set1_epi32(0x3f000000))));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(output), to_ascii_avx2(indices));
+            }
+            return pos;
+        }
+
+        __attribute__((target("avx2"))) __m256i in_range_avx2(const __m256i c, const char low, const char high)
+        {
+            return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(c, _mm256_set1_epi8(low)), c),
+                                    _mm256_cmpeq_epi8(_mm256_min_epu8(c, _mm256_set1_epi8(high)), c));
+        }
+
+        __attribute__((target("avx2"))) std::size_t decode_avx2(char const *input, const std::size_t length,
+                                                                std::uint8_t *output, const std::size_t output_length)
+        {
+            const auto shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6,
+                                                  5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+            std::size_t pos = 0;
+            std::size_t written = 0;
+            // The second lane is stored 12 bytes in, over the unused tail of the first one.
+            for (; length - pos >= 32 && output_length - written >= 28; pos += 32, written += 24)
+            {
+                const auto c = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input + pos));
+                const auto upper = in_range_avx2(c, 'A', 'Z');
+                const auto lower = in_range_avx2(c, 'a', 'z');
+                const auto digit = in_range_avx2(c, '0', '9');
+                const auto plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+                const auto slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+                const auto valid = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, plus)), slash);
+                if (_mm256_movemask_epi8(valid) != -1)
+                {
+                    break;
+                }
+
+                const auto v = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_and_si256(_mm256_sub_epi8(c, _mm256_set1_epi8(65)), upper),
+                                    _mm256_and_si256(_mm256_sub_epi8(c, _mm256_set1_epi8(71)), lower)),
+                    _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_add_epi8(c, _mm256_set1_epi8(4)), digit),
+                                                    _mm256_and_si256(_mm256_set1_epi8(62), plus)),
+                                    _mm256_and_si256(_mm256_set1_epi8(63), slash)));
+                const auto packed = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(v, 18), _mm256_set1_epi32(0x00fc0000)),
+                                    _mm256_and_si256(_mm256_slli_epi32(v, 4), _mm256_set1_epi32(0x0003f000))),
+                    _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 10), _mm256_set1_epi32(0x00000fc0)),
+                                    _mm256_and_si256(_mm256_srli_epi32(v, 24), _mm256_set1_epi32(0x0000003f))));
+                const auto bytes = _mm256_shuffle_epi8(packed, shuffle);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + written), _mm256_castsi256_si128(bytes));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + written + 12),
+                                 _mm256_extracti128_si256(bytes, 1));
+            }
+            return pos;
+        }
+#endif
+
+#ifdef SPANK_OLM_BASE64_NEON
+        uint32x4_t split_neon(const uint32x4_t v)
+        {
+            return vorrq_u32(vorrq_u32(vandq_u32(vshrq_n_u32(v, 10), vdupq_n_u32(0x0000003f)),
+                                       vandq_u32(vshlq_n_u32(v, 4), vdupq_n_u32(0x00003f00))),
+                             vorrq_u32(vandq_u32(vshrq_n_u32(v, 6), vdupq_n_u32(0x003f0000)),
+                                       vandq_u32(vshlq_n_u32(v, 8), vdupq_n_u32(0x3f000000))));
+        }
+
+        std::size_t encode_neon(std::uint8_t const *input, const std::size_t length, char *output)
+        {
+            const uint8x16_t shuffle = {1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10};
+            const uint8x16_t offsets = {71, 252, 252, 252, 252, 252, 252, 252, 252, 252, 252, 237, 240, 65, 0, 0};
+            std::size_t pos = 0;
+            for (; length - pos >= 16; pos += 12, output += 16)
+            {
+                const auto v = vreinterpretq_u32_u8(vqtbl1q_u8(vld1q_u8(input + pos), shuffle));
+                const auto indices = vreinterpretq_u8_u32(split_neon(v));
+                auto reduced = vqsubq_u8(indices, vdupq_n_u8(51));
+                reduced = vorrq_u8(reduced, vandq_u8(vcltq_u8(indices, vdupq_n_u8(26)), vdupq_n_u8(13)));
+                vst1q_u8(reinterpret_cast<std::uint8_t *>(output), vaddq_u8(indices, vqtbl1q_u8(offsets, reduced)));
+            }
+            return pos;
+        }
+
+        uint8x16_t in_range_neon(const uint8x16_t c, const std::uint8_t low, const std::uint8_t high)
+        {
+            return vandq_u8(vcgeq_u8(c, vdupq_n_u8(low)), vcleq_u8(c, vdupq_n_u8(high)));
+        }
+
+        std::size_t decode_neon(char const *input, const std::size_t length, std::uint8_t *output,
+                                const std::size_t output_length)
+        {
+            const uint8x16_t shuffle = {2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 255, 255, 255, 255};
+            std::size_t pos = 0;
+            std::size_t written = 0;
+            for (; length - pos >= 16 && output_length - written >= 16; pos += 16, written += 12)
+            {
+                const auto c = vld1q_u8(reinterpret_cast<std::uint8_t const *>(input + pos));
+                const auto upper = in_range_neon(c, 'A', 'Z');
+                const auto lower = in_range_neon(c, 'a', 'z');
+                const auto digit = in_range_neon(c, '0', '9');
+                const auto plus = vceqq_u8(c, vdupq_n_u8('+'));
+                const auto slash = vceqq_u8(c, vdupq_n_u8('/'));
+                const auto valid = vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, plus)), slash);
+                if (vminvq_u8(valid) != 0xff)
+                {
+                    break;
+                }
+
+                const auto values = vorrq_u8(
+                    vorrq_u8(vandq_u8(vsubq_u8(c, vdupq_n_u8(65)), upper),
+                             vandq_u8(vsubq_u8(c, vdupq_n_u8(71)), lower)),
+                    vorrq_u8(vorrq_u8(vandq_u8(vaddq_u8(c, vdupq_n_u8(4)), digit), vandq_u8(vdupq_n_u8(62), plus)),
+                             vandq_u8(vdupq_n_u8(63), slash)));
+                const auto v = vreinterpretq_u32_u8(values);
+                const auto packed = vorrq_u32(vorrq_u32(vandq_u32(vshlq_n_u32(v, 18), vdupq_n_u32(0x00fc0000)),
+                                                        vandq_u32(vshlq_n_u32(v, 4), vdupq_n_u32(0x0003f000))),
+                                              vorrq_u32(vandq_u32(vshrq_n_u32(v, 10), vdupq_n_u32(0x00000fc0)),
+                                                        vandq_u32(vshrq_n_u32(v, 24), vdupq_n_u32(0x0000003f))));
+                vst1q_u8(output + written, vqtbl1q_u8(vreinterpretq_u8_u32(packed), shuffle));
+            }
+            return pos;
+        }
+#endif
+
+#ifdef SPANK_OLM_BASE64_WASM
+        std::size_t encode_wasm(std::uint8_t const *input, const std::size_t length, char *output)
+        {
+            const auto shuffle = wasm_i8x16_make(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+            const auto offsets = wasm_i8x16_make(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0);
+            std::size_t pos = 0;
+            for (; length - pos >= 16; pos += 12, output += 16)
+            {
+                const auto v = wasm_i8x16_swizzle(wasm_v128_load(input + pos), shuffle);
+                const auto indices =
+                    wasm_v128_or(wasm_v128_or(wasm_v128_and(wasm_u32x4_shr(v, 10), wasm_i32x4_splat(0x0000003f)),
+                                              wasm_v128_and(wasm_i32x4_shl(v, 4), wasm_i32x4_splat(0x00003f00))),
+                                 wasm_v128_or(wasm_v128_and(wasm_u32x4_shr(v, 6), wasm_i32x4_splat(0x003f0000)),
+                                              wasm_v128_and(wasm_i32x4_shl(v, 8), wasm_i32x4_splat(0x3f000000))));
+                auto reduced = wasm_u8x16_sub_sat(indices, wasm_i8x16_splat(51));
+                reduced = wasm_v128_or(
+                    reduced, wasm_v128_and(wasm_u8x16_lt(indices, wasm_i8x16_splat(26)), wasm_i8x16_splat(13)));
+                wasm_v128_store(output, wasm_i8x16_add(indices, wasm_i8x16_swizzle(offsets, reduced)));
+            }
+            return pos;
+        }
+
+        v128_t in_range_wasm(const v128_t c, const std::uint8_t low, const std::uint8_t high)
+        {
+            return wasm_v128_and(wasm_u8x16_ge(c, wasm_u8x16_splat(low)), wasm_u8x16_le(c, wasm_u8x16_splat(high)));
+        }
+
+        std::size_t decode_wasm(char const *input, const std::size_t length, std::uint8_t *output,
+                                const std::size_t output_length)
+        {
+            const auto shuffle = wasm_i8x16_make(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+            std::size_t pos = 0;
+            std::size_t written = 0;
+            for (; length - pos >= 16 && output_length - written >= 16; pos += 16, written += 12)
+            {
+                const auto c = wasm_v128_load(input + pos);
+                const auto upper = in_range_wasm(c, 'A', 'Z');
+                const auto lower = in_range_wasm(c, 'a', 'z');
+                const auto digit = in_range_wasm(c, '0', '9');
+                const auto plus = wasm_i8x16_eq(c, wasm_i8x16_splat('+'));
+                const auto slash = wasm_i8x16_eq(c, wasm_i8x16_splat('/'));
+                const auto valid =
+                    wasm_v128_or(wasm_v128_or(wasm_v128_or(upper, lower), wasm_v128_or(digit, plus)), slash);
+                if (!wasm_i8x16_all_true(valid))
+                {
+                    break;
+                }
+
+                const auto v = wasm_v128_or(
+                    wasm_v128_or(wasm_v128_and(wasm_i8x16_sub(c, wasm_i8x16_splat(65)), upper),
+                                 wasm_v128_and(wasm_i8x16_sub(c, wasm_i8x16_splat(71)), lower)),
+                    wasm_v128_or(wasm_v128_or(wasm_v128_and(wasm_i8x16_add(c, wasm_i8x16_splat(4)), digit),
+                                              wasm_v128_and(wasm_i8x16_splat(62), plus)),
+                                 wasm_v128_and(wasm_i8x16_splat(63), slash)));
+                const auto packed =
+                    wasm_v128_or(wasm_v128_or(wasm_v128_and(wasm_i32x4_shl(v, 18), wasm_i32x4_splat(0x00fc0000)),
+                                              wasm_v128_and(wasm_i32x4_shl(v, 4), wasm_i32x4_splat(0x0003f000))),
+                                 wasm_v128_or(wasm_v128_and(wasm_u32x4_shr(v, 10), wasm_i32x4_splat(0x00000fc0)),
+                                              wasm_v128_and(wasm_u32x4_shr(v, 24), wasm_i32x4_splat(0x0000003f))));
+                wasm_v128_store(output + written, wasm_i8x16_swizzle(packed, shuffle));
+            }
+            return pos;
+        }
+#endif
+
+        struct Kernels
+        {
+            EncodeKernel encode;
+            DecodeKernel decode;
+        };
+
+        Kernels select_kernels()
+        {
+#if defined(SPANK_OLM_BASE64_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return {encode_avx2, decode_avx2};
+            }
+            if (__builtin_cpu_supports("ssse3"))
+            {
+                return {encode_ssse3, decode_ssse3};
+            }
+            return {encode_none, decode_none};
+#elif defined(SPANK_OLM_BASE64_NEON)
+            return {encode_neon, decode_neon};
+#elif defined(SPANK_OLM_BASE64_WASM)
+            return {encode_wasm, decode_wasm};
+#else
+            return {encode_none, decode_none};
+#endif
+        }
+
+        Kernels const &kernels()
+        {
+            static const Kernels selected = select_kernels();
+            return selected;
+        }
+    } // namespace
+
+    std::size_t base64_encode(const std::span<const std::uint8_t> input, const std::span<char> output,
+                              const bool padded)
+    {
+        const auto length = base64_encoded_length(input.size(), padded);
+        if (output.size() < length)
+        {
+            throw SpankOlmErrorOutputBufferTooSmall();
+        }
+
+        const auto in = input.data();
+        auto pos = kernels().encode(in, input.size(), output.data());
+        auto out = output.data() + pos / 3 * 4;
+
+        for (; input.size() - pos >= 3; pos += 3)
+        {
+            const std::uint32_t block = in[pos] << 16 | in[pos + 1] << 8 | in[pos + 2];
+            *out++ = ALPHABET[block >> 18];
+            *out++ = ALPHABET[block >> 12 & 0x3f];
+            *out++ = ALPHABET[block >> 6 & 0x3f];
+            *out++ = ALPHABET[block & 0x3f];
+        }
+
+        const auto remaining = input.size() - pos;
+        if (remaining > 0)
+        {
+            const std::uint32_t block = in[pos] << 16 | (remaining == 2 ? in[pos + 1] << 8 : 0);
+            *out++ = ALPHABET[block >> 18];
+            *out++ = ALPHABET[block >> 12 & 0x3f];
+            if (remaining == 2)
+            {
+                *out++ = ALPHABET[block >> 6 & 0x3f];
+            }
+            if (padded)
+            {
+                *out++ = '=';
+                if (remaining == 1)
+                {
+                    *out++ = '=';
+                }
+            }
+        }
+
+        return length;
+    }
+
+    std::string base64_encode(const std::span<const std::uint8_t> input, const bool padded)
+    {
+        std::string output(base64_encoded_length(input.size(), padded), '\0');
+        base64_encode(input, std::span(output.data(), output.size()), padded);
+        return output;
+    }
+
+    std::size_t base64_decode(const std::string_view input, const std::span<std::uint8_t> output)
+    {
+        auto length = input.size();
+        if (length % 4 == 0 && length > 0 && input[length - 1] == '=')
+        {
+            --length;
+            if (input[length - 1] == '=')
+            {
+                --length;
+            }
+        }
+        if (length % 4 == 1)
+        {
+            throw SpankOlmErrorInvalidBase64();
+        }
+
+        const auto decoded = length / 4 * 3 + (length % 4 == 0 ? 0 : length % 4 - 1);
+        if (output.size() < decoded)
+        {
+            throw SpankOlmErrorOutputBufferTooSmall();
+        }
+
+        const auto in = reinterpret_cast<std::uint8_t const *>(input.data());
+        auto pos = kernels().decode(input.data(), length, output.data(), decoded);
+        auto out = output.data() + pos / 4 * 3;
+
+        for (; pos < length; pos += 4)
+        {
+            const auto count = std::min<std::size_t>(4, length - pos);
+            std::uint32_t block = 0;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const auto value = DECODING_TABLE[in[pos + i]];
+                if (value == INVALID)
+                {
+                    throw SpankOlmErrorInvalidBase64();
+                }
+                block |= static_cast<std::uint32_t>(value) << (18 - 6 * i);
+            }
+
+            // The bits of a final partial group below its last byte have to be zero, or the same bytes would have
+            // several encodings.
+            if (count < 4 && (block & (0xffffff >> (8 * (count - 1)))) != 0)
+            {
+                throw SpankOlmErrorInvalidBase64();
+            }
+
+            *out++ = static_cast<std::uint8_t>(block >> 16);
+            if (count > 2)
+            {
+                *out++ = static_cast<std::uint8_t>(block >> 8);
+            }
+            if (count > 3)
+            {
+                *out++ = static_cast<std::uint8_t>(block);
+            }
+        }
+
+        return decoded;
+    }
+
+    Botan::secure_vector<std::uint8_t> base64_decode(const std::string_view input)
+    {
+        Botan::secure_vector<std::uint8_t> output(base64_decoded_length(input.size()));
+        output.resize(base64_decode(input, output));
+        return output;
+    }
+} // namespace spank_olm
@@ -0,0 +1,174 @@
+#include "bulk_unpickle.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace spank_olm
+{
+    namespace
+    {
+        /**
+         * \brief The number of chunks per worker thread the span functions split their input into.
+         *
+         * Accounts with many one-time keys take much longer to unpickle than others, so a few chunks per thread keep
+         * the workers busy until the end.
+         */
+        constexpr std::size_t CHUNKS_PER_THREAD = 4;
+
+        template <typename T>
+        T unpickle_one(PickleCipher &cipher, std::string_view encrypted);
+
+        template <>
+        Account unpickle_one<Account>(PickleCipher &cipher, const std::string_view encrypted)
+        {
+            return Account::unpickle(cipher, encrypted);
+        }
+
+        template <>
+        Megolm unpickle_one<Megolm>(PickleCipher &cipher, const std::string_view encrypted)
+        {
+            Megolm megolm{};
+            megolm.unpickle(cipher, encrypted);
+            return megolm;
+        }
+
+        /**
+         * \brief Unpickles one pickle, catching whatever it throws.
+         */
+        template <typename T>
+        void unpickle_into(PickleCipher &cipher, const std::string_view encrypted, Unpickled<T> &result)
+        {
+            try
+            {
+                result.value.emplace(unpickle_one<T>(cipher, encrypted));
+            }
+            catch (...)
+            {
+                result.error = std::current_exception();
+            }
+        }
+
+        template <typename T>
+        std::vector<Unpickled<T>> unpickle_all(PickleCipher const &cipher,
+                                               const std::span<const std::string_view> encrypted, ThreadPool &pool)
+        {
+            std::vector<Unpickled<T>> results(encrypted.size());
+            if (encrypted.empty())
+            {
+                return results;
+            }
+
+            const auto chunks = std::min(encrypted.size(), std::max<std::size_t>(1, pool.size() * CHUNKS_PER_THREAD));
+            std::vector<std::future<void>> pending;
+            pending.reserve(chunks);
+            for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+            {
+                const auto begin = encrypted.size() * chunk / chunks;
+                const auto end = encrypted.size() * (chunk + 1) / chunks;
+                pending.push_back(pool.submit([&cipher, &encrypted, &results, begin, end] {
+                    // Ciphers must not be shared between threads.
+                    auto chunk_cipher = cipher;
+                    for (auto i = begin; i < end; ++i)
+                    {
+                        unpickle_into(chunk_cipher, encrypted[i], results[i]);
+                    }
+                }));
+            }
+
+            for (auto &result : pending)
+            {
+                result.wait();
+            }
+            for (auto &result : pending)
+            {
+                result.get();
+            }
+            return results;
+        }
+    } // namespace
+
+    template <typename T>
+    BulkUnpickler<T>::BulkUnpickler(PickleCipher const &cipher, ThreadPool &pool, const std::size_t batch_size) :
+        cipher(cipher), pool(pool), batch_size(std::max<std::size_t>(1, batch_size))
+    {
+        queued.reserve(this->batch_size);
+    }
+
+    template <typename T>
+    BulkUnpickler<T>::~BulkUnpickler()
+    {
+        // The batches don't refer to us, but an abandoned load shouldn't keep the pool busy after we are gone.
+        for (auto &batch : batches)
+        {
+            batch.wait();
+        }
+    }
+
+    template <typename T>
+    std::size_t BulkUnpickler<T>::add(std::string encrypted)
+    {
+        queued.push_back(std::move(encrypted));
+        if (queued.size() >= batch_size)
+        {
+            submit_batch();
+        }
+        return added++;
+    }
+
+    template <typename T>
+    void BulkUnpickler<T>::submit_batch()
+    {
+        if (queued.empty())
+        {
+            return;
+        }
+
+        batches.push_back(pool.submit([batch_cipher = cipher, batch = std::move(queued)]() mutable {
+            std::vector<Unpickled<T>> results(batch.size());
+            for (std::size_t i = 0; i < batch.size(); ++i)
+            {
+                unpickle_into(batch_cipher, batch[i], results[i]);
+            }
+            return results;
+        }));
+
+        queued = {};
+        queued.reserve(batch_size);
+    }
+
+    template <typename T>
+    std::vector<Unpickled<T>> BulkUnpickler<T>::finish()
+    {
+        submit_batch();
+
+        std::vector<Unpickled<T>> results;
+        results.reserve(added);
+        for (auto &batch : batches)
+        {
+            auto batch_results = batch.get();
+            std::move(batch_results.begin(), batch_results.end(), std::back_inserter(results));
+        }
+
+        batches.clear();
+        added = 0;
+        return results;
+    }
+
+    template class BulkUnpickler<Account>;
+    template class BulkUnpickler<Megolm>;
+
+    std::vector<Unpickled<Account>> unpickle_accounts(PickleCipher const &cipher,
+                                                      const std::span<const std::string_view> encrypted,
+                                                      ThreadPool &pool)
+    {
+        return unpickle_all<Account>(cipher, encrypted, pool);
+    }
+
+    std::vector<Unpickled<Megolm>> unpickle_megolms(PickleCipher const &cipher,
+                                                    const std::span<const std::string_view> encrypted,
+                                                    ThreadPool &pool)
+    {
+        return unpickle_all<Megolm>(cipher, encrypted, pool);
+    }
+} // namespace spank_olm
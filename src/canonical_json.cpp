@@ -0,0 +1,179 @@
+#include "canonical_json.hpp"
+#include "base64.hpp"
+#include "json.hpp"
+
+namespace spank_olm
+{
+    namespace
+    {
+        void append_base64(std::string &output, const std::span<const std::uint8_t> bytes)
+        {
+            const auto start = output.size();
+            output.resize(start + base64_encoded_length(bytes.size(), false));
+            output.resize(start + base64_encode(bytes, std::span(output).subspan(start), false));
+        }
+
+        /**
+         * \brief Appends "<algorithm>:<key id>" as one JSON string.
+         */
+        void append_key_id(std::string &output, const std::string_view algorithm, const std::string_view key_id)
+        {
+            append_json_string(output, algorithm);
+            output.back() = ':';
+            const auto quote = output.size();
+            append_json_string(output, key_id);
+            output.erase(quote, 1);
+        }
+    } // namespace
+
+    CanonicalJsonWriter::CanonicalJsonWriter(std::string &output) : output(output) {}
+
+    void CanonicalJsonWriter::begin_object()
+    {
+        separate();
+        write('{');
+        has_members.push_back(false);
+    }
+
+    void CanonicalJsonWriter::end_object()
+    {
+        has_members.pop_back();
+        write('}');
+    }
+
+    void CanonicalJsonWriter::begin_array()
+    {
+        separate();
+        write('[');
+        has_members.push_back(false);
+    }
+
+    void CanonicalJsonWriter::end_array()
+    {
+        has_members.pop_back();
+        write(']');
+    }
+
+    void CanonicalJsonWriter::key(const std::string_view name)
+    {
+        separate();
+        const auto start = output.size();
+        append_json_string(output, name);
+        output += ':';
+        feed(start);
+        after_key = true;
+    }
+
+    void CanonicalJsonWriter::key(const std::string_view algorithm, const std::string_view key_id)
+    {
+        separate();
+        const auto start = output.size();
+        append_key_id(output, algorithm, key_id);
+        output += ':';
+        feed(start);
+        after_key = true;
+    }
+
+    void CanonicalJsonWriter::string_value(const std::string_view text)
+    {
+        separate();
+        const auto start = output.size();
+        append_json_string(output, text);
+        feed(start);
+    }
+
+    void CanonicalJsonWriter::bool_value(const bool flag)
+    {
+        separate();
+        const auto start = output.size();
+        output += flag ? "true" : "false";
+        feed(start);
+    }
+
+    void CanonicalJsonWriter::base64_value(const std::span<const std::uint8_t> bytes)
+    {
+        separate();
+        const auto start = output.size();
+        output += '"';
+        append_base64(output, bytes);
+        output += '"';
+        feed(start);
+    }
+
+    void CanonicalJsonWriter::begin_signed_object(IncrementalSigner &object_signer)
+    {
+        separate();
+        signer = &object_signer;
+        write('{');
+        has_members.push_back(false);
+        signed_depth = has_members.size();
+        signatures_offset.reset();
+    }
+
+    void CanonicalJsonWriter::signatures_position()
+    {
+        signatures_offset = output.size();
+        signatures_after_member = has_members[signed_depth - 1];
+    }
+
+    void CanonicalJsonWriter::end_signed_object(Botan::RandomNumberGenerator &rng, const std::string_view user_id,
+                                                const std::string_view key_id)
+    {
+        if (!signatures_offset)
+        {
+            signatures_position();
+        }
+        end_object();
+        const auto signature = signer->finish(rng);
+        signer = nullptr;
+
+        std::string field;
+        if (signatures_after_member)
+        {
+            field += ',';
+        }
+        field += R"("signatures":{)";
+        append_json_string(field, user_id);
+        field += ":{";
+        append_key_id(field, "ed25519", key_id);
+        field += ":\"";
+        append_base64(field, signature);
+        field += "\"}}";
+        if (!signatures_after_member && output[*signatures_offset] != '}')
+        {
+            field += ',';
+        }
+        output.insert(*signatures_offset, field);
+    }
+
+    void CanonicalJsonWriter::separate()
+    {
+        if (after_key)
+        {
+            after_key = false;
+            return;
+        }
+        if (!has_members.empty())
+        {
+            if (has_members.back())
+            {
+                write(',');
+            }
+            has_members.back() = true;
+        }
+    }
+
+    void CanonicalJsonWriter::feed(const std::size_t start)
+    {
+        if (signer)
+        {
+            signer->update(std::string_view(output).substr(start));
+        }
+    }
+
+    void CanonicalJsonWriter::write(const char c)
+    {
+        output += c;
+        feed(output.size() - 1);
+    }
+} // namespace spank_olm
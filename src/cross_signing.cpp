@@ -0,0 +1,335 @@
+#include "cross_signing.hpp"
+#include "base64.hpp"
+#include "canonical_json.hpp"
+#include "errors.hpp"
+#include "json.hpp"
+#include "signature.hpp"
+
+#include <algorithm>
+
+namespace spank_olm
+{
+    namespace
+    {
+        using PublicKey = std::array<std::uint8_t, CROSS_SIGNING_KEY_LENGTH>;
+
+        /**
+         * \brief Writes a cross-signing key object, signed by the master key unless it is the master key itself.
+         */
+        void write_key_object(std::string &json, Botan::Ed25519_PrivateKey const &key, const std::string_view usage,
+                              const std::string_view user_id, Ed25519Signer *master_signer,
+                              Botan::RandomNumberGenerator &rng, const std::string_view master_key_id)
+        {
+            const auto key_id = base64_encode(key.public_key()->raw_public_key_bits(), false);
+
+            CanonicalJsonWriter writer(json);
+            if (master_signer)
+            {
+                writer.begin_signed_object(*master_signer);
+            }
+            else
+            {
+                writer.begin_object();
+            }
+            writer.key("keys");
+            writer.begin_object();
+            writer.key("ed25519", key_id);
+            writer.string_value(key_id);
+            writer.end_object();
+            if (master_signer)
+            {
+                writer.signatures_position();
+            }
+            writer.key("usage");
+            writer.begin_array();
+            writer.string_value(usage);
+            writer.end_array();
+            writer.key("user_id");
+            writer.string_value(user_id);
+            if (master_signer)
+            {
+                writer.end_signed_object(rng, user_id, master_key_id);
+            }
+            else
+            {
+                writer.end_object();
+            }
+        }
+
+        PublicKey decode_public_key(const std::string_view base64)
+        {
+            std::array<std::uint8_t, base64_decoded_length(base64_encoded_length(CROSS_SIGNING_KEY_LENGTH))> bytes;
+            if (base64.size() > base64_encoded_length(CROSS_SIGNING_KEY_LENGTH) ||
+                base64_decode(base64, bytes) != CROSS_SIGNING_KEY_LENGTH)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            PublicKey key;
+            std::copy_n(bytes.begin(), key.size(), key.begin());
+            return key;
+        }
+
+        void check_user_id(const std::string_view json, const std::string_view user_id)
+        {
+            if (unescape_json_string(find_json_string(json, "user_id")) != user_id)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+        }
+
+        /**
+         * \brief Returns the key of a cross-signing key object after checking its user and usage.
+         *
+         * The object has to hold exactly one key, whose ID is the key itself.
+         */
+        PublicKey parse_key_object(SignedKeyObject const &object, const std::string_view user_id,
+                                   const std::string_view usage)
+        {
+            const std::string_view json = object.signable;
+            check_user_id(json, user_id);
+
+            // The usages are plain words, so a quoted one can't show up inside another.
+            const auto usages = find_json_value(json, "usage");
+            const auto quoted_usage = '"' + std::string(usage) + '"';
+            if (!usages.starts_with('[') || usages.find(quoted_usage) == std::string_view::npos)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+
+            std::optional<PublicKey> key;
+            constexpr std::string_view PREFIX = "ed25519:";
+            for_each_json_field(find_json_value(json, "keys"), [&](const std::string_view name,
+                                                                   const std::string_view value) {
+                if (key || !name.starts_with(PREFIX) || value.size() < 2 || value.front() != '"' ||
+                    name.substr(PREFIX.size()) != value.substr(1, value.size() - 2))
+                {
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+                key = decode_public_key(name.substr(PREFIX.size()));
+                return false;
+            });
+            if (!key)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            return *key;
+        }
+
+        /**
+         * \brief Checks a signature of a key object, which Matrix makes with pure Ed25519 over the signable form.
+         */
+        bool check_signature(PublicKey const &key, SignedKeyObject const &object)
+        {
+            const Botan::Ed25519_PublicKey public_key(key);
+            return verify_pure_signature(public_key, object.signable, object.signature);
+        }
+    } // namespace
+
+    CrossSigningKeys CrossSigningKeys::generate(Botan::RandomNumberGenerator &rng)
+    {
+        CrossSigningKeys keys{Botan::Ed25519_PrivateKey(rng), Botan::Ed25519_PrivateKey(rng),
+                              Botan::Ed25519_PrivateKey(rng)};
+        for (const auto *key : {&keys.master_key, &keys.self_signing_key, &keys.user_signing_key})
+        {
+            if (!key->check_key(rng, false) || !key->public_key()->check_key(rng, false))
+            {
+                throw SpankOlmErrorKeyGeneration();
+            }
+        }
+        return keys;
+    }
+
+    CrossSigningUpload get_cross_signing_upload_json(CrossSigningKeys const &keys, Botan::RandomNumberGenerator &rng,
+                                                     const std::string_view user_id)
+    {
+        const auto master_key_id = base64_encode(keys.master_key.public_key()->raw_public_key_bits(), false);
+        Ed25519Signer master_signer(keys.master_key, rng);
+
+        CrossSigningUpload upload;
+        write_key_object(upload.master_key, keys.master_key, "master", user_id, nullptr, rng, master_key_id);
+        write_key_object(upload.self_signing_key, keys.self_signing_key, "self_signing", user_id, &master_signer, rng,
+                         master_key_id);
+        write_key_object(upload.user_signing_key, keys.user_signing_key, "user_signing", user_id, &master_signer, rng,
+                         master_key_id);
+        return upload;
+    }
+
+    TrustChainVerifier::TrustChainVerifier(std::string own_user_id) : own_user_id(std::move(own_user_id)) {}
+
+    void TrustChainVerifier::set_own_keys(SignedKeyObject const &master_key, SignedKeyObject const &self_signing_key,
+                                          SignedKeyObject const &user_signing_key)
+    {
+        const auto user_signing_public_key = parse_key_object(user_signing_key, own_user_id, "user_signing");
+        const auto *previous = find_user(own_user_id);
+        const auto unchanged = previous && previous->master_key == master_key &&
+            own_user_signing_object == user_signing_key;
+        set_user_keys(own_user_id, master_key, self_signing_key);
+        auto &own = *find_user(own_user_id);
+        own.master_key_trusted = true;
+        if (unchanged)
+        {
+            return;
+        }
+        own_user_signing_object = user_signing_key;
+
+        std::optional<PublicKey> checked_user_signing_key;
+        if (verify(own.master_public_key, user_signing_key))
+        {
+            checked_user_signing_key = user_signing_public_key;
+        }
+        if (checked_user_signing_key != own_user_signing_key)
+        {
+            // The master keys of the other users were signed by the old user-signing key, if at all.
+            own_user_signing_key = checked_user_signing_key;
+            for (auto &[user_id, user] : users)
+            {
+                if (user_id != own_user_id)
+                {
+                    user.master_key_trusted.reset();
+                }
+            }
+        }
+    }
+
+    void TrustChainVerifier::set_user_keys(const std::string_view user_id, SignedKeyObject const &master_key,
+                                           SignedKeyObject const &self_signing_key)
+    {
+        const auto master_public_key = parse_key_object(master_key, user_id, "master");
+        const auto self_signing_public_key = parse_key_object(self_signing_key, user_id, "self_signing");
+
+        auto *user = find_user(user_id);
+        if (!user || user->master_public_key != master_public_key)
+        {
+            // A new identity, nothing of the old one carries over.
+            users.insert_or_assign(std::string(user_id), UserKeys{master_key, self_signing_key, master_public_key,
+                                                                  self_signing_public_key, {}, {}, {}});
+            return;
+        }
+
+        if (user->master_key != master_key)
+        {
+            user->master_key = master_key;
+            user->master_key_trusted.reset();
+        }
+        if (user->self_signing_key != self_signing_key)
+        {
+            user->self_signing_key = self_signing_key;
+            user->self_signing_key_trusted.reset();
+            if (user->self_signing_public_key != self_signing_public_key)
+            {
+                user->self_signing_public_key = self_signing_public_key;
+                user->devices.clear();
+            }
+        }
+    }
+
+    void TrustChainVerifier::forget_user(const std::string_view user_id)
+    {
+        if (const auto user = users.find(user_id); user != users.end())
+        {
+            users.erase(user);
+        }
+    }
+
+    bool TrustChainVerifier::is_user_trusted(const std::string_view user_id)
+    {
+        auto *user = find_user(user_id);
+        if (!user)
+        {
+            return false;
+        }
+        if (!user->master_key_trusted)
+        {
+            user->master_key_trusted = own_user_signing_key && verify(*own_user_signing_key, user->master_key);
+        }
+        return *user->master_key_trusted;
+    }
+
+    std::vector<bool> TrustChainVerifier::are_users_trusted(const std::span<const std::string> user_ids,
+                                                            ThreadPool &pool)
+    {
+        std::vector<UserKeys *> unchecked;
+        if (own_user_signing_key)
+        {
+            for (auto const &user_id : user_ids)
+            {
+                auto *user = find_user(user_id);
+                if (user && !user->master_key_trusted)
+                {
+                    unchecked.push_back(user);
+                }
+            }
+            std::ranges::sort(unchecked);
+            unchecked.erase(std::ranges::unique(unchecked).begin(), unchecked.end());
+        }
+
+        if (!unchecked.empty())
+        {
+            std::vector<std::uint8_t> results(unchecked.size());
+            pool.parallel_for_chunks(unchecked.size(), [&](const std::size_t begin, const std::size_t end) {
+                for (auto i = begin; i < end; ++i)
+                {
+                    results[i] = check_signature(*own_user_signing_key, unchecked[i]->master_key);
+                }
+            });
+            for (std::size_t i = 0; i < unchecked.size(); ++i)
+            {
+                unchecked[i]->master_key_trusted = results[i] != 0;
+            }
+            verifications += unchecked.size();
+        }
+
+        std::vector<bool> trusted;
+        trusted.reserve(user_ids.size());
+        for (auto const &user_id : user_ids)
+        {
+            trusted.push_back(is_user_trusted(user_id));
+        }
+        return trusted;
+    }
+
+    bool TrustChainVerifier::is_device_trusted(const std::string_view user_id, const std::string_view device_id,
+                                               SignedKeyObject const &device_keys)
+    {
+        if (!is_user_trusted(user_id))
+        {
+            return false;
+        }
+        auto &user = *find_user(user_id);
+        if (!user.self_signing_key_trusted)
+        {
+            user.self_signing_key_trusted = verify(user.master_public_key, user.self_signing_key);
+        }
+        if (!*user.self_signing_key_trusted)
+        {
+            return false;
+        }
+
+        const auto link = user.devices.find(device_id);
+        if (link != user.devices.end() && link->second.device_keys == device_keys)
+        {
+            return link->second.trusted;
+        }
+
+        check_user_id(device_keys.signable, user_id);
+        if (unescape_json_string(find_json_string(device_keys.signable, "device_id")) != device_id)
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        const auto trusted = verify(user.self_signing_public_key, device_keys);
+        user.devices.insert_or_assign(std::string(device_id), DeviceLink{device_keys, trusted});
+        return trusted;
+    }
+
+    TrustChainVerifier::UserKeys *TrustChainVerifier::find_user(const std::string_view user_id)
+    {
+        const auto user = users.find(user_id);
+        return user == users.end() ? nullptr : &user->second;
+    }
+
+    bool TrustChainVerifier::verify(PublicKey const &key, SignedKeyObject const &object)
+    {
+        ++verifications;
+        return check_signature(key, object);
+    }
+} // namespace spank_olm
@@ -0,0 +1,49 @@
+#include "fan_out.hpp"
+
+#include <algorithm>
+#include <botan/auto_rng.h>
+#include <vector>
+
+namespace spank_olm
+{
+    namespace
+    {
+        std::vector<FanOutResult> encrypt_chunk(const std::span<Session *const> sessions,
+                                                const std::span<const std::uint8_t> plaintext, const std::size_t begin)
+        {
+            // Random number generators must not be shared between threads, and are only needed for new ratchet keys.
+            Botan::AutoSeeded_RNG rng;
+            Botan::secure_vector<std::uint8_t> scratch;
+
+            std::vector<FanOutResult> results(sessions.size());
+            for (std::size_t i = 0; i < sessions.size(); ++i)
+            {
+                results[i].target = begin + i;
+                try
+                {
+                    results[i].message = sessions[i]->encrypt(rng, plaintext, scratch);
+                }
+                catch (...)
+                {
+                    results[i].error = std::current_exception();
+                }
+            }
+            return results;
+        }
+    } // namespace
+
+    void fan_out_encrypt(const std::span<Session *const> sessions, const std::span<const std::uint8_t> plaintext,
+                         ThreadPool &pool, FanOutSink const &sink, std::size_t chunk_size)
+    {
+        chunk_size = std::max<std::size_t>(1, chunk_size);
+
+        const auto deliver = [&sink](std::vector<FanOutResult> results) { sink(results); };
+        InOrder<std::vector<FanOutResult>> in_flight(pool);
+        for (std::size_t begin = 0; begin < sessions.size(); begin += chunk_size)
+        {
+            const auto chunk = sessions.subspan(begin, std::min(chunk_size, sessions.size() - begin));
+            in_flight.submit([chunk, plaintext, begin] { return encrypt_chunk(chunk, plaintext, begin); }, deliver);
+        }
+        in_flight.drain(deliver);
+    }
+} // namespace spank_olm
@@ -0,0 +1,644 @@
+#include "journal.hpp"
+#include "errors.hpp"
+#include "pickle.hpp"
+
+#include <algorithm>
+#include <botan/auto_rng.h>
+#include <botan/kdf.h>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::array<std::uint8_t, 4> JOURNAL_MAGIC = {'S', 'O', 'J', '1'};
+        constexpr std::array<std::uint8_t, 4> SNAPSHOT_MAGIC = {'S', 'O', 'S', '1'};
+        constexpr std::size_t GENERATION_LENGTH = 8;
+        constexpr std::size_t SALT_LENGTH = 16;
+        constexpr std::size_t JOURNAL_HEADER_LENGTH = JOURNAL_MAGIC.size() + GENERATION_LENGTH + SALT_LENGTH;
+        constexpr std::size_t SNAPSHOT_HEADER_LENGTH = SNAPSHOT_MAGIC.size() + GENERATION_LENGTH;
+        constexpr std::size_t RECORD_LENGTH_LENGTH = 2;
+        constexpr std::size_t TAG_LENGTH = 16;
+        constexpr std::size_t RECORD_KEY_LENGTH = 32;
+
+        constexpr std::string_view KDF_INFO = "Journal";
+
+        // Account records.
+        constexpr std::uint8_t ONE_TIME_KEY = 1; ///< id, private key
+        constexpr std::uint8_t FALLBACK_KEY = 2; ///< id, private key
+        constexpr std::uint8_t MARK_KEYS_AS_PUBLISHED = 3;
+        constexpr std::uint8_t FORGET_OLD_FALLBACK_KEY = 4;
+        constexpr std::uint8_t REMOVE_KEY = 5; ///< id
+
+        // Megolm records.
+        constexpr std::uint8_t ADVANCE = 1; ///< counter
+
+        constexpr std::size_t KEY_RECORD_LENGTH = 4 + 32;
+
+        void store_u64(std::uint8_t *pos, const std::uint64_t value)
+        {
+            for (std::size_t i = 0; i < GENERATION_LENGTH; ++i)
+            {
+                pos[i] = static_cast<std::uint8_t>(value >> (8 * (GENERATION_LENGTH - 1 - i)));
+            }
+        }
+
+        std::uint64_t load_u64(std::uint8_t const *pos)
+        {
+            std::uint64_t value = 0;
+            for (std::size_t i = 0; i < GENERATION_LENGTH; ++i)
+            {
+                value = value << 8 | pos[i];
+            }
+            return value;
+        }
+
+        void write_all(const int fd, std::uint8_t const *data, std::size_t length)
+        {
+            while (length > 0)
+            {
+                const auto result = ::write(fd, data, length);
+                if (result < 0)
+                {
+                    throw SpankOlmErrorIO();
+                }
+                data += result;
+                length -= static_cast<std::size_t>(result);
+            }
+        }
+
+        /**
+         * \brief Writes a file next to the target, fsyncs it and renames it over the target.
+         */
+        void replace_file(std::filesystem::path const &path, std::span<const std::uint8_t> data)
+        {
+            auto temporary = path;
+            temporary += ".tmp";
+
+            const auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd < 0)
+            {
+                throw SpankOlmErrorIO();
+            }
+            try
+            {
+                write_all(fd, data.data(), data.size());
+                if (::fsync(fd) != 0)
+                {
+                    throw SpankOlmErrorIO();
+                }
+            }
+            catch (...)
+            {
+                ::close(fd);
+                std::filesystem::remove(temporary);
+                throw;
+            }
+            ::close(fd);
+
+            std::error_code error;
+            std::filesystem::rename(temporary, path, error);
+            if (error)
+            {
+                std::filesystem::remove(temporary);
+                throw SpankOlmErrorIO();
+            }
+
+            // Make the rename itself durable.
+            const auto directory = ::open(path.parent_path().empty() ? "." : path.parent_path().c_str(),
+                                          O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (directory >= 0)
+            {
+                ::fsync(directory);
+                ::close(directory);
+            }
+        }
+
+        void write_snapshot(std::filesystem::path const &path, const std::uint64_t generation,
+                            const std::string_view encrypted)
+        {
+            std::vector<std::uint8_t> data(SNAPSHOT_HEADER_LENGTH + encrypted.size());
+            std::copy(SNAPSHOT_MAGIC.begin(), SNAPSHOT_MAGIC.end(), data.begin());
+            store_u64(data.data() + SNAPSHOT_MAGIC.size(), generation);
+            std::copy(encrypted.begin(), encrypted.end(), data.begin() + SNAPSHOT_HEADER_LENGTH);
+            replace_file(path, data);
+        }
+
+        std::pair<std::uint64_t, std::string> read_snapshot(std::filesystem::path const &path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                throw SpankOlmErrorIO();
+            }
+            const std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (data.size() < SNAPSHOT_HEADER_LENGTH ||
+                !std::equal(SNAPSHOT_MAGIC.begin(), SNAPSHOT_MAGIC.end(), data.begin()))
+            {
+                throw SpankOlmErrorCorruptedPickle();
+            }
+            const auto generation =
+                load_u64(reinterpret_cast<std::uint8_t const *>(data.data()) + SNAPSHOT_MAGIC.size());
+            return {generation, data.substr(SNAPSHOT_HEADER_LENGTH)};
+        }
+
+        std::filesystem::path journal_path(std::filesystem::path path)
+        {
+            path += ".journal";
+            return path;
+        }
+
+        std::array<std::uint8_t, KEY_RECORD_LENGTH> key_record(const std::uint32_t id,
+                                                               Botan::X25519_PrivateKey const &key)
+        {
+            std::array<std::uint8_t, KEY_RECORD_LENGTH> payload{};
+            const auto pos = pickle(payload.data(), id);
+            const auto bits = key.raw_private_key_bits();
+            std::copy(bits.begin(), bits.end(), pos);
+            return payload;
+        }
+
+        OneTimeKey parse_key_record(std::span<const std::uint8_t> payload)
+        {
+            std::uint32_t id = 0;
+            if (payload.size() != KEY_RECORD_LENGTH || !unpickle(payload.data(), payload.data() + 4, id))
+            {
+                throw SpankOlmErrorCorruptedPickle();
+            }
+            return {id, false, Botan::X25519_PrivateKey(payload.subspan(4))};
+        }
+
+        std::uint32_t parse_u32_record(std::span<const std::uint8_t> payload)
+        {
+            std::uint32_t value = 0;
+            if (payload.size() != 4 || !unpickle(payload.data(), payload.data() + payload.size(), value))
+            {
+                throw SpankOlmErrorCorruptedPickle();
+            }
+            return value;
+        }
+
+        void remove_one_time_key(Account &account, const std::uint32_t id)
+        {
+            for (const auto &one_time_key : account.one_time_keys)
+            {
+                if (one_time_key->id == id)
+                {
+                    account.one_time_keys.erase(one_time_key);
+                    return;
+                }
+            }
+        }
+    } // namespace
+
+    Journal::Journal(std::filesystem::path path, const std::span<const std::uint8_t> pickle_key,
+                     const std::uint64_t generation, Replay const &replay) :
+        path(std::move(path)), pickle_key(pickle_key.begin(), pickle_key.end())
+    {
+        std::ifstream file(this->path, std::ios::binary);
+        if (!file)
+        {
+            reset(generation);
+            return;
+        }
+        const std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+
+        if (data.size() < JOURNAL_HEADER_LENGTH ||
+            !std::equal(JOURNAL_MAGIC.begin(), JOURNAL_MAGIC.end(), data.begin()))
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+        const auto journal_generation = load_u64(data.data() + JOURNAL_MAGIC.size());
+        if (journal_generation > generation)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+        if (journal_generation < generation)
+        {
+            // The snapshot was written after this journal, so it already contains all of its records.
+            reset(generation);
+            return;
+        }
+
+        current_generation = generation;
+        init(std::span(data).subspan(JOURNAL_MAGIC.size() + GENERATION_LENGTH, SALT_LENGTH));
+
+        // Only the last record can have been cut short by an interrupted write. A record which fails authentication
+        // with more data behind it, or a bogus length followed by anything but the zeros of a file that was extended
+        // without its data, means the journal was damaged, and dropping the rest could revive removed keys.
+        auto pos = JOURNAL_HEADER_LENGTH;
+        std::vector<Botan::secure_vector<std::uint8_t>> records;
+        while (data.size() - pos >= RECORD_LENGTH_LENGTH)
+        {
+            const std::size_t length = data[pos] << 8 | data[pos + 1];
+            const auto end = pos + RECORD_LENGTH_LENGTH + length;
+            if (length <= TAG_LENGTH)
+            {
+                if (std::any_of(data.begin() + static_cast<std::ptrdiff_t>(pos), data.end(),
+                                [](const std::uint8_t byte) { return byte != 0; }))
+                {
+                    throw SpankOlmErrorCorruptedPickle();
+                }
+                break;
+            }
+            if (end > data.size())
+            {
+                break;
+            }
+
+            const auto begin = data.begin() + static_cast<std::ptrdiff_t>(pos + RECORD_LENGTH_LENGTH);
+            Botan::secure_vector<std::uint8_t> record(begin, begin + static_cast<std::ptrdiff_t>(length));
+            try
+            {
+                decryption->start(nonce(next_sequence));
+                decryption->finish(record);
+            }
+            catch (Botan::Exception const &)
+            {
+                if (end != data.size())
+                {
+                    throw SpankOlmErrorCorruptedPickle();
+                }
+                break;
+            }
+
+            replay(record[0], std::span<const std::uint8_t>(record).subspan(1));
+            records.push_back(std::move(record));
+            ++next_sequence;
+            pos = end;
+        }
+
+        if (pos != data.size())
+        {
+            // The dropped tail may still be readable somewhere. Continuing the sequence would encrypt new records
+            // under the same key and nonces as the dropped ones, so write the valid records again under a new salt.
+            rewrite(generation, records);
+            return;
+        }
+
+        fd = ::open(this->path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw SpankOlmErrorIO();
+        }
+        written = pos - JOURNAL_HEADER_LENGTH;
+    }
+
+    Journal::~Journal()
+    {
+        try
+        {
+            commit();
+        }
+        catch (...)
+        {
+            // Destructors must not throw; the records are lost like on a crash.
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    void Journal::init(const std::span<const std::uint8_t> salt)
+    {
+        Botan::secure_vector<std::uint8_t> key(RECORD_KEY_LENGTH);
+        const auto kdf = Botan::KDF::create_or_throw("HKDF(SHA-256)");
+        kdf->derive_key(key, pickle_key, salt,
+                        std::span(reinterpret_cast<const std::uint8_t *>(KDF_INFO.data()), KDF_INFO.size()));
+
+        encryption = Botan::Cipher_Mode::create_or_throw("AES-256/GCM", Botan::Cipher_Dir::Encryption);
+        encryption->set_key(key);
+        decryption = Botan::Cipher_Mode::create_or_throw("AES-256/GCM", Botan::Cipher_Dir::Decryption);
+        decryption->set_key(key);
+    }
+
+    std::array<std::uint8_t, 12> Journal::nonce(const std::uint64_t sequence)
+    {
+        std::array<std::uint8_t, 12> nonce{};
+        store_u64(nonce.data() + 4, sequence);
+        return nonce;
+    }
+
+    void Journal::append(const std::uint8_t type, const std::span<const std::uint8_t> payload)
+    {
+        if (payload.size() > MAX_PAYLOAD_LENGTH)
+        {
+            throw SpankOlmErrorOutputBufferTooSmall();
+        }
+
+        Botan::secure_vector<std::uint8_t> record;
+        record.reserve(1 + payload.size() + TAG_LENGTH);
+        record.push_back(type);
+        record.insert(record.end(), payload.begin(), payload.end());
+
+        std::lock_guard lock(mutex);
+        if (failed)
+        {
+            throw SpankOlmErrorIO();
+        }
+        encryption->start(nonce(next_sequence++));
+        encryption->finish(record);
+
+        pending.push_back(static_cast<std::uint8_t>(record.size() >> 8));
+        pending.push_back(static_cast<std::uint8_t>(record.size()));
+        pending.insert(pending.end(), record.begin(), record.end());
+    }
+
+    void Journal::commit()
+    {
+        // Only one thread writes at a time. Whoever gets here next picks up everything appended in the meantime, so
+        // the waiting threads share a single fsync.
+        std::lock_guard sync_lock(sync_mutex);
+
+        std::vector<std::uint8_t> batch;
+        {
+            std::lock_guard lock(mutex);
+            if (failed)
+            {
+                throw SpankOlmErrorIO();
+            }
+            batch.swap(pending);
+        }
+        if (batch.empty())
+        {
+            return;
+        }
+
+        try
+        {
+            write_all(fd, batch.data(), batch.size());
+            if (::fsync(fd) != 0)
+            {
+                throw SpankOlmErrorIO();
+            }
+        }
+        catch (...)
+        {
+            // Cut off whatever part of the batch reached the file and queue it again in front of the records appended
+            // since, so the next commit writes them without a gap in the sequence. The records keep their ciphertext,
+            // so no nonce is used for a second plaintext. If even that fails, the file can't be trusted to continue
+            // with the next record anymore.
+            std::lock_guard lock(mutex);
+            if (::ftruncate(fd, static_cast<off_t>(JOURNAL_HEADER_LENGTH + written)) != 0)
+            {
+                failed = true;
+            }
+            batch.insert(batch.end(), pending.begin(), pending.end());
+            pending.swap(batch);
+            throw;
+        }
+
+        std::lock_guard lock(mutex);
+        written += batch.size();
+    }
+
+    void Journal::reset(const std::uint64_t generation) { rewrite(generation, {}); }
+
+    void Journal::rewrite(const std::uint64_t generation, std::span<const Botan::secure_vector<std::uint8_t>> records)
+    {
+        std::lock_guard sync_lock(sync_mutex);
+        std::lock_guard lock(mutex);
+
+        Botan::AutoSeeded_RNG rng;
+        std::vector<std::uint8_t> data(JOURNAL_HEADER_LENGTH);
+        std::copy(JOURNAL_MAGIC.begin(), JOURNAL_MAGIC.end(), data.begin());
+        store_u64(data.data() + JOURNAL_MAGIC.size(), generation);
+        const auto salt = std::span(data).subspan(JOURNAL_MAGIC.size() + GENERATION_LENGTH, SALT_LENGTH);
+        rng.randomize(salt);
+        init(salt);
+
+        next_sequence = 0;
+        for (auto record : records)
+        {
+            encryption->start(nonce(next_sequence++));
+            encryption->finish(record);
+            data.push_back(static_cast<std::uint8_t>(record.size() >> 8));
+            data.push_back(static_cast<std::uint8_t>(record.size()));
+            data.insert(data.end(), record.begin(), record.end());
+        }
+
+        try
+        {
+            replace_file(path, data);
+
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            if (fd < 0)
+            {
+                throw SpankOlmErrorIO();
+            }
+        }
+        catch (...)
+        {
+            // The ciphers already use the new key, which doesn't match the file anymore.
+            failed = true;
+            throw;
+        }
+
+        current_generation = generation;
+        pending.clear();
+        written = data.size() - JOURNAL_HEADER_LENGTH;
+        failed = false;
+    }
+
+    std::size_t Journal::size() const
+    {
+        std::lock_guard lock(mutex);
+        return written + pending.size();
+    }
+
+    JournaledState::JournaledState(std::filesystem::path path, const std::string_view pickle_key,
+                                   const std::size_t compact_threshold) :
+        path(std::move(path)), pickle_key(pickle_key.begin(), pickle_key.end()), cipher(pickle_key),
+        compact_threshold(compact_threshold)
+    {
+    }
+
+    void JournaledState::create(std::filesystem::path const &path, const std::string_view encrypted)
+    {
+        write_snapshot(path, 1, encrypted);
+        // Don't let an old journal at the same place be applied to the new state.
+        std::filesystem::remove(journal_path(path));
+    }
+
+    void JournaledState::load()
+    {
+        const auto [generation, encrypted] = read_snapshot(path);
+        restore(cipher, encrypted);
+        journal = std::make_unique<Journal>(
+            journal_path(path), pickle_key, generation,
+            [this](const std::uint8_t type, const std::span<const std::uint8_t> payload) { apply(type, payload); });
+    }
+
+    void JournaledState::commit()
+    {
+        journal->commit();
+        if (journal->size() >= compact_threshold)
+        {
+            compact();
+        }
+    }
+
+    void JournaledState::compact()
+    {
+        const auto generation = journal->generation() + 1;
+        write_snapshot(path, generation, snapshot(cipher));
+        journal->reset(generation);
+    }
+
+    AccountJournal::AccountJournal(std::filesystem::path path, const std::string_view pickle_key,
+                                   const std::size_t compact_threshold) :
+        JournaledState(std::move(path), pickle_key, compact_threshold)
+    {
+        load();
+    }
+
+    void AccountJournal::create(std::filesystem::path const &path, const std::string_view pickle_key,
+                                Account const &account)
+    {
+        PickleCipher cipher(pickle_key);
+        JournaledState::create(path, account.pickle(cipher));
+    }
+
+    void AccountJournal::generate_one_time_keys(Botan::RandomNumberGenerator &rng, const std::size_t number_of_keys)
+    {
+        for (std::size_t i = 0; i < number_of_keys; ++i)
+        {
+            OneTimeKey key{++state.next_one_time_key_id, false, Botan::X25519_PrivateKey(rng)};
+            record(ONE_TIME_KEY, key_record(key.id, key.key));
+            state.one_time_keys.insert(key);
+        }
+    }
+
+    void AccountJournal::generate_fallback_key(Botan::RandomNumberGenerator &rng)
+    {
+        OneTimeKey key{++state.next_one_time_key_id, false, Botan::X25519_PrivateKey(rng)};
+        record(FALLBACK_KEY, key_record(key.id, key.key));
+        state.prev_fallback_key = std::move(state.current_fallback_key);
+        state.current_fallback_key = std::move(key);
+    }
+
+    std::size_t AccountJournal::mark_keys_as_published()
+    {
+        record(MARK_KEYS_AS_PUBLISHED, {});
+        return state.mark_keys_as_published();
+    }
+
+    void AccountJournal::forget_old_fallback_key()
+    {
+        record(FORGET_OLD_FALLBACK_KEY, {});
+        state.forget_old_fallback_key();
+    }
+
+    void AccountJournal::remove_key(Botan::Public_Key const &key)
+    {
+        const auto bits = key.raw_public_key_bits();
+        for (const auto &one_time_key : state.one_time_keys)
+        {
+            if (one_time_key->key.raw_public_key_bits() == bits)
+            {
+                std::array<std::uint8_t, 4> payload{};
+                pickle(payload.data(), one_time_key->id);
+                record(REMOVE_KEY, payload);
+                state.one_time_keys.erase(one_time_key);
+                return;
+            }
+        }
+    }
+
+    std::string AccountJournal::snapshot(PickleCipher &cipher) const { return state.pickle(cipher); }
+
+    void AccountJournal::restore(PickleCipher &cipher, const std::string_view encrypted)
+    {
+        state = Account::unpickle(cipher, encrypted);
+    }
+
+    void AccountJournal::apply(const std::uint8_t type, const std::span<const std::uint8_t> payload)
+    {
+        switch (type)
+        {
+        case ONE_TIME_KEY:
+        {
+            auto key = parse_key_record(payload);
+            state.next_one_time_key_id = key.id;
+            state.one_time_keys.insert(key);
+            break;
+        }
+        case FALLBACK_KEY:
+        {
+            auto key = parse_key_record(payload);
+            state.next_one_time_key_id = key.id;
+            state.prev_fallback_key = std::move(state.current_fallback_key);
+            state.current_fallback_key = std::move(key);
+            break;
+        }
+        case MARK_KEYS_AS_PUBLISHED:
+            state.mark_keys_as_published();
+            break;
+        case FORGET_OLD_FALLBACK_KEY:
+            state.forget_old_fallback_key();
+            break;
+        case REMOVE_KEY:
+            remove_one_time_key(state, parse_u32_record(payload));
+            break;
+        default:
+            throw SpankOlmErrorCorruptedPickle();
+        }
+    }
+
+    MegolmJournal::MegolmJournal(std::filesystem::path path, const std::string_view pickle_key,
+                                 const std::size_t compact_threshold) :
+        JournaledState(std::move(path), pickle_key, compact_threshold)
+    {
+        load();
+    }
+
+    void MegolmJournal::create(std::filesystem::path const &path, const std::string_view pickle_key,
+                               Megolm const &megolm)
+    {
+        PickleCipher cipher(pickle_key);
+        JournaledState::create(path, megolm.pickle(cipher));
+    }
+
+    void MegolmJournal::advance()
+    {
+        state.advance();
+        std::array<std::uint8_t, 4> payload{};
+        pickle(payload.data(), state.counter);
+        record(ADVANCE, payload);
+    }
+
+    void MegolmJournal::advance(const unsigned int advance_to)
+    {
+        state.advance(advance_to);
+        std::array<std::uint8_t, 4> payload{};
+        pickle(payload.data(), state.counter);
+        record(ADVANCE, payload);
+    }
+
+    std::string MegolmJournal::snapshot(PickleCipher &cipher) const { return state.pickle(cipher); }
+
+    void MegolmJournal::restore(PickleCipher &cipher, const std::string_view encrypted)
+    {
+        state.unpickle(cipher, encrypted);
+    }
+
+    void MegolmJournal::apply(const std::uint8_t type, const std::span<const std::uint8_t> payload)
+    {
+        if (type != ADVANCE)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+        state.advance(parse_u32_record(payload));
+    }
+} // namespace spank_olm
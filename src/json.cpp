@@ -0,0 +1,368 @@
+#include "json.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace spank_olm
+{
+    namespace
+    {
+        bool is_whitespace(const char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+        std::size_t skip_whitespace(const std::string_view json, std::size_t pos)
+        {
+            while (pos < json.size() && is_whitespace(json[pos]))
+            {
+                ++pos;
+            }
+            return pos;
+        }
+
+        /**
+         * \brief Returns the position after the string whose opening quote is at pos.
+         */
+        std::size_t skip_string(const std::string_view json, std::size_t pos)
+        {
+            for (++pos; pos < json.size(); ++pos)
+            {
+                if (json[pos] == '\\')
+                {
+                    ++pos;
+                }
+                else if (json[pos] == '"')
+                {
+                    return pos + 1;
+                }
+            }
+            throw SpankOlmErrorBadMessageFormat();
+        }
+
+        /**
+         * \brief Returns the position after the value starting at pos.
+         */
+        std::size_t skip_value(const std::string_view json, std::size_t pos)
+        {
+            if (pos >= json.size())
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            if (json[pos] == '"')
+            {
+                return skip_string(json, pos);
+            }
+            if (json[pos] == '{' || json[pos] == '[')
+            {
+                std::size_t depth = 0;
+                while (pos < json.size())
+                {
+                    const auto c = json[pos];
+                    if (c == '"')
+                    {
+                        pos = skip_string(json, pos);
+                        continue;
+                    }
+                    if (c == '{' || c == '[')
+                    {
+                        ++depth;
+                    }
+                    else if ((c == '}' || c == ']') && --depth == 0)
+                    {
+                        return pos + 1;
+                    }
+                    ++pos;
+                }
+                throw SpankOlmErrorBadMessageFormat();
+            }
+
+            // A number, true, false or null
+            const auto start = pos;
+            while (pos < json.size() && !is_whitespace(json[pos]) && json[pos] != ',' && json[pos] != '}' &&
+                   json[pos] != ']')
+            {
+                ++pos;
+            }
+            if (pos == start)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            return pos;
+        }
+
+        std::uint32_t read_hex4(const std::string_view raw, const std::size_t pos)
+        {
+            if (pos + 4 > raw.size())
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            std::uint32_t value = 0;
+            for (std::size_t i = pos; i < pos + 4; ++i)
+            {
+                const auto c = raw[i];
+                value <<= 4;
+                if (c >= '0' && c <= '9')
+                {
+                    value |= c - '0';
+                }
+                else if (c >= 'a' && c <= 'f')
+                {
+                    value |= c - 'a' + 10;
+                }
+                else if (c >= 'A' && c <= 'F')
+                {
+                    value |= c - 'A' + 10;
+                }
+                else
+                {
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+            }
+            return value;
+        }
+
+        /**
+         * \brief Writes a code point as UTF-8.
+         */
+        std::size_t write_utf8(const std::uint32_t code_point, char *out)
+        {
+            if (code_point < 0x80)
+            {
+                out[0] = static_cast<char>(code_point);
+                return 1;
+            }
+            if (code_point < 0x800)
+            {
+                out[0] = static_cast<char>(0xc0 | code_point >> 6);
+                out[1] = static_cast<char>(0x80 | (code_point & 0x3f));
+                return 2;
+            }
+            if (code_point < 0x10000)
+            {
+                out[0] = static_cast<char>(0xe0 | code_point >> 12);
+                out[1] = static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+                out[2] = static_cast<char>(0x80 | (code_point & 0x3f));
+                return 3;
+            }
+            out[0] = static_cast<char>(0xf0 | code_point >> 18);
+            out[1] = static_cast<char>(0x80 | (code_point >> 12 & 0x3f));
+            out[2] = static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+            out[3] = static_cast<char>(0x80 | (code_point & 0x3f));
+            return 4;
+        }
+
+        /**
+         * \brief Calls visit with the raw name and value of the fields of an object until it returns true.
+         *
+         * \return Whether visit returned true.
+         */
+        template <typename Visitor>
+        bool visit_json_fields(const std::string_view json, Visitor &&visit)
+        {
+            auto pos = skip_whitespace(json, 0);
+            if (pos == json.size() || json[pos] != '{')
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            pos = skip_whitespace(json, pos + 1);
+            if (pos < json.size() && json[pos] == '}')
+            {
+                return false;
+            }
+
+            while (pos < json.size() && json[pos] == '"')
+            {
+                const auto name_end = skip_string(json, pos);
+                const auto name = json.substr(pos + 1, name_end - pos - 2);
+                pos = skip_whitespace(json, name_end);
+                if (pos == json.size() || json[pos] != ':')
+                {
+                    break;
+                }
+                pos = skip_whitespace(json, pos + 1);
+                const auto value_end = skip_value(json, pos);
+                if (visit(name, json.substr(pos, value_end - pos)))
+                {
+                    return true;
+                }
+
+                pos = skip_whitespace(json, value_end);
+                if (pos < json.size() && json[pos] == '}')
+                {
+                    return false;
+                }
+                if (pos == json.size() || json[pos] != ',')
+                {
+                    break;
+                }
+                pos = skip_whitespace(json, pos + 1);
+            }
+            throw SpankOlmErrorBadMessageFormat();
+        }
+    } // namespace
+
+    void for_each_json_field(const std::string_view json, JsonFieldVisitor const &visit)
+    {
+        visit_json_fields(json, visit);
+    }
+
+    std::string_view find_json_value(const std::string_view json, const std::string_view key)
+    {
+        std::string_view result;
+        const auto found = visit_json_fields(json, [&](const std::string_view name, const std::string_view value) {
+            if (name != key)
+            {
+                return false;
+            }
+            result = value;
+            return true;
+        });
+        if (!found)
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        return result;
+    }
+
+    std::string_view find_json_string(const std::string_view json, const std::string_view key)
+    {
+        const auto value = find_json_value(json, key);
+        if (value.front() != '"')
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        return value.substr(1, value.size() - 2);
+    }
+
+    std::size_t unescape_json_string(const std::string_view raw, const std::span<char> output)
+    {
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < raw.size(); ++i)
+        {
+            if (length == output.size())
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            if (raw[i] != '\\')
+            {
+                output[length++] = raw[i];
+                continue;
+            }
+            if (++i == raw.size())
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            switch (raw[i])
+            {
+            case '"':
+            case '\\':
+            case '/':
+                output[length++] = raw[i];
+                break;
+            case 'b':
+                output[length++] = '\b';
+                break;
+            case 'f':
+                output[length++] = '\f';
+                break;
+            case 'n':
+                output[length++] = '\n';
+                break;
+            case 'r':
+                output[length++] = '\r';
+                break;
+            case 't':
+                output[length++] = '\t';
+                break;
+            case 'u':
+            {
+                auto code_point = read_hex4(raw, i + 1);
+                i += 4;
+                if (code_point >= 0xd800 && code_point < 0xdc00)
+                {
+                    // A high surrogate has to be followed by an escaped low surrogate.
+                    if (i + 2 >= raw.size() || raw[i + 1] != '\\' || raw[i + 2] != 'u')
+                    {
+                        throw SpankOlmErrorBadMessageFormat();
+                    }
+                    const auto low = read_hex4(raw, i + 3);
+                    if (low < 0xdc00 || low >= 0xe000)
+                    {
+                        throw SpankOlmErrorBadMessageFormat();
+                    }
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                    i += 6;
+                }
+                else if (code_point >= 0xdc00 && code_point < 0xe000)
+                {
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+                char utf8[4];
+                const auto utf8_length = write_utf8(code_point, utf8);
+                if (length + utf8_length > output.size())
+                {
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+                std::copy_n(utf8, utf8_length, output.data() + length);
+                length += utf8_length;
+                break;
+            }
+            default:
+                throw SpankOlmErrorBadMessageFormat();
+            }
+        }
+        return length;
+    }
+
+    std::string unescape_json_string(const std::string_view raw)
+    {
+        std::string text(raw.size(), '\0');
+        text.resize(unescape_json_string(raw, text));
+        return text;
+    }
+
+    void append_json_string(std::string &json, const std::string_view text)
+    {
+        constexpr std::string_view HEX_DIGITS = "0123456789abcdef";
+
+        json += '"';
+        for (const auto c : text)
+        {
+            switch (c)
+            {
+            case '"':
+                json += "\\\"";
+                break;
+            case '\\':
+                json += "\\\\";
+                break;
+            case '\b':
+                json += "\\b";
+                break;
+            case '\f':
+                json += "\\f";
+                break;
+            case '\n':
+                json += "\\n";
+                break;
+            case '\r':
+                json += "\\r";
+                break;
+            case '\t':
+                json += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    json += "\\u00";
+                    json += HEX_DIGITS[c >> 4];
+                    json += HEX_DIGITS[c & 0xf];
+                }
+                else
+                {
+                    json += c;
+                }
+            }
+        }
+        json += '"';
+    }
+} // namespace spank_olm
@@ -0,0 +1,95 @@
+#include "key_backup.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+#include "json.hpp"
+#include "pickle.hpp"
+
+#include <algorithm>
+#include <botan/mem_ops.h>
+
+namespace spank_olm
+{
+    namespace
+    {
+        /**
+         * \brief The number of base64 characters of an exported session, which needs no padding.
+         */
+        constexpr std::size_t SESSION_EXPORT_BASE64_LENGTH = base64_encoded_length(SESSION_EXPORT_LENGTH, false);
+
+        constexpr std::string_view SESSION_KEY_FIELD = "session_key";
+    } // namespace
+
+    RoomKey RoomKey::decode(const std::string_view session_key)
+    {
+        if (session_key.size() > base64_encoded_length(SESSION_EXPORT_LENGTH))
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        std::array<std::uint8_t, base64_decoded_length(base64_encoded_length(SESSION_EXPORT_LENGTH))> buffer;
+        const auto length = base64_decode(session_key, buffer);
+        if (length != SESSION_EXPORT_LENGTH)
+        {
+            Botan::secure_scrub_memory(buffer.data(), buffer.size());
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        if (buffer[0] != SESSION_EXPORT_VERSION)
+        {
+            Botan::secure_scrub_memory(buffer.data(), buffer.size());
+            throw SpankOlmErrorBadMessageVersion();
+        }
+
+        RoomKey key;
+        const auto *pos = buffer.data() + 1;
+        const auto *end = buffer.data() + length;
+        pos = unpickle(pos, end, key.ratchet.counter);
+        pos = unpickle_bytes(pos, end, reinterpret_cast<std::uint8_t *>(key.ratchet.data.data()),
+                             MEGOLM_RATCHET_LENGTH);
+        unpickle_bytes(pos, end, key.signing_key.data(), key.signing_key.size());
+        Botan::secure_scrub_memory(buffer.data(), buffer.size());
+        return key;
+    }
+
+    std::string RoomKey::encode() const
+    {
+        Botan::secure_vector<std::uint8_t> buffer(SESSION_EXPORT_LENGTH);
+        auto *pos = buffer.data();
+        *pos++ = SESSION_EXPORT_VERSION;
+        pos = pickle(pos, ratchet.counter);
+        pos = pickle_bytes(pos, ratchet.get_data(), MEGOLM_RATCHET_LENGTH);
+        pickle_bytes(pos, signing_key.data(), signing_key.size());
+        return base64_encode(buffer, false);
+    }
+
+    RoomKey decode_session_key_field(const std::string_view json)
+    {
+        std::array<char, SESSION_EXPORT_BASE64_LENGTH> session_key;
+        const auto length = unescape_json_string(find_json_string(json, SESSION_KEY_FIELD), session_key);
+        try
+        {
+            auto key = RoomKey::decode(std::string_view(session_key.data(), length));
+            Botan::secure_scrub_memory(session_key.data(), session_key.size());
+            return key;
+        }
+        catch (...)
+        {
+            Botan::secure_scrub_memory(session_key.data(), session_key.size());
+            throw;
+        }
+    }
+
+    std::vector<RestoredRoomKey> restore_key_backup(PkDecryption const &decryption,
+                                                    const std::span<const PkMessage> session_data, ThreadPool &pool)
+    {
+        std::vector<RestoredRoomKey> results(session_data.size());
+        const auto errors = decryption.decrypt_each(
+            session_data, pool, [&results](const std::size_t index, const std::span<const std::uint8_t> plaintext) {
+                results[index].key = decode_session_key_field(
+                    std::string_view(reinterpret_cast<const char *>(plaintext.data()), plaintext.size()));
+            });
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            results[i].error = errors[i];
+        }
+        return results;
+    }
+} // namespace spank_olm
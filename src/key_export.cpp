@@ -0,0 +1,744 @@
+#include "key_export.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+#include "json.hpp"
+#include "pickle.hpp"
+
+#include <algorithm>
+#include <array>
+#include <botan/hash.h>
+#include <botan/mac.h>
+#include <botan/mem_ops.h>
+#include <botan/pwdhash.h>
+#include <botan/stream_cipher.h>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::string_view HEADER_LINE = "-----BEGIN MEGOLM SESSION DATA-----";
+        constexpr std::string_view FOOTER_LINE = "-----END MEGOLM SESSION DATA-----";
+        constexpr std::string_view MEGOLM_ALGORITHM = "m.megolm.v1.aes-sha2";
+
+        constexpr std::uint8_t KEY_EXPORT_VERSION = 1;
+        constexpr std::size_t SALT_LENGTH = 16;
+        constexpr std::size_t IV_LENGTH = 16;
+        constexpr std::size_t HEADER_LENGTH = 1 + SALT_LENGTH + IV_LENGTH + 4;
+        constexpr std::size_t AES_KEY_LENGTH = 32;
+        constexpr std::size_t HMAC_KEY_LENGTH = 32;
+        constexpr std::size_t MAC_LENGTH = 32;
+
+        /**
+         * \brief The number of bytes per line of base64, which gives the 96 characters per line Element writes.
+         */
+        constexpr std::size_t LINE_BYTES = 72;
+
+        constexpr std::size_t READ_BLOCK_LENGTH = 65536;
+
+        /**
+         * \brief The length of the ciphertext segments an import checks before decrypting them.
+         */
+        constexpr std::size_t SEGMENT_LENGTH = 65536;
+
+        constexpr std::size_t SEGMENT_HASH_LENGTH = 32;
+
+        /**
+         * \brief The longest footer accepted, including trailing whitespace.
+         */
+        constexpr std::size_t MAX_FOOTER_LENGTH = FOOTER_LINE.size() + 64;
+
+        using Bytes = std::function<void(std::span<const std::uint8_t>)>;
+
+        bool is_whitespace(const char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+        std::span<const std::uint8_t> as_bytes(const std::string_view text)
+        {
+            return {reinterpret_cast<const std::uint8_t *>(text.data()), text.size()};
+        }
+
+        /**
+         * \brief The version, salt, IV and number of PBKDF2 rounds at the start of a key export.
+         */
+        struct Header
+        {
+            std::array<std::uint8_t, HEADER_LENGTH> bytes{};
+
+            [[nodiscard]] std::span<const std::uint8_t> salt() const
+            {
+                return std::span<const std::uint8_t>(bytes).subspan(1, SALT_LENGTH);
+            }
+
+            [[nodiscard]] std::span<const std::uint8_t> iv() const
+            {
+                return std::span<const std::uint8_t>(bytes).subspan(1 + SALT_LENGTH, IV_LENGTH);
+            }
+
+            [[nodiscard]] std::uint32_t rounds() const
+            {
+                std::uint32_t rounds = 0;
+                unpickle(bytes.data() + 1 + SALT_LENGTH + IV_LENGTH, bytes.data() + bytes.size(), rounds);
+                return rounds;
+            }
+        };
+
+        struct ExportKeys
+        {
+            std::unique_ptr<Botan::StreamCipher> cipher;
+            std::unique_ptr<Botan::MessageAuthenticationCode> hmac;
+        };
+
+        ExportKeys derive_keys(const std::string_view passphrase, Header const &header)
+        {
+            if (header.rounds() == 0 || header.rounds() > MAX_KEY_EXPORT_ROUNDS)
+            {
+                throw SpankOlmErrorBadKeyExport();
+            }
+
+            Botan::secure_vector<std::uint8_t> keys(AES_KEY_LENGTH + HMAC_KEY_LENGTH);
+            const auto salt = header.salt();
+            Botan::PasswordHashFamily::create_or_throw("PBKDF2(SHA-512)")
+                ->from_iterations(header.rounds())
+                ->derive_key(keys.data(), keys.size(), passphrase.data(), passphrase.size(), salt.data(), salt.size());
+
+            ExportKeys result{Botan::StreamCipher::create_or_throw("CTR(AES-256)"),
+                              Botan::MessageAuthenticationCode::create_or_throw("HMAC(SHA-256)")};
+            const auto key_span = std::span<const std::uint8_t>(keys);
+            result.cipher->set_key(key_span.first(AES_KEY_LENGTH));
+            result.cipher->set_iv(header.iv());
+            result.hmac->set_key(key_span.last(HMAC_KEY_LENGTH));
+            return result;
+        }
+
+        /**
+         * \brief Decodes the base64 between the header and footer lines of a key export, one block at a time.
+         */
+        void read_armored(std::istream &input, Bytes const &consume)
+        {
+            std::string line;
+            do
+            {
+                if (!std::getline(input, line))
+                {
+                    throw SpankOlmErrorBadKeyExport();
+                }
+                while (!line.empty() && is_whitespace(line.back()))
+                {
+                    line.pop_back();
+                }
+            } while (line.empty());
+            if (line != HEADER_LINE)
+            {
+                throw SpankOlmErrorBadKeyExport();
+            }
+
+            std::vector<char> block(READ_BLOCK_LENGTH);
+            std::string base64; ///< Characters which don't fill a group of four yet.
+            std::vector<std::uint8_t> decoded;
+            std::string footer;
+            const auto decode = [&](const std::size_t length) {
+                decoded.resize(base64_decoded_length(length));
+                decoded.resize(base64_decode(std::string_view(base64).substr(0, length), decoded));
+                base64.erase(0, length);
+                consume(decoded);
+            };
+
+            while (input.read(block.data(), static_cast<std::streamsize>(block.size())) || input.gcount() > 0)
+            {
+                const auto count = static_cast<std::size_t>(input.gcount());
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    // Base64 has no '-', so the first one starts the footer.
+                    const auto c = block[i];
+                    if (!footer.empty() || c == '-')
+                    {
+                        if (footer.size() == MAX_FOOTER_LENGTH)
+                        {
+                            throw SpankOlmErrorBadKeyExport();
+                        }
+                        footer += c;
+                    }
+                    else if (!is_whitespace(c))
+                    {
+                        base64 += c;
+                    }
+                }
+                decode(base64.size() / 4 * 4);
+            }
+
+            while (!footer.empty() && is_whitespace(footer.back()))
+            {
+                footer.pop_back();
+            }
+            if (footer != FOOTER_LINE)
+            {
+                throw SpankOlmErrorBadKeyExport();
+            }
+            decode(base64.size());
+        }
+
+        /**
+         * \brief Reads a key export, passing on its header and its ciphertext, and returns the MAC at its end.
+         *
+         * The MAC is only known once the file ends, so the last MAC_LENGTH bytes read are always held back.
+         */
+        std::array<std::uint8_t, MAC_LENGTH> read_export(std::istream &input, Header &header,
+                                                         std::function<void()> const &on_header,
+                                                         Bytes const &on_ciphertext)
+        {
+            std::size_t header_length = 0;
+            const auto authenticated = [&](std::span<const std::uint8_t> bytes) {
+                if (header_length < HEADER_LENGTH)
+                {
+                    const auto length = std::min(HEADER_LENGTH - header_length, bytes.size());
+                    std::copy_n(bytes.begin(), length, header.bytes.begin() + header_length);
+                    header_length += length;
+                    bytes = bytes.subspan(length);
+                    if (header_length == HEADER_LENGTH)
+                    {
+                        if (header.bytes[0] != KEY_EXPORT_VERSION)
+                        {
+                            throw SpankOlmErrorBadMessageVersion();
+                        }
+                        on_header();
+                    }
+                }
+                if (!bytes.empty())
+                {
+                    on_ciphertext(bytes);
+                }
+            };
+
+            std::array<std::uint8_t, MAC_LENGTH> held;
+            std::size_t held_length = 0;
+            read_armored(input, [&](const std::span<const std::uint8_t> bytes) {
+                const auto total = held_length + bytes.size();
+                if (total <= MAC_LENGTH)
+                {
+                    std::copy(bytes.begin(), bytes.end(), held.begin() + held_length);
+                    held_length = total;
+                    return;
+                }
+
+                const auto release = total - MAC_LENGTH;
+                if (release >= held_length)
+                {
+                    authenticated(std::span<const std::uint8_t>(held).first(held_length));
+                    authenticated(bytes.first(release - held_length));
+                    std::copy(bytes.end() - MAC_LENGTH, bytes.end(), held.begin());
+                }
+                else
+                {
+                    authenticated(std::span<const std::uint8_t>(held).first(release));
+                    std::copy(held.begin() + release, held.begin() + held_length, held.begin());
+                    std::copy(bytes.begin(), bytes.end(), held.begin() + held_length - release);
+                }
+                held_length = MAC_LENGTH;
+            });
+
+            if (header_length < HEADER_LENGTH || held_length < MAC_LENGTH)
+            {
+                throw SpankOlmErrorBadKeyExport();
+            }
+            return held;
+        }
+
+        /**
+         * \brief Ties the ciphertext of the second pass of an import to the one the first pass authenticated.
+         *
+         * The first pass records a SHA-256 hash of every segment of the ciphertext it feeds into the MAC. The second
+         * pass holds back each segment until it is complete and its hash matches the recorded one, so only bytes the
+         * MAC covered are decrypted, even if the file changes between the passes. This costs 32 bytes per 64 KiB of
+         * file, and a segment of ciphertext.
+         */
+        class CiphertextSegments
+        {
+        public:
+            CiphertextSegments() : hash(Botan::HashFunction::create_or_throw("SHA-256")) {}
+
+            /**
+             * \brief Records the hashes of the next ciphertext of the first pass.
+             */
+            void record(std::span<const std::uint8_t> bytes)
+            {
+                while (!bytes.empty())
+                {
+                    const auto length = std::min(bytes.size(), SEGMENT_LENGTH - recorded_length);
+                    hash->update(bytes.first(length));
+                    recorded_length += length;
+                    bytes = bytes.subspan(length);
+                    if (recorded_length == SEGMENT_LENGTH)
+                    {
+                        finish_segment();
+                    }
+                }
+            }
+
+            /**
+             * \brief Records the hash of the last segment of the first pass.
+             */
+            void finish_recording()
+            {
+                if (recorded_length > 0)
+                {
+                    finish_segment();
+                }
+            }
+
+            /**
+             * \brief Collects the next ciphertext of the second pass, passing on each segment once it is checked.
+             *
+             * \throws SpankOlmErrorBadMessageMac if a segment differs from the one of the first pass.
+             */
+            template <typename Consumer>
+            void check(std::span<const std::uint8_t> bytes, Consumer &&consume)
+            {
+                while (!bytes.empty())
+                {
+                    const auto length = std::min(bytes.size(), SEGMENT_LENGTH - segment.size());
+                    segment.insert(segment.end(), bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(length));
+                    bytes = bytes.subspan(length);
+                    if (segment.size() == SEGMENT_LENGTH)
+                    {
+                        check_segment(consume);
+                    }
+                }
+            }
+
+            /**
+             * \brief Checks and passes on the last segment of the second pass.
+             *
+             * \throws SpankOlmErrorBadMessageMac if the ciphertext differs from the one of the first pass.
+             */
+            template <typename Consumer>
+            void finish_checking(Consumer &&consume)
+            {
+                if (!segment.empty())
+                {
+                    check_segment(consume);
+                }
+                if (checked != hashes.size())
+                {
+                    throw SpankOlmErrorBadMessageMac();
+                }
+            }
+
+        private:
+            using SegmentHash = std::array<std::uint8_t, SEGMENT_HASH_LENGTH>;
+
+            void finish_segment()
+            {
+                hashes.emplace_back();
+                hash->final(hashes.back().data());
+                recorded_length = 0;
+            }
+
+            template <typename Consumer>
+            void check_segment(Consumer &consume)
+            {
+                SegmentHash actual;
+                hash->update(segment);
+                hash->final(actual.data());
+                if (checked == hashes.size() || actual != hashes[checked])
+                {
+                    throw SpankOlmErrorBadMessageMac();
+                }
+                ++checked;
+                consume(std::span<const std::uint8_t>(segment));
+                segment.clear();
+            }
+
+            std::unique_ptr<Botan::HashFunction> hash;
+            std::vector<SegmentHash> hashes;
+            std::size_t recorded_length = 0;
+            std::vector<std::uint8_t> segment;
+            std::size_t checked = 0;
+        };
+
+        /**
+         * \brief Splits the JSON array of a key export into the objects of its sessions as the text arrives.
+         */
+        class EntrySplitter
+        {
+        public:
+            template <typename Consumer>
+            void feed(const std::span<const std::uint8_t> text, Consumer &&consume)
+            {
+                for (const auto byte : text)
+                {
+                    const auto c = static_cast<char>(byte);
+                    switch (state)
+                    {
+                    case State::Start:
+                        if (c == '[')
+                        {
+                            state = State::Between;
+                        }
+                        else if (!is_whitespace(c))
+                        {
+                            throw SpankOlmErrorBadKeyExport();
+                        }
+                        break;
+                    case State::Between:
+                        if (c == '{')
+                        {
+                            state = State::Entry;
+                            depth = 1;
+                            entry.assign(1, c);
+                        }
+                        else if (c == ']')
+                        {
+                            state = State::End;
+                        }
+                        else if (c != ',' && !is_whitespace(c))
+                        {
+                            throw SpankOlmErrorBadKeyExport();
+                        }
+                        break;
+                    case State::Entry:
+                        if (entry.size() == MAX_KEY_EXPORT_ENTRY_LENGTH)
+                        {
+                            throw SpankOlmErrorBadKeyExport();
+                        }
+                        entry.push_back(c);
+                        if (in_string)
+                        {
+                            if (escaped)
+                            {
+                                escaped = false;
+                            }
+                            else if (c == '\\')
+                            {
+                                escaped = true;
+                            }
+                            else if (c == '"')
+                            {
+                                in_string = false;
+                            }
+                        }
+                        else if (c == '"')
+                        {
+                            in_string = true;
+                        }
+                        else if (c == '{' || c == '[')
+                        {
+                            ++depth;
+                        }
+                        else if ((c == '}' || c == ']') && --depth == 0)
+                        {
+                            consume(std::string_view(entry.data(), entry.size()));
+                            state = State::Between;
+                        }
+                        break;
+                    case State::End:
+                        if (!is_whitespace(c))
+                        {
+                            throw SpankOlmErrorBadKeyExport();
+                        }
+                        break;
+                    }
+                }
+            }
+
+            /**
+             * \brief Checks that the array was closed.
+             */
+            void finish() const
+            {
+                if (state != State::End)
+                {
+                    throw SpankOlmErrorBadKeyExport();
+                }
+            }
+
+        private:
+            enum class State
+            {
+                Start,
+                Between,
+                Entry,
+                End,
+            };
+
+            State state = State::Start;
+            std::size_t depth = 0;
+            bool in_string = false;
+            bool escaped = false;
+            Botan::secure_vector<char> entry;
+        };
+
+        /**
+         * \brief The JSON objects of a chunk of sessions, stored back to back.
+         */
+        struct EntryChunk
+        {
+            Botan::secure_vector<char> text;
+            std::vector<std::size_t> ends;
+
+            void add(const std::string_view entry)
+            {
+                text.insert(text.end(), entry.begin(), entry.end());
+                ends.push_back(text.size());
+            }
+        };
+
+        ImportedSession decode_entry(const std::string_view json)
+        {
+            ImportedSession imported;
+            try
+            {
+                auto &session = imported.session;
+                if (unescape_json_string(find_json_string(json, "algorithm")) != MEGOLM_ALGORITHM)
+                {
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+                session.room_id = unescape_json_string(find_json_string(json, "room_id"));
+                session.session_id = unescape_json_string(find_json_string(json, "session_id"));
+                session.sender_key = unescape_json_string(find_json_string(json, "sender_key"));
+                session.sender_claimed_ed25519_key =
+                    unescape_json_string(find_json_string(find_json_value(json, "sender_claimed_keys"), "ed25519"));
+                session.key = decode_session_key_field(json);
+            }
+            catch (...)
+            {
+                imported.error = std::current_exception();
+            }
+            return imported;
+        }
+
+        std::vector<ImportedSession> decode_chunk(EntryChunk const &chunk)
+        {
+            std::vector<ImportedSession> sessions;
+            sessions.reserve(chunk.ends.size());
+            std::size_t begin = 0;
+            for (const auto end : chunk.ends)
+            {
+                sessions.push_back(decode_entry(std::string_view(chunk.text.data() + begin, end - begin)));
+                begin = end;
+            }
+            return sessions;
+        }
+
+        std::string encode_chunk(std::span<const ExportedSession> sessions, const bool leading_comma)
+        {
+            std::string json;
+            for (auto const &session : sessions)
+            {
+                if (leading_comma || &session != sessions.data())
+                {
+                    json += ',';
+                }
+                json += R"({"algorithm":)";
+                append_json_string(json, MEGOLM_ALGORITHM);
+                json += R"(,"forwarding_curve25519_key_chain":[],"room_id":)";
+                append_json_string(json, session.room_id);
+                json += R"(,"sender_claimed_keys":{"ed25519":)";
+                append_json_string(json, session.sender_claimed_ed25519_key);
+                json += R"(},"sender_key":)";
+                append_json_string(json, session.sender_key);
+                json += R"(,"session_id":)";
+                append_json_string(json, session.session_id);
+                json += R"(,"session_key":")";
+                auto session_key = session.key.encode();
+                json += session_key;
+                Botan::secure_scrub_memory(session_key.data(), session_key.size());
+                json += R"("})";
+            }
+            return json;
+        }
+
+        /**
+         * \brief Writes bytes as base64 lines between the header and footer lines of a key export.
+         */
+        class ArmorWriter
+        {
+        public:
+            explicit ArmorWriter(std::ostream &output) : output(output) { output << HEADER_LINE << '\n'; }
+
+            void write(const std::span<const std::uint8_t> bytes)
+            {
+                pending.insert(pending.end(), bytes.begin(), bytes.end());
+                std::size_t pos = 0;
+                for (; pending.size() - pos >= LINE_BYTES; pos += LINE_BYTES)
+                {
+                    write_line(std::span<const std::uint8_t>(pending).subspan(pos, LINE_BYTES));
+                }
+                pending.erase(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(pos));
+            }
+
+            void finish()
+            {
+                if (!pending.empty())
+                {
+                    write_line(pending);
+                }
+                output << FOOTER_LINE << '\n';
+            }
+
+        private:
+            void write_line(const std::span<const std::uint8_t> bytes)
+            {
+                std::array<char, base64_encoded_length(LINE_BYTES) + 1> line;
+                const auto length = base64_encode(bytes, line);
+                line[length] = '\n';
+                output.write(line.data(), static_cast<std::streamsize>(length + 1));
+            }
+
+            std::ostream &output;
+            std::vector<std::uint8_t> pending;
+        };
+    } // namespace
+
+    void import_keys(std::istream &input, const std::string_view passphrase, ThreadPool &pool,
+                     KeyImportSink const &sink, std::size_t chunk_size)
+    {
+        chunk_size = std::max<std::size_t>(1, chunk_size);
+        const auto start = input.tellg();
+        if (start == std::istream::pos_type(-1))
+        {
+            throw SpankOlmErrorIO();
+        }
+
+        // The first pass only checks the MAC, so nothing of a forged file is handed out.
+        Header header;
+        std::optional<ExportKeys> keys;
+        CiphertextSegments segments;
+        const auto mac = read_export(
+            input, header,
+            [&] {
+                keys.emplace(derive_keys(passphrase, header));
+                keys->hmac->update(header.bytes);
+            },
+            [&](const std::span<const std::uint8_t> ciphertext) {
+                keys->hmac->update(ciphertext);
+                segments.record(ciphertext);
+            });
+        segments.finish_recording();
+        std::array<std::uint8_t, MAC_LENGTH> expected_mac;
+        keys->hmac->final(expected_mac.data());
+        if (!Botan::constant_time_compare(std::span<const std::uint8_t>(expected_mac), mac))
+        {
+            throw SpankOlmErrorBadMessageMac();
+        }
+
+        input.clear();
+        if (!input.seekg(start))
+        {
+            throw SpankOlmErrorIO();
+        }
+
+        EntrySplitter splitter;
+        EntryChunk chunk;
+        Botan::secure_vector<std::uint8_t> plaintext;
+        const auto deliver = [&sink](std::vector<ImportedSession> sessions) { sink(sessions); };
+        InOrder<std::vector<ImportedSession>> in_flight(pool);
+        const auto submit_chunk = [&] {
+            in_flight.submit([entries = std::move(chunk)] { return decode_chunk(entries); }, deliver);
+            chunk = {};
+        };
+
+        // The second pass only decrypts ciphertext which matches what the first pass authenticated, in case the file
+        // was changed in between.
+        const auto decrypt = [&](const std::span<const std::uint8_t> ciphertext) {
+            plaintext.assign(ciphertext.begin(), ciphertext.end());
+            keys->cipher->cipher1(plaintext.data(), plaintext.size());
+            splitter.feed(plaintext, [&](const std::string_view entry) {
+                chunk.add(entry);
+                if (chunk.ends.size() == chunk_size)
+                {
+                    submit_chunk();
+                }
+            });
+        };
+        Header second_header;
+        const auto second_mac = read_export(
+            input, second_header,
+            [&] {
+                if (second_header.bytes != header.bytes)
+                {
+                    throw SpankOlmErrorBadMessageMac();
+                }
+            },
+            [&](const std::span<const std::uint8_t> ciphertext) { segments.check(ciphertext, decrypt); });
+        segments.finish_checking(decrypt);
+        if (second_mac != mac)
+        {
+            throw SpankOlmErrorBadMessageMac();
+        }
+        splitter.finish();
+        if (!chunk.ends.empty())
+        {
+            submit_chunk();
+        }
+        in_flight.drain(deliver);
+    }
+
+    void export_keys(std::ostream &output, Botan::RandomNumberGenerator &rng, const std::string_view passphrase,
+                     KeyExportSource const &source, ThreadPool &pool, const std::uint32_t rounds,
+                     std::size_t chunk_size)
+    {
+        chunk_size = std::max<std::size_t>(1, chunk_size);
+
+        Header header;
+        header.bytes[0] = KEY_EXPORT_VERSION;
+        rng.randomize(header.bytes.data() + 1, SALT_LENGTH + IV_LENGTH);
+        // Like Element, clear bit 63 of the counter, as WebCrypto's AES-CTR only counts in the lower 64 bits.
+        header.bytes[1 + SALT_LENGTH + 8] &= 0x7f;
+        pickle(header.bytes.data() + 1 + SALT_LENGTH + IV_LENGTH, rounds);
+        auto keys = derive_keys(passphrase, header);
+
+        ArmorWriter armor(output);
+        keys.hmac->update(header.bytes);
+        armor.write(header.bytes);
+
+        Botan::secure_vector<std::uint8_t> ciphertext;
+        const auto write = [&](const std::string_view text) {
+            ciphertext.assign(text.begin(), text.end());
+            keys.cipher->cipher1(ciphertext.data(), ciphertext.size());
+            keys.hmac->update(ciphertext);
+            armor.write(ciphertext);
+        };
+        const auto deliver = [&write](std::string json) {
+            write(json);
+            Botan::secure_scrub_memory(json.data(), json.size());
+        };
+
+        write("[");
+        {
+            InOrder<std::string> in_flight(pool);
+            for (bool done = false, first = true; !done; first = false)
+            {
+                std::vector<ExportedSession> sessions;
+                sessions.reserve(chunk_size);
+                while (sessions.size() < chunk_size)
+                {
+                    ExportedSession session;
+                    if (!source(session))
+                    {
+                        done = true;
+                        break;
+                    }
+                    sessions.push_back(std::move(session));
+                }
+                if (!sessions.empty())
+                {
+                    in_flight.submit([chunk = std::move(sessions), first] { return encode_chunk(chunk, !first); },
+                                     deliver);
+                }
+            }
+            in_flight.drain(deliver);
+        }
+        write("]");
+
+        std::array<std::uint8_t, MAC_LENGTH> mac;
+        keys.hmac->final(mac.data());
+        armor.write(mac);
+        armor.finish();
+        if (!output)
+        {
+            throw SpankOlmErrorIO();
+        }
+    }
+} // namespace spank_olm
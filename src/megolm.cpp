@@ -1,4 +1,5 @@
 #include "megolm.hpp"
+#include "errors.hpp"
 #include "pickle.hpp"
 
 #include <botan/auto_rng.h>
@@ -91,6 +92,25 @@ namespace spank_olm
         return pos;
     }
 
+    std::string Megolm::pickle(PickleCipher &cipher) const
+    {
+        Botan::secure_vector<std::uint8_t> buffer;
+        buffer.reserve(PickleCipher::buffer_length(pickle_length()));
+        buffer.resize(pickle_length());
+        pickle(buffer.data());
+        return cipher.seal(buffer);
+    }
+
+    void Megolm::unpickle(PickleCipher &cipher, const std::string_view encrypted)
+    {
+        const auto data = cipher.decrypt(encrypted);
+        const auto end = data.data() + data.size();
+        if (unpickle(data.data(), end) != end)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+    }
+
     void Megolm::advance()
     {
         counter++;
@@ -0,0 +1,318 @@
+#include "message.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace spank_olm
+{
+    namespace
+    {
+        // Tags of the message fields: the field number shifted left by 3, ORed with the protobuf wire type.
+        constexpr std::uint8_t RATCHET_KEY_TAG = 0x0a;
+        constexpr std::uint8_t COUNTER_TAG = 0x10;
+        constexpr std::uint8_t CIPHERTEXT_TAG = 0x22;
+        constexpr std::uint8_t ONE_TIME_KEY_TAG = 0x0a;
+        constexpr std::uint8_t BASE_KEY_TAG = 0x12;
+        constexpr std::uint8_t IDENTITY_KEY_TAG = 0x1a;
+        constexpr std::uint8_t MESSAGE_TAG = 0x22;
+        constexpr std::uint8_t MESSAGE_INDEX_TAG = 0x08;
+        constexpr std::uint8_t GROUP_CIPHERTEXT_TAG = 0x12;
+
+        constexpr std::uint8_t WIRE_TYPE_VARINT = 0;
+        constexpr std::uint8_t WIRE_TYPE_BYTES = 2;
+
+        std::size_t varint_length(std::uint64_t value)
+        {
+            std::size_t length = 1;
+            for (; value >= 0x80; value >>= 7)
+            {
+                ++length;
+            }
+            return length;
+        }
+
+        std::uint8_t *write_varint(std::uint8_t *pos, std::uint64_t value)
+        {
+            for (; value >= 0x80; value >>= 7)
+            {
+                *pos++ = static_cast<std::uint8_t>(value | 0x80);
+            }
+            *pos++ = static_cast<std::uint8_t>(value);
+            return pos;
+        }
+
+        std::uint8_t const *read_varint(std::uint8_t const *pos, std::uint8_t const *end, std::uint64_t &value)
+        {
+            value = 0;
+            for (unsigned int shift = 0; pos != end && shift < 64; shift += 7)
+            {
+                const auto byte = *pos++;
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                {
+                    return pos;
+                }
+            }
+            return nullptr;
+        }
+
+        std::uint8_t *write_bytes_field(std::uint8_t *pos, const std::uint8_t tag,
+                                        const std::span<const std::uint8_t> bytes)
+        {
+            *pos++ = tag;
+            pos = write_varint(pos, bytes.size());
+            return std::copy(bytes.begin(), bytes.end(), pos);
+        }
+
+        /**
+         * \brief Calls the handler with the tag, integer value and bytes of every field of a message.
+         *
+         * Fields with unknown tags are passed on as well, so the caller can ignore them like libolm does.
+         */
+        template <typename Handler>
+        void read_fields(const std::span<const std::uint8_t> fields, Handler &&handler)
+        {
+            auto pos = fields.data();
+            const auto end = fields.data() + fields.size();
+            while (pos != end)
+            {
+                std::uint64_t tag;
+                std::uint64_t value;
+                pos = read_varint(pos, end, tag);
+                if (!pos || !((pos = read_varint(pos, end, value))))
+                {
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+
+                switch (tag & 0x7)
+                {
+                case WIRE_TYPE_VARINT:
+                    handler(tag, value, std::span<const std::uint8_t>());
+                    break;
+                case WIRE_TYPE_BYTES:
+                    if (value > static_cast<std::uint64_t>(end - pos))
+                    {
+                        throw SpankOlmErrorBadMessageFormat();
+                    }
+                    handler(tag, 0, std::span<const std::uint8_t>(pos, value));
+                    pos += value;
+                    break;
+                default:
+                    throw SpankOlmErrorBadMessageFormat();
+                }
+            }
+        }
+
+        void check_version(const std::span<const std::uint8_t> message, const std::size_t minimum_length)
+        {
+            if (message.size() < minimum_length)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            if (message[0] != MESSAGE_PROTOCOL_VERSION)
+            {
+                throw SpankOlmErrorBadMessageVersion();
+            }
+        }
+
+        std::uint32_t to_u32(const std::uint64_t value)
+        {
+            if (value > std::numeric_limits<std::uint32_t>::max())
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            return static_cast<std::uint32_t>(value);
+        }
+
+        void read_pre_key_fields(const std::span<const std::uint8_t> fields, PreKeyMessageView &view)
+        {
+            read_fields(fields, [&view](const std::uint64_t tag, std::uint64_t,
+                                        const std::span<const std::uint8_t> bytes) {
+                switch (tag)
+                {
+                case ONE_TIME_KEY_TAG:
+                    view.one_time_key = bytes;
+                    break;
+                case BASE_KEY_TAG:
+                    view.base_key = bytes;
+                    break;
+                case IDENTITY_KEY_TAG:
+                    view.identity_key = bytes;
+                    break;
+                case MESSAGE_TAG:
+                    view.message = bytes;
+                    break;
+                default:
+                    break;
+                }
+            });
+        }
+
+        bool has_keys(PreKeyMessageView const &view)
+        {
+            return view.one_time_key.size() == CURVE25519_KEY_LENGTH && view.base_key.size() == CURVE25519_KEY_LENGTH &&
+                   view.identity_key.size() == CURVE25519_KEY_LENGTH;
+        }
+    } // namespace
+
+    MessageView MessageView::decode(const std::span<const std::uint8_t> message)
+    {
+        check_version(message, 1 + MESSAGE_MAC_LENGTH);
+
+        MessageView view;
+        view.authenticated = message.first(message.size() - MESSAGE_MAC_LENGTH);
+        view.mac = message.last(MESSAGE_MAC_LENGTH);
+
+        bool has_counter = false;
+        read_fields(view.authenticated.subspan(1),
+                    [&](const std::uint64_t tag, const std::uint64_t value, const std::span<const std::uint8_t> bytes) {
+                        switch (tag)
+                        {
+                        case RATCHET_KEY_TAG:
+                            view.ratchet_key = bytes;
+                            break;
+                        case COUNTER_TAG:
+                            view.counter = to_u32(value);
+                            has_counter = true;
+                            break;
+                        case CIPHERTEXT_TAG:
+                            view.ciphertext = bytes;
+                            break;
+                        default:
+                            break;
+                        }
+                    });
+
+        if (view.ratchet_key.size() != CURVE25519_KEY_LENGTH || !has_counter || view.ciphertext.empty())
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        return view;
+    }
+
+    PreKeyMessageView PreKeyMessageView::decode(const std::span<const std::uint8_t> message)
+    {
+        check_version(message, 1);
+
+        PreKeyMessageView view;
+        read_pre_key_fields(message.subspan(1), view);
+        if (!has_keys(view) || view.message.empty())
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        return view;
+    }
+
+    std::optional<PreKeyMessageView> PreKeyMessageView::decode_keys(const std::span<const std::uint8_t> start)
+    {
+        if (start.size() < PRE_KEY_MESSAGE_KEYS_LENGTH || start[0] != MESSAGE_PROTOCOL_VERSION)
+        {
+            return std::nullopt;
+        }
+
+        PreKeyMessageView view;
+        try
+        {
+            read_pre_key_fields(start.subspan(1, PRE_KEY_MESSAGE_KEYS_LENGTH - 1), view);
+        }
+        catch (const SpankOlmErrorBadMessageFormat &)
+        {
+            // A field crosses the end of the start, so the keys aren't encoded first.
+            return std::nullopt;
+        }
+        if (!has_keys(view))
+        {
+            return std::nullopt;
+        }
+        view.message = {};
+        return view;
+    }
+
+    GroupMessageView GroupMessageView::decode(const std::span<const std::uint8_t> message)
+    {
+        check_version(message, 1 + MESSAGE_MAC_LENGTH + GROUP_MESSAGE_SIGNATURE_LENGTH);
+
+        GroupMessageView view;
+        view.signed_part = message.first(message.size() - GROUP_MESSAGE_SIGNATURE_LENGTH);
+        view.signature = message.last(GROUP_MESSAGE_SIGNATURE_LENGTH);
+        view.authenticated = view.signed_part.first(view.signed_part.size() - MESSAGE_MAC_LENGTH);
+        view.mac = view.signed_part.last(MESSAGE_MAC_LENGTH);
+
+        bool has_message_index = false;
+        read_fields(view.authenticated.subspan(1),
+                    [&](const std::uint64_t tag, const std::uint64_t value, const std::span<const std::uint8_t> bytes) {
+                        switch (tag)
+                        {
+                        case MESSAGE_INDEX_TAG:
+                            view.message_index = to_u32(value);
+                            has_message_index = true;
+                            break;
+                        case GROUP_CIPHERTEXT_TAG:
+                            view.ciphertext = bytes;
+                            break;
+                        default:
+                            break;
+                        }
+                    });
+
+        if (!has_message_index || view.ciphertext.empty())
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        return view;
+    }
+
+    std::size_t message_length(const std::uint32_t counter, const std::size_t ciphertext_length)
+    {
+        return 1 + 2 + CURVE25519_KEY_LENGTH + 1 + varint_length(counter) + 1 + varint_length(ciphertext_length) +
+               ciphertext_length + MESSAGE_MAC_LENGTH;
+    }
+
+    std::size_t pre_key_message_length(const std::size_t message_length)
+    {
+        return PRE_KEY_MESSAGE_KEYS_LENGTH + 1 + varint_length(message_length) + message_length;
+    }
+
+    std::size_t group_message_length(const std::uint32_t message_index, const std::size_t ciphertext_length)
+    {
+        return 1 + 1 + varint_length(message_index) + 1 + varint_length(ciphertext_length) + ciphertext_length +
+               MESSAGE_MAC_LENGTH + GROUP_MESSAGE_SIGNATURE_LENGTH;
+    }
+
+    std::uint8_t *encode_message_header(std::uint8_t *pos,
+                                        const std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> ratchet_key,
+                                        const std::uint32_t counter, const std::size_t ciphertext_length)
+    {
+        *pos++ = MESSAGE_PROTOCOL_VERSION;
+        pos = write_bytes_field(pos, RATCHET_KEY_TAG, ratchet_key);
+        *pos++ = COUNTER_TAG;
+        pos = write_varint(pos, counter);
+        *pos++ = CIPHERTEXT_TAG;
+        return write_varint(pos, ciphertext_length);
+    }
+
+    std::uint8_t *encode_pre_key_message_header(std::uint8_t *pos,
+                                                const std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> one_time_key,
+                                                const std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> base_key,
+                                                const std::span<const std::uint8_t, CURVE25519_KEY_LENGTH> identity_key,
+                                                const std::size_t message_length)
+    {
+        *pos++ = MESSAGE_PROTOCOL_VERSION;
+        pos = write_bytes_field(pos, ONE_TIME_KEY_TAG, one_time_key);
+        pos = write_bytes_field(pos, BASE_KEY_TAG, base_key);
+        pos = write_bytes_field(pos, IDENTITY_KEY_TAG, identity_key);
+        *pos++ = MESSAGE_TAG;
+        return write_varint(pos, message_length);
+    }
+
+    std::uint8_t *encode_group_message_header(std::uint8_t *pos, const std::uint32_t message_index,
+                                              const std::size_t ciphertext_length)
+    {
+        *pos++ = MESSAGE_PROTOCOL_VERSION;
+        *pos++ = MESSAGE_INDEX_TAG;
+        pos = write_varint(pos, message_index);
+        *pos++ = GROUP_CIPHERTEXT_TAG;
+        return write_varint(pos, ciphertext_length);
+    }
+} // namespace spank_olm
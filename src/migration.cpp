@@ -0,0 +1,129 @@
+#include "migration.hpp"
+#include "account.hpp"
+#include "account_view.hpp"
+#include "errors.hpp"
+#include "pickle.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace spank_olm
+{
+    namespace
+    {
+        /**
+         * \brief Reads up to count lines into the batch, dropping trailing carriage returns.
+         */
+        void read_batch(std::istream &input, std::vector<std::string> &batch, const std::size_t count)
+        {
+            batch.clear();
+            std::string line;
+            while (batch.size() < count && std::getline(input, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                batch.push_back(std::move(line));
+            }
+        }
+    } // namespace
+
+    std::string migrate_pickle(PickleCipher &from, PickleCipher &to, const std::string_view encrypted, bool &upgraded)
+    {
+        const auto data = from.decrypt(encrypted);
+        const auto raw = std::span<const std::uint8_t>(data);
+
+        std::uint32_t version = 0;
+        if (unpickle(raw.data(), raw.data() + raw.size(), version) && version == ACCOUNT_PICKLE_VERSION)
+        {
+            // Already current, so only the key changes. Parsing the view still rejects corrupted pickles.
+            static_cast<void>(AccountView::parse(raw));
+            upgraded = false;
+            return to.encrypt(raw);
+        }
+
+        upgraded = true;
+        return Account::unpickle(raw).pickle(to);
+    }
+
+    PickleMigrator::PickleMigrator(PickleCipher const &from, PickleCipher const &to, ThreadPool &pool,
+                                   const std::size_t batch_size) :
+        from(from), to(to), pool(pool), batch_size(std::max<std::size_t>(1, batch_size))
+    {
+    }
+
+    void PickleMigrator::run(std::istream &input, std::ostream &output, MigrationProgress &progress)
+    {
+        std::vector<std::string> current;
+        std::vector<std::string> next;
+        std::vector<std::string> migrated;
+        std::uint64_t first_line = 1;
+        std::mutex error_mutex;
+
+        read_batch(input, current, batch_size);
+        while (!current.empty())
+        {
+            progress.read += current.size();
+            migrated.assign(current.size(), {});
+
+            // Read ahead while the workers are busy. The read is queued before the ranges, so it doesn't wait for them.
+            auto reading = pool.submit([&] { read_batch(input, next, batch_size); });
+            try
+            {
+                // Every range gets its own ciphers, as they must not be shared between threads.
+                pool.parallel_for_chunks(current.size(), [&](const std::size_t begin, const std::size_t end) {
+                    auto chunk_from = from;
+                    auto chunk_to = to;
+                    for (auto i = begin; i < end; ++i)
+                    {
+                        try
+                        {
+                            bool upgraded = false;
+                            migrated[i] = migrate_pickle(chunk_from, chunk_to, current[i], upgraded);
+                            if (upgraded)
+                            {
+                                ++progress.upgraded;
+                            }
+                        }
+                        catch (std::exception const &error)
+                        {
+                            ++progress.failed;
+                            if (error_handler)
+                            {
+                                std::lock_guard lock(error_mutex);
+                                error_handler(first_line + i, error);
+                            }
+                        }
+                    }
+                });
+            }
+            catch (...)
+            {
+                // The read references the input and the next batch.
+                reading.wait();
+                throw;
+            }
+            reading.get();
+
+            for (const auto &line : migrated)
+            {
+                output << line << '\n';
+            }
+            if (!output)
+            {
+                throw SpankOlmErrorIO();
+            }
+
+            progress.migrated += current.size() - std::count(migrated.begin(), migrated.end(), std::string());
+            first_line += current.size();
+            if (progress_handler)
+            {
+                progress_handler(progress);
+            }
+            std::swap(current, next);
+        }
+        output.flush();
+    }
+} // namespace spank_olm
@@ -0,0 +1,55 @@
+#include "one_time_key_index.hpp"
+
+#include <algorithm>
+
+namespace spank_olm
+{
+    OneTimeKeyIndex::OneTimeKeyIndex(Account const &account) { rebuild(account); }
+
+    void OneTimeKeyIndex::rebuild(Account const &account)
+    {
+        entries.clear();
+        entries.reserve(account.one_time_keys.size() + 2);
+        for (const auto *one_time_key : account.one_time_keys)
+        {
+            add(*one_time_key);
+        }
+        if (account.current_fallback_key)
+        {
+            add(*account.current_fallback_key);
+        }
+        if (account.prev_fallback_key)
+        {
+            add(*account.prev_fallback_key);
+        }
+
+        table = ProbeTable(entries.size());
+        const auto hash_of = [this](const std::uint32_t entry)
+        { return leading_bytes_hash(entries[entry].public_key); };
+        for (std::uint32_t i = 0; i < entries.size(); ++i)
+        {
+            table.insert(i, hash_of);
+        }
+    }
+
+    void OneTimeKeyIndex::add(OneTimeKey const &key)
+    {
+        Entry entry{{}, &key};
+        const auto public_key = key.key.raw_public_key_bits();
+        std::copy_n(public_key.begin(), entry.public_key.size(), entry.public_key.begin());
+        entries.push_back(entry);
+    }
+
+    OneTimeKey const *OneTimeKeyIndex::find(const std::span<const std::uint8_t> public_key) const
+    {
+        if (public_key.size() != 32)
+        {
+            return nullptr;
+        }
+
+        const auto slot = table.find(leading_bytes_hash(public_key), [&](const std::uint32_t entry) {
+            return std::equal(entries[entry].public_key.begin(), entries[entry].public_key.end(), public_key.begin());
+        });
+        return slot == ProbeTable::NONE ? nullptr : entries[table[slot]].key;
+    }
+} // namespace spank_olm
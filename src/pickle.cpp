@@ -151,19 +151,49 @@ namespace spank_olm
         return pos + size;
     }
 
+    std::size_t pickle_length(const OneTimeKey &value)
+    {
+        // X25519 private keys are always 32 bytes, so there is no need to copy the key just to learn its length.
+        return pickle_length(value.id) + pickle_length(value.published) + pickle_length(std::uint32_t{}) + 32;
+    }
+
+    std::size_t pickle_length(const IdentityKeys &value)
+    {
+        return pickle_length(value.ed25519_key.raw_public_key_bits()) +
+            pickle_length(value.ed25519_key.raw_private_key_bits()) +
+            pickle_length(value.curve25519_key.raw_public_key_bits()) +
+            pickle_length(value.curve25519_key.raw_private_key_bits());
+    }
+
+    std::size_t pickle_length(const CrossSigningKeys &value)
+    {
+        return pickle_length(CROSS_SIGNING_PICKLE_VERSION) + pickle_length(value.master_key.raw_private_key_bits()) +
+            pickle_length(value.self_signing_key.raw_private_key_bits()) +
+            pickle_length(value.user_signing_key.raw_private_key_bits());
+    }
+
     /**
+     * Serializes a OneTimeKey object into a byte array.
      *
      * @param pos Pointer to the current position in the byte array.
      * @param value A OneTimeKey object to serialize.
      * @return Pointer to the position in the byte array after the serialized data.
      */
-    std::uint8_t *pickle(std::uint8_t *pos, const std::optional<OneTimeKey> &value)
+    std::uint8_t *pickle(std::uint8_t *pos, const OneTimeKey &value)
     {
-        pos = pickle(pos, value->id);
-        pos = pickle(pos, value->published);
-        return pickle(pos, value->key.raw_private_key_bits());
+        pos = pickle(pos, value.id);
+        pos = pickle(pos, value.published);
+        return pickle(pos, value.key.raw_private_key_bits());
     }
 
+    /**
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param value A OneTimeKey object to serialize.
+     * @return Pointer to the position in the byte array after the serialized data.
+     */
+    std::uint8_t *pickle(std::uint8_t *pos, const std::optional<OneTimeKey> &value) { return pickle(pos, *value); }
+
     /**
      * Deserializes a OneTimeKey object from a byte array.
      *
@@ -235,9 +265,9 @@ namespace spank_olm
      */
     std::uint8_t *pickle(std::uint8_t *pos, const std::optional<IdentityKeys> &value)
     {
-        pos = pickle(pos, value->ed25519_key.public_key()->raw_public_key_bits());
+        pos = pickle(pos, value->ed25519_key.raw_public_key_bits());
         pos = pickle(pos, value->ed25519_key.raw_private_key_bits());
-        pos = pickle(pos, value->curve25519_key.public_key()->raw_public_key_bits());
+        pos = pickle(pos, value->curve25519_key.raw_public_key_bits());
         return pickle(pos, value->curve25519_key.raw_private_key_bits());
     }
 
@@ -271,6 +301,56 @@ namespace spank_olm
         return pos;
     }
 
+    /**
+     * Serializes a CrossSigningKeys object into a byte array.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param value The CrossSigningKeys object to serialize.
+     * @return Pointer to the position in the byte array after the serialized data.
+     */
+    std::uint8_t *pickle(std::uint8_t *pos, const CrossSigningKeys &value)
+    {
+        pos = pickle(pos, CROSS_SIGNING_PICKLE_VERSION);
+        pos = pickle(pos, value.master_key.raw_private_key_bits());
+        pos = pickle(pos, value.self_signing_key.raw_private_key_bits());
+        return pickle(pos, value.user_signing_key.raw_private_key_bits());
+    }
+
+    /**
+     * Deserializes a CrossSigningKeys object from a byte array.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param end Pointer to the end of the byte array.
+     * @param value Reference to the optional CrossSigningKeys object to store the deserialized value.
+     * @return Pointer to the position in the byte array after the deserialized data, or nullptr on failure or an
+     * unknown version.
+     */
+    std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end,
+                                 std::optional<CrossSigningKeys> &value)
+    {
+        std::uint32_t version = 0;
+        Botan::secure_vector<uint8_t> master_key_bits;
+        Botan::secure_vector<uint8_t> self_signing_key_bits;
+        Botan::secure_vector<uint8_t> user_signing_key_bits;
+
+        pos = unpickle(pos, end, version);
+        UNPICKLE_OK(pos);
+        if (version != CROSS_SIGNING_PICKLE_VERSION)
+        {
+            return nullptr;
+        }
+        pos = unpickle(pos, end, master_key_bits);
+        UNPICKLE_OK(pos);
+        pos = unpickle(pos, end, self_signing_key_bits);
+        UNPICKLE_OK(pos);
+        pos = unpickle(pos, end, user_signing_key_bits);
+        UNPICKLE_OK(pos);
+        value = CrossSigningKeys{Botan::Ed25519_PrivateKey::from_bytes(master_key_bits),
+                                 Botan::Ed25519_PrivateKey::from_bytes(self_signing_key_bits),
+                                 Botan::Ed25519_PrivateKey::from_bytes(user_signing_key_bits)};
+        return pos;
+    }
+
     /**
      * Deserializes an optional OneTimeKey object from a byte array.
      *
@@ -296,6 +376,24 @@ namespace spank_olm
         return pos;
     }
 
+    /**
+     * Deserializes a length prefixed byte string without copying it.
+     *
+     * @param pos Pointer to the current position in the byte array.
+     * @param end Pointer to the end of the byte array.
+     * @param value Reference to the span which is set to the bytes inside the byte array.
+     * @return Pointer to the position in the byte array after the deserialized data, or nullptr on failure.
+     */
+    std::uint8_t const *unpickle(std::uint8_t const *pos, std::uint8_t const *end, std::span<const uint8_t> &value)
+    {
+        std::uint32_t size;
+        pos = unpickle(pos, end, size);
+        if (!pos || static_cast<std::size_t>(end - pos) < size)
+            return nullptr;
+        value = std::span(pos, size);
+        return pos + size;
+    }
+
     std::uint8_t *pickle_bytes(std::uint8_t *pos, const std::uint8_t *bytes, const std::size_t bytes_length)
     {
         std::memcpy(pos, bytes, bytes_length);
@@ -0,0 +1,136 @@
+#include "pickle_encryption.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+
+#include <botan/kdf.h>
+#include <botan/mem_ops.h>
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::size_t AES_KEY_LENGTH = 32;
+        constexpr std::size_t HMAC_KEY_LENGTH = 32;
+        constexpr std::size_t AES_IV_LENGTH = 16;
+        constexpr std::size_t AES_BLOCK_LENGTH = 16;
+
+        constexpr std::string_view KDF_INFO = "Pickle";
+
+        /**
+         * \brief Returns the length of the ciphertext including the PKCS#7 padding.
+         */
+        constexpr std::size_t ciphertext_length(const std::size_t raw_length)
+        {
+            return (raw_length / AES_BLOCK_LENGTH + 1) * AES_BLOCK_LENGTH;
+        }
+    } // namespace
+
+    PickleCipher::PickleCipher(const std::span<const std::uint8_t> pickle_key) :
+        derived_keys(AES_KEY_LENGTH + HMAC_KEY_LENGTH + AES_IV_LENGTH)
+    {
+        const auto kdf = Botan::KDF::create_or_throw("HKDF(SHA-256)");
+        kdf->derive_key(derived_keys, pickle_key, {},
+                        std::span(reinterpret_cast<const std::uint8_t *>(KDF_INFO.data()), KDF_INFO.size()));
+        init();
+    }
+
+    PickleCipher::PickleCipher(const std::string_view pickle_key) :
+        PickleCipher(std::span(reinterpret_cast<const std::uint8_t *>(pickle_key.data()), pickle_key.size()))
+    {
+    }
+
+    PickleCipher::PickleCipher(const PickleCipher &other) : derived_keys(other.derived_keys) { init(); }
+
+    PickleCipher &PickleCipher::operator=(const PickleCipher &other)
+    {
+        if (this != &other)
+        {
+            derived_keys = other.derived_keys;
+            init();
+        }
+        return *this;
+    }
+
+    void PickleCipher::init()
+    {
+        const auto keys = std::span<const std::uint8_t>(derived_keys);
+        const auto aes_key = keys.first(AES_KEY_LENGTH);
+        const auto mac_key = keys.subspan(AES_KEY_LENGTH, HMAC_KEY_LENGTH);
+
+        encryption = Botan::Cipher_Mode::create_or_throw("AES-256/CBC/PKCS7", Botan::Cipher_Dir::Encryption);
+        encryption->set_key(aes_key);
+        decryption = Botan::Cipher_Mode::create_or_throw("AES-256/CBC/PKCS7", Botan::Cipher_Dir::Decryption);
+        decryption->set_key(aes_key);
+        hmac = Botan::MessageAuthenticationCode::create_or_throw("HMAC(SHA-256)");
+        hmac->set_key(mac_key);
+    }
+
+    std::size_t PickleCipher::buffer_length(const std::size_t raw_length)
+    {
+        return ciphertext_length(raw_length) + MAC_LENGTH;
+    }
+
+    std::size_t PickleCipher::encrypted_length(const std::size_t raw_length)
+    {
+        return base64_encoded_length(buffer_length(raw_length), false);
+    }
+
+    std::string PickleCipher::seal(Botan::secure_vector<std::uint8_t> &buffer)
+    {
+        buffer.reserve(buffer_length(buffer.size()));
+
+        const auto iv = std::span<const std::uint8_t>(derived_keys).last(AES_IV_LENGTH);
+        encryption->start(iv);
+        encryption->finish(buffer);
+
+        std::array<std::uint8_t, 32> mac{};
+        hmac->update(buffer);
+        hmac->final(mac.data());
+        buffer.insert(buffer.end(), mac.begin(), mac.begin() + MAC_LENGTH);
+
+        // libolm uses unpadded base64.
+        return base64_encode(buffer, false);
+    }
+
+    std::string PickleCipher::encrypt(const std::span<const std::uint8_t> pickle)
+    {
+        Botan::secure_vector<std::uint8_t> buffer;
+        buffer.reserve(buffer_length(pickle.size()));
+        buffer.assign(pickle.begin(), pickle.end());
+        return seal(buffer);
+    }
+
+    Botan::secure_vector<std::uint8_t> PickleCipher::decrypt(const std::string_view encrypted)
+    {
+        auto buffer = base64_decode(encrypted);
+
+        if (buffer.size() < AES_BLOCK_LENGTH + MAC_LENGTH || (buffer.size() - MAC_LENGTH) % AES_BLOCK_LENGTH != 0)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+
+        const auto ciphertext_end = buffer.size() - MAC_LENGTH;
+        std::array<std::uint8_t, 32> mac{};
+        hmac->update(buffer.data(), ciphertext_end);
+        hmac->final(mac.data());
+        if (!Botan::constant_time_compare(std::span<const std::uint8_t>(mac).first(MAC_LENGTH),
+                                          std::span<const std::uint8_t>(buffer).subspan(ciphertext_end)))
+        {
+            throw SpankOlmErrorBadAccountKey();
+        }
+        buffer.resize(ciphertext_end);
+
+        try
+        {
+            const auto iv = std::span<const std::uint8_t>(derived_keys).last(AES_IV_LENGTH);
+            decryption->start(iv);
+            decryption->finish(buffer);
+        }
+        catch (const Botan::Exception &)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+
+        return buffer;
+    }
+} // namespace spank_olm
@@ -0,0 +1,221 @@
+#include "pk_encryption.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <botan/cipher_mode.h>
+#include <botan/kdf.h>
+#include <botan/mac.h>
+#include <botan/mem_ops.h>
+#include <botan/pubkey.h>
+#include <memory>
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::size_t AES_BLOCK_LENGTH = 16;
+        constexpr std::size_t AES_KEY_LENGTH = 32;
+        constexpr std::size_t HMAC_KEY_LENGTH = 32;
+        constexpr std::size_t AES_IV_LENGTH = 16;
+        constexpr std::size_t PK_MAC_LENGTH = 8;
+
+        /**
+         * \brief The AES key, HMAC key and IV derived from the agreement of a message.
+         */
+        using MessageKeys = std::array<std::uint8_t, AES_KEY_LENGTH + HMAC_KEY_LENGTH + AES_IV_LENGTH>;
+
+        std::array<std::uint8_t, CURVE25519_KEY_LENGTH> to_key(const std::span<const std::uint8_t> key)
+        {
+            if (key.size() != CURVE25519_KEY_LENGTH)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+            std::array<std::uint8_t, CURVE25519_KEY_LENGTH> result;
+            std::copy(key.begin(), key.end(), result.begin());
+            return result;
+        }
+
+        Botan::X25519_PrivateKey to_private_key(const std::span<const std::uint8_t> private_key)
+        {
+            if (private_key.size() != CURVE25519_KEY_LENGTH)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+            return Botan::X25519_PrivateKey(private_key);
+        }
+
+        /**
+         * \brief The Botan objects to encrypt or decrypt messages with, created once and reused for many messages.
+         */
+        class PkCipher
+        {
+        public:
+            PkCipher(Botan::X25519_PrivateKey const &our_key, const Botan::Cipher_Dir direction) :
+                agreement(our_key, null_rng, "Raw"), hkdf(Botan::KDF::create_or_throw("HKDF(SHA-256)")),
+                hmac(Botan::MessageAuthenticationCode::create_or_throw("HMAC(SHA-256)")),
+                cipher(Botan::Cipher_Mode::create_or_throw("AES-256/CBC/PKCS7", direction))
+            {
+            }
+
+            /**
+             * \brief Derives the keys of a message from the agreement with the other side's key.
+             *
+             * \return The MAC, which libolm computes over an empty string.
+             */
+            std::array<std::uint8_t, PK_MAC_LENGTH> start(const std::span<const std::uint8_t> their_key)
+            {
+                MessageKeys keys;
+                try
+                {
+                    const auto shared_secret = agreement.derive_key(CURVE25519_KEY_LENGTH, their_key);
+                    hkdf->derive_key(keys, shared_secret.bits_of(), {}, {});
+                }
+                catch (const Botan::Exception &)
+                {
+                    throw SpankOlmErrorInvalidKey();
+                }
+                const auto key_span = std::span<const std::uint8_t>(keys);
+
+                cipher->set_key(key_span.first(AES_KEY_LENGTH));
+                cipher->start(key_span.last(AES_IV_LENGTH));
+
+                std::array<std::uint8_t, 32> full_mac;
+                hmac->set_key(key_span.subspan(AES_KEY_LENGTH, HMAC_KEY_LENGTH));
+                hmac->final(full_mac.data());
+                Botan::secure_scrub_memory(keys.data(), keys.size());
+
+                std::array<std::uint8_t, PK_MAC_LENGTH> mac;
+                std::copy_n(full_mac.begin(), mac.size(), mac.begin());
+                return mac;
+            }
+
+            /**
+             * \brief Encrypts or decrypts the buffer in place with the keys of the last start().
+             */
+            void finish(Botan::secure_vector<std::uint8_t> &buffer) { cipher->finish(buffer); }
+
+        private:
+            Botan::Null_RNG null_rng;
+            Botan::PK_Key_Agreement agreement;
+            std::unique_ptr<Botan::KDF> hkdf;
+            std::unique_ptr<Botan::MessageAuthenticationCode> hmac;
+            std::unique_ptr<Botan::Cipher_Mode> cipher;
+        };
+
+        /**
+         * \brief Decrypts a message into a buffer with the primitives of one worker.
+         */
+        void decrypt_into(PkCipher &cipher, PkMessage const &message, Botan::secure_vector<std::uint8_t> &buffer)
+        {
+            // Checking the lengths first keeps oversized fields from overflowing the buffers.
+            std::array<std::uint8_t, base64_decoded_length(base64_encoded_length(CURVE25519_KEY_LENGTH))> ephemeral_key;
+            if (message.ephemeral_key.size() > base64_encoded_length(CURVE25519_KEY_LENGTH) ||
+                base64_decode(message.ephemeral_key, ephemeral_key) != CURVE25519_KEY_LENGTH)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+            std::array<std::uint8_t, base64_decoded_length(base64_encoded_length(PK_MAC_LENGTH))> mac;
+            if (message.mac.size() > base64_encoded_length(PK_MAC_LENGTH) ||
+                base64_decode(message.mac, mac) != PK_MAC_LENGTH)
+            {
+                throw SpankOlmErrorBadMessageMac();
+            }
+
+            buffer.resize(base64_decoded_length(message.ciphertext.size()));
+            buffer.resize(base64_decode(message.ciphertext, buffer));
+            if (buffer.empty() || buffer.size() % AES_BLOCK_LENGTH != 0)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+
+            const auto expected_mac =
+                cipher.start(std::span<const std::uint8_t>(ephemeral_key).first(CURVE25519_KEY_LENGTH));
+            if (!Botan::constant_time_compare(std::span<const std::uint8_t>(expected_mac),
+                                              std::span<const std::uint8_t>(mac).first(PK_MAC_LENGTH)))
+            {
+                throw SpankOlmErrorBadMessageMac();
+            }
+            try
+            {
+                cipher.finish(buffer);
+            }
+            catch (const Botan::Exception &)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+        }
+    } // namespace
+
+    PkEncryption::PkEncryption(const std::span<const std::uint8_t> recipient_key) : recipient_key(to_key(recipient_key))
+    {
+    }
+
+    PkMessage PkEncryption::encrypt(Botan::RandomNumberGenerator &rng,
+                                    const std::span<const std::uint8_t> plaintext) const
+    {
+        const Botan::X25519_PrivateKey ephemeral_key(rng);
+        PkCipher cipher(ephemeral_key, Botan::Cipher_Dir::Encryption);
+        const auto mac = cipher.start(recipient_key);
+
+        Botan::secure_vector<std::uint8_t> buffer(plaintext.begin(), plaintext.end());
+        cipher.finish(buffer);
+        return {base64_encode(buffer, false), base64_encode(mac, false),
+                base64_encode(ephemeral_key.public_value(), false)};
+    }
+
+    PkDecryption::PkDecryption(Botan::RandomNumberGenerator &rng) : key(rng), our_public_key(to_key(key.public_value()))
+    {
+    }
+
+    PkDecryption::PkDecryption(const std::span<const std::uint8_t> private_key) :
+        key(to_private_key(private_key)), our_public_key(to_key(key.public_value()))
+    {
+    }
+
+    Botan::secure_vector<std::uint8_t> PkDecryption::decrypt(PkMessage const &message) const
+    {
+        PkCipher cipher(key, Botan::Cipher_Dir::Decryption);
+        Botan::secure_vector<std::uint8_t> plaintext;
+        decrypt_into(cipher, message, plaintext);
+        return plaintext;
+    }
+
+    std::vector<PkDecrypted> PkDecryption::decrypt_batch(const std::span<const PkMessage> messages,
+                                                         ThreadPool &pool) const
+    {
+        std::vector<PkDecrypted> results(messages.size());
+        const auto errors = decrypt_each(messages, pool, [&results](const std::size_t index,
+                                                                    const std::span<const std::uint8_t> plaintext) {
+            results[index].plaintext.assign(plaintext.begin(), plaintext.end());
+        });
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            results[i].error = errors[i];
+        }
+        return results;
+    }
+
+    std::vector<std::exception_ptr> PkDecryption::decrypt_each(const std::span<const PkMessage> messages,
+                                                               ThreadPool &pool, PkConsumer const &consume) const
+    {
+        std::vector<std::exception_ptr> errors(messages.size());
+        pool.parallel_for_chunks(messages.size(), [&](const std::size_t begin, const std::size_t end) {
+            PkCipher cipher(key, Botan::Cipher_Dir::Decryption);
+            Botan::secure_vector<std::uint8_t> buffer;
+            for (auto i = begin; i < end; ++i)
+            {
+                try
+                {
+                    decrypt_into(cipher, messages[i], buffer);
+                    consume(i, buffer);
+                }
+                catch (...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            }
+        });
+        return errors;
+    }
+} // namespace spank_olm
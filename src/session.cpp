@@ -0,0 +1,908 @@
+#include "session.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+#include "pickle.hpp"
+
+#include <algorithm>
+#include <botan/hash.h>
+#include <botan/mem_ops.h>
+#include <botan/pubkey.h>
+
+namespace spank_olm
+{
+    namespace
+    {
+        constexpr std::size_t AES_BLOCK_LENGTH = 16;
+        constexpr std::size_t AES_KEY_LENGTH = 32;
+        constexpr std::size_t HMAC_KEY_LENGTH = 32;
+        constexpr std::size_t AES_IV_LENGTH = 16;
+
+        /**
+         * \brief The length of the private base key and first ratchet key of a new outbound session.
+         */
+        constexpr std::size_t OUTBOUND_PRIVATE_KEYS_LENGTH = 2 * CURVE25519_KEY_LENGTH;
+
+        /**
+         * \brief The number of base64 characters holding the keys at the start of a pre-key message.
+         */
+        constexpr std::size_t PRE_KEY_MESSAGE_KEYS_BASE64_LENGTH = (PRE_KEY_MESSAGE_KEYS_LENGTH + 2) / 3 * 4;
+
+        constexpr std::string_view ROOT_INFO = "OLM_ROOT";
+        constexpr std::string_view RATCHET_INFO = "OLM_RATCHET";
+        constexpr std::string_view KEYS_INFO = "OLM_KEYS";
+
+        constexpr std::uint8_t MESSAGE_KEY_SEED = 0x01;
+        constexpr std::uint8_t CHAIN_KEY_SEED = 0x02;
+
+        /**
+         * \brief A fixed-size buffer for key material which is scrubbed when it goes out of scope.
+         */
+        template <std::size_t N>
+        struct Secret : std::array<std::uint8_t, N>
+        {
+            ~Secret() { Botan::secure_scrub_memory(this->data(), N); }
+        };
+
+        std::span<const std::uint8_t> as_bytes(const std::string_view text)
+        {
+            return {reinterpret_cast<const std::uint8_t *>(text.data()), text.size()};
+        }
+
+        bool equal(const std::span<const std::uint8_t> a, const std::span<const std::uint8_t> b)
+        {
+            return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+        }
+
+        /**
+         * \brief Decodes a message and checks that its ciphertext can be AES-CBC encrypted data.
+         */
+        MessageView decode_message(const std::span<const std::uint8_t> message)
+        {
+            const auto view = MessageView::decode(message);
+            if (view.ciphertext.size() % AES_BLOCK_LENGTH != 0)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+            return view;
+        }
+
+        /**
+         * \brief Computes the X25519 agreement of a prepared private key and their public key.
+         */
+        void x25519(Botan::PK_Key_Agreement const &agreement, const std::span<const std::uint8_t> their_key,
+                    std::uint8_t *shared_secret)
+        {
+            if (their_key.size() != CURVE25519_KEY_LENGTH)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+            try
+            {
+                const auto shared = agreement.derive_key(CURVE25519_KEY_LENGTH, their_key);
+                if (shared.length() != CURVE25519_KEY_LENGTH)
+                {
+                    throw SpankOlmErrorInvalidKey();
+                }
+                std::copy(shared.begin(), shared.end(), shared_secret);
+            }
+            catch (const Botan::Exception &)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+        }
+
+        /**
+         * \brief Computes the X25519 agreement of our private key and their public key.
+         */
+        void x25519(Botan::X25519_PrivateKey const &our_key, const std::span<const std::uint8_t> their_key,
+                    std::uint8_t *shared_secret)
+        {
+            Botan::Null_RNG rng;
+            const Botan::PK_Key_Agreement agreement(our_key, rng, "Raw");
+            x25519(agreement, their_key, shared_secret);
+        }
+
+        Curve25519PublicKey public_key_of(Botan::X25519_PrivateKey const &key)
+        {
+            Curve25519PublicKey public_key;
+            const auto value = key.public_value();
+            std::copy_n(value.begin(), CURVE25519_KEY_LENGTH, public_key.begin());
+            return public_key;
+        }
+
+        Curve25519PublicKey to_public_key(const std::span<const std::uint8_t> key)
+        {
+            if (key.size() != CURVE25519_KEY_LENGTH)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+            Curve25519PublicKey public_key;
+            std::copy(key.begin(), key.end(), public_key.begin());
+            return public_key;
+        }
+
+        /**
+         * \brief A hash of the ratchet key and index for the skipped message key table.
+         *
+         * The keys of one chain share the ratchet key, so the index is mixed in to spread them.
+         */
+        std::size_t skipped_key_hash(const std::span<const std::uint8_t> ratchet_key, const std::uint32_t index)
+        {
+            std::uint64_t hash = leading_bytes_hash(ratchet_key);
+            hash ^= index * 0x9e3779b97f4a7c15ULL;
+            hash *= 0xff51afd7ed558ccdULL;
+            return static_cast<std::size_t>(hash ^ hash >> 32);
+        }
+    } // namespace
+
+    SkippedMessageKeys::SkippedMessageKeys(const std::size_t capacity) : entries(capacity), table(capacity)
+    {
+        clear();
+    }
+
+    SkippedMessageKeys::~SkippedMessageKeys()
+    {
+        if (!entries.empty())
+        {
+            Botan::secure_scrub_memory(entries.data(), entries.size() * sizeof(Entry));
+        }
+    }
+
+    std::size_t SkippedMessageKeys::hash_of(const std::uint32_t entry) const
+    {
+        return skipped_key_hash(entries[entry].ratchet_key, entries[entry].index);
+    }
+
+    std::size_t SkippedMessageKeys::find_slot(const std::span<const std::uint8_t> ratchet_key,
+                                              const std::uint32_t index) const
+    {
+        return table.find(skipped_key_hash(ratchet_key, index), [&](const std::uint32_t entry) {
+            return entries[entry].index == index && equal(entries[entry].ratchet_key, ratchet_key);
+        });
+    }
+
+    void SkippedMessageKeys::insert(Curve25519PublicKey const &ratchet_key, const std::uint32_t index,
+                                    const std::span<const std::uint8_t, 32> message_key)
+    {
+        if (entries.empty())
+        {
+            return;
+        }
+        if (const auto existing = find_slot(ratchet_key, index); existing != ProbeTable::NONE)
+        {
+            remove(existing);
+        }
+        if (count == entries.size())
+        {
+            remove(find_slot(entries[oldest].ratchet_key, entries[oldest].index));
+        }
+
+        const auto entry_index = free;
+        auto &entry = entries[entry_index];
+        free = entry.older;
+
+        entry.ratchet_key = ratchet_key;
+        entry.index = index;
+        std::copy(message_key.begin(), message_key.end(), entry.message_key.begin());
+        entry.older = newest;
+        entry.newer = NONE;
+        if (newest != NONE)
+        {
+            entries[newest].newer = entry_index;
+        }
+        else
+        {
+            oldest = entry_index;
+        }
+        newest = entry_index;
+
+        table.insert(entry_index, [this](const std::uint32_t entry) { return hash_of(entry); });
+        ++count;
+    }
+
+    std::uint8_t const *SkippedMessageKeys::find(const std::span<const std::uint8_t> ratchet_key,
+                                                 const std::uint32_t index) const
+    {
+        const auto slot = find_slot(ratchet_key, index);
+        return slot == ProbeTable::NONE ? nullptr : entries[table[slot]].message_key.data();
+    }
+
+    bool SkippedMessageKeys::erase(const std::span<const std::uint8_t> ratchet_key, const std::uint32_t index)
+    {
+        const auto slot = find_slot(ratchet_key, index);
+        if (slot == ProbeTable::NONE)
+        {
+            return false;
+        }
+        remove(slot);
+        return true;
+    }
+
+    void SkippedMessageKeys::remove(const std::size_t slot)
+    {
+        const auto entry_index = table[slot];
+        auto &entry = entries[entry_index];
+
+        // Unlink the entry from the age order and put it on the free list.
+        if (entry.older != NONE)
+        {
+            entries[entry.older].newer = entry.newer;
+        }
+        else
+        {
+            oldest = entry.newer;
+        }
+        if (entry.newer != NONE)
+        {
+            entries[entry.newer].older = entry.older;
+        }
+        else
+        {
+            newest = entry.older;
+        }
+        Botan::secure_scrub_memory(&entry, sizeof(entry));
+        entry.older = free;
+        free = entry_index;
+        --count;
+
+        table.erase(slot, [this](const std::uint32_t moved) { return hash_of(moved); });
+    }
+
+    void SkippedMessageKeys::clear()
+    {
+        if (!entries.empty())
+        {
+            Botan::secure_scrub_memory(entries.data(), entries.size() * sizeof(Entry));
+        }
+        table.clear();
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            entries[i].older = i + 1 < entries.size() ? static_cast<std::uint32_t>(i + 1) : NONE;
+        }
+        free = entries.empty() ? NONE : 0;
+        oldest = NONE;
+        newest = NONE;
+        count = 0;
+    }
+
+    Session::Primitives::Primitives() :
+        hkdf(Botan::KDF::create_or_throw("HKDF(SHA-256)")),
+        hmac(Botan::MessageAuthenticationCode::create_or_throw("HMAC(SHA-256)")),
+        encryption(Botan::Cipher_Mode::create_or_throw("AES-256/CBC/PKCS7", Botan::Cipher_Dir::Encryption)),
+        decryption(Botan::Cipher_Mode::create_or_throw("AES-256/CBC/PKCS7", Botan::Cipher_Dir::Decryption))
+    {
+    }
+
+    Session::Session(const SessionLimits limits) :
+        session_limits(limits), skipped_message_keys(limits.max_skipped_message_keys)
+    {
+    }
+
+    Session::Session(Session const &other) = default;
+    Session &Session::operator=(Session const &other) = default;
+    Session::Session(Session &&other) noexcept = default;
+    Session &Session::operator=(Session &&other) noexcept = default;
+
+    Session::~Session()
+    {
+        Botan::secure_scrub_memory(root_key.data(), root_key.size());
+        if (sender_chain)
+        {
+            Botan::secure_scrub_memory(sender_chain->chain_key.key.data(), sender_chain->chain_key.key.size());
+        }
+        for (auto *chain : receiver_chains)
+        {
+            Botan::secure_scrub_memory(chain->chain_key.key.data(), chain->chain_key.key.size());
+        }
+    }
+
+    Session Session::create_outbound(Botan::RandomNumberGenerator &rng, Account const &account,
+                                     const std::span<const std::uint8_t> their_identity_key,
+                                     const std::span<const std::uint8_t> their_one_time_key, const SessionLimits limits)
+    {
+        Botan::Null_RNG null_rng;
+        const Botan::PK_Key_Agreement identity_agreement(account.identity_keys->curve25519_key, null_rng, "Raw");
+        const auto private_keys = rng.random_vec(OUTBOUND_PRIVATE_KEYS_LENGTH);
+        return create_outbound_session(identity_agreement, public_key_of(account.identity_keys->curve25519_key),
+                                       private_keys, their_identity_key, their_one_time_key, limits);
+    }
+
+    std::vector<OutboundSession> Session::create_outbound_batch(Botan::RandomNumberGenerator &rng,
+                                                                Account const &account,
+                                                                const std::span<const ClaimedOneTimeKey> claimed,
+                                                                ThreadPool &pool, const SessionLimits limits)
+    {
+        // One call for all keys is much cheaper than two per session, and the workers need no generator of their own.
+        const auto private_keys = rng.random_vec(claimed.size() * OUTBOUND_PRIVATE_KEYS_LENGTH);
+        const auto identity_key = public_key_of(account.identity_keys->curve25519_key);
+
+        std::vector<OutboundSession> results(claimed.size());
+        pool.parallel_for_chunks(claimed.size(), [&](const std::size_t begin, const std::size_t end) {
+            Botan::Null_RNG null_rng;
+            const Botan::PK_Key_Agreement identity_agreement(account.identity_keys->curve25519_key, null_rng, "Raw");
+            for (auto i = begin; i < end; ++i)
+            {
+                try
+                {
+                    results[i].session.emplace(create_outbound_session(
+                        identity_agreement, identity_key,
+                        std::span(private_keys).subspan(i * OUTBOUND_PRIVATE_KEYS_LENGTH, OUTBOUND_PRIVATE_KEYS_LENGTH),
+                        claimed[i].identity_key, claimed[i].one_time_key, limits));
+                }
+                catch (...)
+                {
+                    results[i].error = std::current_exception();
+                }
+            }
+        });
+        return results;
+    }
+
+    Session Session::create_outbound_session(Botan::PK_Key_Agreement const &identity_agreement,
+                                             Curve25519PublicKey const &identity_key,
+                                             const std::span<const std::uint8_t> private_keys,
+                                             const std::span<const std::uint8_t> their_identity_key,
+                                             const std::span<const std::uint8_t> their_one_time_key,
+                                             const SessionLimits limits)
+    {
+        Session session(limits);
+        session.alice_identity_key = identity_key;
+        session.bob_one_time_key = to_public_key(their_one_time_key);
+        to_public_key(their_identity_key);
+
+        const Botan::X25519_PrivateKey base_key(private_keys.first(CURVE25519_KEY_LENGTH));
+        session.alice_base_key = public_key_of(base_key);
+
+        Secret<3 * CURVE25519_KEY_LENGTH> shared_secret;
+        Botan::Null_RNG null_rng;
+        const Botan::PK_Key_Agreement base_agreement(base_key, null_rng, "Raw");
+        x25519(identity_agreement, their_one_time_key, shared_secret.data());
+        x25519(base_agreement, their_identity_key, shared_secret.data() + CURVE25519_KEY_LENGTH);
+        x25519(base_agreement, their_one_time_key, shared_secret.data() + 2 * CURVE25519_KEY_LENGTH);
+
+        Botan::X25519_PrivateKey ratchet_key(private_keys.subspan(CURVE25519_KEY_LENGTH, CURVE25519_KEY_LENGTH));
+        const auto ratchet_public_key = public_key_of(ratchet_key);
+        Secret<32> chain_key;
+        session.initialise(shared_secret, chain_key);
+        session.sender_chain.emplace(SenderChain{std::move(ratchet_key), ratchet_public_key, {chain_key, 0}});
+        return session;
+    }
+
+    PreKeyHeader PreKeyHeader::decode(const std::string_view body)
+    {
+        const auto to_header = [](PreKeyMessageView const &view) {
+            return PreKeyHeader{to_public_key(view.one_time_key), to_public_key(view.base_key),
+                                to_public_key(view.identity_key)};
+        };
+
+        if (body.size() > PRE_KEY_MESSAGE_KEYS_BASE64_LENGTH)
+        {
+            std::array<std::uint8_t, base64_decoded_length(PRE_KEY_MESSAGE_KEYS_BASE64_LENGTH)> start;
+            const auto length = base64_decode(body.substr(0, PRE_KEY_MESSAGE_KEYS_BASE64_LENGTH), start);
+            if (const auto keys = PreKeyMessageView::decode_keys(std::span<const std::uint8_t>(start).first(length)))
+            {
+                return to_header(*keys);
+            }
+        }
+
+        // The keys aren't at the start, so the whole message needs to be decoded.
+        const auto buffer = base64_decode(body);
+        return to_header(PreKeyMessageView::decode(buffer));
+    }
+
+    Curve25519PublicKey decode_ratchet_key(const MessageType type, const std::string_view body)
+    {
+        const auto buffer = base64_decode(body);
+        const auto message = decode_message(type == MessageType::PreKey ? PreKeyMessageView::decode(buffer).message
+                                                                        : std::span<const std::uint8_t>(buffer));
+        return to_public_key(message.ratchet_key);
+    }
+
+    Session Session::create_inbound(Account const &account, const std::string_view body,
+                                    const std::span<const std::uint8_t> their_identity_key, const SessionLimits limits)
+    {
+        return create_inbound_session(account, nullptr, body, their_identity_key, limits);
+    }
+
+    Session Session::create_inbound(Account const &account, OneTimeKeyIndex const &index, const std::string_view body,
+                                    const std::span<const std::uint8_t> their_identity_key, const SessionLimits limits)
+    {
+        return create_inbound_session(account, &index, body, their_identity_key, limits);
+    }
+
+    Session Session::create_inbound_session(Account const &account, OneTimeKeyIndex const *index,
+                                            const std::string_view body,
+                                            const std::span<const std::uint8_t> their_identity_key,
+                                            const SessionLimits limits)
+    {
+        if (index)
+        {
+            // Reject messages for keys we don't have before decoding the rest of the message.
+            const auto header = PreKeyHeader::decode(body);
+            if ((!their_identity_key.empty() && !equal(their_identity_key, header.identity_key)) ||
+                !index->find(header.one_time_key))
+            {
+                throw SpankOlmErrorBadMessageKeyId();
+            }
+        }
+
+        const auto buffer = base64_decode(body);
+        const auto pre_key = PreKeyMessageView::decode(buffer);
+        const auto message = decode_message(pre_key.message);
+
+        if (!their_identity_key.empty() && !equal(their_identity_key, pre_key.identity_key))
+        {
+            throw SpankOlmErrorBadMessageKeyId();
+        }
+
+        OneTimeKey const *one_time_key = nullptr;
+        if (index)
+        {
+            one_time_key = index->find(pre_key.one_time_key);
+        }
+        else if (const auto found = account.lookup_key(Botan::X25519_PublicKey(pre_key.one_time_key)))
+        {
+            one_time_key = *found;
+        }
+        if (!one_time_key)
+        {
+            throw SpankOlmErrorBadMessageKeyId();
+        }
+
+        Session session(limits);
+        session.received_message = true;
+        session.alice_identity_key = to_public_key(pre_key.identity_key);
+        session.alice_base_key = to_public_key(pre_key.base_key);
+        session.bob_one_time_key = to_public_key(pre_key.one_time_key);
+
+        Secret<3 * CURVE25519_KEY_LENGTH> shared_secret;
+        try
+        {
+            x25519(one_time_key->key, pre_key.identity_key, shared_secret.data());
+            x25519(account.identity_keys->curve25519_key, pre_key.base_key,
+                   shared_secret.data() + CURVE25519_KEY_LENGTH);
+            x25519(one_time_key->key, pre_key.base_key, shared_secret.data() + 2 * CURVE25519_KEY_LENGTH);
+        }
+        catch (const SpankOlmErrorInvalidKey &)
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+
+        Secret<32> chain_key;
+        session.initialise(shared_secret, chain_key);
+        ReceiverChain chain{to_public_key(message.ratchet_key), {chain_key, 0}};
+        session.receiver_chains.insert(chain);
+        Botan::secure_scrub_memory(chain.chain_key.key.data(), chain.chain_key.key.size());
+        return session;
+    }
+
+    bool Session::matches_inbound(PreKeyHeader const &header) const
+    {
+        return header.one_time_key == bob_one_time_key && header.base_key == alice_base_key &&
+               header.identity_key == alice_identity_key;
+    }
+
+    bool Session::has_receiver_chain(const std::span<const std::uint8_t> ratchet_key) const
+    {
+        for (const auto *chain : receiver_chains)
+        {
+            if (equal(chain->ratchet_key, ratchet_key))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string Session::session_id() const
+    {
+        const auto hash = Botan::HashFunction::create_or_throw("SHA-256");
+        hash->update(alice_identity_key.data(), alice_identity_key.size());
+        hash->update(alice_base_key.data(), alice_base_key.size());
+        hash->update(bob_one_time_key.data(), bob_one_time_key.size());
+        return base64_encode(hash->final(), false);
+    }
+
+    void Session::initialise(const std::span<const std::uint8_t> shared_secret,
+                             const std::span<std::uint8_t, 32> chain_key)
+    {
+        Secret<64> derived;
+        primitives.hkdf->derive_key(derived, shared_secret, {}, as_bytes(ROOT_INFO));
+        std::copy_n(derived.begin(), root_key.size(), root_key.begin());
+        std::copy_n(derived.begin() + root_key.size(), chain_key.size(), chain_key.begin());
+    }
+
+    void Session::ratchet_root_key(Botan::X25519_PrivateKey const &our_key,
+                                   const std::span<const std::uint8_t> their_key,
+                                   const std::span<std::uint8_t, 32> root_key_out,
+                                   const std::span<std::uint8_t, 32> chain_key_out)
+    {
+        Secret<CURVE25519_KEY_LENGTH> shared_secret;
+        x25519(our_key, their_key, shared_secret.data());
+
+        Secret<64> derived;
+        primitives.hkdf->derive_key(derived, shared_secret, root_key, as_bytes(RATCHET_INFO));
+        std::copy_n(derived.begin(), root_key_out.size(), root_key_out.begin());
+        std::copy_n(derived.begin() + root_key_out.size(), chain_key_out.size(), chain_key_out.begin());
+    }
+
+    void Session::start_sender_chain(Botan::RandomNumberGenerator &rng)
+    {
+        // Without a sender chain we must have received a message, so there is a receiver chain to ratchet against.
+        Botan::X25519_PrivateKey ratchet_key(rng);
+        Secret<32> new_root_key;
+        Secret<32> chain_key;
+        ratchet_root_key(ratchet_key, receiver_chains[0].ratchet_key, new_root_key, chain_key);
+
+        std::copy(new_root_key.begin(), new_root_key.end(), root_key.begin());
+        const auto ratchet_public_key = public_key_of(ratchet_key);
+        sender_chain.emplace(SenderChain{std::move(ratchet_key), ratchet_public_key, {chain_key, 0}});
+    }
+
+    void Session::advance_chain_key(ChainKey &chain_key)
+    {
+        primitives.hmac->set_key(chain_key.key);
+        primitives.hmac->update(CHAIN_KEY_SEED);
+        primitives.hmac->final(chain_key.key.data());
+        ++chain_key.index;
+    }
+
+    void Session::create_message_key(ChainKey const &chain_key, const std::span<std::uint8_t, 32> message_key)
+    {
+        primitives.hmac->set_key(chain_key.key);
+        primitives.hmac->update(MESSAGE_KEY_SEED);
+        primitives.hmac->final(message_key.data());
+    }
+
+    OlmMessage Session::encrypt(Botan::RandomNumberGenerator &rng, const std::string_view plaintext)
+    {
+        return encrypt(rng, as_bytes(plaintext));
+    }
+
+    OlmMessage Session::encrypt(Botan::RandomNumberGenerator &rng, const std::span<const std::uint8_t> plaintext)
+    {
+        Botan::secure_vector<std::uint8_t> buffer;
+        return encrypt(rng, plaintext, buffer);
+    }
+
+    OlmMessage Session::encrypt(Botan::RandomNumberGenerator &rng, const std::span<const std::uint8_t> plaintext,
+                                Botan::secure_vector<std::uint8_t> &buffer)
+    {
+        if (!sender_chain)
+        {
+            start_sender_chain(rng);
+        }
+
+        Secret<32> message_key;
+        const auto counter = sender_chain->chain_key.index;
+        create_message_key(sender_chain->chain_key, message_key);
+        advance_chain_key(sender_chain->chain_key);
+
+        const auto type = received_message ? MessageType::Normal : MessageType::PreKey;
+        const auto ciphertext_length = (plaintext.size() / AES_BLOCK_LENGTH + 1) * AES_BLOCK_LENGTH;
+        const auto inner_length = message_length(counter, ciphertext_length);
+        const auto total_length = type == MessageType::PreKey ? pre_key_message_length(inner_length) : inner_length;
+
+        // The plaintext is encrypted in place right behind the headers, so the buffer is allocated at most once.
+        buffer.clear();
+        buffer.reserve(total_length);
+        buffer.resize(total_length - ciphertext_length - MESSAGE_MAC_LENGTH);
+        auto pos = buffer.data();
+        if (type == MessageType::PreKey)
+        {
+            pos = encode_pre_key_message_header(pos, bob_one_time_key, alice_base_key, alice_identity_key,
+                                                inner_length);
+        }
+        const auto inner_offset = static_cast<std::size_t>(pos - buffer.data());
+        encode_message_header(pos, sender_chain->ratchet_public_key, counter, ciphertext_length);
+
+        const auto ciphertext_offset = buffer.size();
+        buffer.insert(buffer.end(), plaintext.begin(), plaintext.end());
+
+        Secret<AES_KEY_LENGTH + HMAC_KEY_LENGTH + AES_IV_LENGTH> keys;
+        primitives.hkdf->derive_key(keys, message_key, {}, as_bytes(KEYS_INFO));
+        const auto key_span = std::span<const std::uint8_t>(keys);
+
+        primitives.encryption->set_key(key_span.first(AES_KEY_LENGTH));
+        primitives.encryption->start(key_span.last(AES_IV_LENGTH));
+        primitives.encryption->finish(buffer, ciphertext_offset);
+
+        Secret<32> mac;
+        primitives.hmac->set_key(key_span.subspan(AES_KEY_LENGTH, HMAC_KEY_LENGTH));
+        primitives.hmac->update(buffer.data() + inner_offset, buffer.size() - inner_offset);
+        primitives.hmac->final(mac.data());
+        buffer.insert(buffer.end(), mac.begin(), mac.begin() + MESSAGE_MAC_LENGTH);
+
+        return {type, base64_encode(buffer, false)};
+    }
+
+    Botan::secure_vector<std::uint8_t> Session::verify_and_decrypt(const std::span<const std::uint8_t, 32> message_key,
+                                                                   const std::span<const std::uint8_t> authenticated,
+                                                                   const std::span<const std::uint8_t> mac,
+                                                                   const std::span<const std::uint8_t> ciphertext)
+    {
+        Secret<AES_KEY_LENGTH + HMAC_KEY_LENGTH + AES_IV_LENGTH> keys;
+        primitives.hkdf->derive_key(keys, message_key, {}, as_bytes(KEYS_INFO));
+        const auto key_span = std::span<const std::uint8_t>(keys);
+
+        Secret<32> expected_mac;
+        primitives.hmac->set_key(key_span.subspan(AES_KEY_LENGTH, HMAC_KEY_LENGTH));
+        primitives.hmac->update(authenticated);
+        primitives.hmac->final(expected_mac.data());
+        if (!Botan::constant_time_compare(std::span<const std::uint8_t>(expected_mac).first(MESSAGE_MAC_LENGTH), mac))
+        {
+            throw SpankOlmErrorBadMessageMac();
+        }
+
+        Botan::secure_vector<std::uint8_t> plaintext(ciphertext.begin(), ciphertext.end());
+        try
+        {
+            primitives.decryption->set_key(key_span.first(AES_KEY_LENGTH));
+            primitives.decryption->start(key_span.last(AES_IV_LENGTH));
+            primitives.decryption->finish(plaintext);
+        }
+        catch (const Botan::Exception &)
+        {
+            throw SpankOlmErrorBadMessageFormat();
+        }
+        return plaintext;
+    }
+
+    Botan::secure_vector<std::uint8_t> Session::decrypt(const MessageType type, const std::string_view body)
+    {
+        const auto buffer = base64_decode(body);
+        const auto message =
+            decode_message(type == MessageType::PreKey ? PreKeyMessageView::decode(buffer).message
+                                                       : std::span<const std::uint8_t>(buffer));
+
+        ReceiverChain *chain = nullptr;
+        for (auto *candidate : receiver_chains)
+        {
+            if (equal(candidate->ratchet_key, message.ratchet_key))
+            {
+                chain = candidate;
+                break;
+            }
+        }
+
+        if (chain && message.counter < chain->chain_key.index)
+        {
+            // The chain has moved past this message, so only a skipped key can decrypt it.
+            const auto skipped_key = skipped_message_keys.find(message.ratchet_key, message.counter);
+            if (!skipped_key)
+            {
+                throw SpankOlmErrorBadMessageKeyId();
+            }
+            auto plaintext = verify_and_decrypt(std::span<const std::uint8_t, 32>(skipped_key, 32),
+                                                message.authenticated, message.mac, message.ciphertext);
+            skipped_message_keys.erase(message.ratchet_key, message.counter);
+            received_message = true;
+            return plaintext;
+        }
+
+        // Work on copies until the message has been authenticated, so a forged message can't change the session.
+        ChainKey chain_key{};
+        Secret<32> new_root_key;
+        if (chain)
+        {
+            chain_key = chain->chain_key;
+        }
+        else
+        {
+            if (!sender_chain)
+            {
+                throw SpankOlmErrorBadMessageKeyId();
+            }
+            try
+            {
+                ratchet_root_key(sender_chain->ratchet_key, message.ratchet_key, new_root_key, chain_key.key);
+            }
+            catch (const SpankOlmErrorInvalidKey &)
+            {
+                throw SpankOlmErrorBadMessageFormat();
+            }
+        }
+        const auto first_chain_key = chain_key;
+
+        if (message.counter - chain_key.index > session_limits.max_message_gap)
+        {
+            throw SpankOlmErrorBadMessageKeyId();
+        }
+        while (chain_key.index < message.counter)
+        {
+            advance_chain_key(chain_key);
+        }
+        Secret<32> message_key;
+        create_message_key(chain_key, message_key);
+        auto plaintext = verify_and_decrypt(message_key, message.authenticated, message.mac, message.ciphertext);
+
+        if (!chain)
+        {
+            // A new ratchet key from the other side: our sender chain is used up and the next message starts a new one.
+            std::copy(new_root_key.begin(), new_root_key.end(), root_key.begin());
+            receiver_chains.insert(ReceiverChain{to_public_key(message.ratchet_key), first_chain_key});
+            chain = &receiver_chains[0];
+            Botan::secure_scrub_memory(sender_chain->chain_key.key.data(), sender_chain->chain_key.key.size());
+            sender_chain.reset();
+        }
+
+        // Keep the keys of the messages we skipped over, now that the gap is known to be genuine.
+        while (chain->chain_key.index < message.counter)
+        {
+            create_message_key(chain->chain_key, message_key);
+            skipped_message_keys.insert(chain->ratchet_key, chain->chain_key.index, message_key);
+            advance_chain_key(chain->chain_key);
+        }
+        advance_chain_key(chain->chain_key);
+
+        received_message = true;
+        return plaintext;
+    }
+
+    std::size_t Session::pickle_length() const
+    {
+        constexpr std::size_t chain_key_length = 32 + 4;
+        std::size_t length = spank_olm::pickle_length(SESSION_PICKLE_VERSION);
+        length += spank_olm::pickle_length(received_message);
+        length += 3 * CURVE25519_KEY_LENGTH;
+        length += root_key.size();
+        length += spank_olm::pickle_length(std::uint32_t{});
+        if (sender_chain)
+        {
+            length += 2 * CURVE25519_KEY_LENGTH + chain_key_length;
+        }
+        length += spank_olm::pickle_length(std::uint32_t{});
+        length += receiver_chains.size() * (CURVE25519_KEY_LENGTH + chain_key_length);
+        length += spank_olm::pickle_length(std::uint32_t{});
+        length += skipped_message_keys.size() * (CURVE25519_KEY_LENGTH + chain_key_length);
+        return length;
+    }
+
+    std::uint8_t *Session::pickle(std::uint8_t *pos) const
+    {
+        pos = spank_olm::pickle(pos, SESSION_PICKLE_VERSION);
+        pos = spank_olm::pickle(pos, received_message);
+        pos = pickle_bytes(pos, alice_identity_key.data(), alice_identity_key.size());
+        pos = pickle_bytes(pos, alice_base_key.data(), alice_base_key.size());
+        pos = pickle_bytes(pos, bob_one_time_key.data(), bob_one_time_key.size());
+        pos = pickle_bytes(pos, root_key.data(), root_key.size());
+
+        pos = spank_olm::pickle(pos, static_cast<std::uint32_t>(sender_chain ? 1 : 0));
+        if (sender_chain)
+        {
+            const auto private_key = sender_chain->ratchet_key.raw_private_key_bits();
+            pos = pickle_bytes(pos, sender_chain->ratchet_public_key.data(), CURVE25519_KEY_LENGTH);
+            pos = pickle_bytes(pos, private_key.data(), CURVE25519_KEY_LENGTH);
+            pos = pickle_bytes(pos, sender_chain->chain_key.key.data(), sender_chain->chain_key.key.size());
+            pos = spank_olm::pickle(pos, sender_chain->chain_key.index);
+        }
+
+        // libolm inserts new chains and skipped keys at the front of its lists and pickles them in list order, so
+        // both are written newest first.
+        pos = spank_olm::pickle(pos, static_cast<std::uint32_t>(receiver_chains.size()));
+        for (std::size_t i = 0; i < receiver_chains.size(); ++i)
+        {
+            const auto &chain = receiver_chains[i];
+            pos = pickle_bytes(pos, chain.ratchet_key.data(), chain.ratchet_key.size());
+            pos = pickle_bytes(pos, chain.chain_key.key.data(), chain.chain_key.key.size());
+            pos = spank_olm::pickle(pos, chain.chain_key.index);
+        }
+
+        pos = spank_olm::pickle(pos, static_cast<std::uint32_t>(skipped_message_keys.size()));
+        skipped_message_keys.for_each_newest_first([&pos](Curve25519PublicKey const &ratchet_key,
+                                                          const std::uint32_t index,
+                                                          const std::span<const std::uint8_t, 32> message_key) {
+            pos = pickle_bytes(pos, ratchet_key.data(), ratchet_key.size());
+            pos = pickle_bytes(pos, message_key.data(), message_key.size());
+            pos = spank_olm::pickle(pos, index);
+        });
+        return pos;
+    }
+
+    std::string Session::pickle(PickleCipher &cipher) const
+    {
+        Botan::secure_vector<std::uint8_t> buffer;
+        buffer.reserve(PickleCipher::buffer_length(pickle_length()));
+        buffer.resize(pickle_length());
+        pickle(buffer.data());
+        return cipher.seal(buffer);
+    }
+
+    Session Session::unpickle(const std::span<const std::uint8_t> data, const SessionLimits limits)
+    {
+        Session session(limits);
+        auto pos = data.data();
+        const auto end = data.data() + data.size();
+
+        std::uint32_t version;
+        pos = spank_olm::unpickle(pos, end, version);
+        if (!pos)
+        {
+            throw SpankOlmErrorVersionNotFound();
+        }
+        if (version != SESSION_PICKLE_VERSION)
+        {
+            throw SpankOlmErrorUnknownPickleVersion();
+        }
+
+        const auto check = [](std::uint8_t const *position) {
+            if (!position)
+            {
+                throw SpankOlmErrorCorruptedPickle();
+            }
+            return position;
+        };
+
+        pos = check(spank_olm::unpickle(pos, end, session.received_message));
+        pos = check(unpickle_bytes(pos, end, session.alice_identity_key.data(), CURVE25519_KEY_LENGTH));
+        pos = check(unpickle_bytes(pos, end, session.alice_base_key.data(), CURVE25519_KEY_LENGTH));
+        pos = check(unpickle_bytes(pos, end, session.bob_one_time_key.data(), CURVE25519_KEY_LENGTH));
+        pos = check(unpickle_bytes(pos, end, session.root_key.data(), session.root_key.size()));
+
+        std::uint32_t sender_chain_count;
+        pos = check(spank_olm::unpickle(pos, end, sender_chain_count));
+        if (sender_chain_count > 1)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+        if (sender_chain_count == 1)
+        {
+            Curve25519PublicKey public_key;
+            Secret<CURVE25519_KEY_LENGTH> private_key;
+            ChainKey chain_key{};
+            pos = check(unpickle_bytes(pos, end, public_key.data(), public_key.size()));
+            pos = check(unpickle_bytes(pos, end, private_key.data(), private_key.size()));
+            pos = check(unpickle_bytes(pos, end, chain_key.key.data(), chain_key.key.size()));
+            pos = check(spank_olm::unpickle(pos, end, chain_key.index));
+            session.sender_chain.emplace(SenderChain{Botan::X25519_PrivateKey(private_key), public_key, chain_key});
+            Botan::secure_scrub_memory(chain_key.key.data(), chain_key.key.size());
+        }
+
+        std::uint32_t receiver_chain_count;
+        pos = check(spank_olm::unpickle(pos, end, receiver_chain_count));
+        for (std::uint32_t i = 0; i < receiver_chain_count; ++i)
+        {
+            ReceiverChain chain{};
+            pos = check(unpickle_bytes(pos, end, chain.ratchet_key.data(), chain.ratchet_key.size()));
+            pos = check(unpickle_bytes(pos, end, chain.chain_key.key.data(), chain.chain_key.key.size()));
+            pos = check(spank_olm::unpickle(pos, end, chain.chain_key.index));
+            // Newest first in the pickle, so appending keeps the order and drops the oldest ones if there are too many.
+            session.receiver_chains.insert_at(session.receiver_chains.size(), chain);
+            Botan::secure_scrub_memory(chain.chain_key.key.data(), chain.chain_key.key.size());
+        }
+
+        std::uint32_t skipped_key_count;
+        pos = check(spank_olm::unpickle(pos, end, skipped_key_count));
+        constexpr std::size_t SKIPPED_KEY_LENGTH = CURVE25519_KEY_LENGTH + 32 + sizeof(std::uint32_t);
+        if (static_cast<std::size_t>(end - pos) / SKIPPED_KEY_LENGTH < skipped_key_count)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+        // The keys are newest first in the pickle. Insert them oldest first, so the cache evicts the oldest ones if
+        // there are too many.
+        for (auto i = skipped_key_count; i-- > 0;)
+        {
+            Curve25519PublicKey ratchet_key;
+            Secret<32> message_key;
+            std::uint32_t index;
+            auto entry = pos + i * SKIPPED_KEY_LENGTH;
+            entry = check(unpickle_bytes(entry, end, ratchet_key.data(), ratchet_key.size()));
+            entry = check(unpickle_bytes(entry, end, message_key.data(), message_key.size()));
+            check(spank_olm::unpickle(entry, end, index));
+            session.skipped_message_keys.insert(ratchet_key, index, message_key);
+        }
+        pos += skipped_key_count * SKIPPED_KEY_LENGTH;
+
+        if (pos != end)
+        {
+            throw SpankOlmErrorCorruptedPickle();
+        }
+        return session;
+    }
+
+    Session Session::unpickle(PickleCipher &cipher, const std::string_view encrypted, const SessionLimits limits)
+    {
+        const auto data = cipher.decrypt(encrypted);
+        return unpickle(std::span<const std::uint8_t>(data), limits);
+    }
+} // namespace spank_olm
@@ -0,0 +1,286 @@
+#include "session_store.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+
+namespace spank_olm
+{
+    namespace
+    {
+        Curve25519PublicKey to_peer_key(const std::span<const std::uint8_t> their_identity_key)
+        {
+            if (their_identity_key.size() != CURVE25519_KEY_LENGTH)
+            {
+                throw SpankOlmErrorInvalidKey();
+            }
+            Curve25519PublicKey key;
+            std::copy(their_identity_key.begin(), their_identity_key.end(), key.begin());
+            return key;
+        }
+    } // namespace
+
+    SessionStore::SessionStore(const std::size_t max_sessions_per_peer, const SessionLimits limits) :
+        max_sessions_per_peer(std::max<std::size_t>(1, max_sessions_per_peer)), session_limits(limits)
+    {
+    }
+
+    Session &SessionStore::add(const std::span<const std::uint8_t> their_identity_key, Session session)
+    {
+        const auto peer_key = to_peer_key(their_identity_key);
+        auto session_id = session.session_id();
+        remove(session_id);
+
+        auto &peer = peers[peer_key];
+        peer.push_front(Entry{std::move(session_id), std::move(session)});
+        by_id.emplace(peer.front().session_id, Location{peer_key, peer.begin()});
+
+        while (peer.size() > max_sessions_per_peer)
+        {
+            by_id.erase(peer.back().session_id);
+            peer.pop_back();
+        }
+        return peer.front().session;
+    }
+
+    Session *SessionStore::find(const std::string_view session_id)
+    {
+        const auto location = by_id.find(std::string(session_id));
+        return location == by_id.end() ? nullptr : &location->second.entry->session;
+    }
+
+    Session *SessionStore::most_recent(const std::span<const std::uint8_t> their_identity_key)
+    {
+        const auto peer = peers.find(to_peer_key(their_identity_key));
+        return peer == peers.end() || peer->second.empty() ? nullptr : &peer->second.front().session;
+    }
+
+    std::vector<Session *> SessionStore::sessions(const std::span<const std::uint8_t> their_identity_key)
+    {
+        std::vector<Session *> result;
+        const auto peer = peers.find(to_peer_key(their_identity_key));
+        if (peer != peers.end())
+        {
+            result.reserve(peer->second.size());
+            for (auto &entry : peer->second)
+            {
+                result.push_back(&entry.session);
+            }
+        }
+        return result;
+    }
+
+    bool SessionStore::remove(const std::string_view session_id)
+    {
+        const auto location = by_id.find(std::string(session_id));
+        if (location == by_id.end())
+        {
+            return false;
+        }
+
+        const auto peer = peers.find(location->second.peer_key);
+        peer->second.erase(location->second.entry);
+        by_id.erase(location);
+        if (peer->second.empty())
+        {
+            peers.erase(peer);
+        }
+        return true;
+    }
+
+    Session *SessionStore::touch(Peer &peer, const Peer::iterator entry)
+    {
+        // Splicing keeps the iterators in by_id valid.
+        peer.splice(peer.begin(), peer, entry);
+        return &entry->session;
+    }
+
+    void SessionStore::index_sessions(Curve25519PublicKey const &peer_key, Peer &peer)
+    {
+        for (auto entry = peer.begin(); entry != peer.end(); ++entry)
+        {
+            by_id.try_emplace(entry->session_id, Location{peer_key, entry});
+        }
+        while (peer.size() > max_sessions_per_peer)
+        {
+            by_id.erase(peer.back().session_id);
+            peer.pop_back();
+        }
+        if (peer.empty())
+        {
+            peers.erase(peer_key);
+        }
+    }
+
+    SessionStore::Decrypted SessionStore::decrypt(Account const &account,
+                                                  const std::span<const std::uint8_t> their_identity_key,
+                                                  OlmMessage const &message, OneTimeKeyIndex const *index)
+    {
+        const auto peer_key = to_peer_key(their_identity_key);
+        auto &peer = peers[peer_key];
+        try
+        {
+            auto result = decrypt_from(peer, account, their_identity_key, message.type, message.body, index);
+            if (result.new_session)
+            {
+                index_sessions(peer_key, peer);
+            }
+            return result;
+        }
+        catch (...)
+        {
+            if (peer.empty())
+            {
+                peers.erase(peer_key);
+            }
+            throw;
+        }
+    }
+
+    SessionStore::Decrypted SessionStore::decrypt_from(Peer &peer, Account const &account,
+                                                       const std::span<const std::uint8_t> their_identity_key,
+                                                       const MessageType type, const std::string_view body,
+                                                       OneTimeKeyIndex const *index) const
+    {
+        if (type == MessageType::PreKey)
+        {
+            // A pre-key message names the keys of its session, so no trial decryption is needed.
+            const auto header = PreKeyHeader::decode(body);
+            for (auto entry = peer.begin(); entry != peer.end(); ++entry)
+            {
+                if (entry->session.matches_inbound(header))
+                {
+                    auto plaintext = entry->session.decrypt(type, body);
+                    return {std::move(plaintext), touch(peer, entry), false, {}};
+                }
+            }
+
+            auto session = index ? Session::create_inbound(account, *index, body, their_identity_key, session_limits)
+                                 : Session::create_inbound(account, body, their_identity_key, session_limits);
+            auto plaintext = session.decrypt(type, body);
+            auto session_id = session.session_id();
+            const auto one_time_key = session.one_time_key();
+            peer.push_front(Entry{std::move(session_id), std::move(session)});
+            return {std::move(plaintext), &peer.front().session, true, one_time_key};
+        }
+
+        // Sessions with a chain for the ratchet key of the message only need a MAC to be checked, the others a key
+        // agreement, so they are tried last.
+        const auto ratchet_key = decode_ratchet_key(type, body);
+        for (const bool known_chain : {true, false})
+        {
+            for (auto entry = peer.begin(); entry != peer.end(); ++entry)
+            {
+                if (entry->session.has_receiver_chain(ratchet_key) != known_chain)
+                {
+                    continue;
+                }
+                try
+                {
+                    auto plaintext = entry->session.decrypt(type, body);
+                    return {std::move(plaintext), touch(peer, entry), false, {}};
+                }
+                catch (const SpankOlmErrorBadMessageMac &)
+                {
+                }
+                catch (const SpankOlmErrorBadMessageKeyId &)
+                {
+                }
+            }
+        }
+        throw SpankOlmErrorNoMatchingSession();
+    }
+
+    std::vector<BatchDecrypted> SessionStore::decrypt_batch(Account &account,
+                                                            const std::span<const IncomingMessage> messages,
+                                                            ThreadPool &pool)
+    {
+        struct Group
+        {
+            Curve25519PublicKey peer_key;
+            Peer *peer;
+            std::vector<std::size_t> messages;
+            std::vector<Curve25519PublicKey> used_keys;
+        };
+
+        std::vector<BatchDecrypted> results(messages.size());
+
+        // Group the messages by sender. All groups are created before any work starts, so the map isn't modified
+        // while the workers use it.
+        std::vector<Group> groups;
+        std::unordered_map<Curve25519PublicKey, std::size_t, LeadingBytesHash> group_of;
+        for (std::size_t i = 0; i < messages.size(); ++i)
+        {
+            try
+            {
+                const auto peer_key = to_peer_key(messages[i].sender_key);
+                const auto [group, inserted] = group_of.try_emplace(peer_key, groups.size());
+                if (inserted)
+                {
+                    groups.push_back({peer_key, &peers[peer_key], {}, {}});
+                }
+                groups[group->second].messages.push_back(i);
+            }
+            catch (...)
+            {
+                results[i].error = std::current_exception();
+            }
+        }
+
+        // Start with the senders with the most messages, so they don't end up last on an otherwise idle pool.
+        std::sort(groups.begin(), groups.end(),
+                  [](Group const &a, Group const &b) { return a.messages.size() > b.messages.size(); });
+
+        const OneTimeKeyIndex index(account);
+        std::vector<std::future<void>> pending;
+        pending.reserve(groups.size());
+        for (auto &group : groups)
+        {
+            pending.push_back(pool.submit([this, &account, &messages, &results, &index, &group] {
+                for (const auto i : group.messages)
+                {
+                    auto &result = results[i];
+                    try
+                    {
+                        auto decrypted = decrypt_from(*group.peer, account, messages[i].sender_key, messages[i].type,
+                                                      messages[i].body, &index);
+                        result.plaintext = std::move(decrypted.plaintext);
+                        result.session_id = group.peer->front().session_id;
+                        result.new_session = decrypted.new_session;
+                        if (decrypted.one_time_key)
+                        {
+                            // The key the handshake used, not the one the header claims.
+                            group.used_keys.push_back(*decrypted.one_time_key);
+                        }
+                    }
+                    catch (...)
+                    {
+                        result.error = std::current_exception();
+                    }
+                }
+            }));
+        }
+
+        for (auto &result : pending)
+        {
+            result.wait();
+        }
+        for (auto &result : pending)
+        {
+            result.get();
+        }
+
+        // Merge: index the new sessions, then commit the used one-time keys to the account in one go.
+        for (auto &group : groups)
+        {
+            index_sessions(group.peer_key, *group.peer);
+        }
+        for (auto const &group : groups)
+        {
+            for (auto const &key : group.used_keys)
+            {
+                account.remove_key(Botan::X25519_PublicKey(key));
+            }
+        }
+        return results;
+    }
+} // namespace spank_olm
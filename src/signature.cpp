@@ -0,0 +1,355 @@
+#include "signature.hpp"
+#include "errors.hpp"
+
+#include <algorithm>
+#include <array>
+#include <botan/hash.h>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace spank_olm
+{
+    namespace
+    {
+        // According to https://botan.randombit.net/handbook/api_ref/pubkey.html#ed25519-ed448-variants
+        constexpr std::string_view PADDING_SCHEME = "Ed25519ph";
+        constexpr std::string_view PURE_PADDING_SCHEME = "Pure";
+
+        /**
+         * \brief Reads a file chunk by chunk into two buffers which are passed back and forth with the caller.
+         *
+         * A single reader thread fills one buffer while the caller consumes the other, so reading overlaps with
+         * hashing without starting a thread per chunk. Without threads the chunks are read on the caller's thread.
+         */
+        class ChunkReader
+        {
+        public:
+            ChunkReader(std::filesystem::path const &path, const std::size_t chunk_size) :
+                file(path, std::ios::binary), buffers{Buffer{std::vector<std::uint8_t>(chunk_size)},
+                                                      Buffer{std::vector<std::uint8_t>(chunk_size)}}
+            {
+                if (!file)
+                {
+                    throw SpankOlmErrorIO();
+                }
+#ifndef __EMSCRIPTEN__
+                reader = std::thread([this] { read_ahead(); });
+#endif
+            }
+
+            ChunkReader(ChunkReader const &) = delete;
+            ChunkReader &operator=(ChunkReader const &) = delete;
+
+            ~ChunkReader()
+            {
+                if (reader.joinable())
+                {
+                    {
+                        std::lock_guard lock(mutex);
+                        stopping = true;
+                    }
+                    condition.notify_all();
+                    reader.join();
+                }
+            }
+
+            /**
+             * \brief Returns the next chunk, which stays valid until the next call. It is empty at the end of the file.
+             *
+             * \throws SpankOlmErrorIO if the file can't be read.
+             */
+            std::span<const std::uint8_t> next()
+            {
+#ifdef __EMSCRIPTEN__
+                auto &buffer = buffers[0];
+                buffer.length = read(buffer.data);
+#else
+                if (consumed)
+                {
+                    // Hand the previous chunk back to the reader.
+                    {
+                        std::lock_guard lock(mutex);
+                        buffers[current].full = false;
+                    }
+                    condition.notify_all();
+                    current ^= 1;
+                }
+                consumed = true;
+
+                auto &buffer = buffers[current];
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [&buffer] { return buffer.full; });
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+#endif
+                return {buffer.data.data(), buffer.length};
+            }
+
+        private:
+            struct Buffer
+            {
+                std::vector<std::uint8_t> data;
+                std::size_t length = 0;
+                bool full = false;
+            };
+
+            std::size_t read(std::vector<std::uint8_t> &data)
+            {
+                file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size()));
+                if (file.bad())
+                {
+                    throw SpankOlmErrorIO();
+                }
+                return static_cast<std::size_t>(file.gcount());
+            }
+
+            /**
+             * \brief Fills the buffers in turn until the end of the file, an error or the reader is destroyed.
+             */
+            void read_ahead()
+            {
+                for (std::size_t index = 0;; index ^= 1)
+                {
+                    auto &buffer = buffers[index];
+                    {
+                        std::unique_lock lock(mutex);
+                        condition.wait(lock, [&] { return !buffer.full || stopping; });
+                        if (stopping)
+                        {
+                            return;
+                        }
+                    }
+
+                    std::size_t length = 0;
+                    std::exception_ptr failure;
+                    try
+                    {
+                        length = read(buffer.data);
+                    }
+                    catch (...)
+                    {
+                        failure = std::current_exception();
+                    }
+
+                    {
+                        std::lock_guard lock(mutex);
+                        buffer.length = length;
+                        buffer.full = true;
+                        error = failure;
+                    }
+                    condition.notify_all();
+                    if (length == 0 || failure)
+                    {
+                        return;
+                    }
+                }
+            }
+
+            std::ifstream file;
+            std::array<Buffer, 2> buffers;
+            std::size_t current = 0; ///< The buffer the caller reads next.
+            bool consumed = false; ///< Whether the caller already holds the current buffer.
+            std::mutex mutex;
+            std::condition_variable condition;
+            bool stopping = false;
+            std::exception_ptr error;
+            std::thread reader;
+        };
+
+        /**
+         * \brief Calls consume for every chunk of a file, reading the next chunk while the current one is consumed.
+         *
+         * \throws SpankOlmErrorIO if the file can't be read.
+         */
+        template <typename Consumer>
+        void for_each_file_chunk(std::filesystem::path const &path, const std::size_t chunk_size, Consumer &&consume)
+        {
+            ChunkReader reader(path, std::max<std::size_t>(chunk_size, 1));
+            for (auto chunk = reader.next(); !chunk.empty(); chunk = reader.next())
+            {
+                consume(chunk);
+            }
+        }
+    } // namespace
+
+    Ed25519phSigner::Ed25519phSigner(Botan::Ed25519_PrivateKey const &key, Botan::RandomNumberGenerator &rng) :
+        signer(key, rng, PADDING_SCHEME)
+    {
+    }
+
+    void Ed25519phSigner::update(const std::span<const std::uint8_t> chunk) { signer.update(chunk); }
+
+    void Ed25519phSigner::update(const std::string_view chunk) { signer.update(chunk); }
+
+    std::vector<std::uint8_t> Ed25519phSigner::finish(Botan::RandomNumberGenerator &rng)
+    {
+        return signer.signature(rng);
+    }
+
+    Ed25519Signer::Ed25519Signer(Botan::Ed25519_PrivateKey const &key, Botan::RandomNumberGenerator &rng) :
+        signer(key, rng, PURE_PADDING_SCHEME)
+    {
+    }
+
+    void Ed25519Signer::update(const std::string_view chunk) { signer.update(chunk); }
+
+    std::vector<std::uint8_t> Ed25519Signer::finish(Botan::RandomNumberGenerator &rng)
+    {
+        return signer.signature(rng);
+    }
+
+    Ed25519phVerifier::Ed25519phVerifier(Botan::Public_Key const &key) : verifier(key, PADDING_SCHEME) {}
+
+    void Ed25519phVerifier::update(const std::span<const std::uint8_t> chunk) { verifier.update(chunk); }
+
+    void Ed25519phVerifier::update(const std::string_view chunk) { verifier.update(chunk); }
+
+    bool Ed25519phVerifier::finish(const std::span<const std::uint8_t> signature)
+    {
+        return verifier.check_signature(signature);
+    }
+
+    std::vector<std::uint8_t> sign_chunked(Botan::Ed25519_PrivateKey const &key, Botan::RandomNumberGenerator &rng,
+                                           const std::span<const std::uint8_t> data, std::size_t chunk_size)
+    {
+        chunk_size = std::max<std::size_t>(chunk_size, 1);
+
+        Ed25519phSigner signer(key, rng);
+        for (std::size_t offset = 0; offset < data.size(); offset += chunk_size)
+        {
+            signer.update(data.subspan(offset, std::min(chunk_size, data.size() - offset)));
+        }
+        return signer.finish(rng);
+    }
+
+    std::vector<std::uint8_t> sign_file(Botan::Ed25519_PrivateKey const &key, Botan::RandomNumberGenerator &rng,
+                                        std::filesystem::path const &path, const std::size_t chunk_size)
+    {
+        Ed25519phSigner signer(key, rng);
+        for_each_file_chunk(path, chunk_size, [&signer](auto chunk) { signer.update(chunk); });
+        return signer.finish(rng);
+    }
+
+    bool verify_file(Botan::Public_Key const &key, std::filesystem::path const &path,
+                     const std::span<const std::uint8_t> signature, const std::size_t chunk_size)
+    {
+        if (signature.size() != ED25519_SIGNATURE_LENGTH)
+        {
+            return false;
+        }
+
+        Ed25519phVerifier verifier(key);
+        for_each_file_chunk(path, chunk_size, [&verifier](auto chunk) { verifier.update(chunk); });
+        return verifier.finish(signature);
+    }
+
+    bool verify_signature(Botan::Public_Key const &key, const std::string_view message,
+                          const std::span<const std::uint8_t> signature)
+    {
+        if (signature.size() != ED25519_SIGNATURE_LENGTH)
+        {
+            return false;
+        }
+
+        Ed25519phVerifier verifier(key);
+        verifier.update(message);
+        return verifier.finish(signature);
+    }
+
+    bool verify_pure_signature(Botan::Public_Key const &key, const std::string_view message,
+                               const std::span<const std::uint8_t> signature)
+    {
+        if (signature.size() != ED25519_SIGNATURE_LENGTH)
+        {
+            return false;
+        }
+
+        Botan::PK_Verifier verifier(key, PURE_PADDING_SCHEME);
+        verifier.update(message);
+        return verifier.check_signature(signature);
+    }
+
+    SignatureVerificationCache::SignatureVerificationCache(const std::size_t capacity) :
+        max_entries(capacity == 0 ? 1 : capacity)
+    {
+        index.reserve(max_entries);
+    }
+
+    bool SignatureVerificationCache::verify(Botan::Public_Key const &key, const std::string_view message,
+                                            const std::span<const std::uint8_t> signature)
+    {
+        if (signature.size() != ED25519_SIGNATURE_LENGTH)
+        {
+            return false;
+        }
+
+        // Both the key and the signature have a fixed length, so simply concatenating them with the message is
+        // unambiguous.
+        const auto hash = Botan::HashFunction::create_or_throw("SHA-256");
+        hash->update(key.raw_public_key_bits());
+        hash->update(signature);
+        hash->update(message);
+        Digest digest;
+        hash->final(digest.data());
+
+        {
+            std::lock_guard lock(mutex);
+            if (const auto it = index.find(digest); it != index.end())
+            {
+                entries.splice(entries.begin(), entries, it->second);
+                ++hit_count;
+                return it->second->valid;
+            }
+            ++miss_count;
+        }
+
+        // Do the expensive part without holding the lock.
+        const bool valid = verify_signature(key, message, signature);
+
+        std::lock_guard lock(mutex);
+        // Another thread may have verified the same signature in the meantime.
+        if (index.contains(digest))
+        {
+            return valid;
+        }
+        if (entries.size() >= max_entries)
+        {
+            index.erase(entries.back().digest);
+            entries.pop_back();
+        }
+        entries.push_front({digest, valid});
+        index.emplace(digest, entries.begin());
+
+        return valid;
+    }
+
+    void SignatureVerificationCache::clear()
+    {
+        std::lock_guard lock(mutex);
+        index.clear();
+        entries.clear();
+    }
+
+    std::size_t SignatureVerificationCache::size() const
+    {
+        std::lock_guard lock(mutex);
+        return entries.size();
+    }
+
+    std::uint64_t SignatureVerificationCache::hits() const
+    {
+        std::lock_guard lock(mutex);
+        return hit_count;
+    }
+
+    std::uint64_t SignatureVerificationCache::misses() const
+    {
+        std::lock_guard lock(mutex);
+        return miss_count;
+    }
+} // namespace spank_olm
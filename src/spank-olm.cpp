@@ -19,8 +19,9 @@ EMSCRIPTEN_BINDINGS(spank_olm)
        .function("forget_old_fallback_key", &spank_olm::Account::forget_old_fallback_key)
        .function("lookup_key", &spank_olm::Account::lookup_key)
        .function("remove_key", &spank_olm::Account::remove_key)
-       .function("pickle", &spank_olm::Account::pickle)
-       .function("unpickle", &spank_olm::Account::unpickle)
+       .function("pickle", select_overload<std::vector<uint8_t>() const>(&spank_olm::Account::pickle))
+       .function("unpickle",
+                 select_overload<spank_olm::Account(std::vector<uint8_t> const &)>(&spank_olm::Account::unpickle))
        .property("identity_keys", &spank_olm::Account::identity_keys, return_value_policy::reference())
        .property("one_time_keys", &spank_olm::Account::one_time_keys, return_value_policy::reference())
        .property("current_fallback_key", &spank_olm::Account::current_fallback_key, return_value_policy::reference())
@@ -0,0 +1,100 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace spank_olm
+{
+    ThreadPool::ThreadPool(const std::size_t threads)
+    {
+        workers.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    std::size_t ThreadPool::default_thread_count()
+    {
+#ifdef __EMSCRIPTEN__
+        return 0;
+#else
+        return std::max(1u, std::thread::hardware_concurrency());
+#endif
+    }
+
+    void ThreadPool::work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                // Drain the queue before stopping so that no future is left without a result.
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    void ThreadPool::parallel_for(const std::size_t count, std::function<void(std::size_t)> const &function)
+    {
+        parallel_for_chunks(count, [&function](const std::size_t begin, const std::size_t end) {
+            for (auto i = begin; i < end; ++i)
+            {
+                function(i);
+            }
+        });
+    }
+
+    void ThreadPool::parallel_for_chunks(const std::size_t count,
+                                         std::function<void(std::size_t, std::size_t)> const &function)
+    {
+        const auto chunks = std::min(count, std::max<std::size_t>(1, workers.size()));
+        if (chunks <= 1)
+        {
+            if (count > 0)
+            {
+                function(0, count);
+            }
+            return;
+        }
+
+        std::vector<std::future<void>> results;
+        results.reserve(chunks);
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            const auto begin = count * chunk / chunks;
+            const auto end = count * (chunk + 1) / chunks;
+            results.push_back(submit([&function, begin, end] { function(begin, end); }));
+        }
+
+        // Wait for every chunk before rethrowing, as the chunks reference the caller's state.
+        for (auto &result : results)
+        {
+            result.wait();
+        }
+        for (auto &result : results)
+        {
+            result.get();
+        }
+    }
+} // namespace spank_olm
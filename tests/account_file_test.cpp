@@ -0,0 +1,185 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "account_file.hpp"
+#include "errors.hpp"
+#include <array>
+#include <botan/auto_rng.h>
+#include <botan/pubkey.h>
+#include <filesystem>
+#include <fstream>
+
+using namespace spank_olm;
+
+namespace
+{
+    Account make_account(Botan::RandomNumberGenerator &rng)
+    {
+        Account account;
+        account.new_account(rng);
+        account.generate_one_time_keys(rng, 10);
+        account.generate_fallback_key(rng);
+        account.generate_fallback_key(rng);
+        return account;
+    }
+} // namespace
+
+TEST_CASE("AccountFile round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto account = make_account(rng);
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_file_test.bin";
+
+    AccountFile::write(path, account);
+    const auto file = AccountFile::open(path);
+
+    REQUIRE(file.get_identity_json() == account.get_identity_json());
+    REQUIRE(file.one_time_key_count() == account.one_time_keys.size());
+    REQUIRE(file.next_one_time_key_id() == account.next_one_time_key_id);
+    REQUIRE(file.to_account().pickle() == account.pickle());
+
+    const auto signature = file.sign(rng, "Hello, World!");
+    REQUIRE(verify_signature(*account.identity_keys->ed25519_key.public_key(), "Hello, World!", signature));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("AccountFile updates single keys in place")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto account = make_account(rng);
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_file_update_test.bin";
+    AccountFile::write(path, account);
+
+    const auto claimed = account.one_time_keys[3].key.public_key();
+    const auto kept = account.one_time_keys[4].key.public_key();
+    {
+        auto file = AccountFile::open(path, true);
+        const auto lookup_result = file.lookup_key(*claimed);
+        REQUIRE(lookup_result.has_value());
+        REQUIRE(lookup_result->id == account.one_time_keys[3].id);
+
+        REQUIRE(file.mark_as_published(account.one_time_keys[4].id));
+        REQUIRE(file.remove_key(*claimed));
+        REQUIRE(!file.remove_key(*claimed));
+        file.sync();
+    }
+
+    const auto file = AccountFile::open(path);
+    REQUIRE(file.one_time_key_count() == account.one_time_keys.size() - 1);
+    REQUIRE(!file.lookup_key(*claimed).has_value());
+    REQUIRE(file.lookup_key(*kept)->published);
+
+    const auto fallback_key = account.current_fallback_key->key.public_key();
+    REQUIRE(file.lookup_key(*fallback_key)->id == account.current_fallback_key->id);
+
+    // The remaining keys keep their order.
+    auto expected = account;
+    expected.remove_key(*claimed);
+    const auto restored = file.to_account();
+    REQUIRE(restored.one_time_keys.size() == expected.one_time_keys.size());
+    for (std::size_t i = 0; i < expected.one_time_keys.size(); ++i)
+    {
+        REQUIRE(restored.one_time_keys[i].id == expected.one_time_keys[i].id);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("AccountFile finds every key of a full account")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    // Drop some keys first, so the ids no longer start at zero.
+    account.generate_one_time_keys(rng, MAX_ONE_TIME_KEYS / 2);
+    account.generate_one_time_keys(rng, MAX_ONE_TIME_KEYS);
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_file_full_test.bin";
+    AccountFile::write(path, account);
+
+    // Key records start on a cache line.
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::array<std::uint8_t, 44> header{};
+        in.read(reinterpret_cast<char *>(header.data()), header.size());
+        const auto records_offset = header[40] | header[41] << 8 | header[42] << 16 | header[43] << 24;
+        REQUIRE(records_offset % 64 == 0);
+    }
+
+    {
+        auto file = AccountFile::open(path, true);
+        REQUIRE(file.one_time_key_count() == MAX_ONE_TIME_KEYS);
+        for (const auto &key : account.one_time_keys)
+        {
+            REQUIRE(file.lookup_key(*key->key.public_key())->id == key->id);
+            REQUIRE(file.mark_as_published(key->id));
+        }
+        REQUIRE(!file.mark_as_published(account.next_one_time_key_id));
+
+        // Every other key goes away; the rest must stay reachable past the removed ones.
+        for (std::size_t i = 0; i < account.one_time_keys.size(); i += 2)
+        {
+            REQUIRE(file.remove_key(*account.one_time_keys[i].key.public_key()));
+        }
+        file.sync();
+    }
+
+    const auto file = AccountFile::open(path);
+    REQUIRE(file.one_time_key_count() == MAX_ONE_TIME_KEYS / 2);
+    for (std::size_t i = 0; i < account.one_time_keys.size(); ++i)
+    {
+        const auto lookup_result = file.lookup_key(*account.one_time_keys[i].key.public_key());
+        REQUIRE(lookup_result.has_value() == (i % 2 == 1));
+        if (lookup_result)
+        {
+            REQUIRE(lookup_result->published);
+        }
+    }
+    REQUIRE(file.to_account().one_time_keys.size() == MAX_ONE_TIME_KEYS / 2);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("AccountFile checks the full public key")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto account = make_account(rng);
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_file_prefix_test.bin";
+    AccountFile::write(path, account);
+
+    // A key which only shares the stored prefix with one of ours must neither find nor remove it.
+    auto bits = account.one_time_keys[2].key.raw_public_key_bits();
+    bits.back() ^= 1;
+    const Botan::X25519_PublicKey impostor(bits);
+    {
+        auto file = AccountFile::open(path, true);
+        REQUIRE(!file.lookup_key(impostor).has_value());
+        REQUIRE(!file.remove_key(impostor));
+        REQUIRE(file.lookup_key(*account.one_time_keys[2].key.public_key())->id == account.one_time_keys[2].id);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("AccountFile rejects invalid files")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_file_invalid_test.bin";
+    AccountFile::write(path, make_account(rng));
+
+    {
+        auto file = AccountFile::open(path);
+        REQUIRE_THROWS_AS(file.mark_keys_as_published(), SpankOlmErrorIO);
+    }
+
+    std::filesystem::resize_file(path, 100);
+    REQUIRE_THROWS_AS(AccountFile::open(path), SpankOlmErrorCorruptedAccountFile);
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "not an account file, but long enough to have a header";
+    }
+    REQUIRE_THROWS_AS(AccountFile::open(path), SpankOlmErrorCorruptedAccountFile);
+
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(AccountFile::open(path), SpankOlmErrorIO);
+}
@@ -1,8 +1,11 @@
 #include <snitch/snitch.hpp>
 #include "account.hpp"
+#include "account_view.hpp"
 #include "errors.hpp"
+#include "json.hpp"
 #include <botan/auto_rng.h>
 #include <botan/pubkey.h>
+#include <memory_resource>
 
 using namespace spank_olm;
 
@@ -88,3 +91,265 @@ TEST_CASE("Account lookup and remove key")
     lookup_result = account.lookup_key(*key);
     REQUIRE(!lookup_result.has_value());
 }
+
+TEST_CASE("Account lookup of fallback keys")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_fallback_key(rng);
+    account.generate_fallback_key(rng);
+
+    const auto current = account.lookup_key(*account.current_fallback_key->key.public_key());
+    REQUIRE(current.has_value());
+    REQUIRE((*current)->id == account.current_fallback_key->id);
+
+    const auto previous = account.lookup_key(*account.prev_fallback_key->key.public_key());
+    REQUIRE(previous.has_value());
+    REQUIRE((*previous)->id == account.prev_fallback_key->id);
+}
+
+TEST_CASE("Account pickle into a memory resource")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 3);
+
+    std::pmr::monotonic_buffer_resource arena;
+    const auto serialized = account.pickle(&arena);
+    REQUIRE(serialized.get_allocator().resource() == &arena);
+
+    const auto plain = account.pickle();
+    REQUIRE(std::equal(serialized.begin(), serialized.end(), plain.begin(), plain.end()));
+
+    const auto deserialized = Account::unpickle(std::span<const std::uint8_t>(serialized));
+    REQUIRE(account.one_time_keys.size() == deserialized.one_time_keys.size());
+    REQUIRE(account.next_one_time_key_id == deserialized.next_one_time_key_id);
+}
+
+TEST_CASE("Account pickle has the exact length")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, Account::max_number_of_one_time_keys());
+    account.generate_fallback_key(rng);
+    account.generate_fallback_key(rng);
+
+    const auto length = account.pickle_length();
+    const auto serialized = account.pickle();
+    REQUIRE(serialized.size() == length);
+
+    std::vector<std::uint8_t> buffer(length);
+    REQUIRE(account.pickle(std::span(buffer)) == length);
+    REQUIRE(buffer == serialized);
+
+    std::vector<std::uint8_t> too_small(length - 1);
+    REQUIRE_THROWS_AS(account.pickle(std::span(too_small)), SpankOlmErrorOutputBufferTooSmall);
+
+    const auto deserialized = Account::unpickle(serialized);
+    REQUIRE(deserialized.one_time_keys.size() == Account::max_number_of_one_time_keys());
+    for (std::size_t i = 0; i < account.one_time_keys.size(); ++i)
+    {
+        REQUIRE(account.one_time_keys[i].id == deserialized.one_time_keys[i].id);
+    }
+    REQUIRE(deserialized.current_fallback_key.has_value());
+    REQUIRE(deserialized.prev_fallback_key.has_value());
+    REQUIRE(account.current_fallback_key->id == deserialized.current_fallback_key->id);
+    REQUIRE(account.prev_fallback_key->id == deserialized.prev_fallback_key->id);
+    REQUIRE(account.next_one_time_key_id == deserialized.next_one_time_key_id);
+
+    // Pickling the unpickled account again has to produce the same bytes.
+    REQUIRE(deserialized.pickle() == serialized);
+}
+
+TEST_CASE("AccountView matches the unpickled account")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 10);
+    account.generate_fallback_key(rng);
+    account.generate_fallback_key(rng);
+
+    const auto serialized = account.pickle();
+    const auto view = AccountView::parse(serialized);
+
+    REQUIRE(view.pickle_version() == ACCOUNT_PICKLE_VERSION);
+    REQUIRE(view.get_identity_json() == account.get_identity_json());
+    REQUIRE(view.one_time_keys().size() == account.one_time_keys.size());
+    for (std::size_t i = 0; i < account.one_time_keys.size(); ++i)
+    {
+        REQUIRE(view.one_time_keys()[i].id == account.one_time_keys[i].id);
+        REQUIRE(view.one_time_keys()[i].published == account.one_time_keys[i].published);
+    }
+    REQUIRE(view.current_fallback_key().has_value());
+    REQUIRE(view.current_fallback_key()->id == account.current_fallback_key->id);
+    REQUIRE(view.prev_fallback_key().has_value());
+    REQUIRE(view.prev_fallback_key()->id == account.prev_fallback_key->id);
+    REQUIRE(view.next_one_time_key_id() == account.next_one_time_key_id);
+
+    // Building the account from the view has to give back the same pickle.
+    REQUIRE(view.to_account().pickle() == serialized);
+}
+
+TEST_CASE("AccountView signs and looks up keys lazily")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 3);
+    account.generate_fallback_key(rng);
+
+    const auto serialized = account.pickle();
+    const auto view = AccountView::parse(serialized);
+
+    const auto signature = view.sign(rng, "Hello, World!");
+    const auto public_key = account.identity_keys->ed25519_key.public_key();
+    REQUIRE(verify_signature(*public_key, "Hello, World!", signature));
+
+    const auto key = account.one_time_keys[1].key.public_key();
+    const auto lookup_result = view.lookup_key(*key);
+    REQUIRE(lookup_result.has_value());
+    REQUIRE(lookup_result.value()->id == account.one_time_keys[1].id);
+
+    const auto fallback_key = account.current_fallback_key->key.public_key();
+    const auto fallback_result = view.lookup_key(*fallback_key);
+    REQUIRE(fallback_result.has_value());
+    REQUIRE(fallback_result.value()->id == account.current_fallback_key->id);
+
+    Account other;
+    other.new_account(rng);
+    REQUIRE(!view.lookup_key(*other.identity_keys->curve25519_key.public_key()).has_value());
+}
+
+TEST_CASE("AccountView and Account::unpickle accept the same key ids")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 3);
+    account.generate_fallback_key(rng);
+    // libolm never hands out id 0, but it doesn't reject a pickle holding it either.
+    account.one_time_keys[2].id = 0;
+    account.current_fallback_key->id = 0xffffffff;
+
+    const auto serialized = account.pickle();
+    REQUIRE(Account::unpickle(serialized).pickle() == serialized);
+
+    const auto view = AccountView::parse(serialized);
+    REQUIRE(view.one_time_keys()[2].id == 0);
+    REQUIRE(view.current_fallback_key()->id == 0xffffffff);
+    REQUIRE(view.to_account().pickle() == serialized);
+
+    const auto lookup_result = view.lookup_key(*account.one_time_keys[2].key.public_key());
+    REQUIRE(lookup_result.has_value());
+    REQUIRE(lookup_result.value()->id == 0);
+
+    // The search for the last key indexed the ones before it, which are found again through the index.
+    for (std::size_t i = 0; i < 3; ++i)
+    {
+        const auto again = view.lookup_key(*account.one_time_keys[i].key.public_key());
+        REQUIRE(again.has_value());
+        REQUIRE(again.value()->id == account.one_time_keys[i].id);
+    }
+    const auto fallback_result = view.lookup_key(*account.current_fallback_key->key.public_key());
+    REQUIRE(fallback_result.has_value());
+    REQUIRE(fallback_result.value()->id == 0xffffffff);
+}
+
+TEST_CASE("AccountView rejects corrupted pickles")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 2);
+
+    auto serialized = account.pickle();
+    serialized.resize(serialized.size() - 1);
+    REQUIRE_THROWS_AS(AccountView::parse(serialized), SpankOlmErrorCorruptedAccountPickle);
+
+    const std::vector<std::uint8_t> empty;
+    REQUIRE_THROWS_AS(AccountView::parse(empty), SpankOlmErrorVersionNotFound);
+}
+
+TEST_CASE("Account signed device and one-time keys")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 1);
+    account.generate_fallback_key(rng);
+    const auto public_key = account.identity_keys->ed25519_key.public_key();
+    const auto curve25519 =
+        base64_encode(account.identity_keys->curve25519_key.public_key()->raw_public_key_bits(), false);
+    const auto ed25519 = base64_encode(public_key->raw_public_key_bits(), false);
+
+    const auto device_keys = account.get_signed_device_keys_json(rng, "@alice:example.org", "DEVICE");
+    const std::string signable = R"({"algorithms":["m.olm.v1.curve25519-aes-sha2","m.megolm.v1.aes-sha2"],)"
+                                 R"("device_id":"DEVICE","keys":{"curve25519:DEVICE":")" + curve25519 +
+                                 R"(","ed25519:DEVICE":")" + ed25519 + R"("},"user_id":"@alice:example.org"})";
+    const auto signatures_start = device_keys.find(R"(,"signatures":)");
+    const auto signatures_end = device_keys.find(R"(,"user_id")");
+    REQUIRE(signatures_start != std::string::npos);
+    REQUIRE(signatures_end != std::string::npos);
+    REQUIRE(device_keys.substr(0, signatures_start) + device_keys.substr(signatures_end) == signable);
+    const auto signature = device_keys.substr(signatures_start, signatures_end - signatures_start);
+    const std::string prefix = R"(,"signatures":{"@alice:example.org":{"ed25519:DEVICE":")";
+    REQUIRE(signature.starts_with(prefix));
+    REQUIRE(verify_signature(*public_key, signable,
+                             base64_decode(signature.substr(prefix.size(), signature.size() - prefix.size() - 3))));
+
+    std::string keys;
+    CanonicalJsonWriter writer(keys);
+    auto signer = account.start_signature(rng);
+    writer.begin_array();
+    Account::write_signed_key(writer, signer, rng, account.one_time_keys[0], false, "@alice:example.org", "DEVICE");
+    Account::write_signed_key(writer, signer, rng, *account.current_fallback_key, true, "@alice:example.org",
+                              "DEVICE");
+    writer.end_array();
+    const auto one_time_key = base64_encode(account.one_time_keys[0].key.public_key()->raw_public_key_bits(), false);
+    const auto fallback_key =
+        base64_encode(account.current_fallback_key->key.public_key()->raw_public_key_bits(), false);
+    REQUIRE(keys.starts_with(R"([{"key":")" + one_time_key + R"(","signatures":)"));
+    REQUIRE(keys.find(R"(},{"fallback":true,"key":")" + fallback_key + R"(","signatures":)") != std::string::npos);
+}
+
+TEST_CASE("Account signed key batch")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 12);
+    account.generate_fallback_key(rng);
+    const auto public_key = account.identity_keys->ed25519_key.public_key();
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+        const auto keys = account.get_signed_keys_json("@alice:example.org", "DEVICE", pool);
+
+        // Canonical order compares the IDs as strings.
+        REQUIRE(keys.one_time_keys.starts_with(R"({"signed_curve25519:1":)"));
+        REQUIRE(keys.one_time_keys.find(R"("signed_curve25519:12":)") <
+                keys.one_time_keys.find(R"("signed_curve25519:2":)"));
+        for (const auto &key : account.one_time_keys)
+        {
+            const auto object = find_json_value(keys.one_time_keys, "signed_curve25519:" + std::to_string(key->id));
+            const auto key_base64 = base64_encode(key->key.public_key()->raw_public_key_bits(), false);
+            const auto signatures = find_json_value(find_json_value(object, "signatures"), "@alice:example.org");
+            REQUIRE(verify_signature(*public_key, R"({"key":")" + key_base64 + R"("})",
+                                     base64_decode(find_json_string(signatures, "ed25519:DEVICE"))));
+        }
+
+        const auto fallback_id = "signed_curve25519:" + std::to_string(account.current_fallback_key->id);
+        REQUIRE(find_json_value(find_json_value(keys.fallback_keys, fallback_id), "fallback") == "true");
+    }
+
+    account.mark_keys_as_published();
+    ThreadPool pool(2);
+    const auto published = account.get_signed_keys_json("@alice:example.org", "DEVICE", pool);
+    REQUIRE(published.one_time_keys == "{}");
+    REQUIRE(published.fallback_keys == "{}");
+}
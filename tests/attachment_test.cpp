@@ -0,0 +1,80 @@
+#include <snitch/snitch.hpp>
+#include "attachment.hpp"
+#include "errors.hpp"
+#include <algorithm>
+#include <botan/auto_rng.h>
+#include <vector>
+
+using namespace spank_olm;
+
+namespace
+{
+    constexpr std::size_t TEST_LENGTH = 3 * ATTACHMENT_SEGMENT_LENGTH + 12345;
+    constexpr std::size_t PIECE_LENGTH = 100003;
+
+    std::vector<std::uint8_t> random_bytes(Botan::RandomNumberGenerator &rng, const std::size_t length)
+    {
+        std::vector<std::uint8_t> bytes(length);
+        rng.randomize(bytes);
+        return bytes;
+    }
+} // namespace
+
+TEST_CASE("Attachment encryption in pieces and on a pool")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto plaintext = random_bytes(rng, TEST_LENGTH);
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+
+        std::vector<std::uint8_t> ciphertext(plaintext.size());
+        const auto info = encrypt_attachment(rng, plaintext, ciphertext, pool);
+        REQUIRE((info.iv[8] & 0x80) == 0);
+        REQUIRE(ciphertext != plaintext);
+
+        std::vector<std::uint8_t> decrypted(ciphertext.size());
+        AttachmentDecryption decryption(info);
+        for (std::size_t pos = 0; pos < ciphertext.size(); pos += PIECE_LENGTH)
+        {
+            const auto length = std::min(PIECE_LENGTH, ciphertext.size() - pos);
+            decryption.update(std::span(ciphertext).subspan(pos, length), std::span(decrypted).subspan(pos, length));
+        }
+        decryption.finish();
+        REQUIRE(decrypted == plaintext);
+
+        auto buffer = plaintext;
+        AttachmentEncryption encryption(rng);
+        for (std::size_t pos = 0; pos < buffer.size(); pos += PIECE_LENGTH)
+        {
+            const auto piece = std::span(buffer).subspan(pos, std::min(PIECE_LENGTH, buffer.size() - pos));
+            encryption.update(piece, piece);
+        }
+        const auto streamed_info = encryption.finish();
+        decrypt_attachment(streamed_info, buffer, buffer, pool);
+        REQUIRE(buffer == plaintext);
+    }
+}
+
+TEST_CASE("Attachment errors")
+{
+    Botan::AutoSeeded_RNG rng;
+    ThreadPool pool(2);
+    const auto plaintext = random_bytes(rng, TEST_LENGTH);
+    std::vector<std::uint8_t> ciphertext(plaintext.size());
+    const auto info = encrypt_attachment(rng, plaintext, ciphertext, pool);
+
+    ciphertext[2 * ATTACHMENT_SEGMENT_LENGTH] ^= 1;
+    std::vector<std::uint8_t> decrypted(ciphertext.size(), 0xff);
+    REQUIRE_THROWS_AS(decrypt_attachment(info, ciphertext, decrypted, pool), SpankOlmErrorBadAttachmentHash);
+    REQUIRE(std::all_of(decrypted.begin(), decrypted.end(), [](const std::uint8_t byte) { return byte == 0; }));
+
+    AttachmentDecryption decryption(info);
+    decryption.update(ciphertext, decrypted);
+    REQUIRE_THROWS_AS(decryption.finish(), SpankOlmErrorBadAttachmentHash);
+
+    decrypted.pop_back();
+    REQUIRE_THROWS_AS(decrypt_attachment(info, ciphertext, decrypted, pool), SpankOlmErrorOutputBufferTooSmall);
+    REQUIRE_THROWS_AS(encrypt_attachment(rng, ciphertext, decrypted, pool), SpankOlmErrorOutputBufferTooSmall);
+}
@@ -0,0 +1,82 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "bulk_unpickle.hpp"
+#include "errors.hpp"
+#include "megolm.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+TEST_CASE("Unpickle accounts in parallel")
+{
+    Botan::AutoSeeded_RNG rng;
+    PickleCipher cipher("pickle key");
+
+    std::vector<std::vector<std::uint8_t>> expected;
+    std::vector<std::string> encrypted;
+    for (std::size_t i = 0; i < 30; ++i)
+    {
+        Account account;
+        account.new_account(rng);
+        account.generate_one_time_keys(rng, i);
+        expected.push_back(account.pickle());
+        encrypted.push_back(account.pickle(cipher));
+    }
+    encrypted[7] = PickleCipher("other key").encrypt(expected[7]);
+    encrypted[12] = "not a pickle";
+
+    const std::vector<std::string_view> views(encrypted.begin(), encrypted.end());
+    ThreadPool pool(4);
+    const auto results = unpickle_accounts(cipher, views, pool);
+
+    REQUIRE(results.size() == encrypted.size());
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        if (i == 7 || i == 12)
+        {
+            REQUIRE(!results[i].ok());
+            REQUIRE(results[i].error != nullptr);
+            continue;
+        }
+        REQUIRE(results[i].ok());
+        REQUIRE(results[i].value->pickle() == expected[i]);
+    }
+    REQUIRE_THROWS_AS(std::rethrow_exception(results[7].error), SpankOlmErrorBadAccountKey);
+    REQUIRE_THROWS_AS(std::rethrow_exception(results[12].error), SpankOlmErrorInvalidBase64);
+}
+
+TEST_CASE("Unpickle megolms while they are being read")
+{
+    Botan::AutoSeeded_RNG rng;
+    PickleCipher cipher("pickle key");
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+        BulkUnpickler<Megolm> unpickler(cipher, pool, 8);
+
+        std::vector<std::uint32_t> counters;
+        for (std::uint32_t i = 0; i < 50; ++i)
+        {
+            Megolm megolm{};
+            megolm.init(rng, i * 1000);
+            counters.push_back(megolm.counter);
+            REQUIRE(unpickler.add(i == 20 ? std::string("corrupted") : megolm.pickle(cipher)) == i);
+        }
+
+        const auto results = unpickler.finish();
+        REQUIRE(results.size() == counters.size());
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            REQUIRE(results[i].ok() == (i != 20));
+            if (results[i].ok())
+            {
+                REQUIRE(results[i].value->counter == counters[i]);
+            }
+        }
+
+        // The unpickler can be reused once finished.
+        REQUIRE(unpickler.add(results[0].value->pickle(cipher)) == 0);
+        REQUIRE(unpickler.finish().size() == 1);
+    }
+}
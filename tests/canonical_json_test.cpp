@@ -0,0 +1,67 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "canonical_json.hpp"
+#include "json.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+TEST_CASE("Canonical JSON separators and escapes")
+{
+    std::string json;
+    CanonicalJsonWriter writer(json);
+    writer.begin_object();
+    writer.key("a");
+    writer.begin_array();
+    writer.string_value("x\"y");
+    writer.bool_value(false);
+    writer.begin_object();
+    writer.end_object();
+    writer.end_array();
+    writer.key("ed25519", "DEVICE");
+    writer.base64_value(std::vector<std::uint8_t>{1, 2, 3, 4});
+    writer.key("z\n");
+    writer.bool_value(true);
+    writer.end_object();
+    REQUIRE(json == R"({"a":["x\"y",false,{}],"ed25519:DEVICE":"AQIDBA","z\n":true})");
+}
+
+TEST_CASE("Canonical JSON signatures")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    auto signer = account.start_signature(rng);
+
+    std::string json;
+    CanonicalJsonWriter writer(json);
+    writer.begin_object();
+    writer.key("first");
+    writer.begin_signed_object(signer);
+    writer.key("a");
+    writer.string_value("b");
+    writer.signatures_position();
+    writer.key("z");
+    writer.string_value("y");
+    writer.end_signed_object(rng, "@alice:example.org", "DEVICE");
+    writer.key("second");
+    writer.begin_signed_object(signer);
+    writer.key("key");
+    writer.string_value("value");
+    writer.end_signed_object(rng, "@alice:example.org", "DEVICE");
+    writer.end_object();
+
+    const auto first = find_json_value(json, "first");
+    const auto second = find_json_value(json, "second");
+    REQUIRE(first.starts_with(R"({"a":"b","signatures":{"@alice:example.org":{"ed25519:DEVICE":")"));
+    REQUIRE(first.ends_with(R"("}},"z":"y"})"));
+    REQUIRE(second.starts_with(R"({"key":"value","signatures":{"@alice:example.org":{"ed25519:DEVICE":")"));
+
+    const auto signature_of = [](const std::string_view object) {
+        const auto signatures = find_json_value(find_json_value(object, "signatures"), "@alice:example.org");
+        return base64_decode(find_json_string(signatures, "ed25519:DEVICE"));
+    };
+    const auto public_key = account.identity_keys->ed25519_key.public_key();
+    REQUIRE(verify_signature(*public_key, R"({"a":"b","z":"y"})", signature_of(first)));
+    REQUIRE(verify_signature(*public_key, R"({"key":"value"})", signature_of(second)));
+}
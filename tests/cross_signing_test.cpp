@@ -0,0 +1,305 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "base64.hpp"
+#include "cross_signing.hpp"
+#include "errors.hpp"
+#include "json.hpp"
+#include "pickle.hpp"
+#include "signature.hpp"
+#include <botan/auto_rng.h>
+#include <botan/hex.h>
+
+using namespace spank_olm;
+
+namespace
+{
+    /**
+     * \brief Splits a signed object into its signable form and the signature of the given key.
+     */
+    SignedKeyObject split_signed_object(const std::string_view json, const std::string_view user_id,
+                                        const std::string_view key_id)
+    {
+        const auto signatures = find_json_value(json, "signatures");
+        const auto signature_base64 = find_json_string(find_json_value(signatures, user_id), key_id);
+        const auto signature = base64_decode(signature_base64);
+
+        constexpr std::string_view FIELD = R"("signatures":)";
+        auto start = static_cast<std::size_t>(signatures.data() - json.data()) - FIELD.size();
+        auto end = static_cast<std::size_t>(signatures.data() - json.data()) + signatures.size();
+        if (json[start - 1] == ',')
+        {
+            --start;
+        }
+        else if (json[end] == ',')
+        {
+            ++end;
+        }
+        std::string signable(json);
+        signable.erase(start, end - start);
+        return {signable, {signature.begin(), signature.end()}};
+    }
+
+    /**
+     * \brief Signs a signable form with a key, as another client would.
+     */
+    SignedKeyObject sign_object(Botan::Ed25519_PrivateKey const &key, std::string signable,
+                                Botan::RandomNumberGenerator &rng)
+    {
+        Ed25519Signer signer(key, rng);
+        signer.update(signable);
+        return {std::move(signable), signer.finish(rng)};
+    }
+
+    std::string key_id(Botan::Ed25519_PrivateKey const &key)
+    {
+        return "ed25519:" + base64_encode(key.public_key()->raw_public_key_bits(), false);
+    }
+
+    /**
+     * \brief Returns new self-signing and user-signing keys under the same master key.
+     */
+    CrossSigningKeys rotate_signing_keys(CrossSigningKeys const &keys, Botan::RandomNumberGenerator &rng)
+    {
+        return {Botan::Ed25519_PrivateKey::from_bytes(keys.master_key.raw_private_key_bits()),
+                Botan::Ed25519_PrivateKey(rng), Botan::Ed25519_PrivateKey(rng)};
+    }
+
+    struct UserObjects
+    {
+        SignedKeyObject master_key;
+        SignedKeyObject self_signing_key;
+        SignedKeyObject user_signing_key;
+    };
+
+    UserObjects split_upload(CrossSigningKeys const &keys, const std::string_view user_id,
+                             Botan::RandomNumberGenerator &rng)
+    {
+        const auto upload = get_cross_signing_upload_json(keys, rng, user_id);
+        const auto master_id = key_id(keys.master_key);
+        return {{upload.master_key, {}},
+                split_signed_object(upload.self_signing_key, user_id, master_id),
+                split_signed_object(upload.user_signing_key, user_id, master_id)};
+    }
+} // namespace
+
+TEST_CASE("Cross-signing upload")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto keys = CrossSigningKeys::generate(rng);
+    const auto upload = get_cross_signing_upload_json(keys, rng, "@alice:example.org");
+    const auto master_id = base64_encode(keys.master_key.public_key()->raw_public_key_bits(), false);
+    const auto ssk_id = base64_encode(keys.self_signing_key.public_key()->raw_public_key_bits(), false);
+
+    REQUIRE(upload.master_key == R"({"keys":{"ed25519:)" + master_id + R"(":")" + master_id +
+                                     R"("},"usage":["master"],"user_id":"@alice:example.org"})");
+    const auto self_signing =
+        split_signed_object(upload.self_signing_key, "@alice:example.org", "ed25519:" + master_id);
+    REQUIRE(self_signing.signable == R"({"keys":{"ed25519:)" + ssk_id + R"(":")" + ssk_id +
+                                         R"("},"usage":["self_signing"],"user_id":"@alice:example.org"})");
+    REQUIRE(verify_pure_signature(*keys.master_key.public_key(), self_signing.signable, self_signing.signature));
+    REQUIRE(find_json_value(upload.user_signing_key, "usage") == R"(["user_signing"])");
+}
+
+TEST_CASE("Cross-signing trust chain")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto alice_keys = CrossSigningKeys::generate(rng);
+    const auto alice = split_upload(alice_keys, "@alice:example.org", rng);
+
+    const auto bob_keys = CrossSigningKeys::generate(rng);
+    auto bob = split_upload(bob_keys, "@bob:example.org", rng);
+    bob.master_key = sign_object(alice_keys.user_signing_key, bob.master_key.signable, rng);
+
+    Account bob_device;
+    bob_device.new_account(rng);
+    const auto device_json = bob_device.get_signed_device_keys_json(rng, "@bob:example.org", "BOBDEVICE");
+    const auto device =
+        sign_object(bob_keys.self_signing_key,
+                    split_signed_object(device_json, "@bob:example.org", "ed25519:BOBDEVICE").signable, rng);
+
+    TrustChainVerifier verifier("@alice:example.org");
+    REQUIRE_FALSE(verifier.is_user_trusted("@bob:example.org"));
+    verifier.set_own_keys(alice.master_key, alice.self_signing_key, alice.user_signing_key);
+    verifier.set_user_keys("@bob:example.org", bob.master_key, bob.self_signing_key);
+    REQUIRE(verifier.is_user_trusted("@alice:example.org"));
+    REQUIRE(verifier.is_user_trusted("@bob:example.org"));
+    REQUIRE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", device));
+    REQUIRE_THROWS_AS(verifier.is_device_trusted("@bob:example.org", "OTHER", device),
+                      SpankOlmErrorBadMessageFormat);
+
+    // Repeated queries and unchanged updates are answered from the checked links.
+    const auto checked = verifier.verification_count();
+    verifier.set_own_keys(alice.master_key, alice.self_signing_key, alice.user_signing_key);
+    verifier.set_user_keys("@bob:example.org", bob.master_key, bob.self_signing_key);
+    for (int i = 0; i < 3; ++i)
+    {
+        REQUIRE(verifier.is_user_trusted("@bob:example.org"));
+        REQUIRE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", device));
+    }
+    REQUIRE(verifier.verification_count() == checked);
+
+    // A device signed by someone else isn't trusted.
+    const auto forged = sign_object(bob_keys.user_signing_key, device.signable, rng);
+    REQUIRE_FALSE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", forged));
+
+    // A new self-signing key drops the devices signed by the old one.
+    const auto rotated_bob_keys = rotate_signing_keys(bob_keys, rng);
+    const auto rotated_bob = split_upload(rotated_bob_keys, "@bob:example.org", rng);
+    verifier.set_user_keys("@bob:example.org", bob.master_key, rotated_bob.self_signing_key);
+    REQUIRE(verifier.is_user_trusted("@bob:example.org"));
+    REQUIRE_FALSE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", device));
+    const auto resigned = sign_object(rotated_bob_keys.self_signing_key, device.signable, rng);
+    REQUIRE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", resigned));
+
+    // A new user-signing key of our own drops the trust in Bob until their master key is signed again.
+    const auto rotated_alice_keys = rotate_signing_keys(alice_keys, rng);
+    const auto rotated_alice = split_upload(rotated_alice_keys, "@alice:example.org", rng);
+    verifier.set_own_keys(alice.master_key, alice.self_signing_key, rotated_alice.user_signing_key);
+    REQUIRE(verifier.is_user_trusted("@alice:example.org"));
+    REQUIRE_FALSE(verifier.is_user_trusted("@bob:example.org"));
+    REQUIRE_FALSE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", resigned));
+    verifier.set_user_keys("@bob:example.org",
+                           sign_object(rotated_alice_keys.user_signing_key, bob.master_key.signable, rng),
+                           rotated_bob.self_signing_key);
+    REQUIRE(verifier.is_user_trusted("@bob:example.org"));
+    REQUIRE(verifier.is_device_trusted("@bob:example.org", "BOBDEVICE", resigned));
+
+    verifier.forget_user("@bob:example.org");
+    REQUIRE_FALSE(verifier.is_user_trusted("@bob:example.org"));
+}
+
+TEST_CASE("Cross-signing checks pure Ed25519 signatures made by other clients")
+{
+    // Made with a reference Ed25519 implementation, as libolm and other clients sign: the master key is the one of
+    // RFC 8032 test 1, the self-signing key the one of test 2 and the user-signing key the one of test 3.
+    const std::string master = "11qYAYKxCrfVS/7TyWQHOg7hcvPapiMlrwIaaPcHURo";
+    const std::string ssk = "PUAXw+hDiVqStwqnTRt+vJyYLM8uxJaMwM1V8Sr0Zgw";
+    const std::string usk = "/FHNjmIYoaONpH7QAjDwWAgW7RO6MwOsXeuRFUiQgCU";
+    const auto key_object = [](std::string const &key, std::string const &usage, std::string const &signature) {
+        const auto decoded = base64_decode(signature);
+        return SignedKeyObject{R"({"keys":{"ed25519:)" + key + R"(":")" + key + R"("},"usage":[")" + usage +
+                                   R"("],"user_id":"@alice:example.org"})",
+                               {decoded.begin(), decoded.end()}};
+    };
+    const auto master_key = key_object(master, "master", "");
+    const auto self_signing_key = key_object(
+        ssk, "self_signing", "mKOqw/oJFTqDdqkg/dimWMsfGHcDrEYrED4c7kDMxplvI4tuCh18O2kQCwZGmTk7RaXIkM5GMjsii/VhVs/7Dg");
+    const auto user_signing_key = key_object(
+        usk, "user_signing", "iniSaYDWsJZ12Vq2o7HbpoxzY1kOjzA7Mcvf2GciqZIYlmooEihbDN18VJxOHhO6LVrm7cDebCLNMfNJRBC3Bw");
+
+    const auto signature =
+        base64_decode("ySP7nCmSHn2a9C0bm9GizJflhIbfeW759YkXm9wTPg+IeZruu51MlTXmZFBDvk8jYmhBRPKllpDsMVkRkRoeAQ");
+    const SignedKeyObject device{
+        R"({"algorithms":["m.olm.v1.curve25519-aes-sha2","m.megolm.v1.aes-sha2"],"device_id":"JLAFKJWSCS",)"
+        R"("keys":{"curve25519:JLAFKJWSCS":"3C5BFWi2Y8MaVvjM8M22DBmh24PmgR0nPvJOIArzgyI",)"
+        R"("ed25519:JLAFKJWSCS":"lEuiRJBit0IG6nUf5pUzWTUEsRVVe/HJkoKuEww9ULI"},"user_id":"@alice:example.org"})",
+        {signature.begin(), signature.end()}};
+
+    TrustChainVerifier verifier("@alice:example.org");
+    verifier.set_own_keys(master_key, self_signing_key, user_signing_key);
+    REQUIRE(verifier.is_device_trusted("@alice:example.org", "JLAFKJWSCS", device));
+
+    // The same object under an Ed25519ph signature isn't what other clients check.
+    Botan::AutoSeeded_RNG rng;
+    const auto ssk_private = Botan::Ed25519_PrivateKey::from_seed(
+        Botan::hex_decode("4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb"));
+    Ed25519phSigner prehashed(ssk_private, rng);
+    prehashed.update(device.signable);
+    REQUIRE_FALSE(verifier.is_device_trusted("@alice:example.org", "JLAFKJWSCS",
+                                             SignedKeyObject{device.signable, prehashed.finish(rng)}));
+}
+
+TEST_CASE("Cross-signing key objects are checked")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto keys = CrossSigningKeys::generate(rng);
+    const auto alice = split_upload(keys, "@alice:example.org", rng);
+
+    TrustChainVerifier verifier("@alice:example.org");
+    REQUIRE_THROWS_AS(verifier.set_user_keys("@mallory:example.org", alice.master_key, alice.self_signing_key),
+                      SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(verifier.set_user_keys("@alice:example.org", alice.self_signing_key, alice.master_key),
+                      SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(verifier.set_own_keys(alice.master_key, alice.self_signing_key, alice.self_signing_key),
+                      SpankOlmErrorBadMessageFormat);
+
+    // Our own user-signing key has to be signed by our master key.
+    const auto self_signed = sign_object(keys.user_signing_key, alice.user_signing_key.signable, rng);
+    verifier.set_own_keys(alice.master_key, alice.self_signing_key, self_signed);
+    const auto bob_keys = CrossSigningKeys::generate(rng);
+    auto bob = split_upload(bob_keys, "@bob:example.org", rng);
+    bob.master_key = sign_object(keys.user_signing_key, bob.master_key.signable, rng);
+    verifier.set_user_keys("@bob:example.org", bob.master_key, bob.self_signing_key);
+    REQUIRE_FALSE(verifier.is_user_trusted("@bob:example.org"));
+}
+
+TEST_CASE("Cross-signing batch trust")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto alice_keys = CrossSigningKeys::generate(rng);
+    const auto alice = split_upload(alice_keys, "@alice:example.org", rng);
+
+    std::vector<std::string> user_ids;
+    std::vector<UserObjects> users;
+    for (int i = 0; i < 8; ++i)
+    {
+        user_ids.push_back("@user" + std::to_string(i) + ":example.org");
+        const auto keys = CrossSigningKeys::generate(rng);
+        auto user = split_upload(keys, user_ids.back(), rng);
+        // Every third user is signed by their own key instead of ours.
+        const auto &signing_key = i % 3 == 0 ? keys.user_signing_key : alice_keys.user_signing_key;
+        user.master_key = sign_object(signing_key, user.master_key.signable, rng);
+        users.push_back(std::move(user));
+    }
+    user_ids.push_back("@unknown:example.org");
+    user_ids.push_back(user_ids.front());
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+        TrustChainVerifier verifier("@alice:example.org");
+        verifier.set_own_keys(alice.master_key, alice.self_signing_key, alice.user_signing_key);
+        for (std::size_t i = 0; i < users.size(); ++i)
+        {
+            verifier.set_user_keys(user_ids[i], users[i].master_key, users[i].self_signing_key);
+        }
+
+        const auto checked = verifier.verification_count();
+        const auto trusted = verifier.are_users_trusted(user_ids, pool);
+        REQUIRE(trusted.size() == user_ids.size());
+        for (std::size_t i = 0; i < users.size(); ++i)
+        {
+            REQUIRE(trusted[i] == (i % 3 != 0));
+            REQUIRE(verifier.is_user_trusted(user_ids[i]) == trusted[i]);
+        }
+        REQUIRE_FALSE(trusted[users.size()]);
+        REQUIRE_FALSE(trusted.back());
+        REQUIRE(verifier.verification_count() == checked + users.size());
+
+        REQUIRE(verifier.are_users_trusted(user_ids, pool) == trusted);
+        REQUIRE(verifier.verification_count() == checked + users.size());
+    }
+}
+
+TEST_CASE("Cross-signing keys pickle")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto keys = CrossSigningKeys::generate(rng);
+
+    std::vector<std::uint8_t> pickled(pickle_length(keys));
+    REQUIRE(pickle(pickled.data(), keys) == pickled.data() + pickled.size());
+
+    std::optional<CrossSigningKeys> unpickled;
+    REQUIRE(unpickle(pickled.data(), pickled.data() + pickled.size(), unpickled) == pickled.data() + pickled.size());
+    REQUIRE(unpickled.has_value());
+    REQUIRE(unpickled->master_key.raw_private_key_bits() == keys.master_key.raw_private_key_bits());
+    REQUIRE(unpickled->self_signing_key.raw_private_key_bits() == keys.self_signing_key.raw_private_key_bits());
+    REQUIRE(unpickled->user_signing_key.raw_private_key_bits() == keys.user_signing_key.raw_private_key_bits());
+
+    std::optional<CrossSigningKeys> truncated;
+    REQUIRE(unpickle(pickled.data(), pickled.data() + pickled.size() - 1, truncated) == nullptr);
+    pickled[0] ^= 0xff;
+    std::optional<CrossSigningKeys> wrong_version;
+    REQUIRE(unpickle(pickled.data(), pickled.data() + pickled.size(), wrong_version) == nullptr);
+    REQUIRE_FALSE(wrong_version.has_value());
+}
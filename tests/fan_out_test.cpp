@@ -0,0 +1,60 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "fan_out.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+TEST_CASE("Fan out a payload to many sessions")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    alice.new_account(rng);
+
+    std::vector<Account> devices(40);
+    std::vector<Session> outbound;
+    for (auto &device : devices)
+    {
+        device.new_account(rng);
+        device.generate_one_time_keys(rng, 1);
+        outbound.push_back(Session::create_outbound(rng, alice, device.identity_keys->curve25519_key.public_value(),
+                                                    device.one_time_keys[0].key.public_value()));
+    }
+    std::vector<Session *> targets;
+    for (auto &session : outbound)
+    {
+        targets.push_back(&session);
+    }
+
+    const std::string payload = R"({"type":"m.room_key","content":{}})";
+    const auto plaintext = std::span(reinterpret_cast<const std::uint8_t *>(payload.data()), payload.size());
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+        std::vector<FanOutResult> received;
+        std::size_t chunks = 0;
+        fan_out_encrypt(targets, plaintext, pool, [&](std::span<FanOutResult> results) {
+            REQUIRE(results.size() <= 7);
+            ++chunks;
+            std::move(results.begin(), results.end(), std::back_inserter(received));
+        }, 7);
+
+        REQUIRE(chunks == 6);
+        REQUIRE(received.size() == targets.size());
+        for (std::size_t i = 0; i < received.size(); ++i)
+        {
+            REQUIRE(received[i].ok());
+            REQUIRE(received[i].target == i);
+            REQUIRE(received[i].message.type == MessageType::PreKey);
+
+            auto inbound = Session::create_inbound(devices[i], received[i].message.body);
+            const auto decrypted = inbound.decrypt(received[i].message);
+            REQUIRE(std::string(decrypted.begin(), decrypted.end()) == payload);
+        }
+    }
+
+    ThreadPool pool(2);
+    REQUIRE_THROWS_AS(fan_out_encrypt(targets, plaintext, pool, [](auto) { throw std::runtime_error("sink"); }, 4),
+                      std::runtime_error);
+}
@@ -0,0 +1,266 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "errors.hpp"
+#include "journal.hpp"
+#include <botan/auto_rng.h>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <sys/resource.h>
+
+using namespace spank_olm;
+
+namespace
+{
+    std::filesystem::path journal_of(std::filesystem::path path)
+    {
+        path += ".journal";
+        return path;
+    }
+
+    std::vector<char> read_file(std::filesystem::path const &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    }
+
+    /**
+     * \brief Returns the salt from a journal header, which together with the pickle key selects the record key.
+     */
+    std::vector<char> journal_salt(std::filesystem::path const &path)
+    {
+        const auto data = read_file(journal_of(path));
+        return {data.begin() + 12, data.begin() + 28};
+    }
+
+    void remove_store(std::filesystem::path const &path)
+    {
+        std::filesystem::remove(path);
+        std::filesystem::remove(journal_of(path));
+    }
+} // namespace
+
+TEST_CASE("AccountJournal replays changes")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_journal_test";
+    Account account;
+    account.new_account(rng);
+    AccountJournal::create(path, "pickle key", account);
+
+    std::vector<std::uint8_t> expected;
+    {
+        AccountJournal journal(path, "pickle key");
+        journal.generate_one_time_keys(rng, 5);
+        journal.generate_fallback_key(rng);
+        REQUIRE(journal.mark_keys_as_published() == 5);
+        journal.generate_one_time_keys(rng, 2);
+        journal.remove_key(*journal.account().one_time_keys[3].key.public_key());
+        journal.generate_fallback_key(rng);
+        journal.forget_old_fallback_key();
+        journal.commit();
+
+        // Nine new keys, two changes without payload and one removal.
+        REQUIRE(journal.journal_size() == 9 * 55 + 2 * 19 + 23);
+        expected = journal.account().pickle();
+    }
+
+    const AccountJournal reopened(path, "pickle key");
+    REQUIRE(reopened.account().pickle() == expected);
+    REQUIRE(reopened.account().one_time_keys.size() == 6);
+
+    REQUIRE_THROWS_AS(AccountJournal(path, "wrong key"), SpankOlmErrorBadAccountKey);
+    remove_store(path);
+}
+
+TEST_CASE("AccountJournal compacts into a new snapshot")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_journal_compact_test";
+    Account account;
+    account.new_account(rng);
+    AccountJournal::create(path, "pickle key", account);
+
+    std::vector<std::uint8_t> expected;
+    {
+        AccountJournal journal(path, "pickle key", 256);
+        for (std::size_t i = 0; i < 10; ++i)
+        {
+            journal.generate_one_time_keys(rng, 1);
+            journal.commit();
+            REQUIRE(journal.journal_size() < 256);
+        }
+        expected = journal.account().pickle();
+    }
+
+    const AccountJournal reopened(path, "pickle key");
+    REQUIRE(reopened.account().pickle() == expected);
+    remove_store(path);
+}
+
+TEST_CASE("AccountJournal drops a torn record")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_journal_torn_test";
+    Account account;
+    account.new_account(rng);
+    AccountJournal::create(path, "pickle key", account);
+
+    std::vector<std::uint8_t> expected;
+    {
+        AccountJournal journal(path, "pickle key");
+        journal.generate_one_time_keys(rng, 3);
+        journal.commit();
+        expected = journal.account().pickle();
+        journal.generate_one_time_keys(rng, 1);
+        journal.commit();
+    }
+
+    // Cut the last record short, as if the process died while writing it.
+    std::filesystem::resize_file(journal_of(path), std::filesystem::file_size(journal_of(path)) - 10);
+
+    {
+        AccountJournal journal(path, "pickle key");
+        REQUIRE(journal.account().pickle() == expected);
+        journal.mark_keys_as_published();
+        journal.commit();
+    }
+
+    const AccountJournal reopened(path, "pickle key");
+    REQUIRE(reopened.account().one_time_keys.size() == 3);
+    REQUIRE(reopened.account().one_time_keys[0].published);
+    remove_store(path);
+}
+
+TEST_CASE("AccountJournal never reuses a nonce after dropping a torn record")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_journal_nonce_test";
+    Account account;
+    account.new_account(rng);
+    AccountJournal::create(path, "pickle key", account);
+
+    {
+        AccountJournal journal(path, "pickle key");
+        journal.generate_one_time_keys(rng, 3);
+        journal.commit();
+        journal.generate_one_time_keys(rng, 1);
+        journal.commit();
+    }
+    const auto old_salt = journal_salt(path);
+
+    // Cut the last record in the middle. Its sequence number is free again, and the record appended next takes it.
+    std::filesystem::resize_file(journal_of(path), std::filesystem::file_size(journal_of(path)) - 20);
+    std::vector<std::uint8_t> expected;
+    {
+        AccountJournal journal(path, "pickle key");
+        REQUIRE(journal.account().one_time_keys.size() == 3);
+        journal.generate_one_time_keys(rng, 1);
+        journal.commit();
+        expected = journal.account().pickle();
+    }
+
+    // A new salt means a new record key, so no record is encrypted under a (key, nonce) pair used before.
+    REQUIRE(journal_salt(path) != old_salt);
+    const AccountJournal reopened(path, "pickle key");
+    REQUIRE(reopened.account().pickle() == expected);
+    remove_store(path);
+}
+
+TEST_CASE("AccountJournal refuses a damaged record before the end")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_journal_damaged_test";
+    Account account;
+    account.new_account(rng);
+    AccountJournal::create(path, "pickle key", account);
+
+    {
+        AccountJournal journal(path, "pickle key");
+        journal.generate_one_time_keys(rng, 2);
+        journal.commit();
+        journal.remove_key(*journal.account().one_time_keys[0].key.public_key());
+        journal.commit();
+    }
+
+    // Flip a bit in the first record; the removal behind it must not be silently dropped.
+    auto data = read_file(journal_of(path));
+    data[40] ^= 1;
+    {
+        std::ofstream file(journal_of(path), std::ios::binary | std::ios::trunc);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    REQUIRE_THROWS_AS(AccountJournal(path, "pickle key"), SpankOlmErrorCorruptedPickle);
+    REQUIRE(read_file(journal_of(path)) == data);
+    remove_store(path);
+}
+
+TEST_CASE("AccountJournal retries a failed commit")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_account_journal_retry_test";
+    Account account;
+    account.new_account(rng);
+    AccountJournal::create(path, "pickle key", account);
+
+    std::vector<std::uint8_t> expected;
+    {
+        AccountJournal journal(path, "pickle key");
+        journal.generate_one_time_keys(rng, 1);
+        journal.commit();
+
+        // Let only part of the next batch reach the file, so the write fails in the middle of a record.
+        const auto old_handler = std::signal(SIGXFSZ, SIG_IGN);
+        rlimit old_limit{};
+        REQUIRE(::getrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+        rlimit limit = old_limit;
+        limit.rlim_cur = static_cast<rlim_t>(std::filesystem::file_size(journal_of(path)) + 30);
+        REQUIRE(::setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        journal.generate_one_time_keys(rng, 2);
+        const auto size = journal.journal_size();
+        REQUIRE_THROWS_AS(journal.commit(), SpankOlmErrorIO);
+        REQUIRE(::setrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+        std::signal(SIGXFSZ, old_handler);
+
+        REQUIRE(journal.journal_size() == size);
+        journal.generate_one_time_keys(rng, 1);
+        journal.commit();
+        expected = journal.account().pickle();
+    }
+
+    const AccountJournal reopened(path, "pickle key");
+    REQUIRE(reopened.account().pickle() == expected);
+    REQUIRE(reopened.account().one_time_keys.size() == 4);
+    remove_store(path);
+}
+
+TEST_CASE("MegolmJournal replays advances")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_megolm_journal_test";
+    Megolm megolm{};
+    megolm.init(rng, 0);
+    MegolmJournal::create(path, "pickle key", megolm);
+
+    for (unsigned int i = 0; i < 300; ++i)
+    {
+        megolm.advance();
+    }
+    megolm.advance(0x10000);
+
+    {
+        MegolmJournal journal(path, "pickle key");
+        for (unsigned int i = 0; i < 300; ++i)
+        {
+            journal.advance();
+        }
+        journal.advance(0x10000);
+        journal.commit();
+    }
+
+    const MegolmJournal reopened(path, "pickle key");
+    REQUIRE(reopened.megolm().counter == megolm.counter);
+    REQUIRE(reopened.megolm().data == megolm.data);
+    remove_store(path);
+}
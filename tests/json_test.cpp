@@ -0,0 +1,63 @@
+#include <snitch/snitch.hpp>
+#include "errors.hpp"
+#include "json.hpp"
+#include <string>
+#include <vector>
+
+using namespace spank_olm;
+
+TEST_CASE("Find fields in JSON")
+{
+    const std::string_view json = R"( { "a" : [1, {"b": "}"}], "n": -1.5e3, "t" : true, )"
+                                  R"("nested": {"session_key": "no"}, "session_key": "x\/y" })";
+    REQUIRE(find_json_string(json, "session_key") == R"(x\/y)");
+    REQUIRE(find_json_value(json, "n") == "-1.5e3");
+    REQUIRE(find_json_value(json, "a") == R"([1, {"b": "}"}])");
+    REQUIRE(find_json_string(find_json_value(json, "nested"), "session_key") == "no");
+    REQUIRE_THROWS_AS(find_json_string(json, "missing"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(find_json_string(json, "t"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(find_json_string("[]", "a"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(find_json_string("{}", "a"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(find_json_string(R"({"a": "unterminated)", "a"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(find_json_string(R"({"b": 1 "a": "x"})", "a"), SpankOlmErrorBadMessageFormat);
+}
+
+TEST_CASE("JSON string escapes")
+{
+    REQUIRE(unescape_json_string(R"(a\"b\\c\/d\n\t)") == "a\"b\\c/d\n\t");
+    REQUIRE(unescape_json_string(R"(\u00e9\u20AC\ud83d\ude00)") == "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    REQUIRE_THROWS_AS(unescape_json_string(R"(\x)"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(unescape_json_string(R"(\u12)"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(unescape_json_string(R"(\ud83d)"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(unescape_json_string(R"(\ude00)"), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(unescape_json_string("\\"), SpankOlmErrorBadMessageFormat);
+
+    char small[2];
+    REQUIRE_THROWS_AS(unescape_json_string(R"(a\u00e9)", small), SpankOlmErrorBadMessageFormat);
+
+    std::string json;
+    append_json_string(json, "a\"b\\c/\n\x01\xc3\xa9");
+    REQUIRE(json == R"("a\"b\\c/\n\u0001)" "\xc3\xa9\"");
+    REQUIRE(unescape_json_string(std::string_view(json).substr(1, json.size() - 2)) == "a\"b\\c/\n\x01\xc3\xa9");
+}
+
+TEST_CASE("Visit JSON fields")
+{
+    std::vector<std::string> fields;
+    const std::string_view json = R"({"a": 1, "b": {"c": 2}, "d": "e"})";
+    for_each_json_field(json, [&](const std::string_view name, const std::string_view value) {
+        fields.push_back(std::string(name) + "=" + std::string(value));
+        return name == "b";
+    });
+    const std::vector<std::string> expected{"a=1", R"(b={"c": 2})"};
+    REQUIRE(fields == expected);
+
+    fields.clear();
+    for_each_json_field(" { } ", [&](const std::string_view name, const std::string_view) {
+        fields.emplace_back(name);
+        return false;
+    });
+    REQUIRE(fields.empty());
+    REQUIRE_THROWS_AS(for_each_json_field(R"({"a": 1,})", [](auto, auto) { return false; }),
+                      SpankOlmErrorBadMessageFormat);
+}
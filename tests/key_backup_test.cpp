@@ -0,0 +1,94 @@
+#include <snitch/snitch.hpp>
+#include "errors.hpp"
+#include "key_backup.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+namespace
+{
+    RoomKey random_room_key(Botan::RandomNumberGenerator &rng, const std::uint32_t index)
+    {
+        RoomKey key;
+        key.ratchet.init(rng, index);
+        rng.randomize(key.signing_key.data(), key.signing_key.size());
+        return key;
+    }
+
+    bool same_key(RoomKey const &a, RoomKey const &b)
+    {
+        return a.ratchet.counter == b.ratchet.counter && a.ratchet.data == b.ratchet.data &&
+               a.signing_key == b.signing_key;
+    }
+
+    PkMessage backup(Botan::RandomNumberGenerator &rng, PkEncryption const &encryption, std::string const &json)
+    {
+        return encryption.encrypt(rng, std::span(reinterpret_cast<const std::uint8_t *>(json.data()), json.size()));
+    }
+} // namespace
+
+TEST_CASE("Room key export format")
+{
+    Botan::AutoSeeded_RNG rng;
+    const auto key = random_room_key(rng, 0x01020304);
+    const auto encoded = key.encode();
+    REQUIRE(encoded.size() == 220);
+    REQUIRE(same_key(RoomKey::decode(encoded), key));
+
+    auto wrong_version = RoomKey::decode(encoded).encode();
+    wrong_version[0] = 'B';
+    REQUIRE_THROWS_AS(RoomKey::decode(wrong_version), SpankOlmErrorBadMessageVersion);
+    REQUIRE_THROWS_AS(RoomKey::decode(encoded.substr(0, 216)), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(RoomKey::decode(encoded + encoded), SpankOlmErrorBadMessageFormat);
+}
+
+TEST_CASE("Restore a key backup")
+{
+    Botan::AutoSeeded_RNG rng;
+    const PkDecryption decryption(rng);
+    const PkEncryption encryption(decryption.public_key());
+
+    std::vector<RoomKey> keys;
+    std::vector<PkMessage> session_data;
+    for (std::uint32_t i = 0; i < 40; ++i)
+    {
+        keys.push_back(random_room_key(rng, i * 1000));
+        auto session_key = keys.back().encode();
+        if (i % 2)
+        {
+            // Some JSON encoders escape the slashes of the base64.
+            for (std::size_t pos = 0; (pos = session_key.find('/', pos)) != std::string::npos; pos += 2)
+            {
+                session_key.insert(pos, "\\");
+            }
+        }
+        session_data.push_back(backup(rng, encryption,
+                                      R"({"algorithm":"m.megolm.v1.aes-sha2","forwarding_curve25519_key_chain":[],)"
+                                      R"("sender_claimed_keys":{"ed25519":"abc"},"sender_key":"def",)"
+                                      R"("session_key":")" + session_key + R"("})"));
+    }
+    session_data[5] = backup(rng, encryption, R"({"algorithm":"m.megolm.v1.aes-sha2"})");
+    session_data[6] = backup(rng, PkEncryption(PkDecryption(rng).public_key()), "{}");
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+        const auto restored = restore_key_backup(decryption, session_data, pool);
+        REQUIRE(restored.size() == keys.size());
+        for (std::size_t i = 0; i < restored.size(); ++i)
+        {
+            if (i == 5)
+            {
+                REQUIRE_THROWS_AS(std::rethrow_exception(restored[i].error), SpankOlmErrorBadMessageFormat);
+                continue;
+            }
+            if (i == 6)
+            {
+                REQUIRE_THROWS_AS(std::rethrow_exception(restored[i].error), SpankOlmErrorBadMessageMac);
+                continue;
+            }
+            REQUIRE(restored[i].ok());
+            REQUIRE(same_key(restored[i].key, keys[i]));
+        }
+    }
+}
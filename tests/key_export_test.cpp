@@ -0,0 +1,189 @@
+#include <snitch/snitch.hpp>
+#include "base64.hpp"
+#include "errors.hpp"
+#include "key_export.hpp"
+#include "pickle.hpp"
+#include <array>
+#include <botan/auto_rng.h>
+#include <iterator>
+#include <sstream>
+
+using namespace spank_olm;
+
+namespace
+{
+    constexpr std::uint32_t TEST_ROUNDS = 1000;
+
+    ExportedSession random_session(Botan::RandomNumberGenerator &rng, const std::uint32_t i)
+    {
+        ExportedSession session;
+        session.room_id = "!room" + std::to_string(i % 3) + ":example.org";
+        session.session_id = "session \"" + std::to_string(i) + "\"";
+        session.sender_key = "sender/key";
+        session.sender_claimed_ed25519_key = "ed25519\nkey";
+        session.key.ratchet.init(rng, i * 1000);
+        rng.randomize(session.key.signing_key.data(), session.key.signing_key.size());
+        return session;
+    }
+
+    bool same_session(ExportedSession const &a, ExportedSession const &b)
+    {
+        return a.room_id == b.room_id && a.session_id == b.session_id && a.sender_key == b.sender_key &&
+               a.sender_claimed_ed25519_key == b.sender_claimed_ed25519_key &&
+               a.key.ratchet.counter == b.key.ratchet.counter && a.key.ratchet.data == b.key.ratchet.data &&
+               a.key.signing_key == b.key.signing_key;
+    }
+
+    std::string export_sessions(Botan::RandomNumberGenerator &rng, std::vector<ExportedSession> const &sessions,
+                                ThreadPool &pool)
+    {
+        std::ostringstream output;
+        std::size_t next = 0;
+        export_keys(
+            output, rng, "passphrase",
+            [&](ExportedSession &session) {
+                if (next == sessions.size())
+                {
+                    return false;
+                }
+                session = sessions[next++];
+                return true;
+            },
+            pool, TEST_ROUNDS, 7);
+        return output.str();
+    }
+
+    std::vector<ImportedSession> import_sessions(std::string const &file, const std::string_view passphrase,
+                                                 ThreadPool &pool)
+    {
+        std::istringstream input(file);
+        std::vector<ImportedSession> imported;
+        import_keys(
+            input, passphrase, pool,
+            [&](std::span<ImportedSession> sessions) {
+                REQUIRE(sessions.size() <= 5);
+                std::move(sessions.begin(), sessions.end(), std::back_inserter(imported));
+            },
+            5);
+        return imported;
+    }
+
+    /**
+     * \brief Serves one text until it is seeked and another one afterwards, like a file replaced between two reads.
+     */
+    class SwappingBuffer : public std::stringbuf
+    {
+    public:
+        SwappingBuffer(std::string first, std::string second) :
+            std::stringbuf(std::move(first), std::ios::in), second(std::move(second))
+        {
+        }
+
+    protected:
+        pos_type seekpos(const pos_type pos, const std::ios::openmode which) override
+        {
+            if (!second.empty())
+            {
+                str(std::move(second));
+                second.clear();
+            }
+            return std::stringbuf::seekpos(pos, which);
+        }
+
+    private:
+        std::string second;
+    };
+} // namespace
+
+TEST_CASE("Key export round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    std::vector<ExportedSession> sessions;
+    for (std::uint32_t i = 0; i < 50; ++i)
+    {
+        sessions.push_back(random_session(rng, i));
+    }
+
+    for (const std::size_t threads : {0, 3})
+    {
+        ThreadPool pool(threads);
+        const auto file = export_sessions(rng, sessions, pool);
+        REQUIRE(file.starts_with("-----BEGIN MEGOLM SESSION DATA-----\n"));
+        REQUIRE(file.ends_with("\n-----END MEGOLM SESSION DATA-----\n"));
+
+        const auto imported = import_sessions(file, "passphrase", pool);
+        REQUIRE(imported.size() == sessions.size());
+        for (std::size_t i = 0; i < imported.size(); ++i)
+        {
+            REQUIRE(imported[i].ok());
+            REQUIRE(same_session(imported[i].session, sessions[i]));
+        }
+
+        REQUIRE(import_sessions(export_sessions(rng, {}, pool), "passphrase", pool).empty());
+    }
+}
+
+TEST_CASE("Key export errors")
+{
+    Botan::AutoSeeded_RNG rng;
+    ThreadPool pool(2);
+    const auto file = export_sessions(rng, {random_session(rng, 0), random_session(rng, 1)}, pool);
+
+    REQUIRE_THROWS_AS(import_sessions(file, "wrong passphrase", pool), SpankOlmErrorBadMessageMac);
+
+    auto tampered = file;
+    const auto pos = tampered.find('\n') + 50;
+    tampered[pos] = tampered[pos] == 'A' ? 'B' : 'A';
+    REQUIRE_THROWS_AS(import_sessions(tampered, "passphrase", pool), SpankOlmErrorBadMessageMac);
+
+    REQUIRE_THROWS_AS(import_sessions("not a key export", "passphrase", pool), SpankOlmErrorBadKeyExport);
+    REQUIRE_THROWS_AS(import_sessions(file.substr(0, file.rfind("-----END")), "passphrase", pool),
+                      SpankOlmErrorBadKeyExport);
+
+    // A header asking for too many rounds is refused before any key is derived.
+    std::array<std::uint8_t, 1 + 16 + 16 + 4 + 32> too_many_rounds{};
+    too_many_rounds[0] = 1;
+    pickle(too_many_rounds.data() + 1 + 16 + 16, MAX_KEY_EXPORT_ROUNDS + 1);
+    REQUIRE_THROWS_AS(import_sessions("-----BEGIN MEGOLM SESSION DATA-----\n" + base64_encode(too_many_rounds) +
+                                          "\n-----END MEGOLM SESSION DATA-----\n",
+                                      "passphrase", pool),
+                      SpankOlmErrorBadKeyExport);
+
+    std::istringstream input(file);
+    REQUIRE_THROWS_AS(import_keys(input, "passphrase", pool,
+                                  [](std::span<ImportedSession>) { throw SpankOlmErrorIO(); }),
+                      SpankOlmErrorIO);
+}
+
+TEST_CASE("Key export import only hands out authenticated sessions")
+{
+    Botan::AutoSeeded_RNG rng;
+    ThreadPool pool(2);
+    std::vector<ExportedSession> sessions;
+    for (std::uint32_t i = 0; i < 400; ++i)
+    {
+        sessions.push_back(random_session(rng, i));
+    }
+    const auto file = export_sessions(rng, sessions, pool);
+
+    // The file is swapped for a tampered one between the pass which checks the MAC and the one which decrypts.
+    auto tampered = file;
+    const auto pos = tampered.size() * 3 / 4;
+    REQUIRE(tampered[pos] != '\n');
+    tampered[pos] = tampered[pos] == 'A' ? 'B' : 'A';
+    SwappingBuffer buffer(file, tampered);
+    std::istream input(&buffer);
+
+    std::vector<ImportedSession> imported;
+    REQUIRE_THROWS_AS(import_keys(input, "passphrase", pool,
+                                  [&](std::span<ImportedSession> chunk) {
+                                      std::move(chunk.begin(), chunk.end(), std::back_inserter(imported));
+                                  }),
+                      SpankOlmErrorBadMessageMac);
+    REQUIRE(imported.size() < sessions.size());
+    for (std::size_t i = 0; i < imported.size(); ++i)
+    {
+        REQUIRE(imported[i].ok());
+        REQUIRE(same_session(imported[i].session, sessions[i]));
+    }
+}
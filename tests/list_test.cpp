@@ -1,6 +1,9 @@
 #include <iostream>
 #include <snitch/snitch.hpp>
 #include <list.hpp>
+#include <array>
+#include <memory_resource>
+#include <string>
 
 TEST_CASE("FixedSizeArray basic operations")
 {
@@ -165,3 +168,116 @@ TEST_CASE("FixedSizeArray empty and size match")
     REQUIRE(array.empty() == true);
     REQUIRE(array.size() == 0);
 }
+
+TEST_CASE("FixedSizeArray keeps newest first order while wrapping around")
+{
+    using namespace spank_olm;
+
+    FixedSizeArray<int, 4> array;
+    for (int i = 0; i < 23; ++i)
+    {
+        array.insert(i);
+
+        // Erase the oldest element every now and then so that the start keeps moving through the buffer.
+        if (i % 5 == 4)
+        {
+            REQUIRE(array.erase_at(0) == FixedSizeArray<int, 4>::SUCCESS);
+        }
+    }
+
+    REQUIRE(array.size() == 4);
+    int expected = 22;
+    for (const auto& value : array)
+    {
+        REQUIRE(*value == expected--);
+    }
+}
+
+TEST_CASE("FixedSizeArray erase element by pointer")
+{
+    using namespace spank_olm;
+
+    FixedSizeArray<int, 5> array;
+    for (int i = 0; i < 7; ++i)
+    {
+        array.insert(i);
+    }
+
+    // Array is now 6, 5, 4, 3, 2
+    int* middle = nullptr;
+    for (const auto& value : array)
+    {
+        if (*value == 4)
+        {
+            middle = value;
+        }
+    }
+    REQUIRE(middle != nullptr);
+    REQUIRE(array.erase(middle) == FixedSizeArray<int, 5>::SUCCESS);
+    REQUIRE(array.size() == 4);
+    REQUIRE(array[0] == 6);
+    REQUIRE(array[1] == 5);
+    REQUIRE(array[2] == 3);
+    REQUIRE(array[3] == 2);
+
+    // Pointers which don't point into the array are rejected.
+    int outside = 4;
+    REQUIRE(array.erase(&outside) == FixedSizeArray<int, 5>::INDEX_OUT_OF_RANGE);
+    REQUIRE(array.size() == 4);
+}
+
+TEST_CASE("FixedSizeArray copy and move")
+{
+    using namespace spank_olm;
+
+    FixedSizeArray<std::string, 3> array;
+    array.insert("a");
+    array.insert("b");
+    array.insert("c");
+    array.insert("d");
+
+    FixedSizeArray<std::string, 3> copy(array);
+    REQUIRE(copy.size() == 3);
+    REQUIRE(copy[0] == "d");
+    REQUIRE(copy[2] == "b");
+
+    FixedSizeArray<std::string, 3> moved(std::move(copy));
+    REQUIRE(moved.size() == 3);
+    REQUIRE(moved[0] == "d");
+    REQUIRE(moved[2] == "b");
+
+    copy = moved;
+    REQUIRE(copy.size() == 3);
+    REQUIRE(copy[1] == "c");
+}
+
+TEST_CASE("FixedSizeArray passes its allocator on to the elements")
+{
+    using namespace spank_olm;
+    using Array = FixedSizeArray<std::pmr::string, 3, std::pmr::polymorphic_allocator<std::pmr::string>>;
+
+    std::array<std::byte, 4096> buffer;
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+
+    Array array(&arena);
+    REQUIRE(array.get_allocator().resource() == &arena);
+
+    // Long enough to not fit into the small string buffer.
+    const std::string long_value(100, 'x');
+    for (int i = 0; i < 5; ++i)
+    {
+        array.insert(std::pmr::string(long_value + std::to_string(i)));
+    }
+
+    REQUIRE(array.size() == 3);
+    for (const auto& value : array)
+    {
+        REQUIRE(value->get_allocator().resource() == &arena);
+    }
+    REQUIRE(std::string_view(array[0]) == long_value + "4");
+
+    // Copies use the default resource unless told otherwise, like the std::pmr containers.
+    const Array copy(array);
+    REQUIRE(copy.get_allocator().resource() == std::pmr::get_default_resource());
+    REQUIRE(copy[0].get_allocator().resource() == std::pmr::get_default_resource());
+}
@@ -0,0 +1,106 @@
+#include <snitch/snitch.hpp>
+#include "errors.hpp"
+#include "message.hpp"
+#include <algorithm>
+#include <array>
+#include <vector>
+
+using namespace spank_olm;
+
+TEST_CASE("Message round trip")
+{
+    std::array<std::uint8_t, CURVE25519_KEY_LENGTH> ratchet_key{};
+    ratchet_key.fill(0x42);
+    const std::vector<std::uint8_t> ciphertext(200, 0x17);
+
+    std::vector<std::uint8_t> encoded(message_length(300, ciphertext.size()));
+    auto pos = encode_message_header(encoded.data(), ratchet_key, 300, ciphertext.size());
+    pos = std::copy(ciphertext.begin(), ciphertext.end(), pos);
+    std::fill(pos, encoded.data() + encoded.size(), 0x99);
+
+    const auto view = MessageView::decode(encoded);
+    REQUIRE(view.counter == 300);
+    REQUIRE(std::equal(view.ratchet_key.begin(), view.ratchet_key.end(), ratchet_key.begin(), ratchet_key.end()));
+    REQUIRE(std::equal(view.ciphertext.begin(), view.ciphertext.end(), ciphertext.begin(), ciphertext.end()));
+    REQUIRE(view.mac.size() == MESSAGE_MAC_LENGTH);
+    REQUIRE(view.mac[0] == 0x99);
+    REQUIRE(view.authenticated.size() + MESSAGE_MAC_LENGTH == encoded.size());
+    REQUIRE(view.ciphertext.data() >= encoded.data());
+    REQUIRE(view.ciphertext.data() < encoded.data() + encoded.size());
+
+    std::array<std::uint8_t, CURVE25519_KEY_LENGTH> one_time_key{};
+    std::array<std::uint8_t, CURVE25519_KEY_LENGTH> base_key{};
+    std::array<std::uint8_t, CURVE25519_KEY_LENGTH> identity_key{};
+    one_time_key.fill(1);
+    base_key.fill(2);
+    identity_key.fill(3);
+
+    std::vector<std::uint8_t> pre_key(pre_key_message_length(encoded.size()));
+    pos = encode_pre_key_message_header(pre_key.data(), one_time_key, base_key, identity_key, encoded.size());
+    std::copy(encoded.begin(), encoded.end(), pos);
+
+    const auto pre_key_view = PreKeyMessageView::decode(pre_key);
+    REQUIRE(std::equal(pre_key_view.one_time_key.begin(), pre_key_view.one_time_key.end(), one_time_key.begin()));
+    REQUIRE(std::equal(pre_key_view.base_key.begin(), pre_key_view.base_key.end(), base_key.begin()));
+    REQUIRE(std::equal(pre_key_view.identity_key.begin(), pre_key_view.identity_key.end(), identity_key.begin()));
+    REQUIRE(std::equal(pre_key_view.message.begin(), pre_key_view.message.end(), encoded.begin(), encoded.end()));
+
+    const auto keys = PreKeyMessageView::decode_keys(std::span(pre_key).first(PRE_KEY_MESSAGE_KEYS_LENGTH));
+    REQUIRE(keys.has_value());
+    REQUIRE(std::equal(keys->base_key.begin(), keys->base_key.end(), base_key.begin()));
+    REQUIRE(keys->message.empty());
+    REQUIRE(!PreKeyMessageView::decode_keys(std::span(pre_key).first(PRE_KEY_MESSAGE_KEYS_LENGTH - 1)));
+    REQUIRE(!PreKeyMessageView::decode_keys(encoded));
+}
+
+TEST_CASE("Group message round trip")
+{
+    const std::vector<std::uint8_t> ciphertext(16, 0x17);
+
+    std::vector<std::uint8_t> encoded(group_message_length(70000, ciphertext.size()));
+    auto pos = encode_group_message_header(encoded.data(), 70000, ciphertext.size());
+    pos = std::copy(ciphertext.begin(), ciphertext.end(), pos);
+    std::fill(pos, pos + MESSAGE_MAC_LENGTH, 0x99);
+    std::fill(pos + MESSAGE_MAC_LENGTH, encoded.data() + encoded.size(), 0x55);
+
+    const auto view = GroupMessageView::decode(encoded);
+    REQUIRE(view.message_index == 70000);
+    REQUIRE(std::equal(view.ciphertext.begin(), view.ciphertext.end(), ciphertext.begin(), ciphertext.end()));
+    REQUIRE(view.mac[0] == 0x99);
+    REQUIRE(view.signature.size() == GROUP_MESSAGE_SIGNATURE_LENGTH);
+    REQUIRE(view.signature[0] == 0x55);
+    REQUIRE(view.signed_part.size() + GROUP_MESSAGE_SIGNATURE_LENGTH == encoded.size());
+    REQUIRE(view.authenticated.size() + MESSAGE_MAC_LENGTH == view.signed_part.size());
+}
+
+TEST_CASE("Malformed messages")
+{
+    std::array<std::uint8_t, CURVE25519_KEY_LENGTH> ratchet_key{};
+    std::vector<std::uint8_t> encoded(message_length(0, 16));
+    encode_message_header(encoded.data(), ratchet_key, 0, 16);
+    REQUIRE(MessageView::decode(encoded).ciphertext.size() == 16);
+
+    auto wrong_version = encoded;
+    wrong_version[0] = 2;
+    REQUIRE_THROWS_AS(MessageView::decode(wrong_version), SpankOlmErrorBadMessageVersion);
+    REQUIRE_THROWS_AS(MessageView::decode(std::span(encoded).first(MESSAGE_MAC_LENGTH)),
+                      SpankOlmErrorBadMessageFormat);
+
+    // The ciphertext length points past the end of the message
+    auto truncated = encoded;
+    truncated.resize(encoded.size() - MESSAGE_MAC_LENGTH - 1);
+    REQUIRE_THROWS_AS(MessageView::decode(truncated), SpankOlmErrorBadMessageFormat);
+
+    // An unterminated varint
+    const std::vector<std::uint8_t> unterminated = {MESSAGE_PROTOCOL_VERSION, 0x10, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    REQUIRE_THROWS_AS(MessageView::decode(unterminated), SpankOlmErrorBadMessageFormat);
+
+    // Unknown fields are skipped
+    std::vector<std::uint8_t> extended = {MESSAGE_PROTOCOL_VERSION, 0x38, 0x05, 0x3a, 0x01, 0x00};
+    extended.insert(extended.end(), encoded.begin() + 1, encoded.end());
+    REQUIRE(MessageView::decode(extended).ciphertext.size() == 16);
+
+    REQUIRE_THROWS_AS(PreKeyMessageView::decode(encoded), SpankOlmErrorBadMessageFormat);
+    REQUIRE_THROWS_AS(GroupMessageView::decode(encoded), SpankOlmErrorBadMessageFormat);
+}
@@ -0,0 +1,93 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "errors.hpp"
+#include "migration.hpp"
+#include <botan/auto_rng.h>
+#include <sstream>
+
+using namespace spank_olm;
+
+namespace
+{
+    /**
+     * \brief Turns the pickle of an account without fallback keys into a version 2 pickle.
+     */
+    std::vector<std::uint8_t> to_version_2(std::vector<std::uint8_t> pickle)
+    {
+        // The version is stored big endian, and the fallback key count sits right before the next key id.
+        pickle[3] = 2;
+        pickle.erase(pickle.end() - 5);
+        return pickle;
+    }
+} // namespace
+
+TEST_CASE("Migrate a single pickle")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 5);
+
+    PickleCipher old_key("old key");
+    PickleCipher new_key("new key");
+
+    bool upgraded = true;
+    const auto rekeyed = migrate_pickle(old_key, new_key, account.pickle(old_key), upgraded);
+    REQUIRE(!upgraded);
+    REQUIRE(Account::unpickle(new_key, rekeyed).pickle() == account.pickle());
+
+    const auto legacy = old_key.encrypt(to_version_2(account.pickle()));
+    const auto migrated = migrate_pickle(old_key, new_key, legacy, upgraded);
+    REQUIRE(upgraded);
+    REQUIRE(Account::unpickle(new_key, migrated).pickle() == account.pickle());
+
+    REQUIRE_THROWS_AS(migrate_pickle(new_key, new_key, legacy, upgraded), SpankOlmErrorBadAccountKey);
+}
+
+TEST_CASE("Migrate a stream of pickles")
+{
+    Botan::AutoSeeded_RNG rng;
+    PickleCipher old_key("old key");
+    PickleCipher new_key("new key");
+
+    std::vector<std::vector<std::uint8_t>> expected;
+    std::stringstream input;
+    for (std::size_t i = 0; i < 20; ++i)
+    {
+        Account account;
+        account.new_account(rng);
+        account.generate_one_time_keys(rng, i);
+        expected.push_back(account.pickle());
+        input << (i % 2 ? account.pickle(old_key) : old_key.encrypt(to_version_2(account.pickle()))) << "\n";
+    }
+    input << "not a pickle\n";
+
+    ThreadPool pool(3);
+    PickleMigrator migrator(old_key, new_key, pool, 6);
+    std::vector<std::uint64_t> failed_lines;
+    migrator.on_error([&failed_lines](const std::uint64_t line, std::exception const &) {
+        failed_lines.push_back(line);
+    });
+    std::size_t batches = 0;
+    migrator.on_progress([&batches](MigrationProgress const &) { ++batches; });
+
+    std::stringstream output;
+    MigrationProgress progress;
+    migrator.run(input, output, progress);
+
+    REQUIRE(progress.read == 21);
+    REQUIRE(progress.migrated == 20);
+    REQUIRE(progress.upgraded == 10);
+    REQUIRE(progress.failed == 1);
+    REQUIRE(batches == 4);
+    REQUIRE(failed_lines == std::vector<std::uint64_t>{21});
+
+    std::string line;
+    for (const auto &pickle : expected)
+    {
+        REQUIRE(std::getline(output, line));
+        REQUIRE(Account::unpickle(new_key, line).pickle() == pickle);
+    }
+    REQUIRE(std::getline(output, line));
+    REQUIRE(line.empty());
+}
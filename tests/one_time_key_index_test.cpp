@@ -0,0 +1,38 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "one_time_key_index.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+TEST_CASE("One-time key index")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    OneTimeKeyIndex empty;
+    REQUIRE(empty.size() == 0);
+    REQUIRE(empty.find(account.identity_keys->curve25519_key.public_value()) == nullptr);
+
+    account.generate_one_time_keys(rng, 50);
+    account.generate_fallback_key(rng);
+    account.generate_fallback_key(rng);
+
+    OneTimeKeyIndex index(account);
+    REQUIRE(index.size() == 52);
+    for (const auto *one_time_key : account.one_time_keys)
+    {
+        REQUIRE(index.find(one_time_key->key.public_value()) == one_time_key);
+    }
+    REQUIRE(index.find(account.current_fallback_key->key.public_value()) == &*account.current_fallback_key);
+    REQUIRE(index.find(account.prev_fallback_key->key.public_value()) == &*account.prev_fallback_key);
+    REQUIRE(index.find(account.identity_keys->curve25519_key.public_value()) == nullptr);
+    REQUIRE(index.find(std::vector<std::uint8_t>(31)) == nullptr);
+
+    const auto removed = account.one_time_keys[0].key.public_key();
+    account.remove_key(*removed);
+    index.rebuild(account);
+    REQUIRE(index.size() == 51);
+    REQUIRE(index.find(removed->raw_public_key_bits()) == nullptr);
+}
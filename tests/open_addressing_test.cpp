@@ -0,0 +1,61 @@
+#include <snitch/snitch.hpp>
+#include "open_addressing.hpp"
+#include <array>
+#include <vector>
+
+using namespace spank_olm;
+
+TEST_CASE("Open addressing capacity is a power of two at least twice the entries")
+{
+    REQUIRE(open_addressing_capacity(0) == 1);
+    REQUIRE(open_addressing_capacity(1) == 2);
+    REQUIRE(open_addressing_capacity(3) == 8);
+    REQUIRE(open_addressing_capacity(100) == 256);
+}
+
+TEST_CASE("ProbeTable grows and keeps entries reachable after removals")
+{
+    // Every hash lands in a handful of home slots, so the probe sequences overlap and wrap around.
+    std::vector<std::size_t> hashes;
+    for (std::size_t i = 0; i < 40; ++i)
+    {
+        hashes.push_back(i % 3 == 0 ? 7 : (i * 5) % 11);
+    }
+    const auto hash_of = [&](const std::uint32_t entry) { return hashes[entry]; };
+    const auto find = [&](ProbeTable const &table, const std::uint32_t wanted)
+    { return table.find(hashes[wanted], [&](const std::uint32_t entry) { return entry == wanted; }); };
+
+    ProbeTable table;
+    for (std::uint32_t i = 0; i < hashes.size(); ++i)
+    {
+        table.insert(i, hash_of);
+    }
+    REQUIRE(table.size() == hashes.size());
+    for (std::uint32_t i = 0; i < hashes.size(); ++i)
+    {
+        REQUIRE(find(table, i) != ProbeTable::NONE);
+    }
+
+    for (std::uint32_t i = 0; i < hashes.size(); i += 2)
+    {
+        table.erase(find(table, i), hash_of);
+    }
+    REQUIRE(table.size() == hashes.size() / 2);
+    for (std::uint32_t i = 0; i < hashes.size(); ++i)
+    {
+        REQUIRE((find(table, i) != ProbeTable::NONE) == (i % 2 == 1));
+    }
+
+    table.clear();
+    REQUIRE(find(table, 1) == ProbeTable::NONE);
+}
+
+TEST_CASE("Leading bytes hash reads the first word of the key")
+{
+    std::array<std::uint8_t, 32> key{};
+    REQUIRE(LeadingBytesHash{}(key) == 0);
+    key[31] = 1;
+    REQUIRE(LeadingBytesHash{}(key) == 0);
+    key[0] = 1;
+    REQUIRE(LeadingBytesHash{}(key) != 0);
+}
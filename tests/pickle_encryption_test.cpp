@@ -0,0 +1,65 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "errors.hpp"
+#include "megolm.hpp"
+#include "pickle_encryption.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+TEST_CASE("Encrypted account pickle round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+    account.generate_one_time_keys(rng, 10);
+    account.generate_fallback_key(rng);
+
+    PickleCipher cipher("secret pickle key");
+    const auto encrypted = account.pickle(cipher);
+
+    REQUIRE(encrypted.size() == PickleCipher::encrypted_length(account.pickle_length()));
+    REQUIRE(encrypted.find('=') == std::string::npos);
+
+    const auto decrypted = Account::unpickle(cipher, encrypted);
+    REQUIRE(decrypted.pickle() == account.pickle());
+
+    // A copy of the cipher reuses the derived keys.
+    PickleCipher copy(cipher);
+    REQUIRE(Account::unpickle(copy, encrypted).pickle() == account.pickle());
+}
+
+TEST_CASE("Encrypted account pickle rejects the wrong key and modified input")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    PickleCipher cipher("secret pickle key");
+    PickleCipher other_cipher("another pickle key");
+    auto encrypted = account.pickle(cipher);
+
+    REQUIRE_THROWS_AS(Account::unpickle(other_cipher, encrypted), SpankOlmErrorBadAccountKey);
+
+    encrypted[10] = encrypted[10] == 'A' ? 'B' : 'A';
+    REQUIRE_THROWS_AS(Account::unpickle(cipher, encrypted), SpankOlmErrorBadAccountKey);
+
+    REQUIRE_THROWS_AS(Account::unpickle(cipher, "not base64!"), SpankOlmErrorInvalidBase64);
+    REQUIRE_THROWS_AS(Account::unpickle(cipher, "AAAA"), SpankOlmErrorCorruptedPickle);
+}
+
+TEST_CASE("Encrypted megolm pickle round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    Megolm megolm{};
+    megolm.init(rng, 42);
+    megolm.advance();
+
+    PickleCipher cipher("secret pickle key");
+    const auto encrypted = megolm.pickle(cipher);
+
+    Megolm restored{};
+    restored.unpickle(cipher, encrypted);
+    REQUIRE(restored.counter == megolm.counter);
+    REQUIRE(restored.data == megolm.data);
+}
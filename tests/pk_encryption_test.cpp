@@ -0,0 +1,115 @@
+#include <snitch/snitch.hpp>
+#include "errors.hpp"
+#include "pk_encryption.hpp"
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+namespace
+{
+    std::span<const std::uint8_t> as_bytes(const std::string_view text)
+    {
+        return {reinterpret_cast<const std::uint8_t *>(text.data()), text.size()};
+    }
+
+    std::string to_string(Botan::secure_vector<std::uint8_t> const &plaintext)
+    {
+        return {plaintext.begin(), plaintext.end()};
+    }
+} // namespace
+
+TEST_CASE("Pk encryption round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    const PkDecryption decryption(rng);
+    const PkEncryption encryption(decryption.public_key());
+
+    for (const std::size_t length : {0, 1, 15, 16, 17, 1000})
+    {
+        const std::string plaintext(length, 'x');
+        const auto message = encryption.encrypt(rng, as_bytes(plaintext));
+        REQUIRE(message.mac.size() == 11);
+        REQUIRE(message.ephemeral_key.size() == 43);
+        REQUIRE(to_string(decryption.decrypt(message)) == plaintext);
+    }
+
+    // A key pair restored from its private key decrypts the same messages.
+    const auto message = encryption.encrypt(rng, as_bytes("restored"));
+    const PkDecryption restored(decryption.private_key());
+    REQUIRE(std::equal(restored.public_key().begin(), restored.public_key().end(), decryption.public_key().begin()));
+    REQUIRE(to_string(restored.decrypt(message)) == "restored");
+
+    REQUIRE_THROWS_AS(PkEncryption(std::vector<std::uint8_t>(31)), SpankOlmErrorInvalidKey);
+    REQUIRE_THROWS_AS(PkDecryption(std::vector<std::uint8_t>(33)), SpankOlmErrorInvalidKey);
+}
+
+TEST_CASE("Pk decryption rejects broken messages")
+{
+    Botan::AutoSeeded_RNG rng;
+    const PkDecryption decryption(rng);
+    const PkDecryption other(rng);
+    const auto message = PkEncryption(decryption.public_key()).encrypt(rng, as_bytes("secret"));
+
+    REQUIRE_THROWS_AS(other.decrypt(message), SpankOlmErrorBadMessageMac);
+
+    auto bad_mac = message;
+    bad_mac.mac[0] = bad_mac.mac[0] == 'A' ? 'B' : 'A';
+    REQUIRE_THROWS_AS(decryption.decrypt(bad_mac), SpankOlmErrorBadMessageMac);
+
+    auto bad_key = message;
+    bad_key.ephemeral_key.pop_back();
+    REQUIRE_THROWS_AS(decryption.decrypt(bad_key), SpankOlmErrorInvalidKey);
+    bad_key.ephemeral_key = std::string(200, 'A');
+    REQUIRE_THROWS_AS(decryption.decrypt(bad_key), SpankOlmErrorInvalidKey);
+
+    auto bad_ciphertext = message;
+    bad_ciphertext.ciphertext.resize(10);
+    REQUIRE_THROWS_AS(decryption.decrypt(bad_ciphertext), SpankOlmErrorBadMessageFormat);
+    bad_ciphertext.ciphertext = "!!!";
+    REQUIRE_THROWS_AS(decryption.decrypt(bad_ciphertext), SpankOlmErrorInvalidBase64);
+}
+
+TEST_CASE("Pk decryption in batches")
+{
+    Botan::AutoSeeded_RNG rng;
+    const PkDecryption decryption(rng);
+    const PkEncryption encryption(decryption.public_key());
+
+    std::vector<PkMessage> messages;
+    for (int i = 0; i < 50; ++i)
+    {
+        messages.push_back(encryption.encrypt(rng, as_bytes("message " + std::to_string(i))));
+    }
+    messages[13].mac = messages[14].mac.substr(0, 5);
+
+    for (const std::size_t threads : {0, 4})
+    {
+        ThreadPool pool(threads);
+        const auto results = decryption.decrypt_batch(messages, pool);
+        REQUIRE(results.size() == messages.size());
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            if (i == 13)
+            {
+                REQUIRE(!results[i].ok());
+                REQUIRE_THROWS_AS(std::rethrow_exception(results[i].error), SpankOlmErrorBadMessageMac);
+                continue;
+            }
+            REQUIRE(results[i].ok());
+            REQUIRE(to_string(results[i].plaintext) == "message " + std::to_string(i));
+        }
+
+        std::vector<std::size_t> consumed(messages.size());
+        const auto errors = decryption.decrypt_each(messages, pool, [&](std::size_t index, auto plaintext) {
+            if (index == 20)
+            {
+                throw std::runtime_error("consumer");
+            }
+            consumed[index] = plaintext.size();
+        });
+        REQUIRE(errors[13] != nullptr);
+        REQUIRE(errors[20] != nullptr);
+        REQUIRE(errors[0] == nullptr);
+        REQUIRE(consumed[0] == 9);
+    }
+}
@@ -0,0 +1,237 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "base64.hpp"
+#include "errors.hpp"
+#include "session_store.hpp"
+#include <algorithm>
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+namespace
+{
+    std::string to_string(Botan::secure_vector<std::uint8_t> const &plaintext)
+    {
+        return {plaintext.begin(), plaintext.end()};
+    }
+
+    std::vector<std::uint8_t> identity_key(Account const &account)
+    {
+        return account.identity_keys->curve25519_key.public_value();
+    }
+
+    Session create_outbound(Botan::RandomNumberGenerator &rng, Account const &alice, Account &bob)
+    {
+        bob.generate_one_time_keys(rng, 1);
+        return Session::create_outbound(rng, alice, identity_key(bob), bob.one_time_keys[0].key.public_value());
+    }
+} // namespace
+
+TEST_CASE("Session store routes messages to their session")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+
+    std::vector<Session> outbound;
+    for (int i = 0; i < 5; ++i)
+    {
+        outbound.push_back(create_outbound(rng, alice, bob));
+    }
+
+    SessionStore store;
+    for (auto &session : outbound)
+    {
+        const auto message = session.encrypt(rng, "hello");
+        const OneTimeKeyIndex index(bob);
+        const auto result = store.decrypt(bob, identity_key(alice), message, &index);
+        REQUIRE(to_string(result.plaintext) == "hello");
+        REQUIRE(result.new_session);
+        REQUIRE(result.session->session_id() == session.session_id());
+        REQUIRE(result.one_time_key == PreKeyHeader::decode(message.body).one_time_key);
+        bob.remove_key(Botan::X25519_PublicKey(*result.one_time_key));
+    }
+    REQUIRE(store.size() == 5);
+    REQUIRE(store.most_recent(identity_key(alice)) == store.find(outbound[4].session_id()));
+
+    // Another pre-key message on an existing session is matched by its keys.
+    const auto again = store.decrypt(bob, identity_key(alice), outbound[1].encrypt(rng, "again"));
+    REQUIRE(!again.new_session);
+    REQUIRE(again.session == store.find(outbound[1].session_id()));
+    REQUIRE(store.most_recent(identity_key(alice)) == again.session);
+
+    // Replies establish the sessions, after which normal messages are matched by trial decryption.
+    for (auto &session : outbound)
+    {
+        auto *inbound = store.find(session.session_id());
+        REQUIRE(inbound != nullptr);
+        REQUIRE(to_string(session.decrypt(inbound->encrypt(rng, "reply"))) == "reply");
+    }
+    for (std::size_t i = 0; i < outbound.size(); ++i)
+    {
+        const auto message = outbound[i].encrypt(rng, std::to_string(i));
+        REQUIRE(message.type == MessageType::Normal);
+        const auto result = store.decrypt(bob, identity_key(alice), message);
+        REQUIRE(to_string(result.plaintext) == std::to_string(i));
+        REQUIRE(result.session == store.find(outbound[i].session_id()));
+        REQUIRE(store.most_recent(identity_key(alice)) == result.session);
+
+        // The second message of a chain goes to the session which knows the chain.
+        const auto next = store.decrypt(bob, identity_key(alice), outbound[i].encrypt(rng, "next"));
+        REQUIRE(next.session == result.session);
+    }
+
+    const auto sessions = store.sessions(identity_key(alice));
+    REQUIRE(sessions.size() == 5);
+    REQUIRE(sessions[0] == store.find(outbound[4].session_id()));
+
+    // Messages from someone else don't match any session.
+    REQUIRE_THROWS_AS(store.decrypt(bob, identity_key(bob), outbound[0].encrypt(rng, "x")),
+                      SpankOlmErrorNoMatchingSession);
+    const auto replayed = outbound[0].encrypt(rng, "once");
+    REQUIRE(to_string(store.decrypt(bob, identity_key(alice), replayed).plaintext) == "once");
+    REQUIRE_THROWS_AS(store.decrypt(bob, identity_key(alice), replayed), SpankOlmErrorNoMatchingSession);
+}
+
+TEST_CASE("Session store keeps a bounded number of sessions per device")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+
+    SessionStore store(3);
+    std::vector<std::string> ids;
+    for (int i = 0; i < 5; ++i)
+    {
+        auto session = create_outbound(rng, alice, bob);
+        ids.push_back(session.session_id());
+        REQUIRE(store.add(identity_key(bob), std::move(session)).session_id() == ids.back());
+    }
+
+    REQUIRE(store.size() == 3);
+    REQUIRE(store.find(ids[0]) == nullptr);
+    REQUIRE(store.find(ids[1]) == nullptr);
+    REQUIRE(store.find(ids[2]) != nullptr);
+    REQUIRE(store.most_recent(identity_key(bob)) == store.find(ids[4]));
+    REQUIRE(store.sessions(identity_key(alice)).empty());
+
+    REQUIRE(store.remove(ids[4]));
+    REQUIRE(!store.remove(ids[4]));
+    REQUIRE(store.most_recent(identity_key(bob)) == store.find(ids[3]));
+    REQUIRE(store.remove(ids[3]));
+    REQUIRE(store.remove(ids[2]));
+    REQUIRE(store.size() == 0);
+    REQUIRE(store.most_recent(identity_key(bob)) == nullptr);
+
+    REQUIRE_THROWS_AS(store.most_recent(std::vector<std::uint8_t>(31)), SpankOlmErrorInvalidKey);
+}
+
+TEST_CASE("Session store decrypts bursts of messages in parallel")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account bob;
+    bob.new_account(rng);
+
+    for (const std::size_t threads : {0, 4})
+    {
+        ThreadPool pool(threads);
+        SessionStore store;
+
+        std::vector<Account> senders(6);
+        std::vector<std::vector<std::uint8_t>> sender_keys;
+        std::vector<Session> outbound;
+        for (auto &sender : senders)
+        {
+            sender.new_account(rng);
+            sender_keys.push_back(identity_key(sender));
+            outbound.push_back(create_outbound(rng, sender, bob));
+        }
+        REQUIRE(bob.one_time_keys.size() == senders.size());
+
+        // Interleave the messages of the senders, like a sync response would.
+        std::vector<OlmMessage> encrypted;
+        std::vector<IncomingMessage> messages;
+        std::vector<std::string> expected;
+        for (int round = 0; round < 4; ++round)
+        {
+            for (std::size_t sender = 0; sender < senders.size(); ++sender)
+            {
+                expected.push_back(std::to_string(sender) + "/" + std::to_string(round));
+                encrypted.push_back(outbound[sender].encrypt(rng, expected.back()));
+            }
+        }
+        for (std::size_t i = 0; i < encrypted.size(); ++i)
+        {
+            messages.push_back({sender_keys[i % senders.size()], encrypted[i].type, encrypted[i].body});
+        }
+        const std::vector<std::uint8_t> bad_key(31);
+        messages.push_back({bad_key, MessageType::PreKey, encrypted[0].body});
+        messages.push_back({sender_keys[0], MessageType::Normal, "AwoA"});
+
+        const auto results = store.decrypt_batch(bob, messages, pool);
+        REQUIRE(results.size() == messages.size());
+        for (std::size_t i = 0; i < expected.size(); ++i)
+        {
+            REQUIRE(results[i].ok());
+            REQUIRE(to_string(results[i].plaintext) == expected[i]);
+            REQUIRE(results[i].new_session == (i < senders.size()));
+            REQUIRE(results[i].session_id == outbound[i % senders.size()].session_id());
+        }
+        REQUIRE_THROWS_AS(std::rethrow_exception(results[expected.size()].error), SpankOlmErrorInvalidKey);
+        REQUIRE(!results[expected.size() + 1].ok());
+
+        // The used one-time keys have been removed from the account.
+        REQUIRE(bob.one_time_keys.size() == 0);
+        REQUIRE(store.size() == senders.size());
+        for (std::size_t sender = 0; sender < senders.size(); ++sender)
+        {
+            REQUIRE(store.most_recent(sender_keys[sender]) == store.find(outbound[sender].session_id()));
+        }
+    }
+}
+
+TEST_CASE("Session store removes the one-time key a batch actually used")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    bob.generate_one_time_keys(rng, 2);
+    const auto decoy_key = bob.one_time_keys[0].key.public_value();
+    const auto used_key = bob.one_time_keys[1].key.public_value();
+
+    auto outbound = Session::create_outbound(rng, alice, identity_key(bob), used_key);
+    const auto message = outbound.encrypt(rng, "hello");
+
+    // Put the keys again in front of the message, naming the decoy key. The header decoder only reads those, while
+    // the full decoder takes the last one-time key field, the one the handshake used.
+    const auto original = base64_decode(message.body);
+    const auto header = PreKeyHeader::decode(message.body);
+    std::vector<std::uint8_t> crafted{original[0], 0x0a, 0x20};
+    crafted.insert(crafted.end(), decoy_key.begin(), decoy_key.end());
+    crafted.insert(crafted.end(), {0x12, 0x20});
+    crafted.insert(crafted.end(), header.base_key.begin(), header.base_key.end());
+    crafted.insert(crafted.end(), {0x1a, 0x20});
+    crafted.insert(crafted.end(), header.identity_key.begin(), header.identity_key.end());
+    crafted.insert(crafted.end(), original.begin() + 1, original.end());
+    const auto body = base64_encode(crafted, false);
+    REQUIRE(std::ranges::equal(PreKeyHeader::decode(body).one_time_key, decoy_key));
+
+    ThreadPool pool(2);
+    SessionStore store;
+    const auto sender_key = identity_key(alice);
+    const std::vector<IncomingMessage> messages{{sender_key, MessageType::PreKey, body}};
+    const auto results = store.decrypt_batch(bob, messages, pool);
+    REQUIRE(results[0].ok());
+    REQUIRE(to_string(results[0].plaintext) == "hello");
+    REQUIRE(results[0].session_id == outbound.session_id());
+
+    REQUIRE(bob.one_time_keys.size() == 1);
+    REQUIRE(bob.lookup_key(Botan::X25519_PublicKey(decoy_key)).has_value());
+    REQUIRE(!bob.lookup_key(Botan::X25519_PublicKey(used_key)).has_value());
+}
@@ -0,0 +1,476 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "errors.hpp"
+#include "one_time_key_index.hpp"
+#include "session.hpp"
+#include <algorithm>
+#include <botan/auto_rng.h>
+
+using namespace spank_olm;
+
+namespace
+{
+    std::string to_string(Botan::secure_vector<std::uint8_t> const &plaintext)
+    {
+        return {plaintext.begin(), plaintext.end()};
+    }
+
+    std::vector<std::uint8_t> identity_key(Account const &account)
+    {
+        return account.identity_keys->curve25519_key.public_value();
+    }
+
+    /**
+     * \brief Creates an outbound session from Alice to Bob and the matching inbound session from its first message.
+     */
+    std::pair<Session, Session> create_sessions(Botan::RandomNumberGenerator &rng, Account &alice, Account &bob,
+                                                SessionLimits limits = {})
+    {
+        bob.generate_one_time_keys(rng, 1);
+        const auto one_time_key = (*bob.one_time_keys.begin())->key.public_value();
+        auto outbound = Session::create_outbound(rng, alice, identity_key(bob), one_time_key, limits);
+
+        const auto first = outbound.encrypt(rng, "first");
+        REQUIRE(first.type == MessageType::PreKey);
+        auto inbound = Session::create_inbound(bob, first.body, identity_key(alice), limits);
+        REQUIRE(to_string(inbound.decrypt(first)) == "first");
+        bob.remove_key(Botan::X25519_PublicKey(one_time_key));
+        return {std::move(outbound), std::move(inbound)};
+    }
+
+    /**
+     * \brief Assembles an unencrypted session pickle in libolm's layout.
+     *
+     * libolm inserts new receiver chains and skipped message keys at the front of its lists and pickles the lists in
+     * order, so a session it pickles has both newest first.
+     */
+    struct LibolmPickle
+    {
+        void u32(const std::uint32_t value)
+        {
+            for (int shift = 24; shift >= 0; shift -= 8)
+            {
+                bytes.push_back(static_cast<std::uint8_t>(value >> shift));
+            }
+        }
+
+        void fill(const std::uint8_t byte, const std::size_t length = 32) { bytes.insert(bytes.end(), length, byte); }
+
+        void key(const std::span<const std::uint8_t> key) { bytes.insert(bytes.end(), key.begin(), key.end()); }
+
+        /**
+         * \brief Writes the version, the received flag, the handshake keys and the root key.
+         */
+        void header()
+        {
+            u32(SESSION_PICKLE_VERSION);
+            bytes.push_back(1);
+            fill(0x01);
+            fill(0x02);
+            fill(0x03);
+            fill(0x04);
+        }
+
+        std::vector<std::uint8_t> bytes;
+    };
+} // namespace
+
+TEST_CASE("Session round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+
+    auto [outbound, inbound] = create_sessions(rng, alice, bob);
+    REQUIRE(outbound.session_id() == inbound.session_id());
+    REQUIRE(!outbound.has_received_message());
+    REQUIRE(inbound.has_received_message());
+
+    // Alice keeps sending pre-key messages until Bob replies.
+    const auto second = outbound.encrypt(rng, "second");
+    REQUIRE(second.type == MessageType::PreKey);
+    REQUIRE(to_string(inbound.decrypt(second)) == "second");
+
+    const auto reply = inbound.encrypt(rng, "reply");
+    REQUIRE(reply.type == MessageType::Normal);
+    REQUIRE(to_string(outbound.decrypt(reply)) == "reply");
+    REQUIRE(outbound.has_received_message());
+
+    for (int i = 0; i < 3; ++i)
+    {
+        const auto message = outbound.encrypt(rng, std::string(i * 20, 'a'));
+        REQUIRE(message.type == MessageType::Normal);
+        REQUIRE(to_string(inbound.decrypt(message)) == std::string(i * 20, 'a'));
+        REQUIRE(to_string(outbound.decrypt(inbound.encrypt(rng, "ping"))) == "ping");
+    }
+}
+
+TEST_CASE("Session inbound creation checks the keys")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    Account eve;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    eve.new_account(rng);
+    bob.generate_one_time_keys(rng, 1);
+
+    const auto one_time_key = (*bob.one_time_keys.begin())->key.public_value();
+    auto outbound = Session::create_outbound(rng, alice, identity_key(bob), one_time_key);
+    const auto message = outbound.encrypt(rng, "hello");
+
+    REQUIRE_THROWS_AS(Session::create_inbound(eve, message.body), SpankOlmErrorBadMessageKeyId);
+    REQUIRE_THROWS_AS(Session::create_inbound(bob, message.body, identity_key(eve)), SpankOlmErrorBadMessageKeyId);
+    REQUIRE_THROWS_AS(Session::create_inbound(bob, "AwAA"), SpankOlmErrorBadMessageFormat);
+    const std::vector<std::uint8_t> short_key(31);
+    REQUIRE_THROWS_AS(Session::create_outbound(rng, alice, identity_key(bob), short_key), SpankOlmErrorInvalidKey);
+
+    bob.remove_key(Botan::X25519_PublicKey(one_time_key));
+    REQUIRE_THROWS_AS(Session::create_inbound(bob, message.body), SpankOlmErrorBadMessageKeyId);
+}
+
+TEST_CASE("Session outbound creation in bulk")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    alice.new_account(rng);
+
+    std::vector<Account> devices(25);
+    std::vector<std::vector<std::uint8_t>> identity_keys;
+    std::vector<std::vector<std::uint8_t>> one_time_keys;
+    for (auto &device : devices)
+    {
+        device.new_account(rng);
+        device.generate_one_time_keys(rng, 1);
+        identity_keys.push_back(identity_key(device));
+        one_time_keys.push_back(device.one_time_keys[0].key.public_value());
+    }
+    one_time_keys[7].resize(31);
+
+    std::vector<ClaimedOneTimeKey> claimed;
+    for (std::size_t i = 0; i < devices.size(); ++i)
+    {
+        claimed.push_back({identity_keys[i], one_time_keys[i]});
+    }
+
+    for (const std::size_t threads : {0, 4})
+    {
+        ThreadPool pool(threads);
+        auto results = Session::create_outbound_batch(rng, alice, claimed, pool);
+        REQUIRE(results.size() == devices.size());
+
+        std::vector<std::string> session_ids;
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            if (i == 7)
+            {
+                REQUIRE(!results[i].ok());
+                REQUIRE_THROWS_AS(std::rethrow_exception(results[i].error), SpankOlmErrorInvalidKey);
+                continue;
+            }
+            REQUIRE(results[i].ok());
+            auto &outbound = *results[i].session;
+            const auto message = outbound.encrypt(rng, "room key");
+            auto inbound = Session::create_inbound(devices[i], message.body, identity_key(alice));
+            REQUIRE(to_string(inbound.decrypt(message)) == "room key");
+            REQUIRE(inbound.session_id() == outbound.session_id());
+            session_ids.push_back(outbound.session_id());
+        }
+        std::sort(session_ids.begin(), session_ids.end());
+        REQUIRE(std::adjacent_find(session_ids.begin(), session_ids.end()) == session_ids.end());
+    }
+
+    ThreadPool pool(2);
+    REQUIRE(Session::create_outbound_batch(rng, alice, {}, pool).empty());
+}
+
+TEST_CASE("Session inbound creation through a key index")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    bob.generate_one_time_keys(rng, 20);
+    bob.generate_fallback_key(rng);
+
+    const auto one_time_key = bob.one_time_keys[7].key.public_value();
+    auto outbound = Session::create_outbound(rng, alice, identity_key(bob), one_time_key);
+    const auto message = outbound.encrypt(rng, "hello");
+
+    const auto header = PreKeyHeader::decode(message.body);
+    REQUIRE(std::equal(header.one_time_key.begin(), header.one_time_key.end(), one_time_key.begin()));
+    REQUIRE(std::vector<std::uint8_t>(header.identity_key.begin(), header.identity_key.end()) == identity_key(alice));
+
+    const OneTimeKeyIndex index(bob);
+    auto inbound = Session::create_inbound(bob, index, message.body, identity_key(alice));
+    REQUIRE(inbound.matches_inbound(header));
+    REQUIRE(inbound.session_id() == outbound.session_id());
+    REQUIRE(to_string(inbound.decrypt(message)) == "hello");
+
+    // Later pre-key messages are routed to the session by their keys.
+    const auto second = outbound.encrypt(rng, "second");
+    REQUIRE(inbound.matches_inbound(PreKeyHeader::decode(second.body)));
+
+    // Messages for other keys are rejected from their keys alone, even if the rest is garbage.
+    const auto fallback_key = bob.current_fallback_key->key.public_value();
+    auto other = Session::create_outbound(rng, alice, identity_key(bob), fallback_key);
+    const auto other_message = other.encrypt(rng, "other");
+    REQUIRE(!inbound.matches_inbound(PreKeyHeader::decode(other_message.body)));
+    REQUIRE(Session::create_inbound(bob, index, other_message.body).matches_inbound(
+        PreKeyHeader::decode(other_message.body)));
+
+    bob.remove_key(Botan::X25519_PublicKey(one_time_key));
+    const OneTimeKeyIndex rebuilt(bob);
+    auto stale = message.body.substr(0, 140) + std::string(message.body.size() - 140, '!');
+    REQUIRE_THROWS_AS(Session::create_inbound(bob, rebuilt, stale), SpankOlmErrorBadMessageKeyId);
+    REQUIRE_THROWS_AS(Session::create_inbound(bob, rebuilt, message.body), SpankOlmErrorBadMessageKeyId);
+    REQUIRE_THROWS_AS(Session::create_inbound(bob, rebuilt, message.body, identity_key(bob)),
+                      SpankOlmErrorBadMessageKeyId);
+}
+
+TEST_CASE("Session decrypts messages out of order")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    auto [outbound, inbound] = create_sessions(rng, alice, bob);
+    REQUIRE(to_string(outbound.decrypt(inbound.encrypt(rng, "reply"))) == "reply");
+
+    std::vector<OlmMessage> messages;
+    for (int i = 0; i < 5; ++i)
+    {
+        messages.push_back(outbound.encrypt(rng, std::to_string(i)));
+    }
+
+    REQUIRE(to_string(inbound.decrypt(messages[4])) == "4");
+    REQUIRE(inbound.skipped_message_key_count() == 4);
+    REQUIRE(to_string(inbound.decrypt(messages[1])) == "1");
+    REQUIRE(to_string(inbound.decrypt(messages[3])) == "3");
+    REQUIRE(inbound.skipped_message_key_count() == 2);
+
+    // Every key can be used once only.
+    REQUIRE_THROWS_AS(inbound.decrypt(messages[1]), SpankOlmErrorBadMessageKeyId);
+    REQUIRE_THROWS_AS(inbound.decrypt(messages[4]), SpankOlmErrorBadMessageKeyId);
+
+    REQUIRE(to_string(inbound.decrypt(messages[0])) == "0");
+    REQUIRE(to_string(inbound.decrypt(messages[2])) == "2");
+    REQUIRE(inbound.skipped_message_key_count() == 0);
+}
+
+TEST_CASE("Session bounds the skipped message keys")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    auto [outbound, inbound] = create_sessions(rng, alice, bob, SessionLimits{3, 10});
+
+    std::vector<OlmMessage> messages;
+    for (int i = 0; i < 12; ++i)
+    {
+        messages.push_back(outbound.encrypt(rng, std::to_string(i)));
+    }
+
+    // Skipping more messages than allowed is rejected without changing the session.
+    REQUIRE_THROWS_AS(inbound.decrypt(messages[11]), SpankOlmErrorBadMessageKeyId);
+    REQUIRE(inbound.skipped_message_key_count() == 0);
+
+    REQUIRE(to_string(inbound.decrypt(messages[5])) == "5");
+    REQUIRE(inbound.skipped_message_key_count() == 3);
+
+    // Only the newest keys are kept.
+    REQUIRE_THROWS_AS(inbound.decrypt(messages[0]), SpankOlmErrorBadMessageKeyId);
+    REQUIRE_THROWS_AS(inbound.decrypt(messages[1]), SpankOlmErrorBadMessageKeyId);
+    REQUIRE(to_string(inbound.decrypt(messages[2])) == "2");
+    REQUIRE(to_string(inbound.decrypt(messages[4])) == "4");
+    REQUIRE(to_string(inbound.decrypt(messages[11])) == "11");
+}
+
+TEST_CASE("Session ignores forged messages")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    auto [outbound, inbound] = create_sessions(rng, alice, bob);
+
+    const auto message = outbound.encrypt(rng, "hello");
+    std::vector<std::uint8_t> pickled(inbound.pickle_length());
+    inbound.pickle(pickled.data());
+
+    auto forged = message;
+    forged.body[forged.body.size() - 2] = forged.body[forged.body.size() - 2] == 'A' ? 'B' : 'A';
+    REQUIRE_THROWS_AS(inbound.decrypt(forged), SpankOlmErrorBadMessageMac);
+
+    std::vector<std::uint8_t> after(inbound.pickle_length());
+    inbound.pickle(after.data());
+    REQUIRE(after == pickled);
+    REQUIRE(to_string(inbound.decrypt(message)) == "hello");
+
+    REQUIRE_THROWS_AS(inbound.decrypt(MessageType::Normal, "not base64!"), SpankOlmErrorInvalidBase64);
+    REQUIRE_THROWS_AS(inbound.decrypt(MessageType::Normal, "AgAAAAAAAAAAAAAA"), SpankOlmErrorBadMessageVersion);
+}
+
+TEST_CASE("Session pickle round trip")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account alice;
+    Account bob;
+    alice.new_account(rng);
+    bob.new_account(rng);
+    auto [outbound, inbound] = create_sessions(rng, alice, bob);
+    REQUIRE(to_string(outbound.decrypt(inbound.encrypt(rng, "reply"))) == "reply");
+    const auto skipped = outbound.encrypt(rng, "skipped");
+    REQUIRE(to_string(inbound.decrypt(outbound.encrypt(rng, "next"))) == "next");
+
+    PickleCipher cipher("pickle key");
+    auto restored = Session::unpickle(cipher, inbound.pickle(cipher));
+    REQUIRE(restored.session_id() == inbound.session_id());
+    REQUIRE(restored.skipped_message_key_count() == 1);
+
+    std::vector<std::uint8_t> expected(inbound.pickle_length());
+    REQUIRE(inbound.pickle(expected.data()) == expected.data() + expected.size());
+    std::vector<std::uint8_t> actual(restored.pickle_length());
+    restored.pickle(actual.data());
+    REQUIRE(actual == expected);
+
+    REQUIRE(to_string(restored.decrypt(skipped)) == "skipped");
+    REQUIRE(to_string(outbound.decrypt(restored.encrypt(rng, "restored"))) == "restored");
+
+    // A pickle with more skipped keys than allowed keeps the newest ones.
+    REQUIRE(Session::unpickle(expected, SessionLimits{0, MAX_MESSAGE_GAP}).skipped_message_key_count() == 0);
+
+    const auto truncated = std::span<const std::uint8_t>(expected);
+    REQUIRE_THROWS_AS(Session::unpickle(truncated.first(3)), SpankOlmErrorVersionNotFound);
+    REQUIRE_THROWS_AS(Session::unpickle(truncated.first(40)), SpankOlmErrorCorruptedPickle);
+    expected[3] = 2;
+    REQUIRE_THROWS_AS(Session::unpickle(expected), SpankOlmErrorUnknownPickleVersion);
+}
+
+TEST_CASE("Session unpickles libolm's chain order")
+{
+    Botan::AutoSeeded_RNG rng;
+    const Botan::X25519_PrivateKey newest_key(rng);
+    const Botan::X25519_PrivateKey older_key(rng);
+    const auto newest = newest_key.public_value();
+    const auto older = older_key.public_value();
+
+    // Alice's side has received on two chains since it last sent, the newest one being Bob's current ratchet key.
+    LibolmPickle alice;
+    alice.header();
+    alice.u32(0);
+    alice.u32(2);
+    alice.key(newest);
+    alice.fill(0x21);
+    alice.u32(5);
+    alice.key(older);
+    alice.fill(0x22);
+    alice.u32(7);
+    LibolmPickle newest_skipped;
+    newest_skipped.key(newest);
+    newest_skipped.fill(0x31);
+    newest_skipped.u32(3);
+    alice.u32(2);
+    alice.key(newest_skipped.bytes);
+    alice.key(older);
+    alice.fill(0x32);
+    alice.u32(4);
+
+    auto session = Session::unpickle(alice.bytes);
+    REQUIRE(session.has_receiver_chain(newest));
+    REQUIRE(session.has_receiver_chain(older));
+    REQUIRE(session.skipped_message_key_count() == 2);
+    std::vector<std::uint8_t> repickled(session.pickle_length());
+    session.pickle(repickled.data());
+    REQUIRE(repickled == alice.bytes);
+
+    // Bob's side still holds the private part of the current ratchet key. It can only read the reply if Alice's new
+    // sender chain was ratcheted against the newest receiver chain.
+    LibolmPickle bob;
+    bob.header();
+    bob.u32(1);
+    bob.key(newest);
+    const auto newest_private = newest_key.raw_private_key_bits();
+    bob.key(newest_private);
+    bob.fill(0x41);
+    bob.u32(0);
+    bob.u32(0);
+    bob.u32(0);
+    auto peer = Session::unpickle(bob.bytes);
+    REQUIRE(to_string(peer.decrypt(session.encrypt(rng, "reply"))) == "reply");
+
+    // With too many skipped keys, the newest ones are kept.
+    const auto limited = Session::unpickle(alice.bytes, SessionLimits{1, MAX_MESSAGE_GAP});
+    REQUIRE(limited.skipped_message_key_count() == 1);
+    std::vector<std::uint8_t> limited_pickle(limited.pickle_length());
+    limited.pickle(limited_pickle.data());
+    REQUIRE(std::equal(newest_skipped.bytes.rbegin(), newest_skipped.bytes.rend(), limited_pickle.rbegin()));
+
+    // With too many receiver chains, the oldest ones are dropped.
+    LibolmPickle crowded;
+    crowded.header();
+    crowded.u32(0);
+    crowded.u32(MAX_RECEIVER_CHAINS + 1);
+    for (std::uint8_t i = 0; i <= MAX_RECEIVER_CHAINS; ++i)
+    {
+        crowded.fill(static_cast<std::uint8_t>(0x50 + i));
+        crowded.fill(0x60);
+        crowded.u32(0);
+    }
+    crowded.u32(0);
+    const auto crowded_session = Session::unpickle(crowded.bytes);
+    const std::vector<std::uint8_t> newest_crowded(32, 0x50);
+    const std::vector<std::uint8_t> oldest_crowded(32, static_cast<std::uint8_t>(0x50 + MAX_RECEIVER_CHAINS));
+    REQUIRE(crowded_session.has_receiver_chain(newest_crowded));
+    REQUIRE_FALSE(crowded_session.has_receiver_chain(oldest_crowded));
+}
+
+TEST_CASE("Skipped message key cache")
+{
+    SkippedMessageKeys cache(4);
+    REQUIRE(cache.capacity() == 4);
+
+    Curve25519PublicKey first{};
+    Curve25519PublicKey second{};
+    second[0] = 1;
+    std::array<std::uint8_t, 32> key{};
+    for (std::uint32_t i = 0; i < 6; ++i)
+    {
+        key[0] = static_cast<std::uint8_t>(i);
+        cache.insert(i % 2 ? second : first, i, key);
+    }
+
+    REQUIRE(cache.size() == 4);
+    REQUIRE(cache.find(first, 0) == nullptr);
+    REQUIRE(cache.find(second, 1) == nullptr);
+    REQUIRE(cache.find(first, 3) == nullptr);
+    REQUIRE(cache.find(second, 3)[0] == 3);
+    REQUIRE(cache.find(first, 4)[0] == 4);
+
+    std::vector<std::uint32_t> order;
+    cache.for_each([&order](auto const &, const std::uint32_t index, auto) { order.push_back(index); });
+    REQUIRE(order == std::vector<std::uint32_t>{2, 3, 4, 5});
+
+    REQUIRE(cache.erase(second, 3));
+    REQUIRE(!cache.erase(second, 3));
+    REQUIRE(cache.size() == 3);
+    REQUIRE(cache.find(first, 2)[0] == 2);
+    REQUIRE(cache.find(second, 5)[0] == 5);
+
+    cache.clear();
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.find(first, 4) == nullptr);
+
+    SkippedMessageKeys disabled(0);
+    disabled.insert(first, 0, key);
+    REQUIRE(disabled.size() == 0);
+    REQUIRE(disabled.find(first, 0) == nullptr);
+}
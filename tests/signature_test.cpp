@@ -0,0 +1,134 @@
+#include <snitch/snitch.hpp>
+#include "account.hpp"
+#include "errors.hpp"
+#include "signature.hpp"
+#include <botan/auto_rng.h>
+#include <fstream>
+
+using namespace spank_olm;
+
+TEST_CASE("Signature verification of Account::sign output")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    const std::string message = "Test message";
+    auto signature = account.sign(rng, message);
+
+    REQUIRE(verify_signature(account.identity_keys->ed25519_key, message, signature));
+    REQUIRE(!verify_signature(account.identity_keys->ed25519_key, "Other message", signature));
+
+    signature[0] ^= 0x01;
+    REQUIRE(!verify_signature(account.identity_keys->ed25519_key, message, signature));
+
+    signature.pop_back();
+    REQUIRE(!verify_signature(account.identity_keys->ed25519_key, message, signature));
+}
+
+TEST_CASE("Signature verification cache hits for repeated checks")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    const std::string message = "Test message";
+    const auto signature = account.sign(rng, message);
+
+    SignatureVerificationCache cache(16);
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, message, signature));
+    REQUIRE(cache.misses() == 1);
+    REQUIRE(cache.hits() == 0);
+
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, message, signature));
+    REQUIRE(cache.misses() == 1);
+    REQUIRE(cache.hits() == 1);
+
+    // A negative result is cached as well and must not be confused with the valid one.
+    REQUIRE(!cache.verify(account.identity_keys->ed25519_key, "Other message", signature));
+    REQUIRE(!cache.verify(account.identity_keys->ed25519_key, "Other message", signature));
+    REQUIRE(cache.misses() == 2);
+    REQUIRE(cache.hits() == 2);
+    REQUIRE(cache.size() == 2);
+}
+
+TEST_CASE("Signature verification cache evicts the least recently used entry")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    const auto signature_a = account.sign(rng, "a");
+    const auto signature_b = account.sign(rng, "b");
+    const auto signature_c = account.sign(rng, "c");
+
+    SignatureVerificationCache cache(2);
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, "a", signature_a));
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, "b", signature_b));
+    // Touch "a" so that "b" becomes the oldest entry.
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, "a", signature_a));
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, "c", signature_c));
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.hits() == 1);
+
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, "a", signature_a));
+    REQUIRE(cache.hits() == 2);
+    REQUIRE(cache.verify(account.identity_keys->ed25519_key, "b", signature_b));
+    REQUIRE(cache.misses() == 4);
+
+    cache.clear();
+    REQUIRE(cache.size() == 0);
+}
+
+TEST_CASE("Streaming signature matches a single update")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    const std::string message = "A message which is signed in several chunks";
+
+    auto signer = account.start_signature(rng);
+    signer.update(std::string_view(message).substr(0, 10));
+    signer.update(std::string_view(message).substr(10));
+    const auto signature = signer.finish(rng);
+
+    REQUIRE(verify_signature(account.identity_keys->ed25519_key, message, signature));
+
+    Ed25519phVerifier verifier(account.identity_keys->ed25519_key);
+    for (const char c : message)
+    {
+        verifier.update(std::string_view(&c, 1));
+    }
+    REQUIRE(verifier.finish(signature));
+
+    const auto chunked = sign_chunked(account.identity_keys->ed25519_key, rng,
+                                      std::span(reinterpret_cast<const std::uint8_t *>(message.data()), message.size()),
+                                      7);
+    REQUIRE(verify_signature(account.identity_keys->ed25519_key, message, chunked));
+}
+
+TEST_CASE("Signing and verifying a file")
+{
+    Botan::AutoSeeded_RNG rng;
+    Account account;
+    account.new_account(rng);
+
+    const auto path = std::filesystem::temp_directory_path() / "spank_olm_signature_test.bin";
+    std::string contents;
+    for (int i = 0; i < 1000; ++i)
+    {
+        contents += "line " + std::to_string(i) + "\n";
+    }
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << contents;
+    }
+
+    const auto signature = account.sign_file(rng, path);
+    REQUIRE(verify_signature(account.identity_keys->ed25519_key, contents, signature));
+    REQUIRE(verify_file(account.identity_keys->ed25519_key, path, signature, 13));
+
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(account.sign_file(rng, path), SpankOlmErrorIO);
+}
@@ -0,0 +1,102 @@
+#include <snitch/snitch.hpp>
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace spank_olm;
+
+TEST_CASE("ThreadPool runs submitted tasks")
+{
+    ThreadPool pool(4);
+    REQUIRE(pool.size() == 4);
+
+    auto result = pool.submit([] { return 42; });
+    REQUIRE(result.get() == 42);
+
+    auto failing = pool.submit([]() -> int { throw std::runtime_error("failed"); });
+    REQUIRE_THROWS_AS(failing.get(), std::runtime_error);
+}
+
+TEST_CASE("ThreadPool without threads runs tasks inline")
+{
+    ThreadPool pool(0);
+    REQUIRE(pool.size() == 0);
+
+    std::atomic<int> counter = 0;
+    auto result = pool.submit([&counter] { ++counter; });
+    REQUIRE(counter == 1);
+    result.get();
+
+    pool.parallel_for(10, [&counter](std::size_t) { ++counter; });
+    REQUIRE(counter == 11);
+}
+
+TEST_CASE("ThreadPool parallel_for visits every index once")
+{
+    ThreadPool pool(3);
+    std::vector<std::atomic<int>> visits(1000);
+
+    pool.parallel_for(visits.size(), [&visits](const std::size_t i) { ++visits[i]; });
+    for (const auto &visit : visits)
+    {
+        REQUIRE(visit == 1);
+    }
+
+    REQUIRE_THROWS_AS(pool.parallel_for(10,
+                                        [](const std::size_t i) {
+                                            if (i == 7)
+                                            {
+                                                throw std::runtime_error("failed");
+                                            }
+                                        }),
+                      std::runtime_error);
+}
+
+TEST_CASE("ThreadPool parallel_for_chunks covers every index with non-empty ranges")
+{
+    ThreadPool pool(3);
+    for (const std::size_t count : {0, 1, 2, 3, 1000})
+    {
+        std::vector<std::atomic<int>> visits(count);
+        std::atomic<std::size_t> ranges = 0;
+        std::atomic<std::size_t> empty_ranges = 0;
+        pool.parallel_for_chunks(count, [&](const std::size_t begin, const std::size_t end) {
+            ++(begin < end ? ranges : empty_ranges);
+            for (auto i = begin; i < end; ++i)
+            {
+                ++visits[i];
+            }
+        });
+        REQUIRE(ranges == std::min<std::size_t>(count, pool.size()));
+        REQUIRE(empty_ranges == 0);
+        for (const auto &visit : visits)
+        {
+            REQUIRE(visit == 1);
+        }
+    }
+}
+
+TEST_CASE("InOrder hands on results in submission order")
+{
+    ThreadPool pool(3);
+    InOrder<int> in_flight(pool);
+    std::vector<int> delivered;
+    const auto deliver = [&delivered](const int result) { delivered.push_back(result); };
+
+    for (int i = 0; i < 50; ++i)
+    {
+        in_flight.submit([i] { return i; }, deliver);
+        // Only a bounded number of results may be waiting to be handed on.
+        REQUIRE(i + 1 - static_cast<int>(delivered.size()) <=
+                static_cast<int>(pool.size() * InOrder<int>::TASKS_IN_FLIGHT_PER_THREAD));
+    }
+    in_flight.drain(deliver);
+
+    REQUIRE(delivered.size() == 50);
+    for (int i = 0; i < 50; ++i)
+    {
+        REQUIRE(delivered[i] == i);
+    }
+}
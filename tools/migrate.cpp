@@ -0,0 +1,166 @@
+// Upgrades encrypted account pickles to the current pickle version and optionally re-encrypts them with a new key.
+//
+// Usage: spank-olm-migrate --key-file <file> [--new-key-file <file>] [--threads <n>] [--batch-size <n>]
+//                          [--output <file>] [<input>...]
+//
+// Every input holds one encrypted pickle per line. Without inputs, or for an input of "-", the pickles are read from
+// stdin. The migrated pickles are written to the output, or to stdout, in the same order.
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "errors.hpp"
+#include "migration.hpp"
+
+namespace
+{
+    void usage()
+    {
+        std::cerr << "Usage: spank-olm-migrate --key-file <file> [--new-key-file <file>] [--threads <n>]\n"
+                     "                         [--batch-size <n>] [--output <file>] [<input>...]\n";
+    }
+
+    std::string read_key(std::string const &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw SpankOlmErrorIO();
+        }
+        std::string key((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        // Allow keys written with a trailing newline.
+        while (!key.empty() && (key.back() == '\n' || key.back() == '\r'))
+        {
+            key.pop_back();
+        }
+        return key;
+    }
+
+    void print_progress(spank_olm::MigrationProgress const &progress, std::chrono::steady_clock::time_point start)
+    {
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto migrated = progress.migrated.load();
+        std::cerr << "\rread " << progress.read.load() << ", migrated " << migrated << ", upgraded "
+                  << progress.upgraded.load() << ", failed " << progress.failed.load() << " ("
+                  << static_cast<std::uint64_t>(seconds > 0 ? migrated / seconds : 0) << "/s)" << std::flush;
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string key_file;
+    std::string new_key_file;
+    std::string output_file;
+    std::size_t threads = spank_olm::ThreadPool::default_thread_count();
+    std::size_t batch_size = spank_olm::MIGRATION_BATCH_SIZE;
+    std::vector<std::string> inputs;
+
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        const auto &arg = args[i];
+        const auto has_value = i + 1 < args.size();
+        if (arg == "--key-file" && has_value)
+        {
+            key_file = args[++i];
+        }
+        else if (arg == "--new-key-file" && has_value)
+        {
+            new_key_file = args[++i];
+        }
+        else if (arg == "--output" && has_value)
+        {
+            output_file = args[++i];
+        }
+        else if (arg == "--threads" && has_value)
+        {
+            threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else if (arg == "--batch-size" && has_value)
+        {
+            batch_size = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            return EXIT_SUCCESS;
+        }
+        else if (arg.starts_with("--"))
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+
+    if (key_file.empty())
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (inputs.empty())
+    {
+        inputs.emplace_back("-");
+    }
+
+    try
+    {
+        const spank_olm::PickleCipher from(read_key(key_file));
+        const spank_olm::PickleCipher to(read_key(new_key_file.empty() ? key_file : new_key_file));
+
+        std::ofstream output_stream;
+        if (!output_file.empty())
+        {
+            output_stream.open(output_file, std::ios::binary | std::ios::trunc);
+            if (!output_stream)
+            {
+                throw SpankOlmErrorIO();
+            }
+        }
+        std::ostream &output = output_file.empty() ? std::cout : output_stream;
+
+        spank_olm::ThreadPool pool(threads);
+        spank_olm::PickleMigrator migrator(from, to, pool, batch_size);
+        spank_olm::MigrationProgress progress;
+        const auto start = std::chrono::steady_clock::now();
+
+        std::string current_input;
+        migrator.on_error([&current_input](const std::uint64_t line, std::exception const &error) {
+            std::cerr << "\n" << current_input << ":" << line << ": " << error.what() << "\n";
+        });
+        migrator.on_progress([start](spank_olm::MigrationProgress const &p) { print_progress(p, start); });
+
+        for (const auto &input : inputs)
+        {
+            current_input = input;
+            if (input == "-")
+            {
+                migrator.run(std::cin, output, progress);
+                continue;
+            }
+
+            std::ifstream input_stream(input, std::ios::binary);
+            if (!input_stream)
+            {
+                throw SpankOlmErrorIO();
+            }
+            migrator.run(input_stream, output, progress);
+        }
+
+        print_progress(progress, start);
+        std::cerr << "\n";
+        return progress.failed.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (std::exception const &error)
+    {
+        std::cerr << "\nspank-olm-migrate: " << error.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}